@@ -0,0 +1,1405 @@
+#include "benchmark.h"
+
+#include <hyper-console.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+
+struct benchmark_t {
+  const wchar_t *name;
+  const wchar_t *description;
+  void (*run)(const struct benchmark_t *benchmark);
+};
+
+struct link_stream_t {
+  struct hyper_console_memory_backend_t *mb;
+  volatile LONG stop;
+  int links;
+};
+
+struct log_printer_t {
+  struct hyper_console_memory_backend_t *mb;
+  BOOL post;
+  int lines_per_key;
+  int lines;
+  wchar_t line[40];
+};
+
+static void benchmark_layout_tabs(const struct benchmark_t *benchmark);
+static void benchmark_layout_cjk(const struct benchmark_t *benchmark);
+static void benchmark_history_search(const struct benchmark_t *benchmark);
+static void benchmark_history_evict(const struct benchmark_t *benchmark);
+static void benchmark_history_load(const struct benchmark_t *benchmark);
+static void benchmark_scrollback_links(const struct benchmark_t *benchmark);
+static void benchmark_scrollback_log(const struct benchmark_t *benchmark);
+static void print_links_after_bursts(const struct benchmark_t *benchmark, const wchar_t *log_format);
+static void benchmark_archive_search(const struct benchmark_t *benchmark);
+static void benchmark_links_navigate(const struct benchmark_t *benchmark);
+static void benchmark_links_listing(const struct benchmark_t *benchmark);
+static void benchmark_links_interned(const struct benchmark_t *benchmark);
+static void print_listing_links(const struct benchmark_t *benchmark, BOOL interned);
+static void benchmark_links_activate(const struct benchmark_t *benchmark);
+static void benchmark_links_stress(const struct benchmark_t *benchmark);
+static double hover_links(struct hyper_console_memory_backend_t *mb, int width, int lines, int moves);
+static DWORD WINAPI stream_links(void *context);
+static void benchmark_output_post(const struct benchmark_t *benchmark);
+static double print_log_while_editing(BOOL post, int keys, int lines_per_key);
+static BOOL print_log_lines(void *context, const KEY_EVENT_RECORD *er);
+static void write_log_line(void *context);
+static void benchmark_search_filter(const struct benchmark_t *benchmark);
+static void benchmark_search_highlight(const struct benchmark_t *benchmark);
+static double search_log_while_editing(const wchar_t *word, int window_height, int edits, int *last_edit_cells);
+static void benchmark_search_reenter(const struct benchmark_t *benchmark);
+static void benchmark_screen_read(const struct benchmark_t *benchmark);
+
+static const struct benchmark_t all_benchmarks[] = {
+  { L"layout-tabs",      L"Redraw a multi-line input full of tabs.",            benchmark_layout_tabs      },
+  { L"layout-cjk",       L"Redraw a multi-line input full of wide characters.", benchmark_layout_cjk       },
+  { L"history-search",   L"Search a history of 100000 entries with Ctrl+R.",    benchmark_history_search   },
+  { L"history-evict",    L"Add entries to a full history without duplicates.",  benchmark_history_evict    },
+  { L"history-load",     L"Open a history file of 500000 entries.",             benchmark_history_load     },
+  { L"scrollback-links", L"Print links into a full buffer of 9999 lines.",      benchmark_scrollback_links },
+  { L"scrollback-log",   L"Print links between distinct lines of 9999 lines.",  benchmark_scrollback_log   },
+  { L"archive-search",   L"Archive 100000 scrolled log lines and search them.", benchmark_archive_search   },
+  { L"links-navigate",   L"Hover and Tab through 99900 links in mark mode.",    benchmark_links_navigate   },
+  { L"links-listing",    L"Print directory listings with a link per file.",     benchmark_links_listing    },
+  { L"links-interned",   L"Print the listings with interned path prefixes.",    benchmark_links_interned   },
+  { L"links-activate",   L"Start and end input over a buffer of long links.",   benchmark_links_activate   },
+  { L"links-stress",     L"Hover links while another thread prints links.",     benchmark_links_stress     },
+  { L"output-post",      L"Print log lines while the input is being edited.",   benchmark_output_post      },
+  { L"search-filter",    L"Edit a Ctrl+F filter over a full 300x9999 buffer.",  benchmark_search_filter    },
+  { L"search-highlight", L"Edit a Ctrl+F filter with a match on every line.",   benchmark_search_highlight },
+  { L"search-reenter",   L"Enter Ctrl+F repeatedly while a log scrolls by.",    benchmark_search_reenter   },
+  { L"screen-read",      L"Read a 300x9999 buffer per plane and in one pass.",  benchmark_screen_read      },
+};
+
+
+static double get_milliseconds(void) {
+  static LARGE_INTEGER frequency;
+  LARGE_INTEGER counter;
+  
+  if(frequency.QuadPart == 0)
+    QueryPerformanceFrequency(&frequency);
+  
+  QueryPerformanceCounter(&counter);
+  return 1000.0 * (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+static void add_mouse_move(struct hyper_console_memory_backend_t *mb, int x, int y) {
+  INPUT_RECORD record;
+  
+  memset(&record, 0, sizeof(record));
+  record.EventType = MOUSE_EVENT;
+  record.Event.MouseEvent.dwMousePosition.X = (SHORT)x;
+  record.Event.MouseEvent.dwMousePosition.Y = (SHORT)y;
+  record.Event.MouseEvent.dwEventFlags = MOUSE_MOVED;
+  
+  hyper_console_memory_backend_add_input(mb, &record, 1);
+}
+
+static void add_key(struct hyper_console_memory_backend_t *mb, WORD vk, wchar_t ch, DWORD control_key_state) {
+  INPUT_RECORD records[2];
+  
+  memset(records, 0, sizeof(records));
+  records[0].EventType = KEY_EVENT;
+  records[0].Event.KeyEvent.bKeyDown = TRUE;
+  records[0].Event.KeyEvent.wRepeatCount = 1;
+  records[0].Event.KeyEvent.wVirtualKeyCode = vk;
+  records[0].Event.KeyEvent.uChar.UnicodeChar = ch;
+  records[0].Event.KeyEvent.dwControlKeyState = control_key_state;
+  
+  records[1] = records[0];
+  records[1].Event.KeyEvent.bKeyDown = FALSE;
+  
+  hyper_console_memory_backend_add_input(mb, records, 2);
+}
+
+/* Build a text of \a lines lines, each consisting of \a repeat copies of \a pattern.
+   Returns NULL on out-of-memory. Free the result with hyper_console_free_memory().
+ */
+static wchar_t *make_lines(const wchar_t *pattern, int repeat, int lines) {
+  wchar_t *text;
+  wchar_t *s;
+  size_t pattern_length;
+  int i;
+  int j;
+  
+  assert(pattern != NULL);
+  
+  pattern_length = wcslen(pattern);
+  text = hyper_console_allocate_memory((lines * (pattern_length * repeat + 1) + 1) * sizeof(wchar_t));
+  if(!text)
+    return NULL;
+  
+  s = text;
+  for(i = 0; i < lines; ++i) {
+    if(i > 0)
+      *s++ = L'\n';
+    
+    for(j = 0; j < repeat; ++j) {
+      memcpy(s, pattern, pattern_length * sizeof(wchar_t));
+      s += pattern_length;
+    }
+  }
+  *s = L'\0';
+  
+  return text;
+}
+
+/* Edit the end of a large multi-line input. Every key press redraws the whole input.
+ */
+static void benchmark_layout(const struct benchmark_t *benchmark, const wchar_t *pattern, int repeat) {
+  const int lines = 150;
+  const int edits = 100;
+  struct hyper_console_settings_t settings;
+  struct hyper_console_memory_backend_t *mb;
+  wchar_t *text;
+  wchar_t *result;
+  double start;
+  double elapsed;
+  int i;
+  
+  text = make_lines(pattern, repeat, lines);
+  mb = hyper_console_memory_backend_new(120, 2 * lines + 10, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!text || !mb) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    hyper_console_memory_backend_free(mb);
+    hyper_console_free_memory(text);
+    return;
+  }
+  
+  for(i = 0; i < edits; ++i) {
+    add_key(mb, 'X', L'x', 0);
+    add_key(mb, VK_BACK, L'\b', 0);
+  }
+  
+  memset(&settings, 0, sizeof(settings));
+  settings.size             = sizeof(settings);
+  settings.flags            = HYPER_CONSOLE_FLAGS_MULTILINE;
+  settings.default_input    = text;
+  settings.first_tab_column = 4;
+  
+  hyper_console_use_memory_backend(mb);
+  hyper_console_memory_backend_write(mb, L"> ", -1);
+  
+  start = get_milliseconds();
+  result = hyper_console_readline(&settings); // returns NULL once the scripted input is consumed
+  elapsed = get_milliseconds() - start;
+  
+  hyper_console_use_memory_backend(NULL);
+  
+  printf("%-16ls %9.2f ms  (%d redraws of %d characters, %.1f us per redraw)\n",
+    benchmark->name,
+    elapsed,
+    2 * edits,
+    (int)wcslen(text),
+    1000.0 * elapsed / (2 * edits));
+  
+  hyper_console_free_memory(result);
+  hyper_console_memory_backend_free(mb);
+  hyper_console_free_memory(text);
+}
+
+static void benchmark_layout_tabs(const struct benchmark_t *benchmark) {
+  benchmark_layout(benchmark, L"a\tbc\t", 10);
+}
+
+static void benchmark_layout_cjk(const struct benchmark_t *benchmark) {
+  benchmark_layout(benchmark, L"\x4E2D\x6587\x5B57", 15);
+}
+
+/* Type queries into Ctrl+R history search. Every typed character and every further Ctrl+R looks 
+   up the history once.
+ */
+static void benchmark_history_search(const struct benchmark_t *benchmark) {
+  const int entries = 100000;
+  const int searches = 200;
+  const int older = 5;
+  static const wchar_t *const commands[] = {
+    L"git commit -m \"fix issue %d\"",
+    L"cd projects/project%d/src",
+    L"make -j8 target%d",
+    L"grep -rn \"symbol%d\" include",
+  };
+  struct hyper_console_settings_t settings;
+  struct hyper_console_history_t *history;
+  struct hyper_console_memory_backend_t *mb;
+  wchar_t line[100];
+  wchar_t *result;
+  double start;
+  double elapsed;
+  int lookups = 0;
+  int i;
+  int j;
+  
+  history = hyper_console_history_new(0);
+  mb = hyper_console_memory_backend_new(120, 50, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!history || !mb) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    hyper_console_memory_backend_free(mb);
+    hyper_console_history_free(history);
+    return;
+  }
+  
+  start = get_milliseconds();
+  for(i = 0; i < entries; ++i) {
+    swprintf(line, sizeof(line) / sizeof(line[0]), commands[i % 4], i / 4);
+    hyper_console_history_add(history, line, -1);
+  }
+  elapsed = get_milliseconds() - start;
+  printf("%-16ls %9.2f ms  (adding %d entries)\n", benchmark->name, elapsed, entries);
+  
+  for(i = 0; i < searches; ++i) {
+    swprintf(line, sizeof(line) / sizeof(line[0]), L"ct%d/", (i * 7919) % (entries / 4));
+    
+    add_key(mb, 'R', 0x12, LEFT_CTRL_PRESSED);
+    for(j = 0; line[j]; ++j) {
+      add_key(mb, 0, line[j], 0);
+      ++lookups;
+    }
+    for(j = 0; j < older; ++j) {
+      add_key(mb, 'R', 0x12, LEFT_CTRL_PRESSED);
+      ++lookups;
+    }
+    add_key(mb, VK_ESCAPE, 0x1B, 0);
+  }
+  
+  memset(&settings, 0, sizeof(settings));
+  settings.size    = sizeof(settings);
+  settings.history = history;
+  
+  hyper_console_use_memory_backend(mb);
+  hyper_console_memory_backend_write(mb, L"> ", -1);
+  
+  start = get_milliseconds();
+  result = hyper_console_readline(&settings); // returns NULL once the scripted input is consumed
+  elapsed = get_milliseconds() - start;
+  
+  hyper_console_use_memory_backend(NULL);
+  
+  printf("%-16ls %9.2f ms  (%d lookups, %.1f us per lookup and redraw)\n",
+    benchmark->name,
+    elapsed,
+    lookups,
+    1000.0 * elapsed / lookups);
+  
+  hyper_console_free_memory(result);
+  hyper_console_memory_backend_free(mb);
+  hyper_console_history_free(history);
+}
+
+/* Add many entries, half of them repeating older ones, to a history that is kept at its limit. 
+   Every addition evicts or de-duplicates an entry.
+ */
+static void benchmark_history_evict(const struct benchmark_t *benchmark) {
+  const int max_entries = 10000;
+  const int additions = 200000;
+  const int line_size = 40;
+  struct hyper_console_history_t *history;
+  wchar_t *lines;
+  double start;
+  double elapsed;
+  int i;
+  
+  history = hyper_console_history_new(HYPER_CONSOLE_HISTORY_NO_DUPLICATES);
+  lines = hyper_console_allocate_memory(additions * line_size * sizeof(wchar_t));
+  if(!history || !lines) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    hyper_console_free_memory(lines);
+    hyper_console_history_free(history);
+    return;
+  }
+  
+  hyper_console_history_set_limits(history, max_entries, 0);
+  
+  for(i = 0; i < additions; ++i) {
+    int n = (i % 2) ? i : (i * 7919) % (2 * max_entries);
+    
+    swprintf(lines + i * line_size, line_size, L"echo \"line %d\" >> output.txt", n);
+  }
+  
+  start = get_milliseconds();
+  for(i = 0; i < additions; ++i)
+    hyper_console_history_add(history, lines + i * line_size, -1);
+  elapsed = get_milliseconds() - start;
+  
+  printf("%-16ls %9.2f ms  (%d additions, %.3f us per addition)\n",
+    benchmark->name,
+    elapsed,
+    additions,
+    1000.0 * elapsed / additions);
+  
+  hyper_console_free_memory(lines);
+  hyper_console_history_free(history);
+}
+
+/* Open a large history file and search it once with Ctrl+R. Only the newest entries are loaded,
+   the first opening compacts the file and the first search builds the index.
+ */
+static void benchmark_history_load(const struct benchmark_t *benchmark) {
+  const int file_entries = 500000;
+  static const wchar_t query[] = L"issue 4711\"";
+  struct hyper_console_settings_t settings;
+  struct hyper_console_history_t *history;
+  struct hyper_console_memory_backend_t *mb;
+  wchar_t dir[MAX_PATH];
+  wchar_t path[MAX_PATH];
+  wchar_t line[64];
+  wchar_t *result;
+  double start;
+  double open_time;
+  double reopen_time;
+  double search_time;
+  int i;
+  
+  if(!GetTempPathW(MAX_PATH, dir) || !GetTempFileNameW(dir, L"hch", 0, path)) {
+    printf("%-16ls cannot create a temporary file\n", benchmark->name);
+    return;
+  }
+  
+  history = hyper_console_history_new(0);
+  hyper_console_history_set_limits(history, 0, 0);
+  if(!hyper_console_history_open_file(history, path)) {
+    printf("%-16ls cannot open the history file\n", benchmark->name);
+    hyper_console_history_free(history);
+    DeleteFileW(path);
+    return;
+  }
+  
+  for(i = 0; i < file_entries; ++i) {
+    swprintf(line, sizeof(line) / sizeof(line[0]), L"git commit -m \"fix issue %d\"", i);
+    hyper_console_history_add(history, line, -1);
+  }
+  hyper_console_history_free(history);
+  
+  start = get_milliseconds();
+  history = hyper_console_history_new(0);
+  hyper_console_history_open_file(history, path);
+  open_time = get_milliseconds() - start;
+  hyper_console_history_free(history);
+  
+  start = get_milliseconds();
+  history = hyper_console_history_new(0);
+  hyper_console_history_open_file(history, path);
+  reopen_time = get_milliseconds() - start;
+  
+  mb = hyper_console_memory_backend_new(120, 50, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!mb) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    hyper_console_history_free(history);
+    DeleteFileW(path);
+    return;
+  }
+  
+  add_key(mb, 'R', 0x12, LEFT_CTRL_PRESSED);
+  for(i = 0; query[i]; ++i)
+    add_key(mb, 0, query[i], 0);
+  add_key(mb, VK_ESCAPE, 0x1B, 0);
+  
+  memset(&settings, 0, sizeof(settings));
+  settings.size    = sizeof(settings);
+  settings.history = history;
+  
+  hyper_console_use_memory_backend(mb);
+  
+  start = get_milliseconds();
+  result = hyper_console_readline(&settings); // returns NULL once the scripted input is consumed
+  search_time = get_milliseconds() - start;
+  
+  hyper_console_use_memory_backend(NULL);
+  
+  printf("%-16ls %9.2f ms  (%d entries in the file, compacting)\n", benchmark->name, open_time, file_entries);
+  printf("%-16ls %9.2f ms  (reopening, first search %.2f ms)\n", benchmark->name, reopen_time, search_time);
+  
+  hyper_console_free_memory(result);
+  hyper_console_memory_backend_free(mb);
+  hyper_console_history_free(history);
+  DeleteFileW(path);
+}
+
+/* Print bursts of repetitive log lines, each followed by a link, into a full screen buffer. Opening
+   and closing a link both match the whole buffer against the cached lines to find the global 
+   line numbers. Only that is timed, not the output itself.
+ */
+static void benchmark_scrollback_links(const struct benchmark_t *benchmark) {
+  print_links_after_bursts(benchmark, L"waiting for server ...\n");
+}
+
+/* Like scrollback-links, but every log line differs, so that the scroll distance is found by 
+   reading just the bottom of the buffer.
+ */
+static void benchmark_scrollback_log(const struct benchmark_t *benchmark) {
+  print_links_after_bursts(benchmark, L"compiling src/module%d.c ...\n");
+}
+
+/* Fill a screen buffer with log lines and then print bursts of them, each followed by a link.
+   The log_format may contain a %d for a line counter.
+ */
+static void print_links_after_bursts(const struct benchmark_t *benchmark, const wchar_t *log_format) {
+  const int width = 120;
+  const int height = 9999;
+  const int links = 200;
+  const int burst = 20;
+  struct hyper_console_memory_backend_t *mb;
+  wchar_t line[100];
+  double start;
+  double elapsed = 0;
+  int counter = 0;
+  int i;
+  int j;
+  
+  mb = hyper_console_memory_backend_new(width, height, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!mb) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    return;
+  }
+  
+  hyper_console_use_memory_backend(mb);
+  hyper_console_init_hyperlink_system();
+  
+  for(i = 0; i < height; ++i) {
+    swprintf(line, sizeof(line) / sizeof(line[0]), log_format, counter++);
+    hyper_console_memory_backend_write(mb, line, -1);
+  }
+  
+  for(i = 0; i < links; ++i) {
+    for(j = 0; j < burst; ++j) {
+      swprintf(line, sizeof(line) / sizeof(line[0]), log_format, counter++);
+      hyper_console_memory_backend_write(mb, line, -1);
+    }
+      
+    swprintf(line, sizeof(line) / sizeof(line[0]), L"log/server%d.txt", i);
+    
+    hyper_console_memory_backend_write(mb, L"see ", -1);
+    
+    start = get_milliseconds();
+    hyper_console_start_link(line);
+    elapsed += get_milliseconds() - start;
+    
+    hyper_console_memory_backend_write(mb, line, -1);
+    
+    start = get_milliseconds();
+    hyper_console_end_link();
+    elapsed += get_milliseconds() - start;
+    
+    hyper_console_memory_backend_write(mb, L"\n", -1);
+  }
+  
+  printf("%-16ls %9.2f ms  (%d links, %.3f ms per link)\n",
+    benchmark->name,
+    elapsed,
+    links,
+    elapsed / links);
+  
+  hyper_console_done_hyperlink_system();
+  hyper_console_use_memory_backend(NULL);
+  hyper_console_memory_backend_free(mb);
+}
+
+/* Print log lines through a small screen buffer with a link after every burst, so that the 
+   lines which scroll off are archived. Then search a word with Ctrl+F. The input ends there, 
+   so the background search runs through the screen and the whole archive.
+ */
+static void benchmark_archive_search(const struct benchmark_t *benchmark) {
+  const int width = 120;
+  const int height = 300;
+  const int lines = 100000;
+  const int burst = 100;
+  struct hyper_console_scrollback_statistics_t stats;
+  struct hyper_console_settings_t settings;
+  struct hyper_console_memory_backend_t *mb;
+  wchar_t line[200];
+  wchar_t *result;
+  double start;
+  double elapsed = 0;
+  double search_time;
+  int i;
+  
+  mb = hyper_console_memory_backend_new(width, height, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!mb) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    return;
+  }
+  
+  hyper_console_use_memory_backend(mb);
+  hyper_console_init_hyperlink_system();
+  hyper_console_set_scrollback_archive_size(64 * 1024 * 1024);
+  
+  for(i = 0; i < lines; ++i) {
+    swprintf(
+      line, 
+      sizeof(line) / sizeof(line[0]), 
+      L"12:%02d:%02d [INFO] Request %d from Client%d handled by Worker%d in %d ms. Status: OK\n", 
+      i / 60 % 60, 
+      i % 60, 
+      i, 
+      i % 97,
+      i % 13, 
+      i % 1000);
+    hyper_console_memory_backend_write(mb, line, -1);
+    
+    if(i % burst == burst - 1) {
+      start = get_milliseconds();
+      hyper_console_start_link(L"log/server.txt");
+      hyper_console_memory_backend_write(mb, L"log/server.txt", -1);
+      hyper_console_end_link();
+      elapsed += get_milliseconds() - start;
+      
+      hyper_console_memory_backend_write(mb, L"\n", -1);
+    }
+  }
+  
+  memset(&stats, 0, sizeof(stats));
+  stats.size = sizeof(stats);
+  hyper_console_get_scrollback_statistics(&stats);
+  
+  memset(&settings, 0, sizeof(settings));
+  settings.size = sizeof(settings);
+  settings.default_input = L"client42 ";
+  
+  add_key(mb, VK_END, 0, SHIFT_PRESSED);
+  add_key(mb, 'F', 0x06, LEFT_CTRL_PRESSED);
+  
+  hyper_console_memory_backend_write(mb, L"> ", -1);
+  
+  start = get_milliseconds();
+  result = hyper_console_readline(&settings);
+  search_time = get_milliseconds() - start;
+  hyper_console_free_memory(result);
+  
+  printf("%-16ls %9.2f ms  (%d lines archived, %.1f bytes per line, %.1f as UTF-16)\n",
+    benchmark->name,
+    elapsed,
+    stats.archived_lines,
+    stats.archived_lines > 0 ? (double)stats.archive_bytes / stats.archived_lines : 0.0,
+    stats.archived_lines > 0 ? (double)stats.text_bytes    / stats.archived_lines : 0.0);
+  printf("%-16ls %9.2f ms  (searching the screen and archive)\n",
+    benchmark->name,
+    search_time);
+  
+  hyper_console_done_hyperlink_system();
+  hyper_console_use_memory_backend(NULL);
+  hyper_console_memory_backend_free(mb);
+}
+
+/* Fill a screen buffer with links and then hover over them with the mouse and step through them 
+   with Tab and Shift+Tab in mark mode. Every step looks up a link by position. The time of an
+   input session without those events (mainly for activating all links) is subtracted.
+ */
+static void benchmark_links_navigate(const struct benchmark_t *benchmark) {
+  const int width = 120;
+  const int height = 9999;
+  const int lines = 9990;
+  const int links_per_line = 10;
+  const int moves = 20000;
+  const int steps = 5000;
+  struct hyper_console_settings_t settings;
+  struct hyper_console_memory_backend_t *mb;
+  wchar_t line[100];
+  wchar_t *result;
+  double start;
+  double baseline;
+  double elapsed;
+  int i;
+  int j;
+  
+  mb = hyper_console_memory_backend_new(width, height, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!mb) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    return;
+  }
+  
+  hyper_console_use_memory_backend(mb);
+  hyper_console_init_hyperlink_system();
+  
+  start = get_milliseconds();
+  for(i = 0; i < lines; ++i) {
+    for(j = 0; j < links_per_line; ++j) {
+      swprintf(line, sizeof(line) / sizeof(line[0]), L"f%05d.c", i * links_per_line + j);
+      
+      hyper_console_start_link(line);
+      hyper_console_memory_backend_write(mb, line, -1);
+      hyper_console_end_link();
+      
+      hyper_console_memory_backend_write(mb, L"   ", -1);
+    }
+    
+    hyper_console_memory_backend_write(mb, L"\n", -1);
+  }
+  elapsed = get_milliseconds() - start;
+  printf("%-16ls %9.2f ms  (printing %d links)\n", benchmark->name, elapsed, lines * links_per_line);
+  
+  memset(&settings, 0, sizeof(settings));
+  settings.size = sizeof(settings);
+  
+  hyper_console_memory_backend_write(mb, L"> ", -1);
+  
+  start = get_milliseconds();
+  result = hyper_console_readline(&settings); // returns NULL once the (empty) scripted input is consumed
+  baseline = get_milliseconds() - start;
+  hyper_console_free_memory(result);
+  
+  for(i = 0; i < moves; ++i)
+    add_mouse_move(mb, (i * 37) % width, (i * 7919) % lines);
+    
+  add_key(mb, 'M', 0x0D, LEFT_CTRL_PRESSED);
+  for(i = 0; i < steps; ++i)
+    add_key(mb, VK_TAB, L'\t', 0);
+  for(i = 0; i < steps; ++i)
+    add_key(mb, VK_TAB, L'\t', SHIFT_PRESSED);
+  add_key(mb, VK_ESCAPE, 0x1B, 0);
+  
+  start = get_milliseconds();
+  result = hyper_console_readline(&settings);
+  elapsed = get_milliseconds() - start - baseline;
+  hyper_console_free_memory(result);
+  
+  printf("%-16ls %9.2f ms  (%d moves and %d steps, %.1f us per event)\n",
+    benchmark->name,
+    elapsed,
+    moves,
+    2 * steps,
+    1000.0 * elapsed / (moves + 2 * steps));
+    
+  hyper_console_done_hyperlink_system();
+  hyper_console_use_memory_backend(NULL);
+  hyper_console_memory_backend_free(mb);
+}
+
+static void benchmark_links_listing(const struct benchmark_t *benchmark) {
+  print_listing_links(benchmark, FALSE);
+}
+
+static void benchmark_links_interned(const struct benchmark_t *benchmark) {
+  print_listing_links(benchmark, TRUE);
+}
+
+/* Print directory listings into a full screen buffer, each file name a link with a title and an
+   input text. Older listings scroll out of the buffer, so their links are freed again.
+   With interned strings, the title and input text of each link only store the file name.
+ */
+static void print_listing_links(const struct benchmark_t *benchmark, BOOL interned) {
+  const int width = 120;
+  const int height = 9999;
+  const int listings = 20;
+  const int files = 2000;
+  struct hyper_console_memory_backend_t *mb;
+  struct hyper_console_link_statistics_t before;
+  struct hyper_console_link_statistics_t after;
+  struct hyper_console_link_string_t *title_prefix = NULL;
+  struct hyper_console_link_string_t *text_prefix = NULL;
+  wchar_t name[100];
+  wchar_t title[100];
+  wchar_t text[100];
+  double start;
+  double elapsed;
+  int i;
+  int j;
+  
+  mb = hyper_console_memory_backend_new(width, height, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!mb) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    return;
+  }
+  
+  hyper_console_use_memory_backend(mb);
+  hyper_console_init_hyperlink_system();
+  
+  before.size = sizeof(before);
+  hyper_console_get_link_statistics(&before);
+  
+  start = get_milliseconds();
+  for(i = 0; i < listings; ++i) {
+    swprintf(name, sizeof(name) / sizeof(name[0]), L"> dir project%d\n", i);
+    hyper_console_memory_backend_write(mb, name, -1);
+    
+    if(interned) {
+      swprintf(title, sizeof(title) / sizeof(title[0]), L"C:\\projects\\project%d\\", i);
+      swprintf(text,  sizeof(text)  / sizeof(text[0]),  L"type project%d\\", i);
+      title_prefix = hyper_console_intern_link_string(NULL, title);
+      text_prefix  = hyper_console_intern_link_string(NULL, text);
+    }
+    
+    for(j = 0; j < files; ++j) {
+      swprintf(name,  sizeof(name)  / sizeof(name[0]),  L"file%04d.txt", j);
+      hyper_console_memory_backend_write(mb, L"2024-01-01  12:00       4096 ", -1);
+      
+      if(interned) {
+        struct hyper_console_link_string_t *title_string = hyper_console_intern_link_string(title_prefix, name);
+        struct hyper_console_link_string_t *text_string  = hyper_console_intern_link_string(text_prefix,  name);
+        
+        hyper_console_start_interned_link(title_string);
+        hyper_console_set_interned_link_input_text(text_string);
+        hyper_console_release_link_string(title_string);
+        hyper_console_release_link_string(text_string);
+      }
+      else {
+        swprintf(title, sizeof(title) / sizeof(title[0]), L"C:\\projects\\project%d\\file%04d.txt", i, j);
+        swprintf(text,  sizeof(text)  / sizeof(text[0]),  L"type project%d\\file%04d.txt", i, j);
+        hyper_console_start_link(title);
+        hyper_console_set_link_input_text(text);
+      }
+      
+      hyper_console_memory_backend_write(mb, name, -1);
+      hyper_console_end_link();
+      hyper_console_memory_backend_write(mb, L"\n", -1);
+    }
+    
+    hyper_console_release_link_string(title_prefix);
+    hyper_console_release_link_string(text_prefix);
+  }
+  elapsed = get_milliseconds() - start;
+  
+  printf("%-16ls %9.2f ms  (%d links, %.1f us per link)\n",
+    benchmark->name,
+    elapsed,
+    listings * files,
+    1000.0 * elapsed / (listings * files));
+    
+  after.size = sizeof(after);
+  hyper_console_get_link_statistics(&after);
+  printf("%-16s %d link records, %d strings, %d heap allocations, %d heap frees, %d live links, %d live strings\n",
+    "",
+    after.link_allocations - before.link_allocations,
+    after.string_allocations - before.string_allocations,
+    after.heap_allocations - before.heap_allocations,
+    after.heap_frees - before.heap_frees,
+    after.live_links,
+    after.live_strings);
+    
+  hyper_console_done_hyperlink_system();
+  hyper_console_use_memory_backend(NULL);
+  hyper_console_memory_backend_free(mb);
+}
+
+/* Fill the buffer with links that wrap over several lines and read many empty inputs. Every
+   input activates the links in the window at its start and deactivates them at its end.
+ */
+static void benchmark_links_activate(const struct benchmark_t *benchmark) {
+  const int width = 120;
+  const int height = 9999;
+  const int links = 2400;
+  const int link_repeat = 57; // 7 characters each, so that the wrapped rows differ
+  const int inputs = 100;
+  const int window_height = 30;
+  struct hyper_console_settings_t settings;
+  struct hyper_console_memory_backend_t *mb;
+  SMALL_RECT window;
+  COORD cursor;
+  wchar_t *text;
+  wchar_t *result;
+  wchar_t number[10];
+  double start;
+  double elapsed;
+  int i;
+  
+  mb = hyper_console_memory_backend_new(width, height, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!mb) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    return;
+  }
+  
+  hyper_console_use_memory_backend(mb);
+  hyper_console_init_hyperlink_system();
+  
+  for(i = 0; i < links; ++i) {
+    swprintf(number, sizeof(number) / sizeof(number[0]), L"%06d-", i);
+    text = make_lines(number, link_repeat, 1);
+    if(!text)
+      break;
+      
+    hyper_console_start_link(L"a long link");
+    hyper_console_memory_backend_write(mb, text, -1);
+    hyper_console_end_link();
+    hyper_console_free_memory(text);
+    hyper_console_memory_backend_write(mb, L" ", -1);
+  }
+  
+  // like a real console, show only the rows around the cursor
+  hyper_console_memory_backend_get_cells(mb, NULL, &cursor);
+  window.Left   = 0;
+  window.Right  = width - 1;
+  window.Bottom = cursor.Y;
+  window.Top    = (SHORT)(cursor.Y >= window_height ? cursor.Y - window_height + 1 : 0);
+  hyper_console_memory_backend_set_window(mb, &window);
+  
+  memset(&settings, 0, sizeof(settings));
+  settings.size = sizeof(settings);
+  
+  start = get_milliseconds();
+  for(i = 0; i < inputs; ++i) {
+    add_key(mb, VK_RETURN, L'\r', 0);
+    result = hyper_console_readline(&settings);
+    hyper_console_free_memory(result);
+  }
+  elapsed = get_milliseconds() - start;
+  
+  printf("%-16ls %9.2f ms  (%d inputs over %d links, %.2f ms per input)\n",
+    benchmark->name,
+    elapsed,
+    inputs,
+    links,
+    elapsed / inputs);
+    
+  hyper_console_done_hyperlink_system();
+  hyper_console_use_memory_backend(NULL);
+  hyper_console_memory_backend_free(mb);
+}
+
+/* Hover over a buffer of links, first alone and then while a second thread keeps printing links
+   to the same console. Hit-testing only needs the shared lock on the links, so the hover latency
+   should not grow much with the concurrent writer.
+ */
+static void benchmark_links_stress(const struct benchmark_t *benchmark) {
+  const int width = 120;
+  const int height = 9999;
+  const int lines = 2000;
+  const int links_per_line = 10;
+  const int moves = 20000;
+  struct hyper_console_memory_backend_t *mb;
+  struct link_stream_t stream;
+  HANDLE thread;
+  wchar_t line[100];
+  double alone;
+  double streaming;
+  int i;
+  int j;
+  
+  mb = hyper_console_memory_backend_new(width, height, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!mb) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    return;
+  }
+  
+  hyper_console_use_memory_backend(mb);
+  hyper_console_init_hyperlink_system();
+  
+  for(i = 0; i < lines; ++i) {
+    for(j = 0; j < links_per_line; ++j) {
+      swprintf(line, sizeof(line) / sizeof(line[0]), L"f%05d.c", i * links_per_line + j);
+      
+      hyper_console_start_link(line);
+      hyper_console_memory_backend_write(mb, line, -1);
+      hyper_console_end_link();
+      
+      hyper_console_memory_backend_write(mb, L"   ", -1);
+    }
+    
+    hyper_console_memory_backend_write(mb, L"\n", -1);
+  }
+  
+  alone = hover_links(mb, width, lines, moves);
+  
+  stream.mb = mb;
+  stream.stop = 0;
+  stream.links = 0;
+  thread = CreateThread(NULL, 0, stream_links, &stream, 0, NULL);
+  if(thread) {
+    streaming = hover_links(mb, width, lines, moves);
+    
+    InterlockedExchange(&stream.stop, 1);
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+    
+    printf("%-16ls %9.2f ms  (%d moves, %.2f us per move alone, %.2f us while %d links were printed)\n",
+      benchmark->name,
+      streaming,
+      moves,
+      1000.0 * alone / moves,
+      1000.0 * streaming / moves,
+      stream.links);
+  }
+  else
+    printf("%-16ls cannot create thread\n", benchmark->name);
+    
+  hyper_console_done_hyperlink_system();
+  hyper_console_use_memory_backend(NULL);
+  hyper_console_memory_backend_free(mb);
+}
+
+/* Move the mouse over the first rows of the buffer during one input and return the time in ms.
+ */
+static double hover_links(struct hyper_console_memory_backend_t *mb, int width, int lines, int moves) {
+  struct hyper_console_settings_t settings;
+  wchar_t *result;
+  double start;
+  int i;
+  
+  memset(&settings, 0, sizeof(settings));
+  settings.size = sizeof(settings);
+  
+  for(i = 0; i < moves; ++i)
+    add_mouse_move(mb, (i * 37) % width, (i * 7919) % lines);
+  add_key(mb, VK_RETURN, L'\r', 0);
+  
+  start = get_milliseconds();
+  result = hyper_console_readline(&settings);
+  hyper_console_free_memory(result);
+  return get_milliseconds() - start;
+}
+
+/* Thread function that prints links to the memory console until it is asked to stop.
+ */
+static DWORD WINAPI stream_links(void *context) {
+  struct link_stream_t *stream = context;
+  wchar_t name[20];
+  
+  while(!stream->stop) {
+    swprintf(name, sizeof(name) / sizeof(name[0]), L"s%07d.log", stream->links++);
+    
+    hyper_console_start_link(name);
+    hyper_console_memory_backend_write(stream->mb, name, -1);
+    hyper_console_end_link();
+    
+    hyper_console_memory_backend_write(stream->mb, L"\n", -1);
+  }
+  
+  return 0;
+}
+
+/* Print log lines while the user edits a long input, as a log-tailing thread would. Every key
+   press prints some lines, either with one hyper_console_interrupt() per line or with
+   hyper_console_post_output(), which hides and redraws the input once for all lines posted in 
+   the meantime.
+ */
+static void benchmark_output_post(const struct benchmark_t *benchmark) {
+  const int keys = 500;
+  const int lines_per_key = 10;
+  double interrupting;
+  double posted;
+  
+  interrupting = print_log_while_editing(FALSE, keys, lines_per_key);
+  posted       = print_log_while_editing(TRUE,  keys, lines_per_key);
+  if(interrupting < 0 || posted < 0) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    return;
+  }
+  
+  printf("%-16ls %9.2f ms  (%d lines, %.2f ms with one interrupt per line)\n",
+    benchmark->name,
+    posted,
+    keys * lines_per_key,
+    interrupting);
+}
+
+/* Read an input that wraps over several rows in a new console, pressing Right and Left \a keys 
+   times, and return the time in ms or -1 on out-of-memory.
+ */
+static double print_log_while_editing(BOOL post, int keys, int lines_per_key) {
+  const int width = 120;
+  const int height = 9999;
+  struct hyper_console_settings_t settings;
+  struct hyper_console_memory_backend_t *mb;
+  struct log_printer_t printer;
+  wchar_t *text;
+  wchar_t *result;
+  double start;
+  double elapsed;
+  int i;
+  
+  text = make_lines(L"some input ", 30, 1);
+  if(!text)
+    return -1.0;
+    
+  mb = hyper_console_memory_backend_new(width, height, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!mb) {
+    hyper_console_free_memory(text);
+    return -1.0;
+  }
+  
+  hyper_console_use_memory_backend(mb);
+  hyper_console_init_hyperlink_system();
+  
+  memset(&printer, 0, sizeof(printer));
+  printer.mb = mb;
+  printer.post = post;
+  printer.lines_per_key = lines_per_key;
+  
+  memset(&settings, 0, sizeof(settings));
+  settings.size = sizeof(settings);
+  settings.default_input = text;
+  settings.callback_context = &printer;
+  settings.key_event_filter = print_log_lines;
+  
+  for(i = 0; i < keys; ++i)
+    add_key(mb, (i & 1) ? VK_LEFT : VK_RIGHT, 0, 0);
+  add_key(mb, VK_RETURN, L'\r', 0);
+  
+  hyper_console_memory_backend_write(mb, L"> ", -1);
+  
+  start = get_milliseconds();
+  result = hyper_console_readline(&settings);
+  elapsed = get_milliseconds() - start;
+  
+  hyper_console_free_memory(result);
+  hyper_console_free_memory(text);
+  
+  hyper_console_done_hyperlink_system();
+  hyper_console_use_memory_backend(NULL);
+  hyper_console_memory_backend_free(mb);
+  return elapsed;
+}
+
+/* Key filter that prints log lines on every key press.
+ */
+static BOOL print_log_lines(void *context, const KEY_EVENT_RECORD *er) {
+  struct log_printer_t *printer = context;
+  int i;
+  
+  if(!er->bKeyDown || er->wVirtualKeyCode == VK_RETURN)
+    return FALSE;
+    
+  for(i = 0; i < printer->lines_per_key; ++i) {
+    swprintf(printer->line, sizeof(printer->line) / sizeof(printer->line[0]), L"log line %d\n", printer->lines++);
+    
+    if(printer->post)
+      hyper_console_post_output(printer->line, -1);
+    else
+      hyper_console_interrupt(write_log_line, printer);
+  }
+  
+  return FALSE;
+}
+
+static void write_log_line(void *context) {
+  struct log_printer_t *printer = context;
+  
+  hyper_console_memory_backend_write(printer->mb, printer->line, -1);
+}
+
+/* Fill a wide screen buffer with log lines, select a word of the input and search it with Ctrl+F.
+   Then type and erase a further filter character many times. Every edit searches the window 
+   rows for the filter. The rest of the buffer is only searched while no input is waiting, 
+   which never happens here.
+ */
+static void benchmark_search_filter(const struct benchmark_t *benchmark) {
+  const int edits = 100;
+  double elapsed;
+  int last_edit_cells;
+  
+  elapsed = search_log_while_editing(L"worker", 50, edits, &last_edit_cells);
+  if(elapsed < 0) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    return;
+  }
+  
+  printf("%-16ls %9.2f ms  (%d filter edits, %.2f ms per edit, %d cells written by the last edit)\n",
+    benchmark->name,
+    elapsed,
+    2 * edits,
+    elapsed / (2 * edits),
+    last_edit_cells);
+}
+
+/* Like search-filter, but the whole buffer is visible and the filter matches once per line.
+   Every edit removes or draws the highlights of about 10000 matches.
+ */
+static void benchmark_search_highlight(const struct benchmark_t *benchmark) {
+  const int edits = 20;
+  double elapsed;
+  int last_edit_cells;
+  
+  elapsed = search_log_while_editing(L"ok", 0, edits, &last_edit_cells);
+  if(elapsed < 0) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    return;
+  }
+  
+  printf("%-16ls %9.2f ms  (%d filter edits, %.2f ms per edit, %d cells written by the last edit)\n",
+    benchmark->name,
+    elapsed,
+    2 * edits,
+    elapsed / (2 * edits),
+    last_edit_cells);
+}
+
+/* Search a word in a 300x9999 buffer of log lines and time the filter edits.
+   A window_height of 0 shows the whole buffer.
+   Stores the number of cells that the last edit wrote in *last_edit_cells.
+   Returns the time in milliseconds or -1 on out-of-memory.
+ */
+static double search_log_while_editing(const wchar_t *word, int window_height, int edits, int *last_edit_cells) {
+  const int width = 300;
+  const int height = 9999;
+  const int lines = 9990;
+  struct hyper_console_settings_t settings;
+  struct hyper_console_memory_backend_t *mb;
+  SMALL_RECT window;
+  COORD cursor;
+  wchar_t line[200];
+  wchar_t *result;
+  double start;
+  double elapsed;
+  int i;
+  
+  mb = hyper_console_memory_backend_new(width, height, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!mb)
+    return -1;
+  
+  hyper_console_use_memory_backend(mb);
+  hyper_console_init_hyperlink_system();
+  
+  for(i = 0; i < lines; ++i) {
+    swprintf(
+      line, 
+      sizeof(line) / sizeof(line[0]), 
+      L"12:%02d:%02d [INFO] Request %d from Client%d handled by Worker%d in %d ms. Status: OK\n", 
+      i / 60 % 60, 
+      i % 60, 
+      i, 
+      i % 97,
+      i % 13, 
+      i % 1000);
+    hyper_console_memory_backend_write(mb, line, -1);
+  }
+  
+  if(window_height > 0) {
+    hyper_console_memory_backend_get_cells(mb, NULL, &cursor);
+    window.Left   = 0;
+    window.Right  = width - 1;
+    window.Bottom = cursor.Y;
+    window.Top    = (SHORT)(cursor.Y >= window_height ? cursor.Y - window_height + 1 : 0);
+    hyper_console_memory_backend_set_window(mb, &window);
+  }
+  
+  memset(&settings, 0, sizeof(settings));
+  settings.size = sizeof(settings);
+  settings.default_input = word;
+  
+  add_key(mb, VK_END, 0, SHIFT_PRESSED);
+  add_key(mb, 'F', 0x06, LEFT_CTRL_PRESSED);
+  for(i = 0; i < edits; ++i) {
+    add_key(mb, 0, L'0' + i % 10, 0);
+    add_key(mb, VK_BACK, L'\b', 0);
+  }
+  add_key(mb, VK_ESCAPE, 0x1B, 0);
+  add_key(mb, VK_RETURN, L'\r', 0);
+  
+  hyper_console_memory_backend_write(mb, L"> ", -1);
+  
+  start = get_milliseconds();
+  result = hyper_console_readline(&settings);
+  elapsed = get_milliseconds() - start;
+  hyper_console_free_memory(result);
+  hyper_console_get_redraw_info(NULL, last_edit_cells);
+  
+  hyper_console_done_hyperlink_system();
+  hyper_console_use_memory_backend(NULL);
+  hyper_console_memory_backend_free(mb);
+  
+  return elapsed;
+}
+
+void run_benchmarks(const wchar_t *name) {
+  int i;
+  BOOL found = FALSE;
+  
+  assert(name != NULL);
+  
+  fflush(stdout);
+  hyper_console_done_hyperlink_system();
+  
+  for(i = 0; i < (int)(sizeof(all_benchmarks) / sizeof(all_benchmarks[0])); ++i) {
+    if(*name && wcscmp(name, all_benchmarks[i].name) != 0)
+      continue;
+    
+    found = TRUE;
+    all_benchmarks[i].run(&all_benchmarks[i]);
+  }
+  
+  hyper_console_init_hyperlink_system();
+  
+  if(!found) {
+    printf("Unknown benchmark '%ls'. Available benchmarks:\n", name);
+    for(i = 0; i < (int)(sizeof(all_benchmarks) / sizeof(all_benchmarks[0])); ++i) {
+      printf("  %-16ls %ls\n", all_benchmarks[i].name, all_benchmarks[i].description);
+    }
+  }
+}
+
+/* Enter and leave search mode over a full 300x9999 buffer with a window of 50 rows, with a few 
+   log lines printed between the readline calls. Every entry needs the screen contents, most of 
+   which did not change.
+ */
+static void benchmark_search_reenter(const struct benchmark_t *benchmark) {
+  const int width = 300;
+  const int height = 9999;
+  const int prompts = 20;
+  const int searches = 10;
+  struct hyper_console_settings_t settings;
+  struct hyper_console_memory_backend_t *mb;
+  SMALL_RECT window;
+  COORD cursor;
+  wchar_t line[200];
+  double elapsed;
+  int i;
+  int j;
+  
+  mb = hyper_console_memory_backend_new(width, height, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!mb) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    return;
+  }
+  
+  hyper_console_use_memory_backend(mb);
+  hyper_console_init_hyperlink_system();
+  
+  memset(&settings, 0, sizeof(settings));
+  settings.size = sizeof(settings);
+  settings.default_input = L"request 99";
+  
+  elapsed = 0;
+  for(i = 0; i < height + prompts * 3; ++i) {
+    wchar_t *result;
+    double start;
+    
+    swprintf(
+      line, 
+      sizeof(line) / sizeof(line[0]), 
+      L"12:%02d:%02d [INFO] Request %d from Client%d handled by Worker%d in %d ms. Status: OK\n", 
+      i / 60 % 60, 
+      i % 60, 
+      i, 
+      i % 97,
+      i % 13, 
+      i % 1000);
+    hyper_console_memory_backend_write(mb, line, -1);
+    
+    if(i < height || i % 3 != 0)
+      continue;
+    
+    hyper_console_memory_backend_get_cells(mb, NULL, &cursor);
+    window.Left   = 0;
+    window.Right  = width - 1;
+    window.Bottom = cursor.Y;
+    window.Top    = cursor.Y - 49;
+    hyper_console_memory_backend_set_window(mb, &window);
+    
+    for(j = 0; j < searches; ++j) {
+      add_key(mb, 'F', 0x06, LEFT_CTRL_PRESSED);
+      add_key(mb, VK_ESCAPE, 0x1B, 0);
+    }
+    add_key(mb, VK_RETURN, L'\r', 0);
+    
+    hyper_console_memory_backend_write(mb, L"> ", -1);
+    
+    start = get_milliseconds();
+    result = hyper_console_readline(&settings);
+    elapsed+= get_milliseconds() - start;
+    hyper_console_free_memory(result);
+  }
+  
+  hyper_console_done_hyperlink_system();
+  hyper_console_use_memory_backend(NULL);
+  hyper_console_memory_backend_free(mb);
+  
+  printf("%-16ls %9.2f ms  (%d searches, %.2f ms per search)\n",
+    benchmark->name,
+    elapsed,
+    prompts * searches,
+    elapsed / (prompts * searches));
+}
+
+/* Read a full 300x9999 buffer like the per-plane loops did, i.e. first the characters and then the 
+   attributes in strips of 8192 cells, and with a single hyper_console_read_screen_buffer() call that 
+   takes both from the same reads.
+ */
+static void benchmark_screen_read(const struct benchmark_t *benchmark) {
+  const int width = 300;
+  const int height = 9999;
+  const int reads = 20;
+  const int strip_rows = 8192 / 300;
+  struct hyper_console_memory_backend_t *mb;
+  SMALL_RECT region;
+  wchar_t line[200];
+  wchar_t *text;
+  wchar_t *bulk_text;
+  WORD *attributes;
+  WORD *bulk_attributes;
+  double start;
+  double per_plane;
+  double bulk;
+  int i;
+  int y;
+  
+  mb = hyper_console_memory_backend_new(width, height, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  text            = hyper_console_allocate_memory(width * height * sizeof(wchar_t));
+  bulk_text       = hyper_console_allocate_memory(width * height * sizeof(wchar_t));
+  attributes      = hyper_console_allocate_memory(width * height * sizeof(WORD));
+  bulk_attributes = hyper_console_allocate_memory(width * height * sizeof(WORD));
+  if(!mb || !text || !bulk_text || !attributes || !bulk_attributes) {
+    printf("%-16ls out of memory\n", benchmark->name);
+    hyper_console_free_memory(text);
+    hyper_console_free_memory(bulk_text);
+    hyper_console_free_memory(attributes);
+    hyper_console_free_memory(bulk_attributes);
+    hyper_console_memory_backend_free(mb);
+    return;
+  }
+  
+  hyper_console_use_memory_backend(mb);
+  
+  for(i = 0; i < height; ++i) {
+    swprintf(
+      line, 
+      sizeof(line) / sizeof(line[0]), 
+      L"12:%02d:%02d [INFO] Request %d from Client%d handled by Worker%d in %d ms. Status: OK\n", 
+      i / 60 % 60, 
+      i % 60, 
+      i, 
+      i % 97,
+      i % 13, 
+      i % 1000);
+    hyper_console_memory_backend_write(mb, line, -1);
+  }
+  
+  start = get_milliseconds();
+  for(i = 0; i < reads; ++i) {
+    for(y = 0; y < height; y+= strip_rows) {
+      region.Left   = 0;
+      region.Top    = (SHORT)y;
+      region.Right  = width - 1;
+      region.Bottom = (SHORT)(y + strip_rows <= height ? y + strip_rows - 1 : height - 1);
+      hyper_console_read_screen_buffer(&region, text + y * width, NULL);
+    }
+    
+    for(y = 0; y < height; y+= strip_rows) {
+      region.Left   = 0;
+      region.Top    = (SHORT)y;
+      region.Right  = width - 1;
+      region.Bottom = (SHORT)(y + strip_rows <= height ? y + strip_rows - 1 : height - 1);
+      hyper_console_read_screen_buffer(&region, NULL, attributes + y * width);
+    }
+  }
+  per_plane = get_milliseconds() - start;
+  
+  start = get_milliseconds();
+  for(i = 0; i < reads; ++i) {
+    region.Left   = 0;
+    region.Top    = 0;
+    region.Right  = width - 1;
+    region.Bottom = height - 1;
+    hyper_console_read_screen_buffer(&region, bulk_text, bulk_attributes);
+  }
+  bulk = get_milliseconds() - start;
+  
+  assert(memcmp(text, bulk_text, width * height * sizeof(wchar_t)) == 0);
+  assert(memcmp(attributes, bulk_attributes, width * height * sizeof(WORD)) == 0);
+  
+  hyper_console_use_memory_backend(NULL);
+  hyper_console_memory_backend_free(mb);
+  hyper_console_free_memory(text);
+  hyper_console_free_memory(bulk_text);
+  hyper_console_free_memory(attributes);
+  hyper_console_free_memory(bulk_attributes);
+  
+  printf("%-16ls %9.2f ms  (%d reads, %.2f ms per plane-wise read, %.2f ms per bulk read)\n",
+    benchmark->name,
+    per_plane + bulk,
+    reads,
+    per_plane / reads,
+    bulk / reads);
+}
@@ -0,0 +1,17 @@
+#ifndef __APP__BENCHMARK_H__
+#define __APP__BENCHMARK_H__
+
+#include <windows.h>
+
+
+/** Run one or all benchmarks and print their timings to stdout.
+
+  \param name The benchmark name or an empty string to run all benchmarks.
+
+  The benchmarks run headlessly on an in-memory console. The hyperlink system must be initialized
+  when calling this function. It is shut down temporarily while the benchmarks run.
+ */
+void run_benchmarks(const wchar_t *name);
+
+
+#endif // __APP__BENCHMARK_H__
@@ -4,6 +4,9 @@
 
 #include <wchar.h>
 
+#include "benchmark.h"
+#include "selftest.h"
+
 //#include "read-input.h"
 //#include "console-history.h"
 //#include "memory-util.h"
@@ -247,8 +250,21 @@ static void write_file_link(
     hyper_console_end_link();
   }
   else {
-    if(optional_owning_directory)
+    struct hyper_console_link_string_t *command = NULL;
+    
+    if(optional_owning_directory) {
+      struct hyper_console_link_string_t *directory;
+      
+      // all files of a directory listing share the interned "open <directory>\" prefix
+      StringCbPrintfW(cmd, sizeof(cmd), L"open %s\\", optional_owning_directory);
+      directory = hyper_console_intern_link_string(NULL, cmd);
+      if(directory) {
+        command = hyper_console_intern_link_string(directory, filename);
+        hyper_console_release_link_string(directory);
+      }
+      
       StringCbPrintfW(cmd, sizeof(cmd), L"open %s\\%s", optional_owning_directory, filename);
+    }
     else
       StringCbPrintfW(cmd, sizeof(cmd), L"open %s", filename);
       
@@ -256,8 +272,15 @@ static void write_file_link(
       optional_text = cmd + 5;
       
     fflush(stdout);
-    hyper_console_start_link(cmd);
-    hyper_console_set_link_input_text(cmd);
+    if(command) {
+      hyper_console_start_interned_link(command);
+      hyper_console_set_interned_link_input_text(command);
+      hyper_console_release_link_string(command);
+    }
+    else {
+      hyper_console_start_link(cmd);
+      hyper_console_set_link_input_text(cmd);
+    }
     hyper_console_set_link_color(file_link_color);
     
     write_unicode(optional_text);
@@ -1047,6 +1070,9 @@ static void show_help(void) {
 
   printf("Available commands\n");
   
+  write_simple_link(L"run all benchmarks", L"benchmark", L"benchmark");
+  printf("\t Measure the input line editor on an in-memory console.\n");
+  
   write_simple_link(L"scroll to window bottom", L"bottom", L"bottom");
   printf("\t Advance cursor to bottom of the console buffer.\n");
   
@@ -1096,6 +1122,9 @@ static void show_help(void) {
   write_simple_link(L"Keyboard shortcut for 'secret'", L"secret", L"[F2]");
   printf(".\n");
   
+  write_simple_link(L"run self tests", L"selftest", L"selftest");
+  printf("\t Check the input line editor on an in-memory console.\n");
+  
   write_simple_link(L"single-line input", L"single", L"single");
   printf("\t Switch to single-line input mode (default).\n");
   
@@ -1103,6 +1132,7 @@ static void show_help(void) {
   printf("\t Show the current directory tree.\n");
   
   printf("\nYou can use keyboard shortcuts Ctrl+C, Ctrl+X, Ctrl+V to access the clipboard.\n");
+  printf("Press Ctrl+R to search the input history. Press Ctrl+R again for older matches.\n");
 }
 
 static void show_help_callback(void *_mark_mode) {
@@ -1150,6 +1180,7 @@ static BOOL need_more_input_predicate(void *context, const wchar_t *buffer, int
 
 static wchar_t **auto_completion(void *context, const wchar_t *buffer, int len, int cursor_pos, int *completion_start, int *completion_end) {
   static const wchar_t *all_words[] = {
+    L"benchmark",
     L"bottom",
     L"cd",
     L"cd+dir",
@@ -1164,6 +1195,7 @@ static wchar_t **auto_completion(void *context, const wchar_t *buffer, int len,
     L"quit",
     L"run",
     L"secret",
+    L"selftest",
     L"single",
     L"tree"
   };
@@ -1239,7 +1271,7 @@ int main() {
   memset(&settings, 0, sizeof(settings));
   settings.size                       = sizeof(settings);
   settings.default_input              = L"help";
-  settings.history                    = hyper_console_history_new(0);
+  settings.history                    = hyper_console_history_new(HYPER_CONSOLE_HISTORY_NO_DUPLICATES);
   settings.need_more_input_predicate  = need_more_input_predicate;
   settings.auto_completion            = auto_completion;
   settings.line_continuation_prompt   = L"...>";
@@ -1291,6 +1323,19 @@ int main() {
       continue;
     }
     
+    if(first_word_equals(str, L"benchmark")) {
+      const wchar_t *name = str + 9;
+      while(*name == L' ')
+        ++name;
+      run_benchmarks(name);
+      continue;
+    }
+    
+    if(wcscmp(str, L"selftest") == 0) {
+      run_self_tests();
+      continue;
+    }
+    
     if(wcscmp(str, L"bottom") == 0) {
       goto_bottom();
       continue;
@@ -0,0 +1,132 @@
+#include "selftest.h"
+
+#include <hyper-console.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+
+struct self_test_t {
+  const wchar_t *name;
+  const wchar_t *description;
+  BOOL (*run)(void);
+};
+
+static BOOL test_input_scroll(void);
+
+static const struct self_test_t all_self_tests[] = {
+  { L"input-scroll", L"A long input at the bottom scrolls the whole buffer up.", test_input_scroll },
+};
+
+static void add_key(struct hyper_console_memory_backend_t *mb, WORD vk, wchar_t ch, DWORD control_key_state) {
+  INPUT_RECORD records[2];
+
+  memset(records, 0, sizeof(records));
+  records[0].EventType = KEY_EVENT;
+  records[0].Event.KeyEvent.bKeyDown = TRUE;
+  records[0].Event.KeyEvent.wRepeatCount = 1;
+  records[0].Event.KeyEvent.wVirtualKeyCode = vk;
+  records[0].Event.KeyEvent.uChar.UnicodeChar = ch;
+  records[0].Event.KeyEvent.dwControlKeyState = control_key_state;
+
+  records[1] = records[0];
+  records[1].Event.KeyEvent.bKeyDown = FALSE;
+
+  hyper_console_memory_backend_add_input(mb, records, 2);
+}
+
+/* Get the number k of a row that reads "row k", or -1.
+ */
+static int get_row_number(const CHAR_INFO *row, int width) {
+  wchar_t text[32];
+  int number;
+  int i;
+
+  for(i = 0; i < width && i + 1 < (int)(sizeof(text) / sizeof(text[0])); ++i)
+    text[i] = row[i].Char.UnicodeChar;
+  text[i] = L'\0';
+
+  if(swscanf(text, L"row %d", &number) != 1)
+    return -1;
+
+  return number;
+}
+
+/* Fill all but the last row of a 20x10 buffer with numbered lines and edit an input of three rows
+   in the last one. The buffer must scroll up by two rows, including the top rows which are not
+   covered by the scrolled rectangle.
+ */
+static BOOL test_input_scroll(void) {
+  const int width = 20;
+  const int height = 10;
+  struct hyper_console_settings_t settings;
+  struct hyper_console_memory_backend_t *mb;
+  const CHAR_INFO *cells;
+  wchar_t line[32];
+  wchar_t *result;
+  COORD size;
+  int last_row;
+  BOOL ok;
+  int y;
+
+  mb = hyper_console_memory_backend_new(width, height, FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+  if(!mb)
+    return FALSE;
+
+  hyper_console_use_memory_backend(mb);
+
+  for(y = 0; y < height - 1; ++y) {
+    swprintf(line, sizeof(line) / sizeof(line[0]), L"row %d\n", y);
+    hyper_console_memory_backend_write(mb, line, -1);
+  }
+  hyper_console_memory_backend_write(mb, L"> ", -1);
+
+  memset(&settings, 0, sizeof(settings));
+  settings.size = sizeof(settings);
+  settings.default_input = L"0123456789012345678901234567890123456789012345";
+
+  add_key(mb, VK_RETURN, L'\r', 0);
+  result = hyper_console_readline(&settings);
+  hyper_console_free_memory(result);
+
+  cells = hyper_console_memory_backend_get_cells(mb, &size, NULL);
+
+  last_row = -1;
+  for(y = 0; y < size.Y; ++y) {
+    if(get_row_number(cells + y * size.X, size.X) == height - 2)
+      last_row = y;
+  }
+
+  ok = last_row >= 0 && last_row < height - 3;
+  for(y = 0; ok && y <= last_row; ++y) {
+    if(get_row_number(cells + y * size.X, size.X) != height - 2 - last_row + y)
+      ok = FALSE;
+  }
+
+  hyper_console_use_memory_backend(NULL);
+  hyper_console_memory_backend_free(mb);
+  return ok;
+}
+
+BOOL run_self_tests(void) {
+  int i;
+  int failed = 0;
+
+  fflush(stdout);
+  hyper_console_done_hyperlink_system();
+
+  for(i = 0; i < (int)(sizeof(all_self_tests) / sizeof(all_self_tests[0])); ++i) {
+    BOOL ok = all_self_tests[i].run();
+
+    printf("%-16ls %s  %ls\n", all_self_tests[i].name, ok ? "ok    " : "FAILED", all_self_tests[i].description);
+    if(!ok)
+      ++failed;
+  }
+
+  hyper_console_init_hyperlink_system();
+
+  printf("%d of %d self tests failed.\n", failed, i);
+  return failed == 0;
+}
@@ -0,0 +1,17 @@
+#ifndef __APP__SELFTEST_H__
+#define __APP__SELFTEST_H__
+
+#include <windows.h>
+
+
+/** Run the self tests and print their results to stdout.
+
+  \return TRUE if all tests passed.
+
+  The tests run headlessly on an in-memory console. The hyperlink system must be initialized
+  when calling this function. It is shut down temporarily while the tests run.
+ */
+BOOL run_self_tests(void);
+
+
+#endif // __APP__SELFTEST_H__
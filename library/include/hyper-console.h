@@ -12,9 +12,18 @@
  */
 struct hyper_console_history_t;
 
+enum {
+  /** Remove older copies of an entry when it is added again.
+   */
+  HYPER_CONSOLE_HISTORY_NO_DUPLICATES = 0x01
+};
+
 /** Create a new console history buffer.
 
-  \param options History option flags for future use. Must be 0.
+  \param options Zero or more of the HYPER_CONSOLE_HISTORY_XXX flags.
+  
+  The buffer keeps at most 100000 entries and 16 MB of text by default. Use 
+  hyper_console_history_set_limits() to change that.
  */
 HYPER_CONSOLE_API
 struct hyper_console_history_t *hyper_console_history_new(int options);
@@ -28,6 +37,49 @@ HYPER_CONSOLE_API
 void hyper_console_history_free(struct hyper_console_history_t *hist);
 
 
+/** Add an entry to a console history buffer, e.g. when loading a saved history.
+
+  \param hist A console history buffer or NULL.
+  \param text The new entry.
+  \param text_length The length of the entry or -1 to indicate that \a text is a NUL-terminated string.
+  
+  Empty entries and repetitions of the newest entry are ignored. hyper_console_readline() adds 
+  each accepted input automatically.
+ */
+HYPER_CONSOLE_API
+void hyper_console_history_add(struct hyper_console_history_t *hist, const wchar_t *text, int text_length);
+
+
+/** Limit the size of a console history buffer.
+
+  \param hist A console history buffer or NULL.
+  \param max_entries The maximum number of entries or 0 for no limit.
+  \param max_bytes The maximum memory used by all entries in bytes or 0 for no limit.
+  
+  When a limit is exceeded, the oldest entries are discarded. The newest entry is always kept.
+ */
+HYPER_CONSOLE_API
+void hyper_console_history_set_limits(struct hyper_console_history_t *hist, int max_entries, int max_bytes);
+
+
+/** Keep a console history buffer in a file.
+
+  \param hist An empty console history buffer.
+  \param path The file name. The file is created if it does not exist.
+
+  \return TRUE on success, FALSE if the file cannot be opened or is not a history file.
+
+  The newest entries of the file are loaded within the limits of \a hist, so set the limits first.
+  Only those are copied from the file, which is mapped into memory while loading. Every entry 
+  added later is appended to it. Several processes can share the same file. With 
+  HYPER_CONSOLE_HISTORY_NO_DUPLICATES, older copies of duplicate entries are removed from the file 
+  on opening when the file has grown beyond twice the size of the loaded entries and they take at 
+  least half of it. Entries beyond the limits of \a hist are never removed from the file.
+ */
+HYPER_CONSOLE_API
+BOOL hyper_console_history_open_file(struct hyper_console_history_t *hist, const wchar_t *path);
+
+
 enum {
   /** Input can span multiple lines.
   
@@ -157,6 +209,22 @@ wchar_t *hyper_console_readline(struct hyper_console_settings_t *settings);
 HYPER_CONSOLE_API
 void hyper_console_interrupt(void (*callback)(void*), void *callback_arg);
 
+/** Print text from any thread while `hyper_console_readline()` may be running.
+  
+  \param text   The text to print.
+  \param length The length of \a text or -1 if it is 0-terminated.
+  \return TRUE on success, FALSE if the text could not be queued or written.
+  
+  If some thread is in `hyper_console_readline()`, the text is copied to a queue and that thread
+  prints it before it handles its next input event, like `hyper_console_interrupt()` would. All 
+  text posted in the meantime is printed at once, so that the input is hidden and restored only 
+  once per batch. Otherwise, the text is written immediately.
+  
+  Text posted during mark mode or search mode is printed when that mode ends.
+ */
+HYPER_CONSOLE_API
+BOOL hyper_console_post_output(const wchar_t *text, int length);
+
 /** Get the currently edited input text.
   
   \param length Pointer to an integer receiving the input buffer length. Must not be NULL.
@@ -188,6 +256,31 @@ void hyper_console_get_current_selection(int *position, int *anchor);
 HYPER_CONSOLE_API
 void hyper_console_set_current_selection(int position, int anchor);
 
+/** Get the number of input events and redraws of the current input event batch.
+  
+  \param events  Optional. Receives the number of input events that were read at once.
+  \param redraws Optional. Receives the number of times the input line has been redrawn while 
+                 handling them so far.
+  \return TRUE if hyper_console_readline() is running in the current thread, FALSE otherwise.
+  
+  Characters that were typed faster than they could be displayed are read as one batch and 
+  redrawn once. Call this e.g. from the key event filter.
+ */
+HYPER_CONSOLE_API
+BOOL hyper_console_get_input_batch_info(int *events, int *redraws);
+
+/** Get the number of console cells written by the last redraws.
+  
+  \param input_cells  Optional. Receives the number of cells of the input line that the last redraw 
+                      wrote. Unchanged cells are skipped.
+  \param search_cells Optional. Receives the number of cells that search mode wrote for the last 
+                      input event (e.g. a filter edit) it handled in the current thread, or 0. 
+                      The background search and the event that ended search mode do not count.
+  \return TRUE if hyper_console_readline() is running in the current thread, FALSE otherwise.
+ */
+HYPER_CONSOLE_API
+BOOL hyper_console_get_redraw_info(int *input_cells, int *search_cells);
+
 /**Get the selected text in mark-mode.
 
   \param total_length Optional. Receives the string length of the selection.
@@ -207,6 +300,20 @@ wchar_t *hyper_console_get_mark_mode_selection(int *total_length);
 HYPER_CONSOLE_API
 wchar_t *hyper_console_get_mark_mode_line(int *line_length, int *pos_in_line);
 
+/** Read the characters and attributes of a rectangle of the output screen buffer.
+
+  \param region     The rectangle in screen buffer coordinates. Right and Bottom are inclusive. 
+                    Receives the part that was read after clipping it to the screen buffer.
+  \param text       Optional. Receives the characters of the clipped rectangle row by row.
+  \param attributes Optional. Receives the attributes in the same layout.
+  \return TRUE on success, FALSE on error.
+  
+  Both planes are taken from the same ReadConsoleOutputW() calls, which read large tiles of whole 
+  rows. Fullwidth characters occupy two cells, like in the screen buffer.
+ */
+HYPER_CONSOLE_API
+BOOL hyper_console_read_screen_buffer(SMALL_RECT *region, wchar_t *text, WORD *attributes);
+
 /** Allocate a block of memory.
  */
 HYPER_CONSOLE_API
@@ -272,5 +379,209 @@ WORD hyper_console_set_link_color(WORD attribute);
 HYPER_CONSOLE_API
 void hyper_console_end_link(void);
 
+/** Allocation counters of the hyperlink system.
+
+  Link records and their title and input text are carved out of larger memory chunks that are 
+  released together once all links in them scrolled out of the buffer.
+ */
+struct hyper_console_link_statistics_t {
+  /** Size of the structure, i.e. sizeof(struct hyper_console_link_statistics_t)
+   */
+  size_t size;
+  
+  /** Number of link records allocated so far.
+   */
+  int link_allocations;
+  
+  /** Number of distinct link titles and input texts allocated so far.
+   */
+  int string_allocations;
+  
+  /** Number of memory chunks allocated from the heap so far.
+   */
+  int heap_allocations;
+  
+  /** Number of memory chunks returned to the heap so far.
+   */
+  int heap_frees;
+  
+  /** Number of link records currently in use.
+   */
+  int live_links;
+  
+  /** Number of interned link strings currently in use.
+   */
+  int live_strings;
+};
+
+/** Get the allocation counters of the hyperlink system.
+  
+  \param stats The counters. Its \a size member must be set before the call.
+ */
+HYPER_CONSOLE_API
+void hyper_console_get_link_statistics(struct hyper_console_link_statistics_t *stats);
+
+/** Keep the lines that scroll out of the screen buffer in a compressed archive.
+
+  \param max_bytes The memory limit of the archive. When it is exceeded, the oldest lines are 
+                   dropped. 0 disables the archive and drops all lines, which is the default.
+  
+  Search mode counts matching lines in the archive and pressing CTRL+A twice in mark mode selects 
+  the archived lines in addition to the screen buffer. Lines are archived when the hyperlink 
+  system tracks scrolling, i.e. when a link starts or ends and when hyper_console_readline() 
+  starts. Output that scrolls through the whole buffer in between is not seen.
+  
+  This must be called between hyper_console_init_hyperlink_system() and 
+  hyper_console_done_hyperlink_system().
+ */
+HYPER_CONSOLE_API
+void hyper_console_set_scrollback_archive_size(size_t max_bytes);
+
+/** Memory usage of the scrollback archive.
+ */
+struct hyper_console_scrollback_statistics_t {
+  /** Size of the structure, i.e. sizeof(struct hyper_console_scrollback_statistics_t)
+   */
+  size_t size;
+  
+  /** Number of lines in the archive.
+   */
+  int archived_lines;
+  
+  /** Size of the archived lines as UTF-16 text.
+   */
+  size_t text_bytes;
+  
+  /** Memory used by the compressed archive.
+   */
+  size_t archive_bytes;
+};
+
+/** Get the memory usage of the scrollback archive.
+
+  \param stats The statistics. Its \a size member must be set before the call.
+ */
+HYPER_CONSOLE_API
+void hyper_console_get_scrollback_statistics(struct hyper_console_scrollback_statistics_t *stats);
+
+/** An interned, reference counted string for link titles and input texts.
+
+  A string consists of an optional prefix string and its own text. Equal strings with the same
+  prefix are stored only once. Sharing a directory prefix between many file links makes their 
+  memory use independent of the directory's path length.
+ */
+struct hyper_console_link_string_t;
+
+/** Intern a link title or input text.
+  
+  \param prefix An optional interned string that precedes \a text.
+  \param text   The text.
+  
+  \return A reference to the interned string or NULL on error. Release it with 
+          hyper_console_release_link_string().
+ */
+HYPER_CONSOLE_API
+struct hyper_console_link_string_t *hyper_console_intern_link_string(struct hyper_console_link_string_t *prefix, const wchar_t *text);
+
+/** Release a reference returned by hyper_console_intern_link_string().
+  
+  Links keep their own references, so the string may be released right after it was assigned.
+ */
+HYPER_CONSOLE_API
+void hyper_console_release_link_string(struct hyper_console_link_string_t *str);
+
+/** Like hyper_console_start_link(), but with an interned title.
+ */
+HYPER_CONSOLE_API
+void hyper_console_start_interned_link(struct hyper_console_link_string_t *title);
+
+/** Like hyper_console_set_link_input_text(), but with an interned text.
+ */
+HYPER_CONSOLE_API
+void hyper_console_set_interned_link_input_text(struct hyper_console_link_string_t *text);
+
+
+/** An opaque in-memory console screen buffer with scripted input.
+
+  It stands in for the Win32 console, e.g. to run hyper_console_readline() headlessly in tests.
+ */
+struct hyper_console_memory_backend_t;
+
+/** Create a new in-memory console.
+
+  \param width      The screen buffer width. Must be positive.
+  \param height     The screen buffer height. Must be positive.
+  \param attributes The initial text attributes.
+  \return The new console or NULL on error. Free it with hyper_console_memory_backend_free().
+  
+  The visible window covers the whole screen buffer.
+ */
+HYPER_CONSOLE_API
+struct hyper_console_memory_backend_t *hyper_console_memory_backend_new(int width, int height, WORD attributes);
+
+/** Free an in-memory console.
+
+  \param mb An in-memory console or NULL. It must not be in use.
+ */
+HYPER_CONSOLE_API
+void hyper_console_memory_backend_free(struct hyper_console_memory_backend_t *mb);
+
+/** Append input events to be read by the next hyper_console_readline().
+
+  \param mb      An in-memory console.
+  \param records The input records.
+  \param count   The number of records.
+  \return TRUE on success, FALSE on out-of-memory.
+  
+  Once all scripted input is consumed, reading further input fails and hyper_console_readline() 
+  returns NULL.
+ */
+HYPER_CONSOLE_API
+BOOL hyper_console_memory_backend_add_input(struct hyper_console_memory_backend_t *mb, const INPUT_RECORD *records, int count);
+
+/** Write text at the cursor position of an in-memory console.
+
+  \param mb     An in-memory console.
+  \param text   The text to write.
+  \param length The text length or -1 to indicate that \a text is a NUL-terminated string.
+  
+  This is the equivalent of WriteConsoleW(). The control characters \\r, \\n, \\t and \\b are 
+  interpreted, and the buffer scrolls up when writing past its last line.
+ */
+HYPER_CONSOLE_API
+void hyper_console_memory_backend_write(struct hyper_console_memory_backend_t *mb, const wchar_t *text, int length);
+
+/** Get the screen buffer contents of an in-memory console.
+
+  \param mb     An in-memory console.
+  \param size   Optional. Receives the screen buffer size.
+  \param cursor Optional. Receives the cursor position.
+  \return The screen buffer cells in row-major order. They are owned by \a mb.
+ */
+HYPER_CONSOLE_API
+const CHAR_INFO *hyper_console_memory_backend_get_cells(struct hyper_console_memory_backend_t *mb, COORD *size, COORD *cursor);
+
+/** Move the visible window of an in-memory console.
+
+  \param mb     An in-memory console.
+  \param window The new window in screen buffer coordinates. Right and Bottom are inclusive, like 
+                for SetConsoleWindowInfo().
+  \return TRUE on success, FALSE if the window does not fit into the screen buffer.
+  
+  The window does not follow the cursor.
+ */
+HYPER_CONSOLE_API
+BOOL hyper_console_memory_backend_set_window(struct hyper_console_memory_backend_t *mb, const SMALL_RECT *window);
+
+/** Use an in-memory console instead of the Win32 console.
+
+  \param mb An in-memory console or NULL to switch back to the Win32 console.
+  
+  This affects all threads. It must not be called while hyper_console_readline() runs or while 
+  the hyperlink system is initialized.
+ */
+HYPER_CONSOLE_API
+void hyper_console_use_memory_backend(struct hyper_console_memory_backend_t *mb);
+
 
 #endif
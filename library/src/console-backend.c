@@ -0,0 +1,164 @@
+#include "console-backend.h"
+#include "console-buffer-io.h"
+
+
+static HANDLE win32_get_std_handle(DWORD std_handle);
+static BOOL win32_get_mode(HANDLE handle, DWORD *mode);
+static BOOL win32_set_mode(HANDLE handle, DWORD mode);
+static BOOL win32_get_screen_buffer_info(HANDLE hConsoleOutput, CONSOLE_SCREEN_BUFFER_INFO *csbi);
+static BOOL win32_set_cursor_position(HANDLE hConsoleOutput, COORD pos);
+static BOOL win32_get_cursor_info(HANDLE hConsoleOutput, CONSOLE_CURSOR_INFO *cci);
+static BOOL win32_set_cursor_info(HANDLE hConsoleOutput, const CONSOLE_CURSOR_INFO *cci);
+static BOOL win32_set_window_info(HANDLE hConsoleOutput, BOOL absolute, const SMALL_RECT *window);
+static BOOL win32_set_text_attribute(HANDLE hConsoleOutput, WORD attribute);
+static DWORD win32_get_title(wchar_t *buffer, DWORD size);
+static BOOL win32_set_title(const wchar_t *title);
+static BOOL win32_read_output(HANDLE hConsoleOutput, CHAR_INFO *buffer, COORD buffer_size, COORD buffer_coord, SMALL_RECT *region);
+static BOOL win32_write_output(HANDLE hConsoleOutput, const CHAR_INFO *buffer, COORD buffer_size, COORD buffer_coord, SMALL_RECT *region);
+static BOOL win32_read_output_character(HANDLE hConsoleOutput, wchar_t *chars, DWORD length, COORD coord, DWORD *num_read);
+static BOOL win32_read_output_attribute(HANDLE hConsoleOutput, WORD *attributes, DWORD length, COORD coord, DWORD *num_read);
+static BOOL win32_write_output_attribute(HANDLE hConsoleOutput, const WORD *attributes, DWORD length, COORD coord, DWORD *num_written);
+static BOOL win32_fill_output_attribute(HANDLE hConsoleOutput, WORD attribute, DWORD length, COORD coord, DWORD *num_written);
+static BOOL win32_scroll_buffer(HANDLE hConsoleOutput, const SMALL_RECT *scroll_rect, const SMALL_RECT *clip_rect, COORD dest, const CHAR_INFO *fill);
+static BOOL win32_write_text(HANDLE hConsoleOutput, const wchar_t *text, DWORD length, DWORD *num_written);
+static DWORD win32_wait_for_input(HANDLE hConsoleInput, DWORD timeout);
+static BOOL win32_get_number_of_input_events(HANDLE hConsoleInput, DWORD *count);
+static BOOL win32_read_input(HANDLE hConsoleInput, INPUT_RECORD *records, DWORD length, DWORD *num_read);
+static BOOL win32_peek_input(HANDLE hConsoleInput, INPUT_RECORD *records, DWORD length, DWORD *num_read);
+static BOOL win32_write_input(HANDLE hConsoleInput, const INPUT_RECORD *records, DWORD length, DWORD *num_written);
+
+// The Win32 functions are wrapped because addresses of dllimport functions are no constant 
+// initializers in C.
+const struct console_backend_t console_win32_backend = {
+  win32_get_std_handle,
+  win32_get_mode,
+  win32_set_mode,
+  
+  win32_get_screen_buffer_info,
+  win32_set_cursor_position,
+  win32_get_cursor_info,
+  win32_set_cursor_info,
+  win32_set_window_info,
+  win32_set_text_attribute,
+  win32_get_title,
+  win32_set_title,
+  
+  win32_read_output,
+  win32_write_output,
+  win32_read_output_character,
+  win32_read_output_attribute,
+  win32_write_output_attribute,
+  win32_fill_output_attribute,
+  win32_scroll_buffer,
+  win32_write_text,
+  
+  win32_wait_for_input,
+  win32_get_number_of_input_events,
+  win32_read_input,
+  win32_peek_input,
+  win32_write_input
+};
+
+const struct console_backend_t *console_backend = &console_win32_backend;
+
+void console_set_backend(const struct console_backend_t *backend) {
+  console_discard_snapshot();
+  console_backend = backend ? backend : &console_win32_backend;
+}
+
+static HANDLE win32_get_std_handle(DWORD std_handle) {
+  return GetStdHandle(std_handle);
+}
+
+static BOOL win32_get_mode(HANDLE handle, DWORD *mode) {
+  return GetConsoleMode(handle, mode);
+}
+
+static BOOL win32_set_mode(HANDLE handle, DWORD mode) {
+  return SetConsoleMode(handle, mode);
+}
+
+static BOOL win32_get_screen_buffer_info(HANDLE hConsoleOutput, CONSOLE_SCREEN_BUFFER_INFO *csbi) {
+  return GetConsoleScreenBufferInfo(hConsoleOutput, csbi);
+}
+
+static BOOL win32_set_cursor_position(HANDLE hConsoleOutput, COORD pos) {
+  return SetConsoleCursorPosition(hConsoleOutput, pos);
+}
+
+static BOOL win32_get_cursor_info(HANDLE hConsoleOutput, CONSOLE_CURSOR_INFO *cci) {
+  return GetConsoleCursorInfo(hConsoleOutput, cci);
+}
+
+static BOOL win32_set_cursor_info(HANDLE hConsoleOutput, const CONSOLE_CURSOR_INFO *cci) {
+  return SetConsoleCursorInfo(hConsoleOutput, cci);
+}
+
+static BOOL win32_set_window_info(HANDLE hConsoleOutput, BOOL absolute, const SMALL_RECT *window) {
+  return SetConsoleWindowInfo(hConsoleOutput, absolute, window);
+}
+
+static BOOL win32_set_text_attribute(HANDLE hConsoleOutput, WORD attribute) {
+  return SetConsoleTextAttribute(hConsoleOutput, attribute);
+}
+
+static DWORD win32_get_title(wchar_t *buffer, DWORD size) {
+  return GetConsoleTitleW(buffer, size);
+}
+
+static BOOL win32_set_title(const wchar_t *title) {
+  return SetConsoleTitleW(title);
+}
+
+static BOOL win32_read_output(HANDLE hConsoleOutput, CHAR_INFO *buffer, COORD buffer_size, COORD buffer_coord, SMALL_RECT *region) {
+  return ReadConsoleOutputW(hConsoleOutput, buffer, buffer_size, buffer_coord, region);
+}
+
+static BOOL win32_write_output(HANDLE hConsoleOutput, const CHAR_INFO *buffer, COORD buffer_size, COORD buffer_coord, SMALL_RECT *region) {
+  return WriteConsoleOutputW(hConsoleOutput, buffer, buffer_size, buffer_coord, region);
+}
+
+static BOOL win32_read_output_character(HANDLE hConsoleOutput, wchar_t *chars, DWORD length, COORD coord, DWORD *num_read) {
+  return ReadConsoleOutputCharacterW(hConsoleOutput, chars, length, coord, num_read);
+}
+
+static BOOL win32_read_output_attribute(HANDLE hConsoleOutput, WORD *attributes, DWORD length, COORD coord, DWORD *num_read) {
+  return ReadConsoleOutputAttribute(hConsoleOutput, attributes, length, coord, num_read);
+}
+
+static BOOL win32_write_output_attribute(HANDLE hConsoleOutput, const WORD *attributes, DWORD length, COORD coord, DWORD *num_written) {
+  return WriteConsoleOutputAttribute(hConsoleOutput, attributes, length, coord, num_written);
+}
+
+static BOOL win32_fill_output_attribute(HANDLE hConsoleOutput, WORD attribute, DWORD length, COORD coord, DWORD *num_written) {
+  return FillConsoleOutputAttribute(hConsoleOutput, attribute, length, coord, num_written);
+}
+
+static BOOL win32_scroll_buffer(HANDLE hConsoleOutput, const SMALL_RECT *scroll_rect, const SMALL_RECT *clip_rect, COORD dest, const CHAR_INFO *fill) {
+  return ScrollConsoleScreenBufferW(hConsoleOutput, scroll_rect, clip_rect, dest, fill);
+}
+
+static BOOL win32_write_text(HANDLE hConsoleOutput, const wchar_t *text, DWORD length, DWORD *num_written) {
+  DWORD dummy;
+  return WriteConsoleW(hConsoleOutput, text, length, num_written ? num_written : &dummy, NULL);
+}
+
+static DWORD win32_wait_for_input(HANDLE hConsoleInput, DWORD timeout) {
+  return WaitForSingleObject(hConsoleInput, timeout);
+}
+
+static BOOL win32_get_number_of_input_events(HANDLE hConsoleInput, DWORD *count) {
+  return GetNumberOfConsoleInputEvents(hConsoleInput, count);
+}
+
+static BOOL win32_read_input(HANDLE hConsoleInput, INPUT_RECORD *records, DWORD length, DWORD *num_read) {
+  return ReadConsoleInputW(hConsoleInput, records, length, num_read);
+}
+
+static BOOL win32_peek_input(HANDLE hConsoleInput, INPUT_RECORD *records, DWORD length, DWORD *num_read) {
+  return PeekConsoleInputW(hConsoleInput, records, length, num_read);
+}
+
+static BOOL win32_write_input(HANDLE hConsoleInput, const INPUT_RECORD *records, DWORD length, DWORD *num_written) {
+  return WriteConsoleInputW(hConsoleInput, records, length, num_written);
+}
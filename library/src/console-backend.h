@@ -0,0 +1,63 @@
+#ifndef __CONSOLE__BACKEND_H__
+#define __CONSOLE__BACKEND_H__
+
+#include <windows.h>
+
+
+/** Low-level console operations.
+
+  Every console call of the library goes through the current backend, so that the Win32 console
+  can be replaced by an in-memory screen buffer (see console-emulator.c).
+  Each function behaves like the Win32 console function of the same name.
+ */
+struct console_backend_t {
+  HANDLE (*get_std_handle)(DWORD std_handle);
+  BOOL   (*get_mode)(HANDLE handle, DWORD *mode);
+  BOOL   (*set_mode)(HANDLE handle, DWORD mode);
+
+  BOOL  (*get_screen_buffer_info)(HANDLE hConsoleOutput, CONSOLE_SCREEN_BUFFER_INFO *csbi);
+  BOOL  (*set_cursor_position)(   HANDLE hConsoleOutput, COORD pos);
+  BOOL  (*get_cursor_info)(       HANDLE hConsoleOutput, CONSOLE_CURSOR_INFO *cci);
+  BOOL  (*set_cursor_info)(       HANDLE hConsoleOutput, const CONSOLE_CURSOR_INFO *cci);
+  BOOL  (*set_window_info)(       HANDLE hConsoleOutput, BOOL absolute, const SMALL_RECT *window);
+  BOOL  (*set_text_attribute)(    HANDLE hConsoleOutput, WORD attribute);
+  DWORD (*get_title)(wchar_t *buffer, DWORD size);
+  BOOL  (*set_title)(const wchar_t *title);
+
+  BOOL (*read_output)(           HANDLE hConsoleOutput, CHAR_INFO *buffer, COORD buffer_size, COORD buffer_coord, SMALL_RECT *region);
+  BOOL (*write_output)(          HANDLE hConsoleOutput, const CHAR_INFO *buffer, COORD buffer_size, COORD buffer_coord, SMALL_RECT *region);
+  BOOL (*read_output_character)( HANDLE hConsoleOutput, wchar_t *chars, DWORD length, COORD coord, DWORD *num_read);
+  BOOL (*read_output_attribute)( HANDLE hConsoleOutput, WORD *attributes, DWORD length, COORD coord, DWORD *num_read);
+  BOOL (*write_output_attribute)(HANDLE hConsoleOutput, const WORD *attributes, DWORD length, COORD coord, DWORD *num_written);
+  BOOL (*fill_output_attribute)( HANDLE hConsoleOutput, WORD attribute, DWORD length, COORD coord, DWORD *num_written);
+  BOOL (*scroll_buffer)(         HANDLE hConsoleOutput, const SMALL_RECT *scroll_rect, const SMALL_RECT *clip_rect, COORD dest, const CHAR_INFO *fill);
+  BOOL (*write_text)(            HANDLE hConsoleOutput, const wchar_t *text, DWORD length, DWORD *num_written);
+
+  DWORD (*wait_for_input)(            HANDLE hConsoleInput, DWORD timeout);
+  BOOL  (*get_number_of_input_events)(HANDLE hConsoleInput, DWORD *count);
+  BOOL  (*read_input)(                HANDLE hConsoleInput, INPUT_RECORD *records, DWORD length, DWORD *num_read);
+  BOOL  (*peek_input)(                HANDLE hConsoleInput, INPUT_RECORD *records, DWORD length, DWORD *num_read);
+  BOOL  (*write_input)(               HANDLE hConsoleInput, const INPUT_RECORD *records, DWORD length, DWORD *num_written);
+};
+
+
+/** The backend that forwards to the Win32 console API.
+ */
+extern const struct console_backend_t console_win32_backend;
+
+
+/** The current backend. Never NULL.
+ */
+extern const struct console_backend_t *console_backend;
+
+
+/** Replace the current backend.
+
+  \param backend The new backend or NULL to use console_win32_backend.
+
+  This must not be called while hyper_console_readline() runs.
+ */
+void console_set_backend(const struct console_backend_t *backend);
+
+
+#endif // __CONSOLE__BACKEND_H__
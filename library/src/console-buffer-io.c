@@ -2,6 +2,7 @@
 
 #include "console-buffer-io.h"
 
+#include "console-backend.h"
 #include "debug.h"
 #include "memory-util.h"
 #include "text-util.h"
@@ -12,6 +13,25 @@
 
 #define MAX_BUFFER 8192
 
+/* Cells per ReadConsoleOutputW() call. The 32 KB of CHAR_INFO stay below the 64 KB that the console 
+   host transfers per request. Larger tiles did not read faster. */
+#define READ_TILE_CELLS  MAX_BUFFER
+
+/* Rows above the cursor that a snapshot refresh re-reads, for programs that rewrite a few lines 
+   (e.g. progress bars) */
+#define SNAPSHOT_CURSOR_MARGIN  16
+
+/* Rows at the top of the buffer that are compared with the snapshot to detect scrolling, at first */
+#define SNAPSHOT_PROBE_ROWS  8
+
+/* Rows further down that must confirm the scroll distance */
+#define SNAPSHOT_VERIFY_ROWS  4
+
+#define SNAPSHOT_SCROLL_AMBIGUOUS  (-2)
+
+/* The hash of rows whose text was written since the last refresh. It matches no real row. */
+#define SNAPSHOT_UNKNOWN_HASH  0
+
 
 #define MIN(A, B)  ((A) < (B) ? (A) : (B))
 #define MAX(A, B)  ((A) > (B) ? (A) : (B))
@@ -24,9 +44,52 @@ struct send_input_t {
   DWORD counter;
 };
 
+/* The shared screen snapshot and what is known about its staleness.
+ */
+struct snapshot_cache_t {
+  struct console_snapshot_t snapshot;
+  
+  const struct console_backend_t *backend;
+  HANDLE output_handle;
+  
+  ULONGLONG *row_hashes;   // see hash_cells()
+  ULONGLONG *probe_hashes; // hashes of the current first rows
+  CHAR_INFO *cells;        // reading buffer
+  int        cells_capacity;
+  
+  /* Non-zero for rows that were written through console-buffer-io since the last refresh. Other 
+     output may have scrolled the buffer before or after the write. */
+  char *dirty_rows;
+  
+  int cursor_y;  // cursor row at the last refresh
+  int used_rows; // no row below is known to contain text
+  
+  unsigned valid: 1;
+};
+
+/* Protects _snapshot_cache. Output may be written from any thread. */
+static SRWLOCK _srw_snapshot = SRWLOCK_INIT;
+static struct snapshot_cache_t _snapshot_cache;
+
+static BOOL clip_to_screen_buffer(HANDLE hConsoleOutput, SMALL_RECT *region);
+static SMALL_RECT get_read_tile(const SMALL_RECT *region, int x, int y);
 static BOOL flush_input(struct send_input_t *context);
 static BOOL send_input(struct send_input_t *context, wchar_t ch, DWORD control_key_state);
 
+static ULONGLONG hash_cells(const CHAR_INFO *cells, int length);
+static BOOL is_snapshot_of(struct snapshot_cache_t *cache, HANDLE hConsoleOutput);
+static void free_snapshot_cache(struct snapshot_cache_t *cache);
+static void snapshot_touch_rows(HANDLE hConsoleOutput, int top, int bottom, BOOL text_changed);
+static void snapshot_touch_cells(HANDLE hConsoleOutput, COORD coord, DWORD length);
+static void snapshot_discard_content(HANDLE hConsoleOutput);
+static const CHAR_INFO *read_snapshot_cells(struct snapshot_cache_t *cache, int top, int count, int buffer_row);
+static void store_snapshot_cells(struct snapshot_cache_t *cache, int top, int count, const CHAR_INFO *cells);
+static BOOL read_snapshot_rows(struct snapshot_cache_t *cache, int top, int bottom);
+static BOOL read_marked_snapshot_rows(struct snapshot_cache_t *cache, const char *marks, int top, int bottom);
+static int find_snapshot_scroll(struct snapshot_cache_t *cache, int probe_rows);
+static void scroll_snapshot(struct snapshot_cache_t *cache, int scroll);
+static BOOL refresh_snapshot(struct snapshot_cache_t *cache, HANDLE hConsoleOutput);
+
 BOOL console_read_output(
   HANDLE      hConsoleOutput,
   PCHAR_INFO  lpBuffer,
@@ -34,14 +97,154 @@ BOOL console_read_output(
   COORD       dwBufferCoord,
   PSMALL_RECT lpReadRegion
 ) {
-  // TODO: issue multiple calls to ensure that at most MAX_BUFFER cells are transmitted
-  if(!ReadConsoleOutputW(hConsoleOutput, lpBuffer, dwBufferSize, dwBufferCoord, lpReadRegion)) {
-    debug_printf(L"console_read_output: ReadConsoleOutputW");
+  SMALL_RECT region;
+  int x;
+  int y;
+  
+  assert(lpBuffer != NULL);
+  assert(lpReadRegion != NULL);
+  
+  region = *lpReadRegion;
+  region.Right  = (SHORT)MIN(region.Right,  region.Left + dwBufferSize.X - dwBufferCoord.X - 1);
+  region.Bottom = (SHORT)MIN(region.Bottom, region.Top  + dwBufferSize.Y - dwBufferCoord.Y - 1);
+  
+  if( region.Right < region.Left ||
+      region.Bottom < region.Top ||
+      (region.Right - region.Left + 1) * (region.Bottom - region.Top + 1) <= READ_TILE_CELLS)
+  {
+    if(!console_backend->read_output(hConsoleOutput, lpBuffer, dwBufferSize, dwBufferCoord, lpReadRegion)) {
+      debug_printf(L"console_read_output: ReadConsoleOutputW");
+      return FALSE;
+    }
+    return TRUE;
+  }
+  
+  if(!clip_to_screen_buffer(hConsoleOutput, &region))
     return FALSE;
+  
+  *lpReadRegion = region;
+  if(region.Right < region.Left || region.Bottom < region.Top)
+    return TRUE;
+  
+  for(y = region.Top; y <= region.Bottom; ++y) {
+    SMALL_RECT tile;
+    
+    for(x = region.Left; x <= region.Right; x = tile.Right + 1) {
+      SMALL_RECT read_region;
+      COORD coord;
+      
+      tile = get_read_tile(&region, x, y);
+      
+      coord.X = (SHORT)(dwBufferCoord.X + tile.Left - region.Left);
+      coord.Y = (SHORT)(dwBufferCoord.Y + tile.Top  - region.Top);
+      
+      read_region = tile;
+      if(!console_backend->read_output(hConsoleOutput, lpBuffer, dwBufferSize, coord, &read_region)) {
+        debug_printf(L"console_read_output: ReadConsoleOutputW");
+        return FALSE;
+      }
+      
+      if(memcmp(&read_region, &tile, sizeof(tile)) != 0) {
+        debug_printf(L"console_read_output: screen buffer shrank");
+        return FALSE;
+      }
+    }
+    
+    y = tile.Bottom;
   }
+  
   return TRUE;
 }
 
+BOOL console_read_output_rect(
+  HANDLE      hConsoleOutput,
+  PSMALL_RECT lpReadRegion,
+  LPWSTR      lpCharacter,
+  LPWORD      lpAttribute
+) {
+  SMALL_RECT region;
+  CHAR_INFO *cells;
+  int width;
+  int x;
+  int y;
+  
+  assert(lpReadRegion != NULL);
+  
+  region = *lpReadRegion;
+  if(!clip_to_screen_buffer(hConsoleOutput, &region))
+    return FALSE;
+  
+  *lpReadRegion = region;
+  if(region.Right < region.Left || region.Bottom < region.Top)
+    return TRUE;
+  
+  width = region.Right - region.Left + 1;
+  cells = hyper_console_allocate_memory(sizeof(CHAR_INFO) * MIN(READ_TILE_CELLS, width * (region.Bottom - region.Top + 1)));
+  if(!cells)
+    return FALSE;
+  
+  for(y = region.Top; y <= region.Bottom; ++y) {
+    SMALL_RECT tile;
+    
+    for(x = region.Left; x <= region.Right; x = tile.Right + 1) {
+      SMALL_RECT read_region;
+      COORD tile_size;
+      COORD coord;
+      const CHAR_INFO *cell;
+      int i;
+      int j;
+      
+      tile = get_read_tile(&region, x, y);
+      
+      tile_size.X = tile.Right  - tile.Left + 1;
+      tile_size.Y = tile.Bottom - tile.Top  + 1;
+      coord.X = 0;
+      coord.Y = 0;
+      
+      read_region = tile;
+      if(!console_backend->read_output(hConsoleOutput, cells, tile_size, coord, &read_region)) {
+        debug_printf(L"console_read_output_rect: ReadConsoleOutputW");
+        hyper_console_free_memory(cells);
+        return FALSE;
+      }
+      
+      if(memcmp(&read_region, &tile, sizeof(tile)) != 0) {
+        debug_printf(L"console_read_output_rect: screen buffer shrank");
+        hyper_console_free_memory(cells);
+        return FALSE;
+      }
+      
+      cell = cells;
+      for(j = tile.Top - region.Top; j <= tile.Bottom - region.Top; ++j) {
+        int offset = j * width + tile.Left - region.Left;
+        
+        for(i = 0; i < tile_size.X; ++i, ++cell) {
+          if(lpCharacter)
+            lpCharacter[offset + i] = cell->Char.UnicodeChar;
+          if(lpAttribute)
+            lpAttribute[offset + i] = cell->Attributes;
+        }
+      }
+    }
+    
+    y = tile.Bottom;
+  }
+  
+  hyper_console_free_memory(cells);
+  return TRUE;
+}
+
+HYPER_CONSOLE_API
+BOOL hyper_console_read_screen_buffer(SMALL_RECT *region, wchar_t *text, WORD *attributes) {
+  HANDLE output_handle;
+  
+  if(!region)
+    return FALSE;
+  
+  output_handle = console_backend->get_std_handle(STD_OUTPUT_HANDLE);
+  return console_read_output_rect(output_handle, region, text, attributes);
+}
+
 BOOL console_read_output_character(
     HANDLE hConsoleOutput,
     LPWSTR lpCharacter,
@@ -59,7 +262,7 @@ BOOL console_read_output_character(
   
   *lpNumberOfCharsRead = 0;
   
-  if(!GetConsoleScreenBufferInfo(hConsoleOutput, &csbi) || csbi.dwSize.X <= 0) {
+  if(!console_backend->get_screen_buffer_info(hConsoleOutput, &csbi) || csbi.dwSize.X <= 0) {
     debug_printf(L"console_read_output_character: GetConsoleScreenBufferInfo");
     return FALSE;
   }
@@ -67,7 +270,7 @@ BOOL console_read_output_character(
   while(nLength > MAX_BUFFER) {
     int x;
     
-    if(!ReadConsoleOutputCharacterW(hConsoleOutput, lpCharacter, MAX_BUFFER, dwReadCoord, &chars_read)) {
+    if(!console_backend->read_output_character(hConsoleOutput, lpCharacter, MAX_BUFFER, dwReadCoord, &chars_read)) {
       debug_printf(L"console_read_output_character: ReadConsoleOutputCharacterW");
       return FALSE;
     }
@@ -85,7 +288,7 @@ BOOL console_read_output_character(
   }
   
   if(nLength > 0) {
-    if(!ReadConsoleOutputCharacterW(hConsoleOutput, lpCharacter, nLength, dwReadCoord, &chars_read)) {
+    if(!console_backend->read_output_character(hConsoleOutput, lpCharacter, nLength, dwReadCoord, &chars_read)) {
       debug_printf(L"console_read_output_character: ReadConsoleOutputCharacterW 2");
       return FALSE;
     }
@@ -96,8 +299,8 @@ BOOL console_read_output_character(
   return TRUE;
 }
 
-/* Signature of [Read|Write]ConsoleOutputAttribute, ignoring const. */
-typedef BOOL (__stdcall *attribute_rw_func_t)( HANDLE, WORD*, DWORD, COORD, LPDWORD);
+/* Signature of the backend's [read|write]_output_attribute, ignoring const. */
+typedef BOOL (*attribute_rw_func_t)( HANDLE, WORD*, DWORD, COORD, LPDWORD);
 
 static BOOL touch_output_attribute(
     HANDLE hConsoleOutput,
@@ -118,7 +321,7 @@ static BOOL touch_output_attribute(
   
   *lpNumberOfAttrsTouched = 0;
   
-  if(!GetConsoleScreenBufferInfo(hConsoleOutput, &csbi) || csbi.dwSize.X <= 0) {
+  if(!console_backend->get_screen_buffer_info(hConsoleOutput, &csbi) || csbi.dwSize.X <= 0) {
     debug_printf(L"console_read_output_attribute: GetConsoleScreenBufferInfo");
     return FALSE;
   }
@@ -164,7 +367,7 @@ BOOL console_read_output_attribute(
 ) {
   return touch_output_attribute(
       hConsoleOutput, lpAttribute, nLength, dwReadCoord, lpNumberOfAttrsRead,
-      ReadConsoleOutputAttribute);
+      console_backend->read_output_attribute);
 }
 
 BOOL console_write_output_attribute(
@@ -174,9 +377,541 @@ BOOL console_write_output_attribute(
     COORD dwWriteCoord,
     LPDWORD lpNumberOfAttrsWritten
 ) {
+  snapshot_touch_cells(hConsoleOutput, dwWriteCoord, nLength);
+  
   return touch_output_attribute(
       hConsoleOutput, (LPWORD)lpAttribute, nLength, dwWriteCoord, lpNumberOfAttrsWritten,
-      (attribute_rw_func_t)WriteConsoleOutputAttribute);
+      (attribute_rw_func_t)console_backend->write_output_attribute);
+}
+
+BOOL console_fill_output_attribute(
+    HANDLE hConsoleOutput,
+    WORD wAttribute,
+    DWORD nLength,
+    COORD dwWriteCoord,
+    LPDWORD lpNumberOfAttrsWritten
+) {
+  assert(lpNumberOfAttrsWritten != NULL);
+  
+  snapshot_touch_cells(hConsoleOutput, dwWriteCoord, nLength);
+  
+  *lpNumberOfAttrsWritten = 0;
+  if(!console_backend->fill_output_attribute(hConsoleOutput, wAttribute, nLength, dwWriteCoord, lpNumberOfAttrsWritten)) {
+    debug_printf(L"console_fill_output_attribute: FillConsoleOutputAttribute");
+    return FALSE;
+  }
+  
+  return TRUE;
+}
+
+BOOL console_write_output(
+  HANDLE           hConsoleOutput,
+  const CHAR_INFO *lpBuffer,
+  COORD            dwBufferSize,
+  COORD            dwBufferCoord,
+  PSMALL_RECT      lpWriteRegion
+) {
+  assert(lpWriteRegion != NULL);
+  
+  snapshot_touch_rows(hConsoleOutput, lpWriteRegion->Top, lpWriteRegion->Bottom + 1, TRUE);
+  
+  if(!console_backend->write_output(hConsoleOutput, lpBuffer, dwBufferSize, dwBufferCoord, lpWriteRegion)) {
+    debug_printf(L"console_write_output: WriteConsoleOutputW");
+    return FALSE;
+  }
+  
+  return TRUE;
+}
+
+BOOL console_scroll_buffer(
+  HANDLE            hConsoleOutput,
+  const SMALL_RECT *lpScrollRectangle,
+  const SMALL_RECT *lpClipRectangle,
+  COORD             dwDestinationOrigin,
+  const CHAR_INFO  *lpFill
+) {
+  assert(lpScrollRectangle != NULL);
+  
+  snapshot_discard_content(hConsoleOutput);
+  
+  if(!console_backend->scroll_buffer(hConsoleOutput, lpScrollRectangle, lpClipRectangle, dwDestinationOrigin, lpFill)) {
+    debug_printf(L"console_scroll_buffer: ScrollConsoleScreenBufferW");
+    return FALSE;
+  }
+  
+  return TRUE;
+}
+
+/* A cheap fingerprint of the text of a row to detect scrolling (FNV-1a).
+ */
+static ULONGLONG hash_cells(const CHAR_INFO *cells, int length) {
+  ULONGLONG hash = 0xCBF29CE484222325ULL;
+  
+  assert(cells != NULL || length == 0);
+  
+  while(length-- > 0) {
+    hash^= (cells++)->Char.UnicodeChar;
+    hash*= 0x100000001B3ULL;
+  }
+  
+  return hash != SNAPSHOT_UNKNOWN_HASH ? hash : 1;
+}
+
+static BOOL is_snapshot_of(struct snapshot_cache_t *cache, HANDLE hConsoleOutput) {
+  assert(cache != NULL);
+  
+  return cache->valid && cache->backend == console_backend && cache->output_handle == hConsoleOutput;
+}
+
+static void free_snapshot_cache(struct snapshot_cache_t *cache) {
+  assert(cache != NULL);
+  
+  hyper_console_free_memory(cache->snapshot.text);
+  hyper_console_free_memory(cache->snapshot.attributes);
+  hyper_console_free_memory(cache->snapshot.stale_rows);
+  hyper_console_free_memory(cache->row_hashes);
+  hyper_console_free_memory(cache->probe_hashes);
+  hyper_console_free_memory(cache->cells);
+  hyper_console_free_memory(cache->dirty_rows);
+  memset(cache, 0, sizeof(*cache));
+}
+
+static void snapshot_touch_rows(HANDLE hConsoleOutput, int top, int bottom, BOOL text_changed) {
+  struct snapshot_cache_t *cache = &_snapshot_cache;
+  
+  AcquireSRWLockExclusive(&_srw_snapshot);
+  
+  if(is_snapshot_of(cache, hConsoleOutput)) {
+    int y;
+    
+    top    = MAX(top,    0);
+    bottom = MIN(bottom, cache->snapshot.size.Y);
+    for(y = top; y < bottom; ++y) {
+      cache->dirty_rows[y] = 1;
+      
+      // Attributes do not matter for detecting scrolling.
+      if(text_changed)
+        cache->row_hashes[y] = SNAPSHOT_UNKNOWN_HASH;
+    }
+  }
+  
+  ReleaseSRWLockExclusive(&_srw_snapshot);
+}
+
+static void snapshot_touch_cells(HANDLE hConsoleOutput, COORD coord, DWORD length) {
+  int width;
+  
+  if(length == 0)
+    return;
+  
+  // Only a resize changes the width, and that invalidates the snapshot anyway.
+  width = MAX(1, _snapshot_cache.snapshot.size.X);
+  snapshot_touch_rows(hConsoleOutput, coord.Y, coord.Y + (int)((coord.X + length - 1) / width) + 1, FALSE);
+}
+
+/* Moving rows around could look like other programs' scrolling to refresh_snapshot(), so the 
+   next refresh reads everything.
+ */
+static void snapshot_discard_content(HANDLE hConsoleOutput) {
+  AcquireSRWLockExclusive(&_srw_snapshot);
+  
+  if(is_snapshot_of(&_snapshot_cache, hConsoleOutput))
+    _snapshot_cache.valid = FALSE;
+  
+  ReleaseSRWLockExclusive(&_srw_snapshot);
+}
+
+/* Read whole rows into cache->cells.
+   
+   @param buffer_row The row in cache->cells where to put the first row. Earlier rows are kept.
+   @return The first cell read or NULL on error.
+ */
+static const CHAR_INFO *read_snapshot_cells(struct snapshot_cache_t *cache, int top, int count, int buffer_row) {
+  COORD size = cache->snapshot.size;
+  SMALL_RECT region;
+  COORD buffer_size;
+  COORD buffer_coord;
+  
+  assert(cache != NULL);
+  assert(top >= 0);
+  assert(count > 0);
+  assert(top + count <= size.Y);
+  assert(buffer_row >= 0);
+  
+  if(!resize_array((void**)&cache->cells, &cache->cells_capacity, sizeof(CHAR_INFO), size.X * (buffer_row + count)))
+    return NULL;
+  
+  region.Left   = 0;
+  region.Right  = size.X - 1;
+  region.Top    = (SHORT)top;
+  region.Bottom = (SHORT)(top + count - 1);
+    
+  buffer_size.X = size.X;
+  buffer_size.Y = (SHORT)count;
+  buffer_coord.X = 0;
+  buffer_coord.Y = 0;
+    
+  if(!console_read_output(cache->output_handle, cache->cells + buffer_row * size.X, buffer_size, buffer_coord, &region))
+    return NULL;
+    
+  if(region.Left != 0 || region.Right != size.X - 1 || region.Top != top || region.Bottom + 1 - region.Top != count)
+    return NULL;
+  
+  return cache->cells + buffer_row * size.X;
+}
+
+static void store_snapshot_cells(struct snapshot_cache_t *cache, int top, int count, const CHAR_INFO *cells) {
+  int width = cache->snapshot.size.X;
+  int y;
+  
+  assert(cache != NULL);
+  assert(cells != NULL);
+  
+  for(y = top; y < top + count; ++y) {
+    wchar_t *text = cache->snapshot.text + y * width;
+    WORD *attributes = cache->snapshot.attributes + y * width;
+    const CHAR_INFO *row = cells;
+    BOOL changed = FALSE;
+    BOOL blank = TRUE;
+    int x;
+    
+    for(x = 0; x < width; ++x, ++cells) {
+      if(!cache->valid || text[x] != cells->Char.UnicodeChar || attributes[x] != cells->Attributes) {
+        text[x]       = cells->Char.UnicodeChar;
+        attributes[x] = cells->Attributes;
+        changed = TRUE;
+      }
+      
+      if(text[x] != L' ')
+        blank = FALSE;
+    }
+    
+    cache->row_hashes[y] = hash_cells(row, width);
+    cache->snapshot.stale_rows[y] = 0;
+    if(changed)
+      cache->snapshot.version++;
+    
+    if(!blank)
+      cache->used_rows = MAX(cache->used_rows, y + 1);
+  }
+}
+
+static BOOL read_snapshot_rows(struct snapshot_cache_t *cache, int top, int bottom) {
+  const CHAR_INFO *cells;
+  
+  assert(cache != NULL);
+  
+  top    = MAX(top,    0);
+  bottom = MIN(bottom, cache->snapshot.size.Y);
+  if(top >= bottom)
+    return TRUE;
+    
+  cells = read_snapshot_cells(cache, top, bottom - top, 0);
+  if(!cells)
+    return FALSE;
+    
+  store_snapshot_cells(cache, top, bottom - top, cells);
+  return TRUE;
+}
+
+/* Re-read the runs of marked rows in [top, bottom), e.g. the dirty or stale ones.
+ */
+static BOOL read_marked_snapshot_rows(struct snapshot_cache_t *cache, const char *marks, int top, int bottom) {
+  int y;
+  
+  assert(cache != NULL);
+  assert(marks != NULL);
+  
+  y = MAX(top, 0);
+  bottom = MIN(bottom, cache->snapshot.size.Y);
+  while(y < bottom) {
+    int run_end;
+    
+    if(!marks[y]) {
+      ++y;
+      continue;
+    }
+    
+    run_end = y + 1;
+    while(run_end < bottom && marks[run_end])
+      ++run_end;
+    
+    if(!read_snapshot_rows(cache, y, run_end))
+      return FALSE;
+      
+    y = run_end;
+  }
+  
+  return TRUE;
+}
+
+/* Find how far the buffer scrolled since the last refresh, given the hashes of its first rows.
+   
+   @return The number of rows, -1 if the first rows are not found in the snapshot or 
+   SNAPSHOT_SCROLL_AMBIGUOUS if they are found more than once.
+ */
+static int find_snapshot_scroll(struct snapshot_cache_t *cache, int probe_rows) {
+  int found = -1;
+  int scroll;
+  int y;
+  
+  assert(cache != NULL);
+  assert(0 < probe_rows && probe_rows <= cache->snapshot.size.Y);
+  
+  for(scroll = 0; scroll + probe_rows <= cache->snapshot.size.Y; ++scroll) {
+    for(y = 0; y < probe_rows; ++y) {
+      if(cache->row_hashes[scroll + y] != cache->probe_hashes[y])
+        break;
+    }
+    
+    if(y < probe_rows)
+      continue;
+      
+    if(found >= 0)
+      return SNAPSHOT_SCROLL_AMBIGUOUS;
+      
+    found = scroll;
+  }
+  
+  return found;
+}
+
+static void scroll_snapshot(struct snapshot_cache_t *cache, int scroll) {
+  int width = cache->snapshot.size.X;
+  int next_dirty;
+  int keep;
+  int y;
+  
+  assert(cache != NULL);
+  assert(0 < scroll && scroll < cache->snapshot.size.Y);
+  
+  keep = cache->snapshot.size.Y - scroll;
+  memmove(cache->snapshot.text,       cache->snapshot.text       + scroll * width, keep * width * sizeof(wchar_t));
+  memmove(cache->snapshot.attributes, cache->snapshot.attributes + scroll * width, keep * width * sizeof(WORD));
+  memmove(cache->row_hashes,          cache->row_hashes          + scroll,         keep * sizeof(ULONGLONG));
+  
+  // A row that was written somewhere during the scrolling has now moved up by 0 to scroll rows.
+  next_dirty = -1;
+  for(y = cache->snapshot.size.Y - 1; y >= 0; --y) {
+    if(cache->dirty_rows[y])
+      next_dirty = y;
+    
+    cache->dirty_rows[y] = next_dirty >= 0 && next_dirty - y <= scroll;
+  }
+  
+  // The new rows at the bottom
+  memset(cache->dirty_rows + keep, 1, scroll);
+  
+  cache->cursor_y  = MAX(0, cache->cursor_y - scroll);
+  cache->used_rows = MAX(0, cache->used_rows - scroll);
+  cache->snapshot.version++;
+}
+
+/* Bring the snapshot up to date. Other programs' output is assumed to appear at the cursor, 
+   possibly scrolling the whole buffer. Only the touched rows, those from the cursor downwards, 
+   the window and a few probe rows at the top are read, unless the snapshot is new, the buffer 
+   was resized or the scroll distance is unclear. All other rows are marked as stale.
+ */
+static BOOL refresh_snapshot(struct snapshot_cache_t *cache, HANDLE hConsoleOutput) {
+  CONSOLE_SCREEN_BUFFER_INFO csbi;
+  COORD size;
+  int fresh_rows = 0; // rows at the top that are up to date already
+  int tail_top;
+  int tail_bottom;
+  
+  assert(cache != NULL);
+  
+  if(!console_backend->get_screen_buffer_info(hConsoleOutput, &csbi) || csbi.dwSize.X <= 0 || csbi.dwSize.Y <= 0) {
+    debug_printf(L"refresh_snapshot: GetConsoleScreenBufferInfo");
+    cache->valid = FALSE;
+    return FALSE;
+  }
+  
+  size = csbi.dwSize;
+  if( !is_snapshot_of(cache, hConsoleOutput) || 
+      cache->snapshot.size.X != size.X ||
+      cache->snapshot.size.Y != size.Y)
+  {
+    int length = size.X * size.Y;
+    unsigned version = cache->snapshot.version;
+    
+    free_snapshot_cache(cache);
+    cache->snapshot.version = version + 1;
+    cache->snapshot.size    = size;
+    cache->backend          = console_backend;
+    cache->output_handle    = hConsoleOutput;
+    
+    cache->snapshot.text       = hyper_console_allocate_memory(length * sizeof(wchar_t));
+    cache->snapshot.attributes = hyper_console_allocate_memory(length * sizeof(WORD));
+    cache->row_hashes          = hyper_console_allocate_memory(size.Y * sizeof(ULONGLONG));
+    cache->probe_hashes        = hyper_console_allocate_memory(size.Y * sizeof(ULONGLONG));
+    cache->snapshot.stale_rows = hyper_console_allocate_memory(size.Y);
+    cache->dirty_rows          = hyper_console_allocate_memory(size.Y);
+    if( !cache->snapshot.text || 
+        !cache->snapshot.attributes || 
+        !cache->snapshot.stale_rows || 
+        !cache->row_hashes || 
+        !cache->probe_hashes || 
+        !cache->dirty_rows) 
+    {
+      free_snapshot_cache(cache);
+      return FALSE;
+    }
+    
+    tail_top = 0;
+  }
+  else {
+    const CHAR_INFO *probe;
+    int probe_rows;
+    int scroll;
+    
+    // Rows are fresh again once store_snapshot_cells() has seen them.
+    memset(cache->snapshot.stale_rows, 1, size.Y);
+    
+    /* Repeated lines at the top (e.g. empty ones) may fit at several distances. Then more rows 
+       are needed. */
+    probe_rows = MIN(SNAPSHOT_PROBE_ROWS, size.Y);
+    for(;;) {
+      int y;
+      
+      probe = read_snapshot_cells(cache, 0, probe_rows, 0);
+      if(!probe) {
+        cache->valid = FALSE;
+        return FALSE;
+      }
+      
+      for(y = 0; y < probe_rows; ++y)
+        cache->probe_hashes[y] = hash_cells(probe + y * size.X, size.X);
+      
+      scroll = find_snapshot_scroll(cache, probe_rows);
+      if(scroll != SNAPSHOT_SCROLL_AMBIGUOUS || probe_rows == size.Y)
+        break;
+        
+      probe_rows = MIN(2 * probe_rows, size.Y);
+    }
+    
+    /* Output only scrolls the buffer when it reaches the bottom. Otherwise, the match is a 
+       coincidence, e.g. with a repeated command line. */
+    if(scroll > 0 && csbi.dwCursorPosition.Y < size.Y - 1 - SNAPSHOT_CURSOR_MARGIN)
+      scroll = -1;
+    
+    // The first rows may be repeated further down, so check some rows between them and the tail.
+    if(scroll >= 0 && probe_rows < size.Y) {
+      int i;
+      
+      for(i = 1; i <= SNAPSHOT_VERIFY_ROWS && scroll >= 0; ++i) {
+        int y = probe_rows + i * (size.Y - scroll - probe_rows) / (SNAPSHOT_VERIFY_ROWS + 1);
+        const CHAR_INFO *cells;
+        
+        if(y >= size.Y - scroll)
+          break;
+          
+        cells = read_snapshot_cells(cache, y, 1, probe_rows);
+        if(!cells) {
+          cache->valid = FALSE;
+          return FALSE;
+        }
+        
+        if(hash_cells(cells, size.X) != cache->row_hashes[y + scroll])
+          scroll = -1;
+      }
+      
+      probe = cache->cells;
+    }
+    
+    if(scroll < 0 && probe_rows == size.Y) {
+      // Everything was read already.
+      store_snapshot_cells(cache, 0, probe_rows, probe);
+      fresh_rows = tail_top = size.Y;
+    }
+    else if(scroll < 0) {
+      tail_top = 0;
+    }
+    else {
+      if(scroll > 0)
+        scroll_snapshot(cache, scroll);
+        
+      store_snapshot_cells(cache, 0, probe_rows, probe);
+      fresh_rows = probe_rows;
+      
+      tail_top = MIN(cache->cursor_y, csbi.dwCursorPosition.Y) - SNAPSHOT_CURSOR_MARGIN;
+      tail_top = MAX(tail_top, probe_rows);
+    }
+  }
+  
+  tail_bottom = size.Y;
+  if(tail_top > 0) {
+    tail_bottom = MAX(cache->used_rows, csbi.dwCursorPosition.Y + 1);
+    tail_bottom = MAX(tail_bottom,      csbi.srWindow.Bottom + 1);
+    tail_bottom = MIN(tail_bottom,      size.Y);
+    
+    if( !read_marked_snapshot_rows(cache, cache->dirty_rows, fresh_rows,  tail_top) ||
+        !read_marked_snapshot_rows(cache, cache->dirty_rows, tail_bottom, size.Y))
+    {
+      cache->valid = FALSE;
+      return FALSE;
+    }
+  }
+  
+  /* The window may have been scrolled up to show older rows, which other programs can also 
+     change (e.g. full-screen programs). */
+  if( !read_snapshot_rows(cache, tail_top, tail_bottom) ||
+      !read_marked_snapshot_rows(cache, cache->snapshot.stale_rows, csbi.srWindow.Top, csbi.srWindow.Bottom + 1))
+  {
+    cache->valid = FALSE;
+    return FALSE;
+  }
+  
+  cache->valid = TRUE;
+  memset(cache->dirty_rows, 0, size.Y);
+  cache->cursor_y = csbi.dwCursorPosition.Y;
+  return TRUE;
+}
+
+const struct console_snapshot_t *console_borrow_snapshot(HANDLE hConsoleOutput) {
+  AcquireSRWLockExclusive(&_srw_snapshot);
+  
+  if(!refresh_snapshot(&_snapshot_cache, hConsoleOutput)) {
+    ReleaseSRWLockExclusive(&_srw_snapshot);
+    return NULL;
+  }
+  
+  return &_snapshot_cache.snapshot;
+}
+
+void console_return_snapshot(const struct console_snapshot_t *snapshot) {
+  assert(snapshot == &_snapshot_cache.snapshot);
+  
+  ReleaseSRWLockExclusive(&_srw_snapshot);
+}
+
+void console_discard_snapshot(void) {
+  AcquireSRWLockExclusive(&_srw_snapshot);
+  
+  free_snapshot_cache(&_snapshot_cache);
+  
+  ReleaseSRWLockExclusive(&_srw_snapshot);
+}
+
+DWORD console_read_snapshot_characters(const struct console_snapshot_t *snapshot, wchar_t *buffer, DWORD length, COORD coord) {
+  int index;
+  int end;
+  DWORD count = 0;
+  
+  assert(snapshot != NULL);
+  assert(buffer != NULL || length == 0);
+  
+  if(coord.X < 0 || coord.Y < 0 || coord.X >= snapshot->size.X || coord.Y >= snapshot->size.Y)
+    return 0;
+    
+  index = coord.Y * snapshot->size.X + coord.X;
+  end   = MIN(snapshot->size.X * snapshot->size.Y, index + (int)length);
+  for(; index < end; ++index) {
+    if(!(snapshot->attributes[index] & COMMON_LVB_TRAILING_BYTE))
+      buffer[count++] = snapshot->text[index];
+  }
+  
+  return count;
 }
 
 static void invert_color_attributes(
@@ -206,14 +941,15 @@ static COORD console_output_invert_colors_helper(
   if(length <= 0)
     return start;
     
-  if(!ReadConsoleOutputAttribute(hConsoleOutput, attribute_buffer, length, start, &attrs_read)) {
+  if(!console_backend->read_output_attribute(hConsoleOutput, attribute_buffer, length, start, &attrs_read)) {
     debug_printf(L"invert_output_color_attributes: ReadConsoleOutputAttribute");
     return start;
   }
   
   invert_color_attributes(attribute_buffer, length);
   
-  if(!WriteConsoleOutputAttribute(hConsoleOutput, attribute_buffer, length, start, &attrs_written)) {
+  snapshot_touch_cells(hConsoleOutput, start, length);
+  if(!console_backend->write_output_attribute(hConsoleOutput, attribute_buffer, length, start, &attrs_written)) {
     debug_printf(L"invert_output_color_attributes: WriteConsoleOutputAttribute");
     return start;
   }
@@ -299,7 +1035,7 @@ void console_reinvert_colors(
   COORD coords[4];
   CONSOLE_SCREEN_BUFFER_INFO csbi;
   
-  if(!GetConsoleScreenBufferInfo(hConsoleOutput, &csbi) || csbi.dwSize.X <= 0) {
+  if(!console_backend->get_screen_buffer_info(hConsoleOutput, &csbi) || csbi.dwSize.X <= 0) {
     debug_printf(L"console_invert_output_color: GetConsoleScreenBufferInfo");
     return;
   }
@@ -320,7 +1056,7 @@ static void invert_rect(HANDLE hConsoleOutput, const SMALL_RECT *rect) {
   COORD end;
   CONSOLE_SCREEN_BUFFER_INFO csbi;
   
-  if(!GetConsoleScreenBufferInfo(hConsoleOutput, &csbi) || csbi.dwSize.X <= 0) {
+  if(!console_backend->get_screen_buffer_info(hConsoleOutput, &csbi) || csbi.dwSize.X <= 0) {
     debug_printf(L"invert_rect: GetConsoleScreenBufferInfo");
     return;
   }
@@ -419,7 +1155,7 @@ void console_clean_lines(HANDLE hConsoleOutput, int num_lines) {
   COORD pos;
   wchar_t *line_chars;
   
-  if(!GetConsoleScreenBufferInfo(hConsoleOutput, &csbi) || csbi.dwSize.X <= 0) {
+  if(!console_backend->get_screen_buffer_info(hConsoleOutput, &csbi) || csbi.dwSize.X <= 0) {
     debug_printf(L"console_clean_lines: GetConsoleScreenBufferInfo");
     return;
   }
@@ -436,7 +1172,7 @@ void console_clean_lines(HANDLE hConsoleOutput, int num_lines) {
     SHORT x;
     
     pos.X = 0;
-    if(!ReadConsoleOutputCharacterW(hConsoleOutput, line_chars, csbi.dwSize.X, pos, &num_read)) {
+    if(!console_backend->read_output_character(hConsoleOutput, line_chars, csbi.dwSize.X, pos, &num_read)) {
       debug_printf(L"console_clean_lines: ReadConsoleOutputCharacterW");
       break;
     }
@@ -448,10 +1184,8 @@ void console_clean_lines(HANDLE hConsoleOutput, int num_lines) {
     if(x < csbi.dwSize.X) {
       DWORD num_write;
       pos.X = x;
-      if(!FillConsoleOutputAttribute(hConsoleOutput, csbi.wAttributes, csbi.dwSize.X - pos.X, pos, &num_write)) {
-        debug_printf(L"console_clean_lines: FillConsoleOutputAttribute");
+      if(!console_fill_output_attribute(hConsoleOutput, csbi.wAttributes, csbi.dwSize.X - pos.X, pos, &num_write))
         break;
-      }
     }
   }
   
@@ -472,7 +1206,7 @@ BOOL console_scroll_wheel(HANDLE hConsoleOutput, const MOUSE_EVENT_RECORD *er) {
     scroll_lines = (scroll_lines * scroll_delta) / WHEEL_DELTA;
     
     memset(&csbi, 0, sizeof(csbi));
-    if(GetConsoleScreenBufferInfo(hConsoleOutput, &csbi)) {
+    if(console_backend->get_screen_buffer_info(hConsoleOutput, &csbi)) {
       csbi.srWindow.Top -= (SHORT)scroll_lines;
       csbi.srWindow.Bottom -= (SHORT)scroll_lines;
       
@@ -485,7 +1219,7 @@ BOOL console_scroll_wheel(HANDLE hConsoleOutput, const MOUSE_EVENT_RECORD *er) {
         csbi.srWindow.Bottom = csbi.dwSize.Y - 1;
       }
       
-      SetConsoleWindowInfo(hConsoleOutput, TRUE, &csbi.srWindow);
+      console_backend->set_window_info(hConsoleOutput, TRUE, &csbi.srWindow);
     }
     
     return TRUE;
@@ -504,7 +1238,7 @@ BOOL console_scroll_key(HANDLE hConsoleOutput, const KEY_EVENT_RECORD *er) {
     return FALSE;
   
   memset(&csbi, 0, sizeof(csbi));
-  if(!GetConsoleScreenBufferInfo(hConsoleOutput, &csbi)) 
+  if(!console_backend->get_screen_buffer_info(hConsoleOutput, &csbi)) 
     return FALSE;
   
   switch(er->wVirtualKeyCode) {
@@ -546,7 +1280,7 @@ BOOL console_scroll_key(HANDLE hConsoleOutput, const KEY_EVENT_RECORD *er) {
       csbi.srWindow.Bottom = csbi.dwSize.Y - 1;
     }
     
-    SetConsoleWindowInfo(hConsoleOutput, TRUE, &csbi.srWindow);
+    console_backend->set_window_info(hConsoleOutput, TRUE, &csbi.srWindow);
     return TRUE;
   }
   
@@ -554,6 +1288,53 @@ BOOL console_scroll_key(HANDLE hConsoleOutput, const KEY_EVENT_RECORD *er) {
 }
 
 
+/* Clip a rectangle to the screen buffer. The result is empty (Right < Left or Bottom < Top) if they 
+   do not overlap.
+ */
+static BOOL clip_to_screen_buffer(HANDLE hConsoleOutput, SMALL_RECT *region) {
+  CONSOLE_SCREEN_BUFFER_INFO csbi;
+  
+  assert(region != NULL);
+  
+  if(!console_backend->get_screen_buffer_info(hConsoleOutput, &csbi)) {
+    debug_printf(L"clip_to_screen_buffer: GetConsoleScreenBufferInfo");
+    return FALSE;
+  }
+  
+  region->Left   = MAX(region->Left,   0);
+  region->Top    = MAX(region->Top,    0);
+  region->Right  = MIN(region->Right,  csbi.dwSize.X - 1);
+  region->Bottom = MIN(region->Bottom, csbi.dwSize.Y - 1);
+  return TRUE;
+}
+
+/* Get the tile of at most READ_TILE_CELLS cells that starts at (x, y) within a region. Tiles consist 
+   of whole region rows if a row fits, and are parts of a single row otherwise.
+ */
+static SMALL_RECT get_read_tile(const SMALL_RECT *region, int x, int y) {
+  int width = region->Right - region->Left + 1;
+  SMALL_RECT tile;
+  
+  assert(region != NULL);
+  assert(region->Left <= x && x <= region->Right);
+  assert(region->Top  <= y && y <= region->Bottom);
+  
+  tile.Left = (SHORT)x;
+  tile.Top  = (SHORT)y;
+  if(width <= READ_TILE_CELLS) {
+    assert(x == region->Left);
+    
+    tile.Right  = region->Right;
+    tile.Bottom = (SHORT)MIN(region->Bottom, y + READ_TILE_CELLS / width - 1);
+  }
+  else {
+    tile.Right  = (SHORT)MIN(region->Right, x + READ_TILE_CELLS - 1);
+    tile.Bottom = (SHORT)y;
+  }
+  
+  return tile;
+}
+
 static BOOL flush_input(struct send_input_t *context) {
   DWORD written;
   
@@ -561,7 +1342,7 @@ static BOOL flush_input(struct send_input_t *context) {
   
   assert(context->counter <= sizeof(context->input_records) / sizeof(INPUT_RECORD));
   
-  if(!WriteConsoleInputW(context->input_handle, context->input_records, context->counter, &written)) {
+  if(!console_backend->write_input(context->input_handle, context->input_records, context->counter, &written)) {
     debug_printf(L"flush_input: WriteConsoleInputW failed\n");
     context->counter = 0;
     return FALSE;
@@ -613,58 +1394,88 @@ static BOOL send_input(struct send_input_t *context, wchar_t ch, DWORD control_k
   return TRUE;
 }
 
-void console_paste_from_clipboard(HANDLE hConsoleInput) {
+wchar_t *console_get_clipboard_text(int *length) {
   HGLOBAL copy_handle;
-  wchar_t *copy_data;
+  const wchar_t *copy_data;
+  wchar_t *text = NULL;
+  int text_length = 0;
+  
+  assert(length != NULL);
   
+  *length = 0;
   if(!IsClipboardFormatAvailable(CF_UNICODETEXT))
-    return;
+    return NULL;
     
   if(!OpenClipboard(NULL))
-    return;
+    return NULL;
     
   copy_handle = GetClipboardData(CF_UNICODETEXT);
   if(copy_handle) {
     copy_data = GlobalLock(copy_handle);
     if(copy_data) {
-      struct send_input_t context[1];
-      
-      context->input_handle = hConsoleInput;
-      context->counter = 0;
+      size_t max_length = wcslen(copy_data);
       
-      for(; *copy_data; ++copy_data) {
-        wchar_t ch = *copy_data;
-        
-        if(ch == L'\r' && copy_data[1] == L'\n') {
-          send_input(context, L'\r', 0);
-          ++copy_data;
-          continue;
-        }
-        
-        if(ch == L'\n') {
-          send_input(context, L'\r', 0);
-          continue;
-        }
+      if(max_length < INT_MAX)
+        text = hyper_console_allocate_memory((max_length + 1) * sizeof(wchar_t));
         
-        if(ch == L'\t') {
-          send_input(context, L'\t', LITERAL_KEY_STATE);
-//          send_input(context, L' ', 0);
-//          send_input(context, L' ', 0);
-//          send_input(context, L' ', 0);
-//          send_input(context, L' ', 0);
-          continue;
+      if(text) {
+        for(; *copy_data; ++copy_data) {
+          wchar_t ch = *copy_data;
+          
+          if(ch == L'\r' && copy_data[1] == L'\n')
+            ++copy_data;
+          else if(ch == L'\n')
+            ch = L'\r';
+            
+          text[text_length++] = ch;
         }
         
-        send_input(context, ch, 0);
+        text[text_length] = L'\0';
+        *length = text_length;
       }
-      
-      flush_input(context);
     }
     
     GlobalUnlock(copy_handle);
   }
   
   CloseClipboard();
+  return text;
+}
+
+void console_send_text(HANDLE hConsoleInput, const wchar_t *text, int length) {
+  struct send_input_t context[1];
+  int i;
+  
+  assert(text != NULL || length == 0);
+  
+  context->input_handle = hConsoleInput;
+  context->counter = 0;
+  
+  for(i = 0; i < length; ++i) {
+    if(text[i] == L'\t') {
+      send_input(context, L'\t', LITERAL_KEY_STATE);
+//      send_input(context, L' ', 0);
+//      send_input(context, L' ', 0);
+//      send_input(context, L' ', 0);
+//      send_input(context, L' ', 0);
+      continue;
+    }
+    
+    send_input(context, text[i], 0);
+  }
+  
+  flush_input(context);
+}
+
+void console_paste_from_clipboard(HANDLE hConsoleInput) {
+  wchar_t *text;
+  int length;
+  
+  text = console_get_clipboard_text(&length);
+  if(text) {
+    console_send_text(hConsoleInput, text, length);
+    hyper_console_free_memory(text);
+  }
 }
 
 BOOL console_get_screen_word_start_end(HANDLE hConsoleOutput, COORD pos, COORD *start, COORD *end) {
@@ -683,7 +1494,7 @@ BOOL console_get_screen_word_start_end(HANDLE hConsoleOutput, COORD pos, COORD *
   
   *start = *end = pos;
   
-  if(!GetConsoleScreenBufferInfo(hConsoleOutput, &csbi))
+  if(!console_backend->get_screen_buffer_info(hConsoleOutput, &csbi))
     return FALSE;
     
   length = csbi.dwSize.X;
@@ -738,7 +1549,7 @@ void console_alert(HANDLE hConsoleOutput) {
 //  Beep(800, 200);
   MessageBeep(0xFFFFFFFFU);
   
-  if(GetConsoleScreenBufferInfo(hConsoleOutput, &csbi)) {
+  if(console_backend->get_screen_buffer_info(hConsoleOutput, &csbi)) {
     COORD pos;
     DWORD num_read;
     WORD *attr = hyper_console_allocate_memory(csbi.dwSize.X * csbi.dwSize.Y * sizeof(WORD));
@@ -746,7 +1557,7 @@ void console_alert(HANDLE hConsoleOutput) {
     pos.X = pos.Y = 0;
     
     if(attr && console_read_output_attribute(hConsoleOutput, attr, csbi.dwSize.X * csbi.dwSize.Y, pos, &num_read)) {
-      FillConsoleOutputAttribute(
+      console_fill_output_attribute(
           hConsoleOutput,
           BACKGROUND_RED | BACKGROUND_INTENSITY | FOREGROUND_RED | FOREGROUND_BLUE | FOREGROUND_GREEN | FOREGROUND_INTENSITY,
           num_read,
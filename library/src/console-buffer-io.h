@@ -5,6 +5,8 @@
 
 #define LITERAL_KEY_STATE  0x10000
 
+/** Read cells like ReadConsoleOutputW(), but in tiles that the console host accepts.
+ */
 BOOL console_read_output(
   HANDLE      hConsoleOutput,
   PCHAR_INFO  lpBuffer,
@@ -12,6 +14,21 @@ BOOL console_read_output(
   COORD       dwBufferCoord,
   PSMALL_RECT lpReadRegion);
 
+/** Read the characters and attributes of a rectangle in one pass.
+    
+    \param hConsoleOutput The screen buffer.
+    \param lpReadRegion   The rectangle, Right and Bottom inclusive. Receives the part that was 
+                          read after clipping it to the screen buffer.
+    \param lpCharacter    Optional. Receives the characters of the clipped rectangle row by row. 
+                          Fullwidth characters are not compressed.
+    \param lpAttribute    Optional. Receives the attributes in the same layout.
+ */
+BOOL console_read_output_rect(
+  HANDLE      hConsoleOutput,
+  PSMALL_RECT lpReadRegion,
+  LPWSTR      lpCharacter,
+  LPWORD      lpAttribute);
+
 /** Read characters from the console buffer.
     Fullwidth CJK characters that take two cells are compressed, so the number of chars read 
     may be smaller than the number of cells specified by dwReadCoord.
@@ -41,6 +58,79 @@ BOOL console_write_output_attribute(
   COORD dwWriteCoord,
   LPDWORD lpNumberOfAttrsWritten);
 
+/** Fill attributes like FillConsoleOutputAttribute() and mark the rows of the snapshot as stale.
+ */
+BOOL console_fill_output_attribute(
+  HANDLE hConsoleOutput,
+  WORD wAttribute,
+  DWORD nLength,
+  COORD dwWriteCoord,
+  LPDWORD lpNumberOfAttrsWritten);
+
+/** Write cells like WriteConsoleOutputW() and mark the rows of the snapshot as stale.
+ */
+BOOL console_write_output(
+  HANDLE           hConsoleOutput,
+  const CHAR_INFO *lpBuffer,
+  COORD            dwBufferSize,
+  COORD            dwBufferCoord,
+  PSMALL_RECT      lpWriteRegion);
+
+/** Scroll like ScrollConsoleScreenBufferW() and mark the whole snapshot as stale.
+ */
+BOOL console_scroll_buffer(
+  HANDLE            hConsoleOutput,
+  const SMALL_RECT *lpScrollRectangle,
+  const SMALL_RECT *lpClipRectangle,
+  COORD             dwDestinationOrigin,
+  const CHAR_INFO  *lpFill);
+
+/** A copy of the whole screen buffer with one entry per cell.
+    
+    The second cell of a fullwidth CJK character has the COMMON_LVB_TRAILING_BYTE attribute.
+ */
+struct console_snapshot_t {
+  COORD    size;
+  wchar_t *text;
+  WORD    *attributes;
+  char    *stale_rows; ///< Non-zero for rows that were kept from an earlier borrow without re-reading them.
+  unsigned version; ///< Changes whenever the content changes.
+};
+
+/** Borrow the shared snapshot of a screen buffer.
+    
+    The snapshot is kept between calls. Only the rows that were written through console-buffer-io, 
+    the rows around the cursor and the visible rows are re-read, after detecting scrolling at the 
+    top of the buffer. Changes elsewhere by other programs may be missed. Those rows are marked in 
+    stale_rows, so check them before writing anything back that was taken from the snapshot.
+    
+    \param hConsoleOutput A console buffer handle.
+    
+eturn The snapshot or NULL on error. Give it back with console_return_snapshot() as soon 
+            as possible. Until then, other threads block when writing through console-buffer-io,
+            and the calling thread must not write through it at all.
+ */
+const struct console_snapshot_t *console_borrow_snapshot(HANDLE hConsoleOutput);
+
+/** Give back a snapshot from console_borrow_snapshot().
+ */
+void console_return_snapshot(const struct console_snapshot_t *snapshot);
+
+/** Free the snapshot, e.g. when the console backend changes.
+ */
+void console_discard_snapshot(void);
+
+/** Read characters from a snapshot like console_read_output_character().
+    
+    
+eturn The number of characters read. Trailing cells of fullwidth characters are skipped.
+ */
+DWORD console_read_snapshot_characters(
+  const struct console_snapshot_t *snapshot,
+  wchar_t *buffer,
+  DWORD length,
+  COORD coord);
+
 void console_reinvert_colors(
   HANDLE hConsoleOutput,
   COORD old_start,
@@ -71,6 +161,19 @@ BOOL console_scroll_wheel(HANDLE hConsoleOutput, const MOUSE_EVENT_RECORD *er);
 
 BOOL console_scroll_key(HANDLE hConsoleOutput, const KEY_EVENT_RECORD *er);
 
+/* Get the clipboard text with all line breaks (\r\n or \n) converted to \r.
+
+   \param length Receives the text length.
+   \return The 0-terminated text or NULL if the clipboard contains no text. Free it with 
+           hyper_console_free_memory().
+ */
+wchar_t *console_get_clipboard_text(int *length);
+
+/* Type text into the console input as a sequence of key presses.
+   A \r becomes the Return key and a \t a literal Tab (with LITERAL_KEY_STATE).
+ */
+void console_send_text(HANDLE hConsoleInput, const wchar_t *text, int length);
+
 void console_paste_from_clipboard(HANDLE hConsoleInput);
 
 BOOL console_get_screen_word_start_end(HANDLE hConsoleOutput, COORD pos, COORD *start, COORD *end);
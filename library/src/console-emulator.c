@@ -0,0 +1,821 @@
+#include <hyper-console.h>
+
+#include "console-backend.h"
+
+#include "debug.h"
+#include "memory-util.h"
+
+#include <assert.h>
+#include <string.h>
+
+
+#define MIN(A, B)  ((A) < (B) ? (A) : (B))
+#define MAX(A, B)  ((A) > (B) ? (A) : (B))
+
+#define MEMORY_INPUT_HANDLE   ((HANDLE)(ULONG_PTR)0x4D490001)
+#define MEMORY_OUTPUT_HANDLE  ((HANDLE)(ULONG_PTR)0x4D490002)
+
+
+struct hyper_console_memory_backend_t {
+  CHAR_INFO *cells;
+  COORD size;
+  COORD cursor;
+  SMALL_RECT window;
+  WORD attributes;
+  CONSOLE_CURSOR_INFO cursor_info;
+
+  DWORD input_mode;
+  DWORD output_mode;
+
+  INPUT_RECORD *input;
+  int input_capacity;
+  int input_length;
+  int input_pos;
+
+  wchar_t title[256];
+
+  CRITICAL_SECTION lock; // like the Win32 console, every call is atomic
+};
+
+static struct hyper_console_memory_backend_t *current_memory_console;
+
+static CHAR_INFO *cell_at(struct hyper_console_memory_backend_t *mb, int x, int y);
+static void scroll_up_one_line(struct hyper_console_memory_backend_t *mb);
+static void write_char(struct hyper_console_memory_backend_t *mb, wchar_t ch);
+static BOOL clip_rect(struct hyper_console_memory_backend_t *mb, SMALL_RECT *rect);
+static BOOL check_output_handle(HANDLE handle);
+static BOOL check_input_handle(HANDLE handle);
+static struct hyper_console_memory_backend_t *lock_output(HANDLE handle);
+static struct hyper_console_memory_backend_t *lock_input(HANDLE handle);
+
+static HANDLE memory_get_std_handle(DWORD std_handle);
+static BOOL memory_get_mode(HANDLE handle, DWORD *mode);
+static BOOL memory_set_mode(HANDLE handle, DWORD mode);
+static BOOL memory_get_screen_buffer_info(HANDLE hConsoleOutput, CONSOLE_SCREEN_BUFFER_INFO *csbi);
+static BOOL memory_set_cursor_position(HANDLE hConsoleOutput, COORD pos);
+static BOOL memory_get_cursor_info(HANDLE hConsoleOutput, CONSOLE_CURSOR_INFO *cci);
+static BOOL memory_set_cursor_info(HANDLE hConsoleOutput, const CONSOLE_CURSOR_INFO *cci);
+static BOOL memory_set_window_info(HANDLE hConsoleOutput, BOOL absolute, const SMALL_RECT *window);
+static BOOL memory_set_text_attribute(HANDLE hConsoleOutput, WORD attribute);
+static DWORD memory_get_title(wchar_t *buffer, DWORD size);
+static BOOL memory_set_title(const wchar_t *title);
+static BOOL memory_read_output(HANDLE hConsoleOutput, CHAR_INFO *buffer, COORD buffer_size, COORD buffer_coord, SMALL_RECT *region);
+static BOOL memory_write_output(HANDLE hConsoleOutput, const CHAR_INFO *buffer, COORD buffer_size, COORD buffer_coord, SMALL_RECT *region);
+static BOOL memory_read_output_character(HANDLE hConsoleOutput, wchar_t *chars, DWORD length, COORD coord, DWORD *num_read);
+static BOOL memory_read_output_attribute(HANDLE hConsoleOutput, WORD *attributes, DWORD length, COORD coord, DWORD *num_read);
+static BOOL memory_write_output_attribute(HANDLE hConsoleOutput, const WORD *attributes, DWORD length, COORD coord, DWORD *num_written);
+static BOOL memory_fill_output_attribute(HANDLE hConsoleOutput, WORD attribute, DWORD length, COORD coord, DWORD *num_written);
+static BOOL memory_scroll_buffer(HANDLE hConsoleOutput, const SMALL_RECT *scroll_rect, const SMALL_RECT *clip_rect, COORD dest, const CHAR_INFO *fill);
+static BOOL memory_write_text(HANDLE hConsoleOutput, const wchar_t *text, DWORD length, DWORD *num_written);
+static DWORD memory_wait_for_input(HANDLE hConsoleInput, DWORD timeout);
+static BOOL memory_get_number_of_input_events(HANDLE hConsoleInput, DWORD *count);
+static BOOL memory_read_input(HANDLE hConsoleInput, INPUT_RECORD *records, DWORD length, DWORD *num_read);
+static BOOL memory_peek_input(HANDLE hConsoleInput, INPUT_RECORD *records, DWORD length, DWORD *num_read);
+static BOOL memory_write_input(HANDLE hConsoleInput, const INPUT_RECORD *records, DWORD length, DWORD *num_written);
+
+static const struct console_backend_t memory_backend = {
+  memory_get_std_handle,
+  memory_get_mode,
+  memory_set_mode,
+
+  memory_get_screen_buffer_info,
+  memory_set_cursor_position,
+  memory_get_cursor_info,
+  memory_set_cursor_info,
+  memory_set_window_info,
+  memory_set_text_attribute,
+  memory_get_title,
+  memory_set_title,
+
+  memory_read_output,
+  memory_write_output,
+  memory_read_output_character,
+  memory_read_output_attribute,
+  memory_write_output_attribute,
+  memory_fill_output_attribute,
+  memory_scroll_buffer,
+  memory_write_text,
+
+  memory_wait_for_input,
+  memory_get_number_of_input_events,
+  memory_read_input,
+  memory_peek_input,
+  memory_write_input
+};
+
+HYPER_CONSOLE_API
+struct hyper_console_memory_backend_t *hyper_console_memory_backend_new(int width, int height, WORD attributes) {
+  struct hyper_console_memory_backend_t *mb;
+  int i;
+
+  if(width <= 0 || height <= 0 || width > 0x7FFF || height > 0x7FFF)
+    return NULL;
+
+  mb = hyper_console_allocate_memory(sizeof(struct hyper_console_memory_backend_t));
+  if(!mb)
+    return NULL;
+
+  memset(mb, 0, sizeof(struct hyper_console_memory_backend_t));
+  mb->cells = hyper_console_allocate_memory(sizeof(CHAR_INFO) * (size_t)width * (size_t)height);
+  if(!mb->cells) {
+    hyper_console_free_memory(mb);
+    return NULL;
+  }
+
+  mb->size.X = (SHORT)width;
+  mb->size.Y = (SHORT)height;
+  mb->window.Right = (SHORT)(width - 1);
+  mb->window.Bottom = (SHORT)(height - 1);
+  mb->attributes = attributes;
+  mb->cursor_info.dwSize = 25;
+  mb->cursor_info.bVisible = TRUE;
+  mb->input_mode = ENABLE_PROCESSED_INPUT | ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT | ENABLE_MOUSE_INPUT;
+  mb->output_mode = ENABLE_PROCESSED_OUTPUT | ENABLE_WRAP_AT_EOL_OUTPUT;
+  InitializeCriticalSection(&mb->lock);
+
+  for(i = 0; i < width * height; ++i) {
+    mb->cells[i].Char.UnicodeChar = L' ';
+    mb->cells[i].Attributes = attributes;
+  }
+
+  return mb;
+}
+
+HYPER_CONSOLE_API
+void hyper_console_memory_backend_free(struct hyper_console_memory_backend_t *mb) {
+  if(!mb)
+    return;
+
+  assert(mb != current_memory_console && "in-memory console still in use");
+
+  DeleteCriticalSection(&mb->lock);
+  hyper_console_free_memory(mb->input);
+  hyper_console_free_memory(mb->cells);
+  hyper_console_free_memory(mb);
+}
+
+HYPER_CONSOLE_API
+BOOL hyper_console_memory_backend_add_input(struct hyper_console_memory_backend_t *mb, const INPUT_RECORD *records, int count) {
+  assert(mb != NULL);
+  assert(records != NULL || count == 0);
+
+  if(count <= 0)
+    return count == 0;
+
+  EnterCriticalSection(&mb->lock);
+  if(mb->input_pos > 0) {
+    memmove(mb->input, mb->input + mb->input_pos, sizeof(INPUT_RECORD) * (mb->input_length - mb->input_pos));
+    mb->input_length -= mb->input_pos;
+    mb->input_pos = 0;
+  }
+
+  if( count > 0x7FFFFFFF - mb->input_length ||
+      !resize_array((void**)&mb->input, &mb->input_capacity, sizeof(INPUT_RECORD), mb->input_length + count))
+  {
+    LeaveCriticalSection(&mb->lock);
+    return FALSE;
+  }
+
+  memcpy(mb->input + mb->input_length, records, sizeof(INPUT_RECORD) * count);
+  mb->input_length += count;
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+HYPER_CONSOLE_API
+void hyper_console_memory_backend_write(struct hyper_console_memory_backend_t *mb, const wchar_t *text, int length) {
+  assert(mb != NULL);
+  assert(text != NULL);
+
+  if(length < 0)
+    length = (int)wcslen(text);
+
+  EnterCriticalSection(&mb->lock);
+  while(length-- > 0)
+    write_char(mb, *text++);
+  LeaveCriticalSection(&mb->lock);
+}
+
+HYPER_CONSOLE_API
+const CHAR_INFO *hyper_console_memory_backend_get_cells(struct hyper_console_memory_backend_t *mb, COORD *size, COORD *cursor) {
+  assert(mb != NULL);
+
+  if(size)
+    *size = mb->size;
+
+  if(cursor)
+    *cursor = mb->cursor;
+
+  return mb->cells;
+}
+
+HYPER_CONSOLE_API
+BOOL hyper_console_memory_backend_set_window(struct hyper_console_memory_backend_t *mb, const SMALL_RECT *window) {
+  assert(mb != NULL);
+  assert(window != NULL);
+
+  if(window->Left < 0 || window->Top < 0 || window->Right >= mb->size.X || window->Bottom >= mb->size.Y || window->Left > window->Right || window->Top > window->Bottom)
+    return FALSE;
+
+  EnterCriticalSection(&mb->lock);
+  mb->window = *window;
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+HYPER_CONSOLE_API
+void hyper_console_use_memory_backend(struct hyper_console_memory_backend_t *mb) {
+  current_memory_console = mb;
+  console_set_backend(mb ? &memory_backend : NULL);
+}
+
+static CHAR_INFO *cell_at(struct hyper_console_memory_backend_t *mb, int x, int y) {
+  assert(0 <= x && x < mb->size.X);
+  assert(0 <= y && y < mb->size.Y);
+
+  return &mb->cells[y * mb->size.X + x];
+}
+
+static void scroll_up_one_line(struct hyper_console_memory_backend_t *mb) {
+  CHAR_INFO *last_line;
+  int i;
+
+  memmove(mb->cells, mb->cells + mb->size.X, sizeof(CHAR_INFO) * mb->size.X * (mb->size.Y - 1));
+
+  last_line = cell_at(mb, 0, mb->size.Y - 1);
+  for(i = 0; i < mb->size.X; ++i) {
+    last_line[i].Char.UnicodeChar = L' ';
+    last_line[i].Attributes = mb->attributes;
+  }
+}
+
+static void write_char(struct hyper_console_memory_backend_t *mb, wchar_t ch) {
+  CHAR_INFO *cell;
+
+  switch(ch) {
+    case L'\r':
+      mb->cursor.X = 0;
+      return;
+
+    case L'\n':
+      mb->cursor.X = 0;
+      if(mb->cursor.Y + 1 < mb->size.Y)
+        mb->cursor.Y++;
+      else
+        scroll_up_one_line(mb);
+      return;
+
+    case L'\b':
+      if(mb->cursor.X > 0)
+        mb->cursor.X--;
+      return;
+
+    case L'\t':
+      do {
+        write_char(mb, L' ');
+      } while(mb->cursor.X % 8 != 0);
+      return;
+  }
+
+  cell = cell_at(mb, mb->cursor.X, mb->cursor.Y);
+  cell->Char.UnicodeChar = ch;
+  cell->Attributes = mb->attributes;
+
+  if(mb->cursor.X + 1 < mb->size.X)
+    mb->cursor.X++;
+  else
+    write_char(mb, L'\n');
+}
+
+static BOOL clip_rect(struct hyper_console_memory_backend_t *mb, SMALL_RECT *rect) {
+  rect->Left   = MAX(rect->Left,   0);
+  rect->Top    = MAX(rect->Top,    0);
+  rect->Right  = MIN(rect->Right,  mb->size.X - 1);
+  rect->Bottom = MIN(rect->Bottom, mb->size.Y - 1);
+
+  return rect->Left <= rect->Right && rect->Top <= rect->Bottom;
+}
+
+static BOOL check_output_handle(HANDLE handle) {
+  if(current_memory_console && handle == MEMORY_OUTPUT_HANDLE)
+    return TRUE;
+
+  SetLastError(ERROR_INVALID_HANDLE);
+  return FALSE;
+}
+
+static BOOL check_input_handle(HANDLE handle) {
+  if(current_memory_console && handle == MEMORY_INPUT_HANDLE)
+    return TRUE;
+
+  SetLastError(ERROR_INVALID_HANDLE);
+  return FALSE;
+}
+
+/* Check the handle and lock the current console. Release it with LeaveCriticalSection().
+ */
+static struct hyper_console_memory_backend_t *lock_output(HANDLE handle) {
+  if(!check_output_handle(handle))
+    return NULL;
+
+  EnterCriticalSection(&current_memory_console->lock);
+  return current_memory_console;
+}
+
+static struct hyper_console_memory_backend_t *lock_input(HANDLE handle) {
+  if(!check_input_handle(handle))
+    return NULL;
+
+  EnterCriticalSection(&current_memory_console->lock);
+  return current_memory_console;
+}
+
+static HANDLE memory_get_std_handle(DWORD std_handle) {
+  switch(std_handle) {
+    case STD_INPUT_HANDLE:  return MEMORY_INPUT_HANDLE;
+    case STD_OUTPUT_HANDLE: return MEMORY_OUTPUT_HANDLE;
+    case STD_ERROR_HANDLE:  return MEMORY_OUTPUT_HANDLE;
+  }
+
+  SetLastError(ERROR_INVALID_PARAMETER);
+  return INVALID_HANDLE_VALUE;
+}
+
+static BOOL memory_get_mode(HANDLE handle, DWORD *mode) {
+  struct hyper_console_memory_backend_t *mb;
+
+  if(handle == MEMORY_INPUT_HANDLE)
+    mb = lock_input(handle);
+  else
+    mb = lock_output(handle);
+
+  if(!mb)
+    return FALSE;
+
+  if(handle == MEMORY_INPUT_HANDLE)
+    *mode = mb->input_mode;
+  else
+    *mode = mb->output_mode;
+
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_set_mode(HANDLE handle, DWORD mode) {
+  struct hyper_console_memory_backend_t *mb;
+
+  if(handle == MEMORY_INPUT_HANDLE)
+    mb = lock_input(handle);
+  else
+    mb = lock_output(handle);
+
+  if(!mb)
+    return FALSE;
+
+  if(handle == MEMORY_INPUT_HANDLE)
+    mb->input_mode = mode;
+  else
+    mb->output_mode = mode;
+
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_get_screen_buffer_info(HANDLE hConsoleOutput, CONSOLE_SCREEN_BUFFER_INFO *csbi) {
+  struct hyper_console_memory_backend_t *mb = lock_output(hConsoleOutput);
+
+  if(!mb)
+    return FALSE;
+
+  csbi->dwSize = mb->size;
+  csbi->dwCursorPosition = mb->cursor;
+  csbi->wAttributes = mb->attributes;
+  csbi->srWindow = mb->window;
+  csbi->dwMaximumWindowSize = mb->size;
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_set_cursor_position(HANDLE hConsoleOutput, COORD pos) {
+  struct hyper_console_memory_backend_t *mb = lock_output(hConsoleOutput);
+
+  if(!mb)
+    return FALSE;
+
+  if(pos.X < 0 || pos.Y < 0 || pos.X >= mb->size.X || pos.Y >= mb->size.Y) {
+    LeaveCriticalSection(&mb->lock);
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+
+  mb->cursor = pos;
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_get_cursor_info(HANDLE hConsoleOutput, CONSOLE_CURSOR_INFO *cci) {
+  struct hyper_console_memory_backend_t *mb = lock_output(hConsoleOutput);
+
+  if(!mb)
+    return FALSE;
+
+  *cci = mb->cursor_info;
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_set_cursor_info(HANDLE hConsoleOutput, const CONSOLE_CURSOR_INFO *cci) {
+  struct hyper_console_memory_backend_t *mb = lock_output(hConsoleOutput);
+
+  if(!mb)
+    return FALSE;
+
+  mb->cursor_info = *cci;
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_set_window_info(HANDLE hConsoleOutput, BOOL absolute, const SMALL_RECT *window) {
+  struct hyper_console_memory_backend_t *mb = lock_output(hConsoleOutput);
+  SMALL_RECT rect;
+
+  if(!mb)
+    return FALSE;
+
+  rect = *window;
+  if(!absolute) {
+    rect.Left   += mb->window.Left;
+    rect.Top    += mb->window.Top;
+    rect.Right  += mb->window.Right;
+    rect.Bottom += mb->window.Bottom;
+  }
+
+  if(rect.Left < 0 || rect.Top < 0 || rect.Right >= mb->size.X || rect.Bottom >= mb->size.Y || rect.Left > rect.Right || rect.Top > rect.Bottom) {
+    LeaveCriticalSection(&mb->lock);
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+  }
+
+  mb->window = rect;
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_set_text_attribute(HANDLE hConsoleOutput, WORD attribute) {
+  struct hyper_console_memory_backend_t *mb = lock_output(hConsoleOutput);
+
+  if(!mb)
+    return FALSE;
+
+  mb->attributes = attribute;
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static DWORD memory_get_title(wchar_t *buffer, DWORD size) {
+  struct hyper_console_memory_backend_t *mb = current_memory_console;
+  size_t len;
+
+  if(!mb || size == 0)
+    return 0;
+
+  EnterCriticalSection(&mb->lock);
+  len = MIN(wcslen(mb->title), size - 1);
+  memcpy(buffer, mb->title, sizeof(wchar_t) * len);
+  buffer[len] = L'\0';
+  LeaveCriticalSection(&mb->lock);
+  return (DWORD)len;
+}
+
+static BOOL memory_set_title(const wchar_t *title) {
+  struct hyper_console_memory_backend_t *mb = current_memory_console;
+  size_t len;
+
+  if(!mb)
+    return FALSE;
+
+  EnterCriticalSection(&mb->lock);
+  len = MIN(wcslen(title), ARRAYSIZE(mb->title) - 1);
+  memcpy(mb->title, title, sizeof(wchar_t) * len);
+  mb->title[len] = L'\0';
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_read_output(HANDLE hConsoleOutput, CHAR_INFO *buffer, COORD buffer_size, COORD buffer_coord, SMALL_RECT *region) {
+  struct hyper_console_memory_backend_t *mb = lock_output(hConsoleOutput);
+  int y;
+
+  if(!mb)
+    return FALSE;
+
+  region->Right  = MIN(region->Right,  region->Left + buffer_size.X - buffer_coord.X - 1);
+  region->Bottom = MIN(region->Bottom, region->Top  + buffer_size.Y - buffer_coord.Y - 1);
+  if(!clip_rect(mb, region)) {
+    LeaveCriticalSection(&mb->lock);
+    return TRUE;
+  }
+
+  for(y = region->Top; y <= region->Bottom; ++y) {
+    memcpy(
+      buffer + (buffer_coord.Y + y - region->Top) * buffer_size.X + buffer_coord.X,
+      cell_at(mb, region->Left, y),
+      sizeof(CHAR_INFO) * (region->Right - region->Left + 1));
+  }
+
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_write_output(HANDLE hConsoleOutput, const CHAR_INFO *buffer, COORD buffer_size, COORD buffer_coord, SMALL_RECT *region) {
+  struct hyper_console_memory_backend_t *mb = lock_output(hConsoleOutput);
+  int y;
+
+  if(!mb)
+    return FALSE;
+
+  region->Right  = MIN(region->Right,  region->Left + buffer_size.X - buffer_coord.X - 1);
+  region->Bottom = MIN(region->Bottom, region->Top  + buffer_size.Y - buffer_coord.Y - 1);
+  if(!clip_rect(mb, region)) {
+    LeaveCriticalSection(&mb->lock);
+    return TRUE;
+  }
+
+  for(y = region->Top; y <= region->Bottom; ++y) {
+    memcpy(
+      cell_at(mb, region->Left, y),
+      buffer + (buffer_coord.Y + y - region->Top) * buffer_size.X + buffer_coord.X,
+      sizeof(CHAR_INFO) * (region->Right - region->Left + 1));
+  }
+
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_read_output_character(HANDLE hConsoleOutput, wchar_t *chars, DWORD length, COORD coord, DWORD *num_read) {
+  struct hyper_console_memory_backend_t *mb;
+  int i;
+  int end;
+
+  *num_read = 0;
+  mb = lock_output(hConsoleOutput);
+  if(!mb)
+    return FALSE;
+
+  if(coord.X < 0 || coord.Y < 0 || coord.X >= mb->size.X || coord.Y >= mb->size.Y) {
+    LeaveCriticalSection(&mb->lock);
+    return TRUE;
+  }
+
+  i = coord.Y * mb->size.X + coord.X;
+  end = (int)MIN((DWORD)(mb->size.X * mb->size.Y - i), length) + i;
+  for(; i < end; ++i) {
+    // Like conhost, report double-width characters only once.
+    if(mb->cells[i].Attributes & COMMON_LVB_TRAILING_BYTE)
+      continue;
+
+    chars[(*num_read)++] = mb->cells[i].Char.UnicodeChar;
+  }
+
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_read_output_attribute(HANDLE hConsoleOutput, WORD *attributes, DWORD length, COORD coord, DWORD *num_read) {
+  struct hyper_console_memory_backend_t *mb;
+  int i;
+
+  *num_read = 0;
+  mb = lock_output(hConsoleOutput);
+  if(!mb)
+    return FALSE;
+
+  if(coord.X < 0 || coord.Y < 0 || coord.X >= mb->size.X || coord.Y >= mb->size.Y) {
+    LeaveCriticalSection(&mb->lock);
+    return TRUE;
+  }
+
+  i = coord.Y * mb->size.X + coord.X;
+  *num_read = MIN((DWORD)(mb->size.X * mb->size.Y - i), length);
+  while(length-- > 0 && i < mb->size.X * mb->size.Y)
+    *attributes++ = mb->cells[i++].Attributes;
+
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_write_output_attribute(HANDLE hConsoleOutput, const WORD *attributes, DWORD length, COORD coord, DWORD *num_written) {
+  struct hyper_console_memory_backend_t *mb;
+  int i;
+
+  *num_written = 0;
+  mb = lock_output(hConsoleOutput);
+  if(!mb)
+    return FALSE;
+
+  if(coord.X < 0 || coord.Y < 0 || coord.X >= mb->size.X || coord.Y >= mb->size.Y) {
+    LeaveCriticalSection(&mb->lock);
+    return TRUE;
+  }
+
+  i = coord.Y * mb->size.X + coord.X;
+  *num_written = MIN((DWORD)(mb->size.X * mb->size.Y - i), length);
+  while(length-- > 0 && i < mb->size.X * mb->size.Y)
+    mb->cells[i++].Attributes = *attributes++;
+
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_fill_output_attribute(HANDLE hConsoleOutput, WORD attribute, DWORD length, COORD coord, DWORD *num_written) {
+  struct hyper_console_memory_backend_t *mb;
+  int i;
+
+  *num_written = 0;
+  mb = lock_output(hConsoleOutput);
+  if(!mb)
+    return FALSE;
+
+  if(coord.X < 0 || coord.Y < 0 || coord.X >= mb->size.X || coord.Y >= mb->size.Y) {
+    LeaveCriticalSection(&mb->lock);
+    return TRUE;
+  }
+
+  i = coord.Y * mb->size.X + coord.X;
+  *num_written = MIN((DWORD)(mb->size.X * mb->size.Y - i), length);
+  while(length-- > 0 && i < mb->size.X * mb->size.Y)
+    mb->cells[i++].Attributes = attribute;
+
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_scroll_buffer(HANDLE hConsoleOutput, const SMALL_RECT *scroll_rect, const SMALL_RECT *clip_rect_ptr, COORD dest, const CHAR_INFO *fill) {
+  struct hyper_console_memory_backend_t *mb = lock_output(hConsoleOutput);
+  SMALL_RECT source;
+  SMALL_RECT clip;
+  CHAR_INFO *copy;
+  int width;
+  int height;
+  int x;
+  int y;
+
+  if(!mb)
+    return FALSE;
+
+  source = *scroll_rect;
+  if(clip_rect_ptr) {
+    clip = *clip_rect_ptr;
+  }
+  else {
+    // Like ScrollConsoleScreenBufferW(), no clip rectangle means the whole screen buffer.
+    clip.Left   = 0;
+    clip.Top    = 0;
+    clip.Right  = mb->size.X - 1;
+    clip.Bottom = mb->size.Y - 1;
+  }
+
+  if(!clip_rect(mb, &source) || !clip_rect(mb, &clip)) {
+    LeaveCriticalSection(&mb->lock);
+    return TRUE;
+  }
+
+  width  = source.Right - source.Left + 1;
+  height = source.Bottom - source.Top + 1;
+  copy = hyper_console_allocate_memory(sizeof(CHAR_INFO) * width * height);
+  if(!copy) {
+    LeaveCriticalSection(&mb->lock);
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+
+  for(y = 0; y < height; ++y)
+    memcpy(copy + y * width, cell_at(mb, source.Left, source.Top + y), sizeof(CHAR_INFO) * width);
+
+  // Cells of the source that will not be overwritten get the fill character.
+  for(y = source.Top; y <= source.Bottom; ++y) {
+    if(y < clip.Top || y > clip.Bottom)
+      continue;
+
+    for(x = MAX(source.Left, clip.Left); x <= MIN(source.Right, clip.Right); ++x)
+      *cell_at(mb, x, y) = *fill;
+  }
+
+  for(y = 0; y < height; ++y) {
+    int dy = dest.Y + y;
+    if(dy < clip.Top || dy > clip.Bottom)
+      continue;
+
+    for(x = 0; x < width; ++x) {
+      int dx = dest.X + x;
+      if(dx < clip.Left || dx > clip.Right)
+        continue;
+
+      *cell_at(mb, dx, dy) = copy[y * width + x];
+    }
+  }
+
+  LeaveCriticalSection(&mb->lock);
+  hyper_console_free_memory(copy);
+  return TRUE;
+}
+
+static BOOL memory_write_text(HANDLE hConsoleOutput, const wchar_t *text, DWORD length, DWORD *num_written) {
+  if(num_written)
+    *num_written = 0;
+
+  if(!check_output_handle(hConsoleOutput))
+    return FALSE;
+
+  hyper_console_memory_backend_write(current_memory_console, text, (int)length);
+  if(num_written)
+    *num_written = length;
+
+  return TRUE;
+}
+
+static DWORD memory_wait_for_input(HANDLE hConsoleInput, DWORD timeout) {
+  struct hyper_console_memory_backend_t *mb = lock_input(hConsoleInput);
+  BOOL have_input;
+
+  if(!mb)
+    return WAIT_FAILED;
+
+  have_input = mb->input_pos < mb->input_length;
+  LeaveCriticalSection(&mb->lock);
+  if(have_input)
+    return WAIT_OBJECT_0;
+
+  // Scripted input cannot arrive while waiting. Let readers fail in memory_read_input()
+  // instead of blocking forever.
+  if(timeout == INFINITE)
+    return WAIT_OBJECT_0;
+
+  Sleep(timeout);
+  return WAIT_TIMEOUT;
+}
+
+static BOOL memory_get_number_of_input_events(HANDLE hConsoleInput, DWORD *count) {
+  struct hyper_console_memory_backend_t *mb = lock_input(hConsoleInput);
+
+  if(!mb)
+    return FALSE;
+
+  *count = (DWORD)(mb->input_length - mb->input_pos);
+  LeaveCriticalSection(&mb->lock);
+  return TRUE;
+}
+
+static BOOL memory_read_input(HANDLE hConsoleInput, INPUT_RECORD *records, DWORD length, DWORD *num_read) {
+  struct hyper_console_memory_backend_t *mb;
+  DWORD count;
+
+  *num_read = 0;
+  mb = lock_input(hConsoleInput);
+  if(!mb)
+    return FALSE;
+
+  if(mb->input_pos == mb->input_length) {
+    LeaveCriticalSection(&mb->lock);
+    debug_printf(L"memory_read_input: end of scripted input\n");
+    SetLastError(ERROR_HANDLE_EOF);
+    return FALSE;
+  }
+
+  count = MIN((DWORD)(mb->input_length - mb->input_pos), length);
+  memcpy(records, mb->input + mb->input_pos, sizeof(INPUT_RECORD) * count);
+  mb->input_pos += (int)count;
+  LeaveCriticalSection(&mb->lock);
+  *num_read = count;
+  return TRUE;
+}
+
+static BOOL memory_peek_input(HANDLE hConsoleInput, INPUT_RECORD *records, DWORD length, DWORD *num_read) {
+  struct hyper_console_memory_backend_t *mb;
+  DWORD count;
+
+  *num_read = 0;
+  mb = lock_input(hConsoleInput);
+  if(!mb)
+    return FALSE;
+
+  count = MIN((DWORD)(mb->input_length - mb->input_pos), length);
+  memcpy(records, mb->input + mb->input_pos, sizeof(INPUT_RECORD) * count);
+  LeaveCriticalSection(&mb->lock);
+  *num_read = count;
+  return TRUE;
+}
+
+static BOOL memory_write_input(HANDLE hConsoleInput, const INPUT_RECORD *records, DWORD length, DWORD *num_written) {
+  *num_written = 0;
+  if(!check_input_handle(hConsoleInput))
+    return FALSE;
+
+  if(!hyper_console_memory_backend_add_input(current_memory_console, records, (int)length)) {
+    SetLastError(ERROR_NOT_ENOUGH_MEMORY);
+    return FALSE;
+  }
+
+  *num_written = length;
+  return TRUE;
+}
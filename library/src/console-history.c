@@ -1,27 +1,124 @@
 #include "console-history.h"
 
+#include "debug.h"
+#include "history-file.h"
+#include "history-index.h"
 #include "memory-util.h"
 
 #include <assert.h>
+#include <wchar.h>
+
+
+/* Usable size of a regular arena chunk in bytes. Larger entries get a chunk of their own. */
+#define HISTORY_CHUNK_SIZE  (64 * 1024 - (int)sizeof(struct history_chunk_t))
+
+#define DEFAULT_MAX_ENTRIES  100000
+#define DEFAULT_MAX_BYTES    (16 * 1024 * 1024)
+
+/* The index is rebuilt when it refers to more removed entries than live entries, but at least 
+   this many.
+ */
+#define MIN_INDEX_GARBAGE  1024
+
+/* A history file is checked for duplicates when it is larger than twice its loaded entries and 
+   this size. It is compacted when older copies of duplicate entries take at least half of it. */
+#define MIN_COMPACT_FILE_SIZE  (1024 * 1024)
+
+#define ALIGN_SIZE(SIZE)  (((SIZE) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
 
 
-// TODO: use  text_line_t  and  text_array_t  from scroll-counter.c
 struct history_line_t {
+  struct history_chunk_t *chunk;
+  struct history_line_t  *next_in_bucket;
+  unsigned hash;       // only used with HYPER_CONSOLE_HISTORY_NO_DUPLICATES
+  int id;   // ascending with the entries' age, used by the index
+  int size; // allocated bytes in the chunk
   int length;
   wchar_t content[1]; // 0-terminated
 };
 
+/* Entries are allocated at the end of the newest chunk and never move. A chunk is released when 
+   its last entry is removed. The chunk data follows the header.
+ */
+struct history_chunk_t {
+  struct history_chunk_t *prev;
+  struct history_chunk_t *next;
+  int used;
+  int capacity;
+  int live_entries;
+};
+
 struct hyper_console_history_t {
+  /* entries[first_entry ... first_entry + entries_count - 1], oldest first */
   struct history_line_t **entries;
   int entries_capacity;
+  int first_entry;
   int entries_count;
+  int next_id;
+  
+  struct history_chunk_t *oldest_chunk;
+  struct history_chunk_t *newest_chunk;
+  struct history_chunk_t *spare_chunk;
+  
+  /* Hash set of all entries for de-duplication, chained by history_line_t::next_in_bucket.
+     Only used with HYPER_CONSOLE_HISTORY_NO_DUPLICATES.
+   */
+  struct history_line_t **buckets; // [bucket_count]
+  int bucket_count;
+  
+  int options;
+  int max_entries;
+  int max_bytes;
+  int total_bytes;
   
   wchar_t *future_entry; // 0-terminated
   int      future_entry_length;
   
   int current_index;
+  
+  /* Substring index over all entries by their ids. NULL if out-of-memory or outdated. */
+  struct history_index_t *index;
+  int index_garbage; // number of ids in the index whose entries were removed
+  BOOL index_outdated; // rebuild the index before the next search
+  
+  /* Optional backing file. It is only mapped while loading, so that other processes can compact it. */
+  struct history_file_t *file;
+};
+
+/* The newest copy of every distinct record in a history file, collected for compaction. */
+struct file_records_t {
+  struct history_file_t *file;
+  
+  LONGLONG *starts; // newest first
+  unsigned *hashes;
+  int count;
+  int starts_capacity;
+  int hashes_capacity;
+  
+  int *buckets; // 1 + index into starts, or 0
+  int bucket_count;
 };
 
+static unsigned hash_text(const wchar_t *text, int length);
+static struct history_line_t *allocate_line(struct hyper_console_history_t *hist, int length);
+static void release_line(struct hyper_console_history_t *hist, struct history_line_t *line);
+static BOOL grow_buckets(struct hyper_console_history_t *hist);
+static void link_to_bucket(struct hyper_console_history_t *hist, struct history_line_t *line);
+static struct history_line_t *find_duplicate(struct hyper_console_history_t *hist, const wchar_t *text, int length, unsigned hash);
+static void unlink_from_bucket(struct hyper_console_history_t *hist, struct history_line_t *line);
+static BOOL reserve_entry(struct hyper_console_history_t *hist);
+static int find_entry_by_id(struct hyper_console_history_t *hist, int id);
+static void remove_entry(struct hyper_console_history_t *hist, int index);
+static void enforce_limits(struct hyper_console_history_t *hist);
+static void renumber_entries(struct hyper_console_history_t *hist);
+static void invalidate_index(struct hyper_console_history_t *hist);
+static void rebuild_index(struct hyper_console_history_t *hist);
+static LONGLONG load_file_entries(struct hyper_console_history_t *hist, LONGLONG end);
+static BOOL add_file_record(struct file_records_t *records, LONGLONG start, const wchar_t *text, int length);
+static void compact_file(struct hyper_console_history_t *hist, LONGLONG end);
+static const wchar_t *get_file_record(void *context, int index, int *length);
+static int find_in_line(const struct history_line_t *line, const wchar_t *pattern, int pattern_length);
+
 
 HYPER_CONSOLE_API
 struct hyper_console_history_t *hyper_console_history_new(int options) {
@@ -33,25 +130,593 @@ struct hyper_console_history_t *hyper_console_history_new(int options) {
     
   memset(hist, 0, sizeof(struct hyper_console_history_t));
   
+  hist->options     = options;
+  hist->max_entries = DEFAULT_MAX_ENTRIES;
+  hist->max_bytes   = DEFAULT_MAX_BYTES;
+  hist->index = history_index_new();
+  
   return hist;
 }
 
 
 HYPER_CONSOLE_API
 void hyper_console_history_free(struct hyper_console_history_t *hist) {
-  int i;
-  
   if(hist == NULL)
     return;
     
-  for(i = 0; i < hist->entries_count; ++i)
-    hyper_console_free_memory(hist->entries[i]);
+  while(hist->oldest_chunk) {
+    struct history_chunk_t *next = hist->oldest_chunk->next;
     
+    hyper_console_free_memory(hist->oldest_chunk);
+    hist->oldest_chunk = next;
+  }
+  
+  hyper_console_free_memory(hist->spare_chunk);
+  hyper_console_free_memory(hist->buckets);
   hyper_console_free_memory(hist->entries);
   hyper_console_free_memory(hist->future_entry);
+  history_index_free(hist->index);
+  history_file_close(hist->file);
   hyper_console_free_memory(hist);
 }
 
+HYPER_CONSOLE_API
+void hyper_console_history_set_limits(struct hyper_console_history_t *hist, int max_entries, int max_bytes) {
+  if(hist == NULL)
+    return;
+    
+  hist->max_entries = max_entries;
+  hist->max_bytes   = max_bytes;
+  enforce_limits(hist);
+  
+  if(hist->current_index > hist->entries_count)
+    hist->current_index = hist->entries_count;
+}
+
+HYPER_CONSOLE_API
+BOOL hyper_console_history_open_file(struct hyper_console_history_t *hist, const wchar_t *path) {
+  struct history_file_t *file;
+  LONGLONG end;
+  
+  if(hist == NULL || path == NULL || hist->file != NULL || hist->entries_count > 0)
+    return FALSE;
+    
+  file = history_file_open(path);
+  if(!file)
+    return FALSE;
+    
+  // Other processes must not append or compact while we load.
+  if(!history_file_lock(file)) {
+    history_file_close(file);
+    return FALSE;
+  }
+  
+  hist->file = file;
+  if(history_file_map(file, &end)) {
+    LONGLONG live_size = load_file_entries(hist, end);
+    LONGLONG file_size = history_file_get_size(file);
+    
+    // Only older copies of duplicates can be removed, other processes may use larger limits.
+    if( (hist->options & HYPER_CONSOLE_HISTORY_NO_DUPLICATES) &&
+        file_size > MIN_COMPACT_FILE_SIZE &&
+        file_size > 2 * live_size)
+    {
+      compact_file(hist, end);
+    }
+    
+    // A mapping would keep other processes from replacing the file.
+    history_file_unmap(file);
+  }
+  
+  history_file_unlock(file);
+  return TRUE;
+}
+
+
+static unsigned hash_text(const wchar_t *text, int length) {
+  unsigned hash = 2166136261U; // FNV-1a
+  int i;
+  
+  assert(text != NULL || length == 0);
+  
+  for(i = 0; i < length; ++i) {
+    hash ^= (unsigned short)text[i];
+    hash *= 16777619U;
+  }
+  
+  return hash;
+}
+
+static struct history_line_t *allocate_line(struct hyper_console_history_t *hist, int length) {
+  struct history_chunk_t *chunk;
+  struct history_line_t *line;
+  int size;
+  
+  assert(hist != NULL);
+  assert(length >= 0 && length < INT_MAX / 4);
+  
+  size = (int)ALIGN_SIZE(sizeof(struct history_line_t) + length * sizeof(wchar_t));
+  
+  chunk = hist->newest_chunk;
+  if(!chunk || chunk->capacity - chunk->used < size) {
+    if(size <= HISTORY_CHUNK_SIZE && hist->spare_chunk) {
+      chunk = hist->spare_chunk;
+      hist->spare_chunk = NULL;
+    }
+    else {
+      int capacity = size > HISTORY_CHUNK_SIZE ? size : HISTORY_CHUNK_SIZE;
+      
+      chunk = hyper_console_allocate_memory(sizeof(struct history_chunk_t) + capacity);
+      if(!chunk)
+        return NULL;
+        
+      chunk->capacity = capacity;
+    }
+    
+    chunk->used = 0;
+    chunk->live_entries = 0;
+    chunk->next = NULL;
+    chunk->prev = hist->newest_chunk;
+    if(hist->newest_chunk)
+      hist->newest_chunk->next = chunk;
+    else
+      hist->oldest_chunk = chunk;
+    hist->newest_chunk = chunk;
+  }
+  
+  line = (struct history_line_t*)((char*)(chunk + 1) + chunk->used);
+  line->chunk = chunk;
+  line->size = size;
+  chunk->used += size;
+  chunk->live_entries++;
+  
+  return line;
+}
+
+static void release_line(struct hyper_console_history_t *hist, struct history_line_t *line) {
+  struct history_chunk_t *chunk;
+  
+  assert(hist != NULL);
+  assert(line != NULL);
+  
+  chunk = line->chunk;
+  assert(chunk->live_entries > 0);
+  if(--chunk->live_entries > 0)
+    return;
+    
+  if(chunk == hist->newest_chunk) { // reuse in place
+    chunk->used = 0;
+    return;
+  }
+  
+  if(chunk->prev)
+    chunk->prev->next = chunk->next;
+  else
+    hist->oldest_chunk = chunk->next;
+    
+  chunk->next->prev = chunk->prev;
+  
+  if(!hist->spare_chunk && chunk->capacity == HISTORY_CHUNK_SIZE)
+    hist->spare_chunk = chunk;
+  else
+    hyper_console_free_memory(chunk);
+}
+
+static BOOL grow_buckets(struct hyper_console_history_t *hist) {
+  struct history_line_t **new_buckets;
+  int new_count;
+  int i;
+  
+  assert(hist != NULL);
+  
+  new_count = hist->bucket_count > 0 ? 2 * hist->bucket_count : 256;
+  if(new_count <= 0 || new_count > (1 << 30) / (int)sizeof(new_buckets[0]))
+    return FALSE;
+    
+  new_buckets = hyper_console_allocate_memory(new_count * sizeof(new_buckets[0]));
+  if(!new_buckets)
+    return FALSE;
+    
+  memset(new_buckets, 0, new_count * sizeof(new_buckets[0]));
+  hyper_console_free_memory(hist->buckets);
+  hist->buckets = new_buckets;
+  hist->bucket_count = new_count;
+  
+  for(i = 0; i < hist->entries_count; ++i)
+    link_to_bucket(hist, hist->entries[hist->first_entry + i]);
+    
+  return TRUE;
+}
+
+static void link_to_bucket(struct hyper_console_history_t *hist, struct history_line_t *line) {
+  struct history_line_t **bucket;
+  
+  assert(hist != NULL);
+  assert(line != NULL);
+  assert(hist->bucket_count > 0);
+  
+  bucket = &hist->buckets[line->hash & (hist->bucket_count - 1)];
+  line->next_in_bucket = *bucket;
+  *bucket = line;
+}
+
+static struct history_line_t *find_duplicate(struct hyper_console_history_t *hist, const wchar_t *text, int length, unsigned hash) {
+  struct history_line_t *line;
+  
+  assert(hist != NULL);
+  assert(text != NULL || length == 0);
+  
+  if(hist->bucket_count == 0)
+    return NULL;
+    
+  for(line = hist->buckets[hash & (hist->bucket_count - 1)]; line; line = line->next_in_bucket) {
+    if( line->hash == hash &&
+        line->length == length &&
+        memcmp(&line->content[0], text, length * sizeof(wchar_t)) == 0)
+    {
+      return line;
+    }
+  }
+  
+  return NULL;
+}
+
+static void unlink_from_bucket(struct hyper_console_history_t *hist, struct history_line_t *line) {
+  struct history_line_t **link;
+  
+  assert(hist != NULL);
+  assert(line != NULL);
+  
+  if(hist->bucket_count == 0)
+    return;
+    
+  link = &hist->buckets[line->hash & (hist->bucket_count - 1)];
+  while(*link != line) {
+    assert(*link != NULL);
+    link = &(*link)->next_in_bucket;
+  }
+  
+  *link = line->next_in_bucket;
+}
+
+/* Make room for one more entry at the end of hist->entries.
+ */
+static BOOL reserve_entry(struct hyper_console_history_t *hist) {
+  assert(hist != NULL);
+  
+  if(hist->first_entry + hist->entries_count < hist->entries_capacity)
+    return TRUE;
+    
+  // Slide the window back to the front once at least half of the array is unused.
+  if(hist->first_entry > 0 && hist->first_entry >= hist->entries_count) {
+    memmove(
+      hist->entries, 
+      hist->entries + hist->first_entry, 
+      hist->entries_count * sizeof(hist->entries[0]));
+    hist->first_entry = 0;
+    return TRUE;
+  }
+  
+  return resize_array(
+           (void**)&hist->entries,
+           &hist->entries_capacity,
+           sizeof(hist->entries[0]),
+           hist->first_entry + hist->entries_count + 1);
+}
+
+/* Get the current index of an entry id or -1 if the entry was removed.
+ */
+static int find_entry_by_id(struct hyper_console_history_t *hist, int id) {
+  struct history_line_t **entries;
+  int lo = 0;
+  int hi;
+  
+  assert(hist != NULL);
+  
+  entries = hist->entries + hist->first_entry;
+  hi = hist->entries_count;
+  if(hi == 0)
+    return -1;
+    
+  // Ids are consecutive unless duplicates were removed.
+  lo = id - entries[0]->id;
+  if(lo >= 0 && lo < hi && entries[lo]->id == id)
+    return lo;
+    
+  lo = 0;
+  while(lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    
+    if(entries[mid]->id < id)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  
+  if(lo < hist->entries_count && entries[lo]->id == id)
+    return lo;
+    
+  return -1;
+}
+
+/* Remove an entry. Removing the oldest entry takes constant time.
+ */
+static void remove_entry(struct hyper_console_history_t *hist, int index) {
+  struct history_line_t *line;
+  
+  assert(hist != NULL);
+  assert(0 <= index && index < hist->entries_count);
+  
+  line = hist->entries[hist->first_entry + index];
+  if(index == 0) {
+    hist->first_entry++;
+  }
+  else {
+    memmove(
+      hist->entries + hist->first_entry + index,
+      hist->entries + hist->first_entry + index + 1,
+      (hist->entries_count - index - 1) * sizeof(hist->entries[0]));
+  }
+  hist->entries_count--;
+  
+  if(hist->entries_count == 0)
+    hist->first_entry = 0;
+    
+  unlink_from_bucket(hist, line);
+  hist->total_bytes -= line->size;
+  hist->index_garbage++;
+  release_line(hist, line);
+}
+
+/* Remove the oldest entries until the limits are met. The newest entry is always kept.
+ */
+static void enforce_limits(struct hyper_console_history_t *hist) {
+  assert(hist != NULL);
+  
+  while( hist->entries_count > 1 &&
+         ((hist->max_entries > 0 && hist->entries_count > hist->max_entries) ||
+          (hist->max_bytes   > 0 && hist->total_bytes   > hist->max_bytes)))
+  {
+    remove_entry(hist, 0);
+  }
+  
+  if(hist->index_garbage > MIN_INDEX_GARBAGE && hist->index_garbage > hist->entries_count)
+    invalidate_index(hist);
+}
+
+/* Restart the ids at 0 before they overflow. */
+static void renumber_entries(struct hyper_console_history_t *hist) {
+  int i;
+  
+  assert(hist != NULL);
+  
+  for(i = 0; i < hist->entries_count; ++i)
+    hist->entries[hist->first_entry + i]->id = i;
+    
+  hist->next_id = hist->entries_count;
+  invalidate_index(hist);
+}
+
+/* Discard the index. It is rebuilt by the next search.
+ */
+static void invalidate_index(struct hyper_console_history_t *hist) {
+  assert(hist != NULL);
+  
+  history_index_free(hist->index);
+  hist->index = NULL;
+  hist->index_garbage = 0;
+  hist->index_outdated = TRUE;
+}
+
+static void rebuild_index(struct hyper_console_history_t *hist) {
+  int i;
+  
+  assert(hist != NULL);
+  
+  history_index_free(hist->index);
+  hist->index = history_index_new();
+  hist->index_garbage = 0;
+  hist->index_outdated = FALSE;
+  
+  for(i = 0; hist->index && i < hist->entries_count; ++i) {
+    struct history_line_t *line = hist->entries[hist->first_entry + i];
+    
+    if(!history_index_add(hist->index, line->id, line->content, line->length)) {
+      history_index_free(hist->index);
+      hist->index = NULL;
+    }
+  }
+}
+
+/* Copy the newest records of the mapped history file, walking backwards from its end, so that 
+   older records are never touched. Returns the file size of the loaded records.
+ */
+static LONGLONG load_file_entries(struct hyper_console_history_t *hist, LONGLONG end) {
+  LONGLONG live_size = 0;
+  LONGLONG pos = end;
+  int i;
+  
+  assert(hist != NULL);
+  assert(hist->file != NULL);
+  assert(hist->entries_count == 0);
+  
+  while(hist->max_entries <= 0 || hist->entries_count < hist->max_entries) {
+    struct history_line_t *line;
+    const wchar_t *text;
+    unsigned hash = 0;
+    int size;
+    int length;
+    
+    text = history_file_prev_record(hist->file, &pos, &length);
+    if(!text)
+      break;
+      
+    size = (int)ALIGN_SIZE(sizeof(struct history_line_t) + length * sizeof(wchar_t));
+    if(hist->max_bytes > 0 && hist->total_bytes + size > hist->max_bytes && hist->entries_count > 0)
+      break;
+      
+    // The file keeps all copies, only the newest one counts.
+    if(hist->options & HYPER_CONSOLE_HISTORY_NO_DUPLICATES) {
+      hash = hash_text(text, length);
+      if(find_duplicate(hist, text, length, hash))
+        continue;
+        
+      if(hist->entries_count >= hist->bucket_count && !grow_buckets(hist))
+        break;
+    }
+    
+    if(!reserve_entry(hist))
+      break;
+      
+    line = allocate_line(hist, length);
+    if(!line)
+      break;
+      
+    line->hash = hash;
+    line->length = length;
+    memcpy(&line->content[0], text, length * sizeof(wchar_t));
+    line->content[length] = L'\0';
+    if(hist->bucket_count > 0)
+      link_to_bucket(hist, line);
+      
+    // newest first for now
+    hist->entries[hist->first_entry + hist->entries_count] = line;
+    hist->entries_count++;
+    hist->total_bytes += size;
+    live_size += history_file_record_size(length);
+  }
+  
+  for(i = 0; i < hist->entries_count / 2; ++i) {
+    struct history_line_t *tmp = hist->entries[hist->first_entry + i];
+    
+    hist->entries[hist->first_entry + i] = hist->entries[hist->first_entry + hist->entries_count - 1 - i];
+    hist->entries[hist->first_entry + hist->entries_count - 1 - i] = tmp;
+  }
+  
+  for(i = 0; i < hist->entries_count; ++i)
+    hist->entries[hist->first_entry + i]->id = i;
+    
+  hist->next_id = hist->entries_count;
+  hist->current_index = hist->entries_count;
+  
+  // The first search builds the index.
+  invalidate_index(hist);
+  
+  return live_size;
+}
+
+/* Add a record to the set unless a newer copy of it is there already. 
+   Returns FALSE on out-of-memory.
+ */
+static BOOL add_file_record(struct file_records_t *records, LONGLONG start, const wchar_t *text, int length) {
+  unsigned hash;
+  int i;
+  
+  assert(records != NULL);
+  
+  if(2 * (records->count + 1) > records->bucket_count) {
+    int *buckets;
+    int bucket_count = records->bucket_count ? 2 * records->bucket_count : 1024;
+    
+    buckets = hyper_console_allocate_memory(bucket_count * sizeof(int));
+    if(!buckets)
+      return FALSE;
+      
+    memset(buckets, 0, bucket_count * sizeof(int));
+    for(i = 0; i < records->count; ++i) {
+      int j = records->hashes[i] & (bucket_count - 1);
+      
+      while(buckets[j] != 0)
+        j = (j + 1) & (bucket_count - 1);
+        
+      buckets[j] = 1 + i;
+    }
+    
+    hyper_console_free_memory(records->buckets);
+    records->buckets = buckets;
+    records->bucket_count = bucket_count;
+  }
+  
+  hash = hash_text(text, length);
+  for(i = hash & (records->bucket_count - 1); records->buckets[i] != 0; i = (i + 1) & (records->bucket_count - 1)) {
+    int index = records->buckets[i] - 1;
+    LONGLONG pos = records->starts[index];
+    const wchar_t *other;
+    int other_length;
+    
+    if(records->hashes[index] != hash)
+      continue;
+      
+    other = history_file_next_record(records->file, &pos, &other_length);
+    if(other && other_length == length && memcmp(other, text, length * sizeof(wchar_t)) == 0)
+      return TRUE;
+  }
+  
+  if( !resize_array((void**)&records->starts, &records->starts_capacity, sizeof(LONGLONG), records->count + 1) ||
+      !resize_array((void**)&records->hashes, &records->hashes_capacity, sizeof(unsigned), records->count + 1))
+  {
+    return FALSE;
+  }
+  
+  records->starts[records->count] = start;
+  records->hashes[records->count] = hash;
+  records->buckets[i] = 1 + records->count;
+  records->count++;
+  return TRUE;
+}
+
+/* Rewrite the history file without older copies of duplicate entries, if they take at least 
+   half of it. The file must be locked. All other records are kept, even those beyond max_entries 
+   and max_bytes.
+ */
+static void compact_file(struct hyper_console_history_t *hist, LONGLONG end) {
+  struct file_records_t records;
+  LONGLONG kept_size = 0;
+  LONGLONG pos = end;
+  BOOL ok = TRUE;
+  
+  assert(hist != NULL);
+  assert(hist->file != NULL);
+  
+  memset(&records, 0, sizeof(records));
+  records.file = hist->file;
+  
+  while(ok) {
+    const wchar_t *text;
+    int length;
+    int count = records.count;
+    
+    text = history_file_prev_record(hist->file, &pos, &length);
+    if(!text)
+      break;
+      
+    ok = add_file_record(&records, pos, text, length);
+    if(records.count > count)
+      kept_size += history_file_record_size(length);
+  }
+  
+  if(ok && 2 * kept_size <= end) {
+    if(!history_file_replace(hist->file, get_file_record, &records, records.count))
+      debug_printf(L"history file: compaction failed with error %u\n", (unsigned)GetLastError());
+  }
+  
+  hyper_console_free_memory(records.starts);
+  hyper_console_free_memory(records.hashes);
+  hyper_console_free_memory(records.buckets);
+}
+
+static const wchar_t *get_file_record(void *context, int index, int *length) {
+  struct file_records_t *records = context;
+  LONGLONG pos;
+  
+  assert(records != NULL);
+  assert(0 <= index && index < records->count);
+  
+  // oldest first
+  pos = records->starts[records->count - 1 - index];
+  return history_file_next_record(records->file, &pos, length);
+}
+
 
 int console_history_count(struct hyper_console_history_t *hist) {
   if(hist == NULL)
@@ -77,7 +742,7 @@ const wchar_t *console_history_get(struct hyper_console_history_t *hist, int ind
     return NULL;
   }
   
-  line = hist->entries[index];
+  line = hist->entries[hist->first_entry + index];
   
   if(length != NULL) {
     *length = line->length;
@@ -139,6 +804,7 @@ void console_history_add(struct hyper_console_history_t *hist, const wchar_t *te
   struct history_line_t *line;
   const wchar_t *prev_text;
   int prev_length;
+  unsigned hash;
   
   assert(text != NULL || text_length == 0);
   
@@ -154,14 +820,14 @@ void console_history_add(struct hyper_console_history_t *hist, const wchar_t *te
     text_length = (int)ulen;
   }
   
-  if(text_length >= INT_MAX / 2)
+  if(text_length >= INT_MAX / 4)
     return;
     
   // Ignore empty entries
   if(text_length == 0)
     return;
     
-  // Ignore duplicates. TODO: ignore old duplicates if GetConsoleHistoryInfo() says so.
+  // Ignore repetitions of the newest entry.
   prev_text = console_history_get(hist, hist->entries_count - 1, &prev_length);
   if( prev_length == text_length &&
       memcmp(prev_text, text, sizeof(wchar_t) * text_length) == 0)
@@ -169,29 +835,161 @@ void console_history_add(struct hyper_console_history_t *hist, const wchar_t *te
     return;
   }
   
-  if(!resize_array(
-        (void**)&hist->entries,
-        &hist->entries_capacity,
-        sizeof(hist->entries[0]),
-        hist->entries_count + 1))
-  {
-    return;
+  hash = 0;
+  if(hist->options & HYPER_CONSOLE_HISTORY_NO_DUPLICATES) {
+    hash = hash_text(text, text_length);
+    line = find_duplicate(hist, text, text_length, hash);
+    if(line)
+      remove_entry(hist, find_entry_by_id(hist, line->id));
+      
+    if(hist->entries_count >= hist->bucket_count && !grow_buckets(hist))
+      return;
   }
   
-  line = hyper_console_allocate_memory(sizeof(struct history_line_t) + text_length * sizeof(wchar_t));
+  if(!reserve_entry(hist))
+    return;
+    
+  if(hist->next_id == INT_MAX)
+    renumber_entries(hist);
+    
+  line = allocate_line(hist, text_length);
   if(line == NULL)
     return;
     
+  line->hash = hash;
+  line->id = hist->next_id++;
   line->length = text_length;
   memcpy(&line->content[0], text, text_length * sizeof(wchar_t));
   line->content[text_length] = L'\0';
   
-  hist->entries[hist->entries_count] = line;
+  if(hist->bucket_count > 0)
+    link_to_bucket(hist, line);
+    
+  hist->entries[hist->first_entry + hist->entries_count] = line;
   hist->entries_count++;
+  hist->total_bytes += line->size;
+  
+  if(hist->index && !history_index_add(hist->index, line->id, line->content, line->length)) {
+    // an incomplete index would miss matches, fall back to scanning all entries
+    history_index_free(hist->index);
+    hist->index = NULL;
+  }
+  
+  if(hist->file && !history_file_append(hist->file, text, text_length))
+    debug_printf(L"history file: append failed with error %u\n", (unsigned)GetLastError());
+    
+  enforce_limits(hist);
   
   hist->current_index = hist->entries_count;
 }
 
+HYPER_CONSOLE_API
+void hyper_console_history_add(struct hyper_console_history_t *hist, const wchar_t *text, int text_length) {
+  console_history_add(hist, text, text_length);
+}
+
+static int find_in_line(const struct history_line_t *line, const wchar_t *pattern, int pattern_length) {
+  const wchar_t *s;
+  const wchar_t *last;
+  
+  assert(line != NULL);
+  assert(pattern != NULL);
+  assert(pattern_length > 0);
+  
+  if(pattern_length > line->length)
+    return -1;
+    
+  s = &line->content[0];
+  last = s + line->length - pattern_length;
+  while(s <= last) {
+    s = wmemchr(s, pattern[0], last - s + 1);
+    if(!s)
+      return -1;
+      
+    if(wmemcmp(s, pattern, pattern_length) == 0)
+      return (int)(s - &line->content[0]);
+      
+    ++s;
+  }
+  
+  return -1;
+}
+
+int console_history_find(struct hyper_console_history_t *hist, const wchar_t *pattern, int pattern_length, int before_index, int *match_pos) {
+  const int *ids;
+  int count;
+  int pos;
+  int i;
+  
+  assert(pattern != NULL || pattern_length == 0);
+  
+  if(match_pos)
+    *match_pos = 0;
+    
+  if(hist == NULL)
+    return -1;
+    
+  if(before_index > hist->entries_count)
+    before_index = hist->entries_count;
+    
+  if(before_index <= 0)
+    return -1;
+    
+  if(pattern_length <= 0)
+    return before_index - 1;
+    
+  if(hist->index_outdated)
+    rebuild_index(hist);
+    
+  if(hist->index && history_index_get_candidates(hist->index, pattern, pattern_length, &ids, &count)) {
+    int oldest_id = hist->entries[hist->first_entry]->id;
+    int before_id;
+    int lo = 0;
+    int hi = count;
+    
+    if(before_index < hist->entries_count)
+      before_id = hist->entries[hist->first_entry + before_index]->id;
+    else
+      before_id = hist->next_id;
+      
+    // find the first candidate >= before_id
+    while(lo < hi) {
+      int mid = lo + (hi - lo) / 2;
+      
+      if(ids[mid] < before_id)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    
+    while(lo-- > 0 && ids[lo] >= oldest_id) {
+      i = find_entry_by_id(hist, ids[lo]);
+      if(i < 0) // removed duplicate
+        continue;
+        
+      pos = find_in_line(hist->entries[hist->first_entry + i], pattern, pattern_length);
+      if(pos >= 0) {
+        if(match_pos)
+          *match_pos = pos;
+        return i;
+      }
+    }
+    
+    return -1;
+  }
+  
+  for(i = before_index - 1; i >= 0; --i) {
+    pos = find_in_line(hist->entries[hist->first_entry + i], pattern, pattern_length);
+    if(pos >= 0) {
+      if(match_pos)
+        *match_pos = pos;
+      return i;
+    }
+  }
+  
+  return -1;
+}
+
 int console_history_get_index(struct hyper_console_history_t *hist) {
   if(!hist)
     return 0;
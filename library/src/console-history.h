@@ -18,7 +18,8 @@ int console_history_count(struct hyper_console_history_t *hist);
   \param index The entries index. 0 is the oldest, console_history_count(hist)-1 the newest.
   \param length Optional output parameter where to store the text length.
   
-  \return The history entry or NULL on error.
+  \return The history entry or NULL on error. Entries loaded from a history file are not
+          NUL-terminated.
  */
 const wchar_t *console_history_get(struct hyper_console_history_t *hist, int index, int *length);
 
@@ -55,6 +56,24 @@ void console_history_set_future(struct hyper_console_history_t *hist, const wcha
 void console_history_add(struct hyper_console_history_t *hist, const wchar_t *text, int text_length);
 
 
+/** Find the newest entry that contains a text.
+
+  \param hist A console history buffer or NULL.
+  \param pattern The text to search for.
+  \param pattern_length The length of \a pattern. An empty pattern matches every entry.
+  \param before_index Only entries with smaller indices are searched. Pass console_history_count()
+                      to start with the newest entry.
+  \param match_pos Optional output parameter where to store the position of the match within 
+                   the entry.
+  
+  \return The entry index or -1 if no entry matches.
+  
+  Patterns of at least three characters are looked up in a trigram index, so the search time 
+  depends on the number of entries sharing the rarest trigram, not on the history size.
+ */
+int console_history_find(struct hyper_console_history_t *hist, const wchar_t *pattern, int pattern_length, int before_index, int *match_pos);
+
+
 /** Get the current history navigation index.
 
   \param hist A console history buffer or NULL.
@@ -0,0 +1,524 @@
+#include <hyper-console.h>
+
+#include "history-file.h"
+#include "debug.h"
+#include "memory-util.h"
+
+#include <assert.h>
+
+
+#define HISTORY_FILE_MAGIC  0x31484348 // "HCH1"
+
+#define ALIGN4(SIZE)  (((SIZE) + 3) & ~(LONGLONG)3)
+
+
+struct history_file_header_t {
+  DWORD magic;
+  DWORD char_size;
+};
+
+struct history_file_t {
+  wchar_t *path;
+  HANDLE file;
+  HANDLE mapping;
+  const BYTE *view;
+  LONGLONG view_size;
+  LONGLONG valid_end;
+};
+
+static HANDLE open_file_handle(const wchar_t *path, DWORD creation);
+static BOOL lock_handle(HANDLE file);
+static void unlock_handle(HANDLE file);
+static BOOL is_current_file(struct history_file_t *file);
+static BOOL reopen_file(struct history_file_t *file);
+static BOOL write_all(HANDLE file, const void *data, LONGLONG size);
+static BOOL seek_to(HANDLE file, LONGLONG pos, DWORD method);
+static DWORD read_length(struct history_file_t *file, LONGLONG pos);
+static BOOL find_valid_end(struct history_file_t *file);
+
+
+/* Open a history file for sharing. FILE_SHARE_DELETE allows compaction to replace the file while 
+   other processes have it open.
+ */
+static HANDLE open_file_handle(const wchar_t *path, DWORD creation) {
+  return CreateFileW(
+           path,
+           GENERIC_READ | GENERIC_WRITE,
+           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+           NULL,
+           creation,
+           FILE_ATTRIBUTE_NORMAL,
+           NULL);
+}
+
+static BOOL lock_handle(HANDLE file) {
+  OVERLAPPED overlapped;
+  
+  // lock a byte far beyond the end of file, so that readers are never blocked
+  memset(&overlapped, 0, sizeof(overlapped));
+  overlapped.Offset     = 0xFFFFFFFF;
+  overlapped.OffsetHigh = 0x7FFFFFFF;
+  return LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &overlapped);
+}
+
+static void unlock_handle(HANDLE file) {
+  OVERLAPPED overlapped;
+  
+  memset(&overlapped, 0, sizeof(overlapped));
+  overlapped.Offset     = 0xFFFFFFFF;
+  overlapped.OffsetHigh = 0x7FFFFFFF;
+  UnlockFileEx(file, 0, 1, 0, &overlapped);
+}
+
+/* Check whether the path still names the opened file, i.e. no other process replaced it by a 
+   compacted copy. If the path cannot be opened, the opened file is kept.
+ */
+static BOOL is_current_file(struct history_file_t *file) {
+  BY_HANDLE_FILE_INFORMATION opened;
+  BY_HANDLE_FILE_INFORMATION current;
+  HANDLE handle;
+  BOOL same;
+  
+  assert(file != NULL);
+  
+  handle = CreateFileW(
+             file->path,
+             0,
+             FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+             NULL,
+             OPEN_EXISTING,
+             FILE_ATTRIBUTE_NORMAL,
+             NULL);
+  if(handle == INVALID_HANDLE_VALUE)
+    return TRUE;
+    
+  same = !GetFileInformationByHandle(file->file, &opened) ||
+         !GetFileInformationByHandle(handle, &current) ||
+         (opened.dwVolumeSerialNumber == current.dwVolumeSerialNumber &&
+          opened.nFileIndexHigh       == current.nFileIndexHigh &&
+          opened.nFileIndexLow        == current.nFileIndexLow);
+          
+  CloseHandle(handle);
+  return same;
+}
+
+/* Switch to the file that the path names now. An existing mapping stays valid.
+ */
+static BOOL reopen_file(struct history_file_t *file) {
+  HANDLE handle;
+  
+  assert(file != NULL);
+  
+  handle = open_file_handle(file->path, OPEN_EXISTING);
+  if(handle == INVALID_HANDLE_VALUE)
+    return FALSE;
+    
+  CloseHandle(file->file);
+  file->file = handle;
+  return TRUE;
+}
+
+static BOOL write_all(HANDLE file, const void *data, LONGLONG size) {
+  const BYTE *bytes = data;
+  
+  while(size > 0) {
+    DWORD chunk = size > 0x10000000 ? 0x10000000 : (DWORD)size;
+    DWORD written;
+    
+    if(!WriteFile(file, bytes, chunk, &written, NULL) || written == 0)
+      return FALSE;
+      
+    bytes += written;
+    size -= written;
+  }
+  
+  return TRUE;
+}
+
+static BOOL seek_to(HANDLE file, LONGLONG pos, DWORD method) {
+  LARGE_INTEGER distance;
+  
+  distance.QuadPart = pos;
+  return SetFilePointerEx(file, distance, NULL, method);
+}
+
+static DWORD read_length(struct history_file_t *file, LONGLONG pos) {
+  DWORD length;
+  
+  assert(file != NULL);
+  assert(file->view != NULL);
+  assert(pos >= 0 && pos + (LONGLONG)sizeof(DWORD) <= file->view_size);
+  
+  memcpy(&length, file->view + pos, sizeof(DWORD));
+  return length;
+}
+
+/* Find the end of the last complete record. Normally, that is the end of the file. Otherwise,
+   a write was interrupted and the file must be scanned from the start.
+ */
+static BOOL find_valid_end(struct history_file_t *file) {
+  LONGLONG pos;
+  int length;
+  
+  assert(file != NULL);
+  
+  pos = file->view_size;
+  if(pos == sizeof(struct history_file_header_t) || history_file_prev_record(file, &pos, &length)) {
+    file->valid_end = file->view_size;
+    return TRUE;
+  }
+  
+  debug_printf(L"history file: incomplete record at the end, scanning %d bytes\n", (int)file->view_size);
+  
+  pos = sizeof(struct history_file_header_t);
+  file->valid_end = file->view_size;
+  while(history_file_next_record(file, &pos, &length)) {
+  }
+  
+  file->valid_end = pos;
+  return TRUE;
+}
+
+
+struct history_file_t *history_file_open(const wchar_t *path) {
+  struct history_file_t *file;
+  LARGE_INTEGER size;
+  BOOL ok = FALSE;
+  
+  assert(path != NULL);
+  
+  file = hyper_console_allocate_memory(sizeof(struct history_file_t));
+  if(!file)
+    return NULL;
+    
+  memset(file, 0, sizeof(struct history_file_t));
+  file->path = hyper_console_allocate_memory((wcslen(path) + 1) * sizeof(wchar_t));
+  if(!file->path) {
+    hyper_console_free_memory(file);
+    return NULL;
+  }
+  
+  memcpy(file->path, path, (wcslen(path) + 1) * sizeof(wchar_t));
+  file->file = open_file_handle(path, OPEN_ALWAYS);
+  if(file->file == INVALID_HANDLE_VALUE) {
+    hyper_console_free_memory(file->path);
+    hyper_console_free_memory(file);
+    return NULL;
+  }
+  
+  if(!history_file_lock(file)) {
+    history_file_close(file);
+    return NULL;
+  }
+  
+  if(GetFileSizeEx(file->file, &size)) {
+    struct history_file_header_t header;
+    
+    if(size.QuadPart == 0) {
+      header.magic = HISTORY_FILE_MAGIC;
+      header.char_size = sizeof(wchar_t);
+      ok = seek_to(file->file, 0, FILE_BEGIN) && write_all(file->file, &header, sizeof(header));
+    }
+    else if(size.QuadPart >= (LONGLONG)sizeof(header)) {
+      DWORD read;
+      
+      ok = seek_to(file->file, 0, FILE_BEGIN) &&
+           ReadFile(file->file, &header, sizeof(header), &read, NULL) &&
+           read == sizeof(header) &&
+           header.magic == HISTORY_FILE_MAGIC &&
+           header.char_size == sizeof(wchar_t);
+    }
+  }
+  
+  history_file_unlock(file);
+  if(!ok) {
+    history_file_close(file);
+    return NULL;
+  }
+  
+  return file;
+}
+
+void history_file_close(struct history_file_t *file) {
+  if(file == NULL)
+    return;
+    
+  history_file_unmap(file);
+  CloseHandle(file->file);
+  hyper_console_free_memory(file->path);
+  hyper_console_free_memory(file);
+}
+
+BOOL history_file_lock(struct history_file_t *file) {
+  assert(file != NULL);
+  
+  for(;;) {
+    if(!lock_handle(file->file))
+      return FALSE;
+      
+    if(is_current_file(file))
+      return TRUE;
+      
+    // Another process compacted the file. Records must go to the new one.
+    unlock_handle(file->file);
+    if(!reopen_file(file))
+      return FALSE;
+  }
+}
+
+void history_file_unlock(struct history_file_t *file) {
+  assert(file != NULL);
+  
+  unlock_handle(file->file);
+}
+
+BOOL history_file_map(struct history_file_t *file, LONGLONG *end) {
+  LARGE_INTEGER size;
+  
+  assert(file != NULL);
+  assert(end != NULL);
+  
+  history_file_unmap(file);
+  *end = sizeof(struct history_file_header_t);
+  
+  if(!GetFileSizeEx(file->file, &size))
+    return FALSE;
+    
+  if(size.QuadPart <= (LONGLONG)sizeof(struct history_file_header_t))
+    return TRUE; // nothing to map
+    
+  if((ULONGLONG)size.QuadPart > (SIZE_T)-1)
+    return FALSE;
+    
+  file->mapping = CreateFileMappingW(file->file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if(!file->mapping)
+    return FALSE;
+    
+  file->view = MapViewOfFile(file->mapping, FILE_MAP_READ, 0, 0, (SIZE_T)size.QuadPart);
+  if(!file->view) {
+    CloseHandle(file->mapping);
+    file->mapping = NULL;
+    return FALSE;
+  }
+  
+  file->view_size = size.QuadPart;
+  find_valid_end(file);
+  *end = file->valid_end;
+  return TRUE;
+}
+
+void history_file_unmap(struct history_file_t *file) {
+  assert(file != NULL);
+  
+  if(file->view)
+    UnmapViewOfFile(file->view);
+    
+  if(file->mapping)
+    CloseHandle(file->mapping);
+    
+  file->view = NULL;
+  file->mapping = NULL;
+  file->view_size = 0;
+  file->valid_end = 0;
+}
+
+const wchar_t *history_file_prev_record(struct history_file_t *file, LONGLONG *pos, int *length) {
+  LONGLONG start;
+  DWORD len;
+  
+  assert(file != NULL);
+  assert(pos != NULL);
+  assert(length != NULL);
+  
+  *length = 0;
+  if(!file->view || *pos > file->valid_end || *pos - (LONGLONG)sizeof(struct history_file_header_t) < 2 * (LONGLONG)sizeof(DWORD))
+    return NULL;
+    
+  len = read_length(file, *pos - sizeof(DWORD));
+  if(len == 0 || len >= INT_MAX / sizeof(wchar_t))
+    return NULL;
+    
+  start = *pos - history_file_record_size(len);
+  if(start < (LONGLONG)sizeof(struct history_file_header_t) || read_length(file, start) != len)
+    return NULL;
+    
+  *pos = start;
+  *length = len;
+  return (const wchar_t*)(file->view + start + sizeof(DWORD));
+}
+
+const wchar_t *history_file_next_record(struct history_file_t *file, LONGLONG *pos, int *length) {
+  LONGLONG end;
+  DWORD len;
+  
+  assert(file != NULL);
+  assert(pos != NULL);
+  assert(length != NULL);
+  
+  *length = 0;
+  if(!file->view || *pos < (LONGLONG)sizeof(struct history_file_header_t) || *pos + 2 * (LONGLONG)sizeof(DWORD) > file->valid_end)
+    return NULL;
+    
+  len = read_length(file, *pos);
+  if(len == 0 || len >= INT_MAX / sizeof(wchar_t))
+    return NULL;
+    
+  end = *pos + history_file_record_size(len);
+  if(end > file->valid_end || read_length(file, end - sizeof(DWORD)) != len)
+    return NULL;
+    
+  *length = len;
+  *pos = end;
+  return (const wchar_t*)(file->view + end - history_file_record_size(len) + sizeof(DWORD));
+}
+
+LONGLONG history_file_record_size(int length) {
+  assert(length >= 0);
+  
+  return 2 * sizeof(DWORD) + ALIGN4((LONGLONG)length * sizeof(wchar_t));
+}
+
+LONGLONG history_file_get_size(struct history_file_t *file) {
+  assert(file != NULL);
+  
+  return file->view_size;
+}
+
+BOOL history_file_append(struct history_file_t *file, const wchar_t *text, int length) {
+  BYTE *record;
+  LONGLONG size;
+  DWORD len = length;
+  BOOL ok;
+  
+  assert(file != NULL);
+  assert(text != NULL);
+  assert(length > 0);
+  
+  size = history_file_record_size(length);
+  record = hyper_console_allocate_memory((size_t)size);
+  if(!record)
+    return FALSE;
+    
+  memset(record, 0, (size_t)size);
+  memcpy(record, &len, sizeof(DWORD));
+  memcpy(record + sizeof(DWORD), text, length * sizeof(wchar_t));
+  memcpy(record + size - sizeof(DWORD), &len, sizeof(DWORD));
+  
+  // a single write, so that readers see either nothing or the whole record
+  ok = history_file_lock(file);
+  if(ok) {
+    ok = seek_to(file->file, 0, FILE_END) && write_all(file->file, record, size);
+    history_file_unlock(file);
+  }
+  
+  hyper_console_free_memory(record);
+  return ok;
+}
+
+BOOL history_file_replace(
+  struct history_file_t *file,
+  const wchar_t *(*get_record)(void *context, int index, int *length),
+  void *context,
+  int count
+) {
+  struct history_file_header_t header;
+  wchar_t *temp_path;
+  HANDLE temp;
+  HANDLE handle;
+  size_t path_length;
+  BYTE *buffer;
+  BYTE *s;
+  LONGLONG size = 0;
+  BOOL ok;
+  int i;
+  
+  assert(file != NULL);
+  assert(get_record != NULL);
+  
+  for(i = 0; i < count; ++i) {
+    int length;
+    
+    get_record(context, i, &length);
+    size += history_file_record_size(length);
+  }
+  
+  if((ULONGLONG)size >= (size_t)-1)
+    return FALSE;
+    
+  buffer = hyper_console_allocate_memory((size_t)size + 1);
+  if(!buffer)
+    return FALSE;
+    
+  memset(buffer, 0, (size_t)size);
+  s = buffer;
+  for(i = 0; i < count; ++i) {
+    const wchar_t *text;
+    int length;
+    DWORD len;
+    
+    text = get_record(context, i, &length);
+    len = length;
+    memcpy(s, &len, sizeof(DWORD));
+    memcpy(s + sizeof(DWORD), text, length * sizeof(wchar_t));
+    s += history_file_record_size(length);
+    memcpy(s - sizeof(DWORD), &len, sizeof(DWORD));
+  }
+  
+  // The records may have come from the mapping, which would prevent replacing the file.
+  history_file_unmap(file);
+       
+  path_length = wcslen(file->path);
+  temp_path = hyper_console_allocate_memory((path_length + 5) * sizeof(wchar_t));
+  if(!temp_path) {
+    hyper_console_free_memory(buffer);
+    return FALSE;
+  }
+  
+  memcpy(temp_path, file->path, path_length * sizeof(wchar_t));
+  memcpy(temp_path + path_length, L".tmp", 5 * sizeof(wchar_t));
+  
+  temp = open_file_handle(temp_path, CREATE_ALWAYS);
+  if(temp == INVALID_HANDLE_VALUE) {
+    hyper_console_free_memory(temp_path);
+    hyper_console_free_memory(buffer);
+    return FALSE;
+  }
+  
+  header.magic = HISTORY_FILE_MAGIC;
+  header.char_size = sizeof(wchar_t);
+  ok = write_all(temp, &header, sizeof(header)) &&
+       write_all(temp, buffer, size) &&
+       FlushFileBuffers(temp);
+  CloseHandle(temp);
+  hyper_console_free_memory(buffer);
+  
+  // The old file stays locked until the new one is in place, so that no record gets lost.
+  if(ok) {
+    ok = ReplaceFileW(file->path, temp_path, NULL, REPLACEFILE_IGNORE_MERGE_ERRORS, NULL, NULL) ||
+         MoveFileExW(temp_path, file->path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+  }
+  
+  if(!ok) {
+    DWORD error = GetLastError();
+    
+    DeleteFileW(temp_path);
+    hyper_console_free_memory(temp_path);
+    SetLastError(error);
+    return FALSE;
+  }
+  
+  hyper_console_free_memory(temp_path);
+  
+  handle = open_file_handle(file->path, OPEN_EXISTING);
+  if(handle != INVALID_HANDLE_VALUE) {
+    if(lock_handle(handle)) {
+      CloseHandle(file->file);
+      file->file = handle;
+    }
+    else {
+      CloseHandle(handle);
+    }
+  }
+  
+  return TRUE;
+}
@@ -0,0 +1,123 @@
+#ifndef __CONSOLE__HISTORY_FILE_H__
+#define __CONSOLE__HISTORY_FILE_H__
+
+#include <windows.h>
+
+
+/** An append-only history log on disk.
+
+  The file starts with a small header, followed by one record per entry:
+  the text length, the text (padded to a multiple of 4 bytes) and the length again.
+  The trailing length allows reading the newest records without touching the older ones.
+  Records are appended under an exclusive file lock, so several processes can share a file.
+ */
+struct history_file_t;
+
+
+/** Open or create a history file.
+
+  \param path The file name.
+  
+  \return The file or NULL if it cannot be opened or is not a history file.
+ */
+struct history_file_t *history_file_open(const wchar_t *path);
+
+
+/** Unmap and close a history file.
+
+  \param file A history file or NULL.
+ */
+void history_file_close(struct history_file_t *file);
+
+
+/** Acquire the exclusive lock that serializes writers across processes.
+
+  If another process has replaced the file in the meantime, the new file is opened and locked 
+  instead.
+ */
+BOOL history_file_lock(struct history_file_t *file);
+
+
+/** Release the lock acquired by history_file_lock().
+ */
+void history_file_unlock(struct history_file_t *file);
+
+
+/** Map the current file contents into memory.
+
+  \param file A history file. It should be locked.
+  \param end Output parameter for the end of the last complete record.
+             Incomplete records at the end (e.g. after a crash) are ignored.
+             
+  \return TRUE on success. The mapping stays valid until history_file_unmap() or
+          history_file_close().
+ */
+BOOL history_file_map(struct history_file_t *file, LONGLONG *end);
+
+
+/** Release the mapping created by history_file_map().
+ */
+void history_file_unmap(struct history_file_t *file);
+
+
+/** Get the mapped record that ends at a position.
+
+  \param file A mapped history file.
+  \param pos The end of a record. Will be set to the start of that record.
+  \param length Output parameter for the text length.
+  
+  \return The record text (not 0-terminated) or NULL if there is no record before \a pos.
+ */
+const wchar_t *history_file_prev_record(struct history_file_t *file, LONGLONG *pos, int *length);
+
+
+/** Get the mapped record that starts at a position.
+
+  \param file A mapped history file.
+  \param pos The start of a record. Will be set to the end of that record.
+  \param length Output parameter for the text length.
+  
+  \return The record text (not 0-terminated) or NULL if there is no complete record at \a pos.
+ */
+const wchar_t *history_file_next_record(struct history_file_t *file, LONGLONG *pos, int *length);
+
+
+/** Get the size of a record in the file.
+ */
+LONGLONG history_file_record_size(int length);
+
+
+/** Get the file size at the time it was mapped.
+ */
+LONGLONG history_file_get_size(struct history_file_t *file);
+
+
+/** Append a record to the file. This locks the file while writing.
+ */
+BOOL history_file_append(struct history_file_t *file, const wchar_t *text, int length);
+
+
+/** Replace all records of the file.
+
+  \param file A locked history file.
+  \param get_record Callback that returns the text and length of the i-th new record. The text 
+                    may point into the mapping of \a file.
+  \param context The first argument for \a get_record.
+  \param count The number of records.
+  
+  \return TRUE on success, FALSE on failure. The mapping is released once all records are 
+          copied.
+  
+  The records are written to a temporary file next to the history file, which then replaces it. 
+  On failure, the history file is unchanged. Replacing fails while other processes have the file 
+  mapped, so they should only map it while they hold the lock. Afterwards, \a file refers to the new file and is still locked. Other processes 
+  switch to the new file the next time they lock it.
+ */
+BOOL history_file_replace(
+  struct history_file_t *file,
+  const wchar_t *(*get_record)(void *context, int index, int *length),
+  void *context,
+  int count);
+
+
+#endif // __CONSOLE__HISTORY_FILE_H__
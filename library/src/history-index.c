@@ -0,0 +1,187 @@
+#include <hyper-console.h>
+
+#include "history-index.h"
+#include "memory-util.h"
+
+#include <assert.h>
+
+
+/* Minimum number of hash table slots (must be a power of 2) */
+#define MIN_SLOT_CAPACITY  256
+
+
+struct trigram_postings_t {
+  ULONGLONG key;
+  int *ids; // [capacity], ascending
+  int count;
+  int capacity; // 0 for unused hash table slots
+};
+
+struct history_index_t {
+  struct trigram_postings_t *slots; // [slot_capacity], open addressing with linear probing
+  int slot_capacity;
+  int slot_count;
+};
+
+static ULONGLONG make_trigram_key(const wchar_t *text);
+static unsigned hash_trigram_key(ULONGLONG key);
+static struct trigram_postings_t *find_slot(struct trigram_postings_t *slots, int slot_capacity, ULONGLONG key);
+static BOOL grow_slots(struct history_index_t *index);
+
+
+static ULONGLONG make_trigram_key(const wchar_t *text) {
+  assert(text != NULL);
+  
+  return ((ULONGLONG)(unsigned short)text[0] << 32) |
+         ((ULONGLONG)(unsigned short)text[1] << 16) |
+         ((ULONGLONG)(unsigned short)text[2]);
+}
+
+static unsigned hash_trigram_key(ULONGLONG key) {
+  return (unsigned)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+/* Find the slot of a key or the empty slot where it belongs.
+ */
+static struct trigram_postings_t *find_slot(struct trigram_postings_t *slots, int slot_capacity, ULONGLONG key) {
+  unsigned mask;
+  unsigned i;
+  
+  assert(slots != NULL);
+  assert(slot_capacity > 0);
+  assert((slot_capacity & (slot_capacity - 1)) == 0);
+  
+  mask = (unsigned)slot_capacity - 1;
+  i = hash_trigram_key(key) & mask;
+  while(slots[i].capacity != 0 && slots[i].key != key)
+    i = (i + 1) & mask;
+    
+  return &slots[i];
+}
+
+static BOOL grow_slots(struct history_index_t *index) {
+  struct trigram_postings_t *new_slots;
+  int new_capacity;
+  int i;
+  
+  assert(index != NULL);
+  
+  new_capacity = index->slot_capacity > 0 ? 2 * index->slot_capacity : MIN_SLOT_CAPACITY;
+  if(new_capacity <= 0 || new_capacity > (1 << 30) / (int)sizeof(new_slots[0]))
+    return FALSE;
+    
+  new_slots = hyper_console_allocate_memory(new_capacity * sizeof(new_slots[0]));
+  if(!new_slots)
+    return FALSE;
+    
+  memset(new_slots, 0, new_capacity * sizeof(new_slots[0]));
+  for(i = 0; i < index->slot_capacity; ++i) {
+    if(index->slots[i].capacity != 0)
+      *find_slot(new_slots, new_capacity, index->slots[i].key) = index->slots[i];
+  }
+  
+  hyper_console_free_memory(index->slots);
+  index->slots = new_slots;
+  index->slot_capacity = new_capacity;
+  return TRUE;
+}
+
+
+struct history_index_t *history_index_new(void) {
+  struct history_index_t *index;
+  
+  index = hyper_console_allocate_memory(sizeof(struct history_index_t));
+  if(!index)
+    return NULL;
+    
+  memset(index, 0, sizeof(struct history_index_t));
+  
+  return index;
+}
+
+void history_index_free(struct history_index_t *index) {
+  int i;
+  
+  if(index == NULL)
+    return;
+    
+  for(i = 0; i < index->slot_capacity; ++i)
+    hyper_console_free_memory(index->slots[i].ids);
+    
+  hyper_console_free_memory(index->slots);
+  hyper_console_free_memory(index);
+}
+
+BOOL history_index_add(struct history_index_t *index, int id, const wchar_t *text, int length) {
+  int i;
+  
+  assert(index != NULL);
+  assert(id >= 0);
+  assert(text != NULL || length == 0);
+  
+  for(i = 0; i + 3 <= length; ++i) {
+    struct trigram_postings_t *slot;
+    ULONGLONG key;
+    
+    // keep the load factor below 3/4
+    if(4 * (index->slot_count + 1) > 3 * index->slot_capacity && !grow_slots(index))
+      return FALSE;
+      
+    key = make_trigram_key(text + i);
+    slot = find_slot(index->slots, index->slot_capacity, key);
+    
+    // repeated trigram within the same entry
+    if(slot->count > 0 && slot->ids[slot->count - 1] == id)
+      continue;
+      
+    assert(slot->count == 0 || slot->ids[slot->count - 1] < id);
+    
+    if(slot->capacity == 0) {
+      if(!resize_array((void**)&slot->ids, &slot->capacity, sizeof(slot->ids[0]), 1))
+        return FALSE;
+        
+      slot->key = key;
+      index->slot_count++;
+    }
+    else if(!resize_array((void**)&slot->ids, &slot->capacity, sizeof(slot->ids[0]), slot->count + 1))
+      return FALSE;
+      
+    slot->ids[slot->count++] = id;
+  }
+  
+  return TRUE;
+}
+
+BOOL history_index_get_candidates(struct history_index_t *index, const wchar_t *pattern, int pattern_length, const int **ids, int *count) {
+  const struct trigram_postings_t *rarest = NULL;
+  int i;
+  
+  assert(index != NULL);
+  assert(pattern != NULL || pattern_length == 0);
+  assert(ids != NULL);
+  assert(count != NULL);
+  
+  *ids = NULL;
+  *count = 0;
+  
+  if(pattern_length < 3)
+    return FALSE;
+    
+  if(index->slot_capacity == 0)
+    return TRUE;
+    
+  for(i = 0; i + 3 <= pattern_length; ++i) {
+    const struct trigram_postings_t *slot;
+    
+    slot = find_slot(index->slots, index->slot_capacity, make_trigram_key(pattern + i));
+    if(slot->capacity == 0) // no entry contains this trigram
+      return TRUE;
+      
+    if(!rarest || slot->count < rarest->count)
+      rarest = slot;
+  }
+  
+  *ids = rarest->ids;
+  *count = rarest->count;
+  return TRUE;
+}
@@ -0,0 +1,60 @@
+#ifndef __CONSOLE__HISTORY_INDEX_H__
+#define __CONSOLE__HISTORY_INDEX_H__
+
+#include <windows.h>
+
+
+/** A substring index over history entries.
+
+  Every trigram (three consecutive characters) of an entry maps to a posting list of the ids of
+  all entries that contain it. Entries are added incrementally and must be added in ascending id
+  order, so every posting list is sorted.
+ */
+struct history_index_t;
+
+
+/** Create a new, empty history index.
+
+  \return The new index or NULL on out-of-memory. Free it with history_index_free().
+ */
+struct history_index_t *history_index_new(void);
+
+
+/** Free a history index.
+
+  \param index A history index or NULL.
+ */
+void history_index_free(struct history_index_t *index);
+
+
+/** Add all trigrams of an entry to the index.
+
+  \param index A history index.
+  \param id The entry id. It must be larger than all ids added before.
+  \param text The entry text.
+  \param length The length of \a text.
+
+  \return TRUE on success, FALSE on out-of-memory. The index is incomplete after a failure
+          and should be discarded.
+ */
+BOOL history_index_add(struct history_index_t *index, int id, const wchar_t *text, int length);
+
+
+/** Get the ids of all entries that might contain a pattern.
+
+  \param index A history index.
+  \param pattern The search pattern.
+  \param pattern_length The length of \a pattern.
+  \param ids Output parameter for the ascending candidate ids. Points into the index and stays
+             valid until the next history_index_add().
+  \param count Output parameter for the number of candidate ids.
+
+  \return FALSE if the pattern is too short for the index. The caller must scan all entries then.
+
+  The candidates are the posting list of the pattern's rarest trigram, so they are a superset of
+  the actual matches and must be verified.
+ */
+BOOL history_index_get_candidates(struct history_index_t *index, const wchar_t *pattern, int pattern_length, const int **ids, int *count);
+
+
+#endif // __CONSOLE__HISTORY_INDEX_H__
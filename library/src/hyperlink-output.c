@@ -1,8 +1,12 @@
+#define _WIN32_WINNT 0x0600
+
 #include "hyperlink-output.h"
 
+#include "console-backend.h"
 #include "console-buffer-io.h"
 #include "read-input.h"
 #include "scroll-counter.h"
+#include "scrollback-archive.h"
 #include "memory-util.h"
 #include "debug.h"
 
@@ -12,6 +16,21 @@
 
 #define LINE_CANARY_SIZE  3
 
+#define MIN(A, B)  ((A) < (B) ? (A) : (B))
+#define MAX(A, B)  ((A) > (B) ? (A) : (B))
+
+/* Usable size of a regular link arena chunk in bytes. Larger blocks get a chunk of their own. */
+#define LINK_CHUNK_SIZE  (16 * 1024 - (int)sizeof(struct link_chunk_t))
+
+#define ALIGN_SIZE(SIZE)  (((SIZE) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+/* A run of equal console attributes.
+ */
+struct attribute_run_t {
+  WORD attribute;
+  int length;
+};
+
 struct hyperlink_t {
   struct hyperlink_t *prev_link;
   
@@ -21,20 +40,77 @@ struct hyperlink_t {
   int end_global_line;
   int end_column;
   
-  wchar_t *title;
-  wchar_t *input_text;
+  struct hyper_console_link_string_t *title;
+  struct hyper_console_link_string_t *input_text;
   
-  int inactive_attribute_count;
-  WORD *inactive_attributes;
+  int inactive_attribute_count; // total length of the saved attribute runs
+  int inactive_run_count;
+  struct attribute_run_t *inactive_runs; // [inactive_run_count] if there is more than one run
+  WORD inactive_attribute; // the only saved attribute if inactive_run_count == 1
   
   WORD attr_previous;
   WORD attr_active;
+  
+  unsigned is_open: 1;
+  unsigned is_active: 1; // shows attr_active, the inactive attributes are saved
 };
 
 struct dangling_hyperlinks_t { // just another name for struct hyperlink_t
   struct hyperlink_t first;
 };
 
+/* Link records and their title and input text are allocated at the end of the newest chunk and 
+   never move. Links usually die in the order they were created, when they scroll out of the 
+   buffer, so a chunk is released as a whole when its last block is freed. The chunk data follows
+   the header, and every block starts with a pointer to its chunk.
+ */
+struct link_chunk_t {
+  struct link_chunk_t *prev;
+  struct link_chunk_t *next;
+  int used;
+  int capacity;
+  int live_blocks;
+};
+
+/* An interned, reference counted link title or input text. It consists of an optional shared
+   prefix and the suffix text. Equal (prefix, suffix) pairs are stored only once.
+ */
+struct hyper_console_link_string_t {
+  struct hyper_console_link_string_t *prefix;
+  struct hyper_console_link_string_t *next_in_bucket;
+  unsigned hash;
+  int ref_count;
+  int length; // including the prefix
+  int suffix_length;
+  wchar_t suffix[1]; // [suffix_length], not 0-terminated
+};
+
+/* The arena is shared by all hyperlink collections, because cut links may outlive their 
+   collection. It is guarded by _srw_global_links while the hyperlink system is initialized.
+ */
+struct link_arena_t {
+  struct link_chunk_t *oldest_chunk;
+  struct link_chunk_t *newest_chunk;
+  struct link_chunk_t *spare_chunk;
+  
+  /* Hash set of all interned strings, chained by hyper_console_link_string_t::next_in_bucket.
+   */
+  struct hyper_console_link_string_t **buckets; // [bucket_count]
+  int bucket_count;
+  
+  struct hyper_console_link_statistics_t stats;
+};
+
+/* An entry of the link index, which holds all links of a collection sorted by start position.
+   The reach is the maximum end position of this and all preceding entries. A search for the links
+   that contain a position can stop at the first entry whose reach is not after that position.
+ */
+struct link_index_entry_t {
+  struct hyperlink_t *link;
+  int reach_line;
+  int reach_column; // negative while the entry is being removed
+};
+
 struct hyperlink_collection_t {
   HANDLE output_handle;
   
@@ -46,9 +122,25 @@ struct hyperlink_collection_t {
   int num_open_links;
   struct hyperlink_t *last_link;
   
+  struct link_index_entry_t *index;
+  int index_count;
+  int index_capacity;
+  
+  int min_end_line; // no link ends before this global line
+  
+  /* Only links that scroll into view are activated during input. All active links lie within 
+     these global lines.
+   */
+  int active_first_line;
+  int active_last_line;
+  BOOL input_active;
+  
   struct hyperlink_t *mouse_over_link;
   struct hyperlink_t *pressed_link;
   
+  WORD *attribute_buffer; // scratch space for reading and writing link attributes
+  int attribute_buffer_capacity;
+  
   wchar_t old_title[256];
   
   WORD attr_default;
@@ -59,17 +151,36 @@ static void init_hyperlink_collection(struct hyperlink_collection_t *hc);
 static void init_colors(struct hyperlink_collection_t *hc);
 static void free_hyperlink_collection(struct hyperlink_collection_t *hc);
 
+static void *allocate_link_block(int size);
+static void free_link_block(void *data);
+static void trim_link_arena(void);
+
+static unsigned hash_link_string(const struct hyper_console_link_string_t *prefix, const wchar_t *text, int length);
+static BOOL grow_link_string_buckets(void);
+static struct hyper_console_link_string_t *intern_link_string(struct hyper_console_link_string_t *prefix, const wchar_t *text, int length);
+static void release_link_string(struct hyper_console_link_string_t *str);
+static int copy_link_string_text(const struct hyper_console_link_string_t *str, wchar_t *buf, int buf_len);
+static wchar_t *get_link_string_text(const struct hyper_console_link_string_t *str);
+
 static void free_link_at(struct hyperlink_t **last_link);
 static void clean_old_links(struct hyperlink_collection_t *hc, int first_keep_line);
 static struct hyperlink_t *open_new_link(struct hyperlink_collection_t *hc);
 static void close_link(struct hyperlink_collection_t *hc);
 static struct dangling_hyperlinks_t *cut_links_after_cursor(struct hyperlink_collection_t *hc);
-static void set_open_link_title(struct hyperlink_collection_t *hc, const wchar_t *title, int title_length);
-static void set_open_link_input_text(struct hyperlink_collection_t *hc, const wchar_t *text, int text_length);
+static void set_open_link_title(struct hyperlink_collection_t *hc, struct hyper_console_link_string_t *title);
+static void set_open_link_input_text(struct hyperlink_collection_t *hc, struct hyper_console_link_string_t *text);
 static WORD set_open_link_color(struct hyperlink_collection_t *hc, WORD attribute);
 
 static void hs_paste_and_activate_links(struct hyperlink_collection_t *hc, struct dangling_hyperlinks_t *links);
 
+static int count_links_starting_before(struct hyperlink_collection_t *hc, int line, int column, BOOL inclusive);
+static int count_entries_reaching_before_line(struct hyperlink_collection_t *hc, int line);
+static int find_link_in_index(struct hyperlink_collection_t *hc, const struct hyperlink_t *link);
+static void set_link_index_reach(struct hyperlink_collection_t *hc, int i);
+static void update_link_index_reach(struct hyperlink_collection_t *hc, int first);
+static BOOL add_to_link_index(struct hyperlink_collection_t *hc, struct hyperlink_t *link);
+static void remove_from_link_index(struct hyperlink_collection_t *hc, struct hyperlink_t *first, struct hyperlink_t *stop);
+
 static BOOL is_global_position_before(int a_line, int a_col, int b_line, int b_col);
 static struct hyperlink_t *find_link(struct hyperlink_collection_t *hc, COORD pos);
 static int find_link_visual_position(struct hyperlink_collection_t *hc, const struct hyperlink_t *link, COORD *position);
@@ -80,10 +191,14 @@ static BOOL save_old_console_title(struct hyperlink_collection_t *hc);
 static void set_console_title(struct hyperlink_collection_t *hc, const wchar_t *title);
 
 static BOOL invert_link_colors(struct hyperlink_collection_t *hc, const struct hyperlink_t *link);
+static COORD advance_position(struct hyperlink_collection_t *hc, COORD pos, int count);
+static BOOL save_inactive_attributes(struct hyperlink_t *link, const WORD *attributes, int length);
 static BOOL activate_link(struct hyperlink_collection_t *hc, struct hyperlink_t *link);
 static void deactivate_link(struct hyperlink_collection_t *hc, struct hyperlink_t *link);
-static void activate_all_links(struct hyperlink_collection_t *hc);
-static void deactivate_all_links(struct hyperlink_collection_t *hc);
+static BOOL get_visible_lines(struct hyperlink_collection_t *hc, int *first_line, int *last_line);
+static int activate_visible_links(struct hyperlink_collection_t *hc, BOOL count_only);
+static void activate_released_link(struct hyperlink_collection_t *hc, struct hyperlink_t *link);
+static void deactivate_active_links(struct hyperlink_collection_t *hc);
 
 static BOOL hs_click(struct hyperlink_collection_t *hc, COORD local, COORD local_end);
 static BOOL hs_get_hover_title(struct hyperlink_collection_t *hc, COORD local, COORD local_end, wchar_t *buf, size_t buf_len);
@@ -101,6 +216,7 @@ static BOOL hs_handle_mouse_event(struct hyperlink_collection_t *hc, const MOUSE
 static BOOL hs_handle_key_event(struct hyperlink_collection_t *hc, const KEY_EVENT_RECORD *er);
 static BOOL hs_handle_focus_event(struct hyperlink_collection_t *hc, const FOCUS_EVENT_RECORD *er);
 
+static BOOL hs_is_event_ignored(struct hyperlink_collection_t *hc, const INPUT_RECORD *event);
 static BOOL hs_handle_events(struct hyperlink_collection_t *hc, INPUT_RECORD *event);
 
 static void hs_update_scollback(struct hyperlink_collection_t *hc, int pre_input_lines);
@@ -109,6 +225,8 @@ static void hs_end_input(struct hyperlink_collection_t *hc);
 
 //static void hs_print_debug_info(struct hyperlink_collection_t *hc);
 
+static struct link_arena_t _link_arena;
+
 static void init_hyperlink_collection(struct hyperlink_collection_t *hc) {
   CONSOLE_SCREEN_BUFFER_INFO csbi;
   
@@ -116,11 +234,14 @@ static void init_hyperlink_collection(struct hyperlink_collection_t *hc) {
   
   memset(hc, 0, sizeof(struct hyperlink_collection_t));
   
-  hc->output_handle = GetStdHandle(STD_OUTPUT_HANDLE);
+  hc->output_handle = console_backend->get_std_handle(STD_OUTPUT_HANDLE);
   hc->scrollback = console_scrollback_new();
+  hc->min_end_line = INT_MAX;
+  hc->active_first_line = INT_MAX;
+  hc->active_last_line = INT_MIN;
   
   hc->attr_default = 0x0F;
-  if(GetConsoleScreenBufferInfo(hc->output_handle, &csbi)) {
+  if(console_backend->get_screen_buffer_info(hc->output_handle, &csbi)) {
     hc->console_width = csbi.dwSize.X;
     hc->attr_default = csbi.wAttributes;
   }
@@ -152,18 +273,15 @@ static void free_hyperlink_collection(struct hyperlink_collection_t *hc) {
   while(hc->last_link)
     free_link_at(&hc->last_link);
     
+  trim_link_arena();
+  hyper_console_free_memory(hc->index);
+  hyper_console_free_memory(hc->attribute_buffer);
   console_scrollback_free(hc->scrollback);
   
   //hyper_console_free_memory(hc->old_title);
   memset(hc, 0, sizeof(struct hyperlink_collection_t));
 }
 
-void hyperlink_system_free_dangling_hyperlinks(struct dangling_hyperlinks_t *links) {
-  struct hyperlink_t *link = (struct hyperlink_t*)links;
-  while(link)
-    free_link_at(&link);
-}
-
 void hyperlink_system_move_links(struct dangling_hyperlinks_t *links, int delta_lines) {
   struct hyperlink_t *link;
   
@@ -173,6 +291,285 @@ void hyperlink_system_move_links(struct dangling_hyperlinks_t *links, int delta_
   }
 }
 
+static void *allocate_link_block(int size) {
+  struct link_chunk_t *chunk;
+  struct link_chunk_t **block;
+  
+  assert(size > 0 && size < INT_MAX / 2);
+  
+  size = (int)ALIGN_SIZE(sizeof(struct link_chunk_t*) + size);
+  
+  chunk = _link_arena.newest_chunk;
+  if(!chunk || chunk->capacity - chunk->used < size) {
+    if(size <= LINK_CHUNK_SIZE && _link_arena.spare_chunk) {
+      chunk = _link_arena.spare_chunk;
+      _link_arena.spare_chunk = NULL;
+    }
+    else {
+      int capacity = size > LINK_CHUNK_SIZE ? size : LINK_CHUNK_SIZE;
+      
+      chunk = hyper_console_allocate_memory(sizeof(struct link_chunk_t) + capacity);
+      if(!chunk)
+        return NULL;
+        
+      chunk->capacity = capacity;
+      _link_arena.stats.heap_allocations++;
+    }
+    
+    chunk->used = 0;
+    chunk->live_blocks = 0;
+    chunk->next = NULL;
+    chunk->prev = _link_arena.newest_chunk;
+    if(_link_arena.newest_chunk)
+      _link_arena.newest_chunk->next = chunk;
+    else
+      _link_arena.oldest_chunk = chunk;
+    _link_arena.newest_chunk = chunk;
+  }
+  
+  block = (struct link_chunk_t**)((char*)(chunk + 1) + chunk->used);
+  *block = chunk;
+  chunk->used += size;
+  chunk->live_blocks++;
+  
+  return block + 1;
+}
+
+static void free_link_block(void *data) {
+  struct link_chunk_t *chunk;
+  
+  if(!data)
+    return;
+    
+  chunk = ((struct link_chunk_t**)data)[-1];
+  assert(chunk->live_blocks > 0);
+  if(--chunk->live_blocks > 0)
+    return;
+    
+  if(chunk == _link_arena.newest_chunk) { // reuse in place
+    chunk->used = 0;
+    return;
+  }
+  
+  if(chunk->prev)
+    chunk->prev->next = chunk->next;
+  else
+    _link_arena.oldest_chunk = chunk->next;
+    
+  chunk->next->prev = chunk->prev;
+  
+  if(!_link_arena.spare_chunk && chunk->capacity == LINK_CHUNK_SIZE) {
+    _link_arena.spare_chunk = chunk;
+  }
+  else {
+    hyper_console_free_memory(chunk);
+    _link_arena.stats.heap_frees++;
+  }
+}
+
+/* Release the chunks that are kept for reuse once no links are left.
+ */
+static void trim_link_arena(void) {
+  struct link_chunk_t *chunk = _link_arena.newest_chunk;
+  
+  if(_link_arena.stats.live_strings == 0) {
+    hyper_console_free_memory(_link_arena.buckets);
+    _link_arena.buckets = NULL;
+    _link_arena.bucket_count = 0;
+  }
+  
+  if(chunk && chunk->live_blocks == 0 && chunk == _link_arena.oldest_chunk) {
+    hyper_console_free_memory(chunk);
+    _link_arena.stats.heap_frees++;
+    _link_arena.oldest_chunk = NULL;
+    _link_arena.newest_chunk = NULL;
+  }
+  
+  if(_link_arena.spare_chunk) {
+    hyper_console_free_memory(_link_arena.spare_chunk);
+    _link_arena.stats.heap_frees++;
+    _link_arena.spare_chunk = NULL;
+  }
+}
+
+static unsigned hash_link_string(const struct hyper_console_link_string_t *prefix, const wchar_t *text, int length) {
+  unsigned hash = 2166136261U; // FNV-1a
+  int i;
+  
+  assert(text != NULL || length == 0);
+  
+  hash ^= (unsigned)((size_t)prefix >> 3);
+  hash *= 16777619U;
+  for(i = 0; i < length; ++i) {
+    hash ^= (unsigned short)text[i];
+    hash *= 16777619U;
+  }
+  
+  return hash;
+}
+
+static BOOL grow_link_string_buckets(void) {
+  struct hyper_console_link_string_t **new_buckets;
+  int new_count;
+  int i;
+  
+  new_count = _link_arena.bucket_count > 0 ? 2 * _link_arena.bucket_count : 256;
+  if(new_count <= 0 || new_count > (1 << 30) / (int)sizeof(new_buckets[0]))
+    return FALSE;
+    
+  new_buckets = hyper_console_allocate_memory(new_count * sizeof(new_buckets[0]));
+  if(!new_buckets)
+    return FALSE;
+    
+  memset(new_buckets, 0, new_count * sizeof(new_buckets[0]));
+  for(i = 0; i < _link_arena.bucket_count; ++i) {
+    struct hyper_console_link_string_t *str = _link_arena.buckets[i];
+    
+    while(str) {
+      struct hyper_console_link_string_t *next = str->next_in_bucket;
+      struct hyper_console_link_string_t **bucket = &new_buckets[str->hash & (new_count - 1)];
+      
+      str->next_in_bucket = *bucket;
+      *bucket = str;
+      str = next;
+    }
+  }
+  
+  hyper_console_free_memory(_link_arena.buckets);
+  _link_arena.buckets = new_buckets;
+  _link_arena.bucket_count = new_count;
+  return TRUE;
+}
+
+/** Get a reference to the interned string prefix+text.
+  @param prefix The optional prefix.
+  @param text   The suffix text.
+  @param length The suffix length.
+  
+  @return The string with one new reference or NULL on error. Must be released with 
+          release_link_string().
+ */
+static struct hyper_console_link_string_t *intern_link_string(struct hyper_console_link_string_t *prefix, const wchar_t *text, int length) {
+  struct hyper_console_link_string_t *str;
+  struct hyper_console_link_string_t **bucket;
+  unsigned hash;
+  
+  assert(text != NULL || length == 0);
+  assert(length >= 0);
+  
+  if(length >= INT_MAX / 4 || (prefix && prefix->length >= INT_MAX / 4 - length))
+    return NULL;
+    
+  hash = hash_link_string(prefix, text, length);
+  if(_link_arena.bucket_count > 0) {
+    for(str = _link_arena.buckets[hash & (_link_arena.bucket_count - 1)]; str; str = str->next_in_bucket) {
+      if( str->hash == hash &&
+          str->prefix == prefix &&
+          str->suffix_length == length &&
+          memcmp(str->suffix, text, length * sizeof(wchar_t)) == 0)
+      {
+        str->ref_count++;
+        return str;
+      }
+    }
+  }
+  
+  if(_link_arena.stats.live_strings >= _link_arena.bucket_count && !grow_link_string_buckets()) {
+    if(_link_arena.bucket_count == 0)
+      return NULL;
+  }
+  
+  str = allocate_link_block(sizeof(struct hyper_console_link_string_t) + length * sizeof(wchar_t));
+  if(!str)
+    return NULL;
+    
+  str->prefix = prefix;
+  str->hash = hash;
+  str->ref_count = 1;
+  str->length = (prefix ? prefix->length : 0) + length;
+  str->suffix_length = length;
+  memcpy(str->suffix, text, length * sizeof(wchar_t));
+  if(prefix)
+    prefix->ref_count++;
+    
+  bucket = &_link_arena.buckets[hash & (_link_arena.bucket_count - 1)];
+  str->next_in_bucket = *bucket;
+  *bucket = str;
+  
+  _link_arena.stats.string_allocations++;
+  _link_arena.stats.live_strings++;
+  return str;
+}
+
+static void release_link_string(struct hyper_console_link_string_t *str) {
+  while(str) {
+    struct hyper_console_link_string_t **link;
+    struct hyper_console_link_string_t *prefix;
+    
+    assert(str->ref_count > 0);
+    if(--str->ref_count > 0)
+      return;
+      
+    link = &_link_arena.buckets[str->hash & (_link_arena.bucket_count - 1)];
+    while(*link != str) {
+      assert(*link != NULL);
+      link = &(*link)->next_in_bucket;
+    }
+    *link = str->next_in_bucket;
+    
+    prefix = str->prefix;
+    free_link_block(str);
+    _link_arena.stats.live_strings--;
+    str = prefix;
+  }
+}
+
+/** Copy the text of an interned string.
+  @param str     The string.
+  @param buf     The destination. Will be 0-terminated.
+  @param buf_len The capacity of \a buf. At least 1.
+  
+  @return The number of characters written, excluding the terminating 0.
+ */
+static int copy_link_string_text(const struct hyper_console_link_string_t *str, wchar_t *buf, int buf_len) {
+  int result;
+  int length;
+  
+  assert(str != NULL);
+  assert(buf != NULL);
+  assert(buf_len > 0);
+  
+  result = length = MIN(str->length, buf_len - 1);
+  buf[length] = L'\0';
+  for(; str; str = str->prefix) {
+    int start = str->length - str->suffix_length;
+    
+    if(start < length) {
+      memcpy(buf + start, str->suffix, (length - start) * sizeof(wchar_t));
+      length = start;
+    }
+  }
+  
+  return result;
+}
+
+/** Get the text of an interned string in a new 0-terminated buffer.
+  @return The text or NULL if \a str is NULL or there is not enough memory. The caller must free
+          it with hyper_console_free_memory().
+ */
+static wchar_t *get_link_string_text(const struct hyper_console_link_string_t *str) {
+  wchar_t *text;
+  
+  if(!str)
+    return NULL;
+    
+  text = hyper_console_allocate_memory((str->length + 1) * sizeof(wchar_t));
+  if(text)
+    copy_link_string_text(str, text, str->length + 1);
+    
+  return text;
+}
+
 static void free_link_at(struct hyperlink_t **last_link) {
   struct hyperlink_t *link;
   
@@ -184,30 +581,39 @@ static void free_link_at(struct hyperlink_t **last_link) {
     
   *last_link = link->prev_link;
   
-  hyper_console_free_memory(link->title);
-  hyper_console_free_memory(link->input_text);
-  hyper_console_free_memory(link->inactive_attributes);
-  hyper_console_free_memory(link);
+  release_link_string(link->title);
+  release_link_string(link->input_text);
+  hyper_console_free_memory(link->inactive_runs);
+  free_link_block(link);
+  _link_arena.stats.live_links--;
 }
 
 static void clean_old_links(struct hyperlink_collection_t *hc, int first_keep_line) {
   struct hyperlink_t **link_ptr;
   int skip_count;
+  int min_end_line = INT_MAX;
   
   assert(hc);
   
+  if(first_keep_line <= hc->min_end_line)
+    return;
+  
   skip_count = hc->num_open_links;
   link_ptr = &hc->last_link;
   while(skip_count-- > 0) {
     assert(*link_ptr != NULL);
     
+    min_end_line = MIN(min_end_line, (*link_ptr)->end_global_line);
     link_ptr = &(*link_ptr)->prev_link;
   }
   
   while(*link_ptr && (*link_ptr)->end_global_line >= first_keep_line) {
+    min_end_line = MIN(min_end_line, (*link_ptr)->end_global_line);
     link_ptr = &(*link_ptr)->prev_link;
   }
   
+  hc->min_end_line = min_end_line;
+  remove_from_link_index(hc, *link_ptr, NULL);
   while(*link_ptr) {
     if(hc->mouse_over_link == *link_ptr) {
       on_mouse_leave_link(hc);
@@ -218,8 +624,7 @@ static void clean_old_links(struct hyperlink_collection_t *hc, int first_keep_li
       hc->pressed_link = NULL;
     }
     
-    debug_printf(L"clean link %s in line %d < %d\n",
-                 (*link_ptr)->title,
+    debug_printf(L"clean link in line %d < %d\n",
                  (*link_ptr)->start_global_line,
                  first_keep_line);
                  
@@ -243,7 +648,7 @@ static struct hyperlink_t *open_new_link(struct hyperlink_collection_t *hc) {
     return NULL;
   }
   
-  if(!GetConsoleScreenBufferInfo(hc->output_handle, &csbi)) {
+  if(!console_backend->get_screen_buffer_info(hc->output_handle, &csbi)) {
     hc->num_failed_open_links++;
     return NULL;
   }
@@ -262,21 +667,31 @@ static struct hyperlink_t *open_new_link(struct hyperlink_collection_t *hc) {
   clean_old_links(hc, top_line);
   debug_printf(L"open new link at %d:%d (top = %d:%d)\n", line, column, top_line, top_column);
   
-  link = hyper_console_allocate_memory(sizeof(struct hyperlink_t));
+  link = allocate_link_block(sizeof(struct hyperlink_t));
   if(!link) {
     hc->num_failed_open_links++;
     return NULL;
   }
   
   memset(link, 0, sizeof(struct hyperlink_t));
+  _link_arena.stats.link_allocations++;
+  _link_arena.stats.live_links++;
   
   link->start_column      = link->end_column      = column;
   link->start_global_line = link->end_global_line = line;
   
   link->attr_previous = csbi.wAttributes;
   link->attr_active = hc->attr_link;
+  link->is_open = TRUE;
   //SetConsoleTextAttribute(hc->output_handle, hc->attr_link);
   
+  if(!add_to_link_index(hc, link)) {
+    free_link_at(&link);
+    hc->num_failed_open_links++;
+    return NULL;
+  }
+  
+  hc->min_end_line = MIN(hc->min_end_line, line);
   link->prev_link = hc->last_link;
   hc->last_link = link;
   hc->num_open_links++;
@@ -301,10 +716,11 @@ static void close_link(struct hyperlink_collection_t *hc) {
   assert(hc->num_open_links > 0);
   assert(link != NULL);
   
-  SetConsoleTextAttribute(hc->output_handle, link->attr_previous);
+  console_backend->set_text_attribute(hc->output_handle, link->attr_previous);
   
+  link->is_open = FALSE;
   hc->num_open_links--;
-  if(!GetConsoleScreenBufferInfo(hc->output_handle, &csbi))
+  if(!console_backend->get_screen_buffer_info(hc->output_handle, &csbi))
     return;
     
   console_scrollback_update(hc->scrollback, csbi.dwCursorPosition.Y);
@@ -314,6 +730,9 @@ static void close_link(struct hyperlink_collection_t *hc) {
     
   link->end_global_line = line;
   link->end_column      = column;
+  
+  hc->min_end_line = MIN(hc->min_end_line, line);
+  update_link_index_reach(hc, find_link_in_index(hc, link));
 }
 
 static struct dangling_hyperlinks_t *cut_links_after_cursor(struct hyperlink_collection_t *hc) {
@@ -327,7 +746,7 @@ static struct dangling_hyperlinks_t *cut_links_after_cursor(struct hyperlink_col
   
   assert(hc != NULL);
   
-  if(!GetConsoleScreenBufferInfo(hc->output_handle, &csbi))
+  if(!console_backend->get_screen_buffer_info(hc->output_handle, &csbi))
     return NULL;
     
   console_scrollback_update(hc->scrollback, csbi.dwCursorPosition.Y);
@@ -355,83 +774,46 @@ static struct dangling_hyperlinks_t *cut_links_after_cursor(struct hyperlink_col
       link_ptr = &link->prev_link;
   }
   
+  remove_from_link_index(hc, result, NULL);
   return (struct dangling_hyperlinks_t*)result;
 }
 
-static void set_open_link_title(struct hyperlink_collection_t *hc, const wchar_t *title, int title_length) {
+static void set_open_link_title(struct hyperlink_collection_t *hc, struct hyper_console_link_string_t *title) {
   struct hyperlink_t *link;
   
   assert(hc != NULL);
-  assert(title != NULL || title_length == 0);
   
   if(hc->num_failed_open_links > 0)
     return;
-    
-  if(title_length < 0) {
-    size_t ulen = wcslen(title);
-    
-    if(ulen >= INT_MAX)
-      return;
-      
-    title_length = (int)ulen;
-  }
   
   link = hc->last_link;
   assert(hc->num_open_links > 0);
   assert(link != NULL);
   
-  hyper_console_free_memory(link->title);
-  if(title) {
-    link->title = hyper_console_allocate_memory((title_length + 1) * sizeof(wchar_t));
-    if(link->title) {
-      memcpy(
-        link->title,
-        title,
-        title_length * sizeof(wchar_t));
-      link->title[title_length] = L'\0';
-    }
-  }
-  else {
-    link->title = NULL;
-  }
+  if(title)
+    title->ref_count++;
+    
+  release_link_string(link->title);
+  link->title = title;
 }
 
-static void set_open_link_input_text(struct hyperlink_collection_t *hc, const wchar_t *text, int text_length) {
+static void set_open_link_input_text(struct hyperlink_collection_t *hc, struct hyper_console_link_string_t *text) {
   struct hyperlink_t *link;
   
   assert(hc != NULL);
-  assert(text != NULL || text_length == 0);
   
   if(hc->num_failed_open_links > 0)
     return;
-    
-  if(text_length < 0) {
-    size_t ulen = wcslen(text);
-    
-    if(ulen >= INT_MAX)
-      return;
-      
-    text_length = (int)ulen;
-  }
   
   link = hc->last_link;
   assert(hc->num_open_links > 0);
   assert(link != NULL);
   
-  hyper_console_free_memory(link->input_text);
-  if(text) {
-    link->input_text = hyper_console_allocate_memory((text_length + 1) * sizeof(wchar_t));
-    if(link->input_text) {
-      memcpy(
-        link->input_text,
-        text,
-        text_length * sizeof(wchar_t));
-      link->input_text[text_length] = L'\0';
-    }
-  }
-  else {
-    link->input_text = NULL;
-  }
+  if(text)
+    text->ref_count++;
+    
+  release_link_string(link->input_text);
+  link->input_text = text;
 }
 
 static void hs_paste_and_activate_links(struct hyperlink_collection_t *hc, struct dangling_hyperlinks_t *links) {
@@ -451,8 +833,14 @@ static void hs_paste_and_activate_links(struct hyperlink_collection_t *hc, struc
   
   old_link = *link_ptr;
   *link_ptr = (struct hyperlink_t *)links;
-  while(*link_ptr)
-    link_ptr = &(*link_ptr)->prev_link;
+  while(*link_ptr) {
+    if(add_to_link_index(hc, *link_ptr)) {
+      hc->min_end_line = MIN(hc->min_end_line, (*link_ptr)->end_global_line);
+      link_ptr = &(*link_ptr)->prev_link;
+    }
+    else
+      free_link_at(link_ptr);
+  }
     
   *link_ptr = old_link;
 }
@@ -476,6 +864,190 @@ static WORD set_open_link_color(struct hyperlink_collection_t *hc, WORD attribut
   return old_attr;
 }
 
+/** Count the links in the index that start before a global position.
+  @param hc           The hyperlink collection.
+  @param line         The global line.
+  @param column       The column.
+  @param inclusive    Whether links starting exactly at the position count, too.
+
+  @return The index position of the first link that does not start before the given position.
+ */
+static int count_links_starting_before(struct hyperlink_collection_t *hc, int line, int column, BOOL inclusive) {
+  int lo = 0;
+  int hi;
+  
+  assert(hc != NULL);
+  
+  hi = hc->index_count;
+  while(lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    const struct hyperlink_t *link = hc->index[mid].link;
+    BOOL before;
+    
+    if(inclusive)
+      before = is_global_position_before(link->start_global_line, link->start_column, line, column);
+    else
+      before = !is_global_position_before(line, column, link->start_global_line, link->start_column);
+      
+    if(before)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  
+  return lo;
+}
+
+/* Binary search for the first index entry whose reach is not before a global line. No link in the
+   preceding entries touches that line or any later line.
+ */
+static int count_entries_reaching_before_line(struct hyperlink_collection_t *hc, int line) {
+  int lo = 0;
+  int hi;
+  
+  assert(hc != NULL);
+  
+  hi = hc->index_count;
+  while(lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    
+    if(hc->index[mid].reach_line < line)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  
+  return lo;
+}
+
+static int find_link_in_index(struct hyperlink_collection_t *hc, const struct hyperlink_t *link) {
+  int i;
+  
+  assert(hc != NULL);
+  assert(link != NULL);
+  
+  i = count_links_starting_before(hc, link->start_global_line, link->start_column, FALSE);
+  for(; i < hc->index_count; ++i) {
+    const struct hyperlink_t *other = hc->index[i].link;
+    
+    if(other == link)
+      return i;
+      
+    if(other->start_global_line != link->start_global_line || other->start_column != link->start_column)
+      break;
+  }
+  
+  return -1;
+}
+
+static void set_link_index_reach(struct hyperlink_collection_t *hc, int i) {
+  struct link_index_entry_t *entry;
+  
+  assert(hc != NULL);
+  assert(0 <= i && i < hc->index_count);
+  
+  entry = &hc->index[i];
+  entry->reach_line   = entry->link->end_global_line;
+  entry->reach_column = entry->link->end_column;
+  if(i > 0 && is_global_position_before(entry->reach_line, entry->reach_column, entry[-1].reach_line, entry[-1].reach_column)) {
+    entry->reach_line   = entry[-1].reach_line;
+    entry->reach_column = entry[-1].reach_column;
+  }
+}
+
+/* Recalculate the reach of the entries after one entry was inserted or its link's end changed.
+ */
+static void update_link_index_reach(struct hyperlink_collection_t *hc, int first) {
+  int i;
+  
+  assert(hc != NULL);
+  
+  if(first < 0)
+    return;
+    
+  for(i = first; i < hc->index_count; ++i) {
+    int old_line = hc->index[i].reach_line;
+    int old_column = hc->index[i].reach_column;
+    
+    set_link_index_reach(hc, i);
+    if(i > first && old_line == hc->index[i].reach_line && old_column == hc->index[i].reach_column)
+      break;
+  }
+}
+
+static BOOL add_to_link_index(struct hyperlink_collection_t *hc, struct hyperlink_t *link) {
+  int pos;
+  
+  assert(hc != NULL);
+  assert(link != NULL);
+  
+  if(!resize_array((void**)&hc->index, &hc->index_capacity, sizeof(struct link_index_entry_t), hc->index_count + 1))
+    return FALSE;
+    
+  // new links are usually the last ones
+  pos = count_links_starting_before(hc, link->start_global_line, link->start_column, TRUE);
+  memmove(hc->index + pos + 1, hc->index + pos, (hc->index_count - pos) * sizeof(struct link_index_entry_t));
+  hc->index[pos].link = link;
+  hc->index_count++;
+  
+  update_link_index_reach(hc, pos);
+  return TRUE;
+}
+
+/** Remove a chain of links from the index.
+  @param hc           The hyperlink collection.
+  @param first        The first link to remove.
+  @param stop         The link after the last one to remove (following prev_link). NULL to remove
+                      the whole chain.
+ */
+static void remove_from_link_index(struct hyperlink_collection_t *hc, struct hyperlink_t *first, struct hyperlink_t *stop) {
+  struct hyperlink_t *link;
+  int first_removed;
+  int last_removed;
+  int i;
+  int count;
+  
+  assert(hc != NULL);
+  
+  first_removed = hc->index_count;
+  last_removed = -1;
+  for(link = first; link != stop; link = link->prev_link) {
+    int pos;
+    
+    assert(link != NULL);
+    
+    pos = find_link_in_index(hc, link);
+    if(pos < 0)
+      continue;
+      
+    hc->index[pos].reach_column = -1;
+    first_removed = MIN(first_removed, pos);
+    last_removed = MAX(last_removed, pos);
+  }
+  
+  count = first_removed;
+  for(i = first_removed; i < hc->index_count; ++i) {
+    int old_line = hc->index[i].reach_line;
+    int old_column = hc->index[i].reach_column;
+    
+    if(old_column < 0)
+      continue;
+      
+    hc->index[count] = hc->index[i];
+    set_link_index_reach(hc, count);
+    ++count;
+    
+    // behind the removed entries, an unchanged reach stays unchanged
+    if(i > last_removed && old_line == hc->index[count - 1].reach_line && old_column == hc->index[count - 1].reach_column) {
+      memmove(hc->index + count, hc->index + i + 1, (hc->index_count - i - 1) * sizeof(struct link_index_entry_t));
+      count += hc->index_count - i - 1;
+      break;
+    }
+  }
+  
+  hc->index_count = count;
+}
+
 static BOOL is_global_position_before(int a_line, int a_col, int b_line, int b_col) {
   if(a_line < b_line)
     return TRUE;
@@ -490,20 +1062,23 @@ static struct hyperlink_t *find_link(struct hyperlink_collection_t *hc, COORD po
   int line;
   int column;
   struct hyperlink_t *link;
+  int i;
   
   assert(hc != NULL);
   
   if(!console_scollback_local_to_global(hc->scrollback, pos, &line, &column))
     return FALSE;
     
-  for(link = hc->last_link; link != NULL; link = link->prev_link) {
-    BOOL start_ok;
-    BOOL end_ok;
+  // Of nested links, the one that starts last (the innermost) wins.
+  i = count_links_starting_before(hc, line, column, TRUE);
+  while(i-- > 0) {
+    const struct link_index_entry_t *entry = &hc->index[i];
     
-    start_ok = is_global_position_before(link->start_global_line, link->start_column, line, column);
-    end_ok = !is_global_position_before(link->end_global_line, link->end_column, line, column);
+    if(is_global_position_before(entry->reach_line, entry->reach_column, line, column))
+      break; // no earlier link ends after pos
     
-    if(start_ok && end_ok)
+    link = entry->link;
+    if(!is_global_position_before(link->end_global_line, link->end_column, line, column))
       return link;
   }
   
@@ -573,7 +1148,7 @@ static BOOL save_old_console_title(struct hyperlink_collection_t *hc) {
   
   assert(hc != NULL);
   
-  GetConsoleTitleW(hc->old_title, ARRAYSIZE(hc->old_title));
+  console_backend->get_title(hc->old_title, ARRAYSIZE(hc->old_title));
   return TRUE;
 }
 
@@ -581,7 +1156,7 @@ static void set_console_title(struct hyperlink_collection_t *hc, const wchar_t *
   assert(hc != NULL);
   
   if(title)
-    SetConsoleTitleW(title);
+    console_backend->set_title(title);
 }
 
 static BOOL invert_link_colors(struct hyperlink_collection_t *hc, const struct hyperlink_t *link) {
@@ -608,7 +1183,7 @@ static BOOL invert_link_colors(struct hyperlink_collection_t *hc, const struct h
       *att = (*att & 0xFF00) | ((*att & 0x00F0) >> 4) | ((*att & 0x000F) << 4);
     }
     
-    if(WriteConsoleOutputAttribute(hc->output_handle, attributes, length, start, &num_valid)) {
+    if(console_write_output_attribute(hc->output_handle, attributes, length, start, &num_valid)) {
       hyper_console_free_memory(attributes);
       return TRUE;
     }
@@ -618,108 +1193,264 @@ static BOOL invert_link_colors(struct hyperlink_collection_t *hc, const struct h
   return FALSE;
 }
 
+static COORD advance_position(struct hyperlink_collection_t *hc, COORD pos, int count) {
+  int offset;
+  
+  assert(hc != NULL);
+  assert(hc->console_width > 0);
+  
+  offset = pos.X + count;
+  pos.X = (SHORT)(offset % hc->console_width);
+  pos.Y = (SHORT)(pos.Y + offset / hc->console_width);
+  return pos;
+}
+
+/** Store the attributes of an inactive link run-length encoded.
+  @param link       The link.
+  @param attributes The attributes of the link's visual cells.
+  @param length     The number of attributes.
+  
+  @return FALSE if there is not enough memory.
+ */
+static BOOL save_inactive_attributes(struct hyperlink_t *link, const WORD *attributes, int length) {
+  int count;
+  int i;
+  
+  assert(link != NULL);
+  assert(attributes != NULL);
+  assert(length > 0);
+  
+  count = 1;
+  for(i = 1; i < length; ++i) {
+    if(attributes[i] != attributes[i - 1])
+      ++count;
+  }
+  
+  if(count > 1) {
+    struct attribute_run_t *run;
+    
+    link->inactive_runs = hyper_console_allocate_memory(count * sizeof(struct attribute_run_t));
+    if(!link->inactive_runs)
+      return FALSE;
+      
+    run = link->inactive_runs;
+    run->attribute = attributes[0];
+    run->length = 1;
+    for(i = 1; i < length; ++i) {
+      if(attributes[i] != run->attribute) {
+        ++run;
+        run->attribute = attributes[i];
+        run->length = 0;
+      }
+      run->length++;
+    }
+  }
+  
+  link->inactive_attribute = attributes[0];
+  link->inactive_run_count = count;
+  link->inactive_attribute_count = length;
+  return TRUE;
+}
+
 static BOOL activate_link(struct hyperlink_collection_t *hc, struct hyperlink_t *link) {
   COORD start;
   int length;
   DWORD num_valid;
-  WORD *new_attributes;
   
   assert(hc != NULL);
-  assert(link != NULL);
-  
-  length = find_link_visual_position(hc, link, &start);
-  if(length <= 0)
+  assert(link != NULL);
+  
+  length = find_link_visual_position(hc, link, &start);
+  if(length <= 0)
+    return FALSE;
+    
+  link->inactive_attribute_count = 0;
+  link->inactive_run_count = 0;
+  hyper_console_free_memory(link->inactive_runs);
+  link->inactive_runs = NULL;
+  
+  if(!resize_array((void**)&hc->attribute_buffer, &hc->attribute_buffer_capacity, sizeof(WORD), length))
+    return TRUE;
+    
+  if(console_read_output_attribute(hc->output_handle, hc->attribute_buffer, length, start, &num_valid)) {
+    if(save_inactive_attributes(link, hc->attribute_buffer, length))
+      console_fill_output_attribute(hc->output_handle, link->attr_active, length, start, &num_valid);
+    
+    return TRUE;
+  }
+  
+  return FALSE;
+}
+
+static void deactivate_link(struct hyperlink_collection_t *hc, struct hyperlink_t *link) {
+  COORD start;
+  int length;
+  DWORD num_valid;
+  int i;
+  
+  assert(hc != NULL);
+  assert(link != NULL);
+  
+  length = find_link_visual_position(hc, link, &start);
+  if(length <= 0)
+    return;
+    
+  if(link->inactive_run_count == 0 || length != link->inactive_attribute_count)
+    return;
+    
+  if(link->inactive_run_count == 1) {
+    console_fill_output_attribute(hc->output_handle, link->inactive_attribute, length, start, &num_valid);
+    return;
+  }
+  
+  // one write is cheaper than filling many short runs
+  if(resize_array((void**)&hc->attribute_buffer, &hc->attribute_buffer_capacity, sizeof(WORD), length)) {
+    WORD *att = hc->attribute_buffer;
+    
+    for(i = 0; i < link->inactive_run_count; ++i) {
+      WORD *run_end = att + link->inactive_runs[i].length;
+      
+      while(att != run_end)
+        *att++ = link->inactive_runs[i].attribute;
+    }
+    
+    console_write_output_attribute(hc->output_handle, hc->attribute_buffer, length, start, &num_valid);
+    return;
+  }
+  
+  for(i = 0; i < link->inactive_run_count; ++i) {
+    console_fill_output_attribute(hc->output_handle, link->inactive_runs[i].attribute, link->inactive_runs[i].length, start, &num_valid);
+    start = advance_position(hc, start, link->inactive_runs[i].length);
+  }
+}
+
+/** Get the global lines that are visible in the console window.
+  @param hc         The hyperlink collection.
+  @param first_line Receives the global line at the top of the window.
+  @param last_line  Receives the global line at the bottom of the window, or INT_MAX if the
+                    window reaches beyond the known lines.
+  
+  @return FALSE if the window shows no known lines.
+ */
+static BOOL get_visible_lines(struct hyperlink_collection_t *hc, int *first_line, int *last_line) {
+  CONSOLE_SCREEN_BUFFER_INFO csbi;
+  COORD pos;
+  int column;
+  
+  assert(hc != NULL);
+  assert(first_line != NULL);
+  assert(last_line != NULL);
+    
+  if(!console_backend->get_screen_buffer_info(hc->output_handle, &csbi))
     return FALSE;
     
-  link->inactive_attribute_count = 0;
-  hyper_console_free_memory(link->inactive_attributes);
+  pos.X = 0;
+  pos.Y = csbi.srWindow.Top;
+  if(!console_scollback_local_to_global(hc->scrollback, pos, first_line, &column))
+    return FALSE;
+    
+  pos.Y = csbi.srWindow.Bottom;
+  if(!console_scollback_local_to_global(hc->scrollback, pos, last_line, &column))
+    *last_line = INT_MAX;
+    
+  return TRUE;
+}
+
+/** Activate the inactive links that intersect the console window.
+  @param hc         The hyperlink collection.
+  @param count_only Do not activate anything, only count the links.
   
-  link->inactive_attributes = hyper_console_allocate_memory(length * sizeof(WORD));
-  if(link->inactive_attributes == NULL)
-    return TRUE;
+  @return The number of links that were (or would be) activated.
+ */
+static int activate_visible_links(struct hyperlink_collection_t *hc, BOOL count_only) {
+  int first_line;
+  int last_line;
+  int count = 0;
+  int i;
+  
+  assert(hc != NULL);
+  
+  if(!hc->input_active || !get_visible_lines(hc, &first_line, &last_line))
+    return 0;
     
-  if(console_read_output_attribute(hc->output_handle, link->inactive_attributes, length, start, &num_valid)) {
-    link->inactive_attribute_count = length;
+  for(i = count_entries_reaching_before_line(hc, first_line); i < hc->index_count; ++i) {
+    struct hyperlink_t *link = hc->index[i].link;
     
-    new_attributes = hyper_console_allocate_memory(length * sizeof(WORD));
-    if(new_attributes != NULL) {
-      int i;
-      for(i = 0; i < length; ++i)
-        new_attributes[i] = link->attr_active;
-        
-      WriteConsoleOutputAttribute(hc->output_handle, new_attributes, length, start, &num_valid);
+    if(link->start_global_line > last_line)
+      break;
       
-      hyper_console_free_memory(new_attributes);
-    }
-    
-    return TRUE;
+    if(link->is_active || link->is_open || link->end_global_line < first_line)
+      continue;
+      
+    // The colors of these links are inverted. activate_released_link() activates them later.
+    if(link == hc->mouse_over_link || link == hc->pressed_link)
+      continue;
+      
+    ++count;
+    if(count_only || !activate_link(hc, link))
+      continue;
+      
+    link->is_active = TRUE;
+    hc->active_first_line = MIN(hc->active_first_line, link->start_global_line);
+    hc->active_last_line  = MAX(hc->active_last_line,  link->end_global_line);
   }
   
-  return FALSE;
+  return count;
 }
 
-static void deactivate_link(struct hyperlink_collection_t *hc, struct hyperlink_t *link) {
-  COORD start;
-  int length;
-  DWORD num_valid;
+/** Activate a visible link that activate_visible_links() skipped, once the mouse is neither over 
+  it nor pressing it anymore.
+  @param hc   The hyperlink collection.
+  @param link The link that the mouse left or released, or NULL.
+ */
+static void activate_released_link(struct hyperlink_collection_t *hc, struct hyperlink_t *link) {
+  int first_line;
+  int last_line;
   
   assert(hc != NULL);
-  assert(link != NULL);
   
-  length = find_link_visual_position(hc, link, &start);
-  if(length <= 0)
+  if(!link || link == hc->mouse_over_link || link == hc->pressed_link)
+    return;
+    
+  if(link->is_active || link->is_open)
+    return;
+    
+  if(!hc->input_active || !get_visible_lines(hc, &first_line, &last_line))
+    return;
+    
+  if(link->start_global_line > last_line || link->end_global_line < first_line)
     return;
     
-  if(link->inactive_attributes == NULL || length != link->inactive_attribute_count)
+  if(!activate_link(hc, link))
     return;
     
-  WriteConsoleOutputAttribute(hc->output_handle, link->inactive_attributes, length, start, &num_valid);
+  link->is_active = TRUE;
+  hc->active_first_line = MIN(hc->active_first_line, link->start_global_line);
+  hc->active_last_line  = MAX(hc->active_last_line,  link->end_global_line);
 }
 
-static void activate_all_links(struct hyperlink_collection_t *hc) {
-  struct hyperlink_t **link_ptr;
-  int skip_count;
+static void deactivate_active_links(struct hyperlink_collection_t *hc) {
+  int i;
   
-  assert(hc);
-  assert(hc->mouse_over_link == NULL);
-  assert(hc->pressed_link == NULL);
+  assert(hc != NULL);
   
-  skip_count = hc->num_open_links;
-  link_ptr = &hc->last_link;
-  while(skip_count-- > 0) {
-    assert(*link_ptr != NULL);
+  if(hc->active_first_line > hc->active_last_line)
+    return;
     
-    link_ptr = &(*link_ptr)->prev_link;
-  }
-  
-  while(*link_ptr) {
-    if(activate_link(hc, *link_ptr)) {
-      link_ptr = &(*link_ptr)->prev_link;
-    }
-    else {
-      free_link_at(link_ptr);
+  for(i = count_entries_reaching_before_line(hc, hc->active_first_line); i < hc->index_count; ++i) {
+    struct hyperlink_t *link = hc->index[i].link;
+    
+    if(link->start_global_line > hc->active_last_line)
+      break;
+      
+    if(link->is_active) {
+      deactivate_link(hc, link);
+      link->is_active = FALSE;
     }
   }
-}
 
-static void deactivate_all_links(struct hyperlink_collection_t *hc) {
-  struct hyperlink_t *link;
-  int skip_count;
-  
-  assert(hc);
-  
-  skip_count = hc->num_open_links;
-  link = hc->last_link;
-  while(skip_count-- > 0) {
-    assert(link != NULL);
-    
-    link = link->prev_link;
-  }
-  
-  while(link) {
-    deactivate_link(hc, link);
-    link = link->prev_link;
-  }
+  hc->active_first_line = INT_MAX;
+  hc->active_last_line = INT_MIN;
 }
 
 static BOOL hs_click(struct hyperlink_collection_t *hc, COORD local, COORD local_end) {
@@ -740,7 +1471,19 @@ static BOOL hs_click(struct hyperlink_collection_t *hc, COORD local, COORD local
       return FALSE;
   }
     
-  return stop_current_input(FALSE, link->input_text);
+  if(link->input_text) {
+    wchar_t *text = get_link_string_text(link->input_text);
+    BOOL result;
+    
+    if(!text)
+      return FALSE;
+      
+    result = stop_current_input(FALSE, text);
+    hyper_console_free_memory(text);
+    return result;
+  }
+  
+  return stop_current_input(FALSE, NULL);
 }
 
 static BOOL hs_get_hover_title(struct hyperlink_collection_t *hc, COORD local, COORD local_end, wchar_t *buf, size_t buf_len) {
@@ -776,18 +1519,14 @@ static BOOL hs_get_hover_title(struct hyperlink_collection_t *hc, COORD local, C
     return TRUE;
   }
   
-  wcsncpy(buf, link->title, buf_len);
-  buf[buf_len - 1] = L'\0';
+  copy_link_string_text(link->title, buf, buf_len < INT_MAX ? (int)buf_len : INT_MAX);
   return TRUE;
 }
 
 static BOOL hs_find_next_link(struct hyperlink_collection_t *hc, COORD *pos, COORD *endpos, BOOL forward) {
-  struct hyperlink_t *link;
-  struct hyperlink_t *best_below = NULL;
-  struct hyperlink_t *best_above = NULL;
-  struct hyperlink_t *topmost = NULL;
-  struct hyperlink_t *bottomost = NULL;
+  struct hyperlink_t *link = NULL;
   int line, column;
+  int i;
   
   assert(hc != NULL);
   
@@ -795,29 +1534,38 @@ static BOOL hs_find_next_link(struct hyperlink_collection_t *hc, COORD *pos, COO
   if(!console_scollback_local_to_global(hc->scrollback, *pos, &line, &column))
     return FALSE;
     
-  for(link = hc->last_link; link != NULL; link = link->prev_link) {
-    if(link->start_global_line == line && link->start_column == column)
-      continue;
-    if(is_global_position_before(line, column, link->start_global_line, link->start_column)) {
-      if(!best_below || is_global_position_before(link->start_global_line, link->start_column, best_below->start_global_line, best_below->start_column))
-        best_below = link;
-    }
-    else if(is_global_position_before(link->end_global_line, link->end_column, line, column)) {
-      if(!best_above || is_global_position_before(best_above->start_global_line, best_above->start_column, link->start_global_line, link->start_column))
-        best_above = link;
+  if(forward) {
+    // the first link that starts after pos, or wrap around to the first link that does not start at pos
+    i = count_links_starting_before(hc, line, column, TRUE);
+    if(i < hc->index_count)
+      link = hc->index[i].link;
+    else if(count_links_starting_before(hc, line, column, FALSE) > 0)
+      link = hc->index[0].link;
+  }
+  else {
+    // the last link that ends before pos, or wrap around to the last link that does not start at pos
+    i = count_links_starting_before(hc, line, column, FALSE);
+    while(i-- > 0) {
+      struct hyperlink_t *other = hc->index[i].link;
+      
+      if(is_global_position_before(other->end_global_line, other->end_column, line, column)) {
+        link = other;
+        break;
+      }
     }
     
-    if(!topmost || is_global_position_before(link->start_global_line, link->start_column, topmost->start_global_line, topmost->start_column))
-      topmost = link;
+    if(!link) {
+      i = hc->index_count;
+      while(i-- > 0) {
+        struct hyperlink_t *other = hc->index[i].link;
       
-    if(!bottomost || is_global_position_before(bottomost->start_global_line, bottomost->start_column, link->start_global_line, link->start_column))
-      bottomost = link;
+        if(other->start_global_line != line || other->start_column != column) {
+          link = other;
+          break;
+        }
+      }
+    }
   }
-  
-  if(forward)
-    link = best_below ? best_below : topmost;
-  else
-    link = best_above ? best_above : bottomost;
     
   if(link) {
     console_scollback_global_to_local(hc->scrollback, link->start_global_line, link->start_column, pos);
@@ -832,7 +1580,12 @@ static void on_mouse_enter_link(struct hyperlink_collection_t *hc) {
   assert(hc != NULL);
   assert(hc->mouse_over_link != NULL);
   
-  set_console_title(hc, hc->mouse_over_link->title);
+  if(hc->mouse_over_link->title) {
+    wchar_t *title = get_link_string_text(hc->mouse_over_link->title);
+    
+    set_console_title(hc, title);
+    hyper_console_free_memory(title);
+  }
   
   invert_link_colors(hc, hc->mouse_over_link);
 }
@@ -850,10 +1603,13 @@ static BOOL set_mouse_over_link(struct hyperlink_collection_t *hc, struct hyperl
   assert(hc != NULL);
   
   if(link != hc->mouse_over_link) {
-    if(hc->mouse_over_link)
+    struct hyperlink_t *old_link = hc->mouse_over_link;
+    
+    if(old_link)
       on_mouse_leave_link(hc);
       
     hc->mouse_over_link = link;
+    activate_released_link(hc, old_link);
     if(hc->mouse_over_link)
       on_mouse_enter_link(hc);
       
@@ -872,8 +1628,13 @@ static BOOL hs_handle_lbutton_down(struct hyperlink_collection_t *hc, const MOUS
     
   set_mouse_over_link(hc, find_link(hc, er->dwMousePosition));
   
-  if(hc->pressed_link && hc->pressed_link != hc->mouse_over_link)
-    invert_link_colors(hc, hc->pressed_link);
+  if(hc->pressed_link && hc->pressed_link != hc->mouse_over_link) {
+    struct hyperlink_t *old_link = hc->pressed_link;
+    
+    invert_link_colors(hc, old_link);
+    hc->pressed_link = NULL;
+    activate_released_link(hc, old_link);
+  }
     
   hc->pressed_link = hc->mouse_over_link;
   if(hc->pressed_link) {
@@ -894,13 +1655,19 @@ static BOOL hs_handle_mouse_up(struct hyperlink_collection_t *hc, const MOUSE_EV
       struct hyperlink_t *link = find_link(hc, er->dwMousePosition);
       
       if(link == hc->pressed_link && hc->pressed_link->input_text) {
-        if(!stop_current_input(FALSE, hc->pressed_link->input_text)) {
+        wchar_t *text = get_link_string_text(hc->pressed_link->input_text);
+        
+        if(!text || !stop_current_input(FALSE, text)) {
           // beep
         }
+        
+        hyper_console_free_memory(text);
       }
       
-      invert_link_colors(hc, hc->pressed_link);
+      link = hc->pressed_link;
+      invert_link_colors(hc, link);
       hc->pressed_link = NULL;
+      activate_released_link(hc, link);
       return TRUE;
     }
   }
@@ -959,9 +1726,11 @@ static BOOL hs_handle_key_event(struct hyperlink_collection_t *hc, const KEY_EVE
   
   set_mouse_over_link(hc, NULL);
   if(hc->pressed_link) {
-    invert_link_colors(hc, hc->pressed_link);
+    struct hyperlink_t *link = hc->pressed_link;
     
+    invert_link_colors(hc, link);
     hc->pressed_link = NULL;
+    activate_released_link(hc, link);
   }
   
   return FALSE;
@@ -974,9 +1743,11 @@ static BOOL hs_handle_focus_event(struct hyperlink_collection_t *hc, const FOCUS
   if(!er->bSetFocus) {
     set_mouse_over_link(hc, NULL);
     if(hc->pressed_link) {
-      invert_link_colors(hc, hc->pressed_link);
+      struct hyperlink_t *link = hc->pressed_link;
       
+      invert_link_colors(hc, link);
       hc->pressed_link = NULL;
+      activate_released_link(hc, link);
     }
     
     return FALSE;
@@ -985,13 +1756,48 @@ static BOOL hs_handle_focus_event(struct hyperlink_collection_t *hc, const FOCUS
   return FALSE;
 }
 
+/** Check whether hs_handle_events() would neither handle an event nor change the hover state.
+  This only reads the collection.
+  @param hc     The hyperlink collection.
+  @param event  The input event.
+ */
+static BOOL hs_is_event_ignored(struct hyperlink_collection_t *hc, const INPUT_RECORD *event) {
+  const MOUSE_EVENT_RECORD *er;
+  
+  assert(hc != NULL);
+  assert(event != NULL);
+  
+  if(hc->pressed_link)
+    return FALSE;
+    
+  switch(event->EventType) {
+    case KEY_EVENT:
+      return hc->mouse_over_link == NULL;
+      
+    case FOCUS_EVENT:
+      return hc->mouse_over_link == NULL || event->Event.FocusEvent.bSetFocus;
+      
+    case MOUSE_EVENT:
+      er = &event->Event.MouseEvent;
+      if(er->dwEventFlags == 0)
+        return FALSE;
+        
+      if(er->dwEventFlags != MOUSE_MOVED || er->dwButtonState != 0 || (er->dwControlKeyState & SHIFT_PRESSED))
+        return TRUE;
+        
+      return find_link(hc, er->dwMousePosition) == hc->mouse_over_link;
+  }
+  
+  return TRUE;
+}
+
 static BOOL hs_handle_events(struct hyperlink_collection_t *hc, INPUT_RECORD *event) {
   HANDLE input_handle;
   
   assert(hc != NULL);
   assert(event != NULL);
   
-  input_handle = GetStdHandle(STD_INPUT_HANDLE);
+  input_handle = console_backend->get_std_handle(STD_INPUT_HANDLE);
   
   for(;;) {
     DWORD num_read;
@@ -1019,7 +1825,7 @@ static BOOL hs_handle_events(struct hyperlink_collection_t *hc, INPUT_RECORD *ev
     if(!hc->pressed_link)
       return TRUE;
       
-    if(!ReadConsoleInputW(input_handle, event, 1, &num_read) || num_read < 1)
+    if(!console_backend->read_input(input_handle, event, 1, &num_read) || num_read < 1)
       return TRUE;
   };
 }
@@ -1051,7 +1857,8 @@ static void hs_start_input(struct hyperlink_collection_t *hc, int console_width)
   hc->mouse_over_link = NULL;
   hc->pressed_link = NULL;
   
-  activate_all_links(hc);
+  hc->input_active = TRUE;
+  activate_visible_links(hc, FALSE);
   
   save_old_console_title(hc);
 }
@@ -1059,7 +1866,8 @@ static void hs_start_input(struct hyperlink_collection_t *hc, int console_width)
 static void hs_end_input(struct hyperlink_collection_t *hc) {
   assert(hc != NULL);
   
-  deactivate_all_links(hc);
+  deactivate_active_links(hc);
+  hc->input_active = FALSE;
   
   hc->mouse_over_link = NULL;
   hc->pressed_link = NULL;
@@ -1075,7 +1883,7 @@ static void hs_print_debug_info(struct hyperlink_collection_t *hc) {
 
   assert(hc != NULL);
 
-  if(!GetConsoleScreenBufferInfo(hc->output_handle, &csbi)) {
+  if(!console_backend->get_screen_buffer_info(hc->output_handle, &csbi)) {
     fprintf(stderr, "GetConsoleScreenBufferInfo failed\n");
     return;
   }
@@ -1127,40 +1935,111 @@ static void hs_print_debug_info(struct hyperlink_collection_t *hc) {
 
 static BOOL _have_hyperlink_system = FALSE;
 struct hyperlink_collection_t _global_links[1];
-static CRITICAL_SECTION _cs_global_links[1];
+/* Hit-testing, title lookup and link navigation only read the links and share the lock. Printing
+   links and the hover effects of the input thread modify them and take it exclusively.
+ */
+static SRWLOCK _srw_global_links[1];
 
 HYPER_CONSOLE_API
 void hyper_console_start_link(const wchar_t *title) {
+  struct hyper_console_link_string_t *str = NULL;
+  
+  assert(_have_hyperlink_system);
+  
+  AcquireSRWLockExclusive(_srw_global_links);
+  
+  if(title && wcslen(title) < INT_MAX)
+    str = intern_link_string(NULL, title, (int)wcslen(title));
+    
+  open_new_link(_global_links);
+  set_open_link_title(_global_links, str);
+  release_link_string(str);
+  
+  ReleaseSRWLockExclusive(_srw_global_links);
+}
+
+HYPER_CONSOLE_API
+void hyper_console_start_interned_link(struct hyper_console_link_string_t *title) {
   assert(_have_hyperlink_system);
   
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockExclusive(_srw_global_links);
   
   open_new_link(_global_links);
-  set_open_link_title(_global_links, title, -1);
+  set_open_link_title(_global_links, title);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockExclusive(_srw_global_links);
 }
 
 HYPER_CONSOLE_API
 void hyper_console_end_link(void) {
   assert(_have_hyperlink_system);
   
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockExclusive(_srw_global_links);
   
   close_link(_global_links);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockExclusive(_srw_global_links);
 }
 
 HYPER_CONSOLE_API
 void hyper_console_set_link_input_text(const wchar_t *text) {
+  struct hyper_console_link_string_t *str = NULL;
+  
+  assert(_have_hyperlink_system);
+  
+  AcquireSRWLockExclusive(_srw_global_links);
+  
+  if(text && wcslen(text) < INT_MAX)
+    str = intern_link_string(NULL, text, (int)wcslen(text));
+    
+  set_open_link_input_text(_global_links, str);
+  release_link_string(str);
+  
+  ReleaseSRWLockExclusive(_srw_global_links);
+}
+
+HYPER_CONSOLE_API
+void hyper_console_set_interned_link_input_text(struct hyper_console_link_string_t *text) {
   assert(_have_hyperlink_system);
   
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockExclusive(_srw_global_links);
+  
+  set_open_link_input_text(_global_links, text);
+  
+  ReleaseSRWLockExclusive(_srw_global_links);
+}
+
+HYPER_CONSOLE_API
+struct hyper_console_link_string_t *hyper_console_intern_link_string(struct hyper_console_link_string_t *prefix, const wchar_t *text) {
+  struct hyper_console_link_string_t *str = NULL;
+  size_t length;
+  
+  assert(text != NULL);
+  
+  length = wcslen(text);
+  if(length >= INT_MAX)
+    return NULL;
+    
+  if(_have_hyperlink_system)
+    AcquireSRWLockExclusive(_srw_global_links);
+    
+  str = intern_link_string(prefix, text, (int)length);
   
-  set_open_link_input_text(_global_links, text, text ? -1 : 0);
+  if(_have_hyperlink_system)
+    ReleaseSRWLockExclusive(_srw_global_links);
+    
+  return str;
+}
+
+HYPER_CONSOLE_API
+void hyper_console_release_link_string(struct hyper_console_link_string_t *str) {
+  if(_have_hyperlink_system)
+    AcquireSRWLockExclusive(_srw_global_links);
+    
+  release_link_string(str);
   
-  LeaveCriticalSection(_cs_global_links);
+  if(_have_hyperlink_system)
+    ReleaseSRWLockExclusive(_srw_global_links);
 }
 
 HYPER_CONSOLE_API
@@ -1169,11 +2048,11 @@ WORD hyper_console_set_link_color(WORD attribute) {
   
   assert(_have_hyperlink_system);
   
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockExclusive(_srw_global_links);
   
   old_color = set_open_link_color(_global_links, attribute);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockExclusive(_srw_global_links);
   
   return old_color;
 }
@@ -1184,26 +2063,39 @@ struct dangling_hyperlinks_t *hyperlink_system_cut_links_after_cursor(void) {
   if(!_have_hyperlink_system)
     return NULL;
     
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockExclusive(_srw_global_links);
   
   result = cut_links_after_cursor(_global_links);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockExclusive(_srw_global_links);
   
   return result;
 }
 
+void hyperlink_system_free_dangling_hyperlinks(struct dangling_hyperlinks_t *links) {
+  struct hyperlink_t *link = (struct hyperlink_t*)links;
+  
+  if(_have_hyperlink_system)
+    AcquireSRWLockExclusive(_srw_global_links);
+    
+  while(link)
+    free_link_at(&link);
+    
+  if(_have_hyperlink_system)
+    ReleaseSRWLockExclusive(_srw_global_links);
+}
+
 void hyperlink_system_paste_and_activate_links(struct dangling_hyperlinks_t *links) {
   if(!_have_hyperlink_system) {
     hyperlink_system_free_dangling_hyperlinks(links);
     return;
   }
   
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockExclusive(_srw_global_links);
   
   hs_paste_and_activate_links(_global_links, links);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockExclusive(_srw_global_links);
 }
 
 BOOL hyperlink_system_local_to_global(COORD local, int *line, int *column) {
@@ -1218,11 +2110,77 @@ BOOL hyperlink_system_local_to_global(COORD local, int *line, int *column) {
   if(!_have_hyperlink_system)
     return FALSE;
     
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockShared(_srw_global_links);
   
   result = hs_local_to_global(_global_links, local, line, column);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockShared(_srw_global_links);
+  
+  return result;
+}
+
+BOOL hyperlink_system_get_archived_lines(int *first_line, int *end_line) {
+  struct console_archive_t *archive;
+  
+  assert(first_line != NULL);
+  assert(end_line != NULL);
+  
+  *first_line = 0;
+  *end_line = 0;
+  
+  if(!_have_hyperlink_system)
+    return FALSE;
+    
+  AcquireSRWLockShared(_srw_global_links);
+  
+  archive = console_scrollback_get_archive(_global_links->scrollback);
+  if(archive)
+    console_archive_get_lines(archive, first_line, end_line);
+    
+  ReleaseSRWLockShared(_srw_global_links);
+  
+  return *first_line < *end_line;
+}
+
+/* The archive caches the last decompressed block, so even reading it needs the exclusive lock.
+ */
+int hyperlink_system_find_archived_text(int *line, int max_lines, const wchar_t *folded, int length) {
+  struct console_archive_t *archive;
+  int result = -1;
+  
+  assert(line != NULL);
+  
+  if(!_have_hyperlink_system)
+    return -1;
+    
+  AcquireSRWLockExclusive(_srw_global_links);
+  
+  archive = console_scrollback_get_archive(_global_links->scrollback);
+  if(archive)
+    result = console_archive_find_text(archive, line, max_lines, folded, length);
+    
+  ReleaseSRWLockExclusive(_srw_global_links);
+  
+  return result;
+}
+
+wchar_t *hyperlink_system_get_archived_text(int first_line, int end_line, int *total_length) {
+  struct console_archive_t *archive;
+  wchar_t *result = NULL;
+  
+  assert(total_length != NULL);
+  
+  *total_length = 0;
+  if(!_have_hyperlink_system)
+    return NULL;
+    
+  AcquireSRWLockExclusive(_srw_global_links);
+  
+  archive = console_scrollback_get_archive(_global_links->scrollback);
+  if(archive)
+    result = console_archive_get_text(archive, first_line, end_line, total_length);
+    
+  ReleaseSRWLockExclusive(_srw_global_links);
   
   return result;
 }
@@ -1233,11 +2191,11 @@ BOOL hyperlink_system_click(COORD local, COORD local_end) {
   if(!_have_hyperlink_system)
     return FALSE;
     
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockShared(_srw_global_links);
   
   handled = hs_click(_global_links, local, local_end);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockShared(_srw_global_links);
   
   return handled;
 }
@@ -1252,11 +2210,11 @@ BOOL hyperlink_system_get_hover_title(COORD local, COORD local_end, wchar_t *buf
   if(!_have_hyperlink_system)
     return 0;
     
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockShared(_srw_global_links);
   
   result = hs_get_hover_title(_global_links, local, local_end, buf, buf_len);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockShared(_srw_global_links);
   
   return result;
 }
@@ -1271,26 +2229,37 @@ BOOL hyperlink_system_find_next_link(COORD *pos, COORD *endpos, BOOL forward) {
   if(!_have_hyperlink_system) 
     return FALSE;
     
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockShared(_srw_global_links);
   
   success = hs_find_next_link(_global_links, pos, endpos, forward);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockShared(_srw_global_links);
   
   return success;
 }
 
 BOOL hyperlink_system_handle_events(INPUT_RECORD *event) {
+  BOOL ignored;
   BOOL handled;
   
   if(!_have_hyperlink_system)
     return FALSE;
     
-  EnterCriticalSection(_cs_global_links);
+  // Most mouse moves stay over the same link. Check that without blocking other readers.
+  AcquireSRWLockShared(_srw_global_links);
+  
+  ignored = hs_is_event_ignored(_global_links, event);
+  
+  ReleaseSRWLockShared(_srw_global_links);
+  
+  if(ignored)
+    return FALSE;
+    
+  AcquireSRWLockExclusive(_srw_global_links);
   
   handled = hs_handle_events(_global_links, event);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockExclusive(_srw_global_links);
   
   return handled;
 }
@@ -1299,34 +2268,60 @@ void hyperlink_system_update_scollback(int pre_input_lines) {
   if(!_have_hyperlink_system)
     return;
   
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockExclusive(_srw_global_links);
   
   hs_update_scollback(_global_links, pre_input_lines);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockExclusive(_srw_global_links);
 }
 
 void hyperlink_system_start_input(int console_width, int pre_input_lines) {
   if(!_have_hyperlink_system)
     return;
     
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockExclusive(_srw_global_links);
   
   hs_update_scollback(_global_links, pre_input_lines);
   hs_start_input(_global_links, console_width);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockExclusive(_srw_global_links);
+}
+
+BOOL hyperlink_system_have_inactive_visible_links(void) {
+  BOOL result;
+  
+  if(!_have_hyperlink_system)
+    return FALSE;
+    
+  AcquireSRWLockShared(_srw_global_links);
+  
+  result = activate_visible_links(_global_links, TRUE) > 0;
+  
+  ReleaseSRWLockShared(_srw_global_links);
+  
+  return result;
+}
+
+void hyperlink_system_activate_visible_links(void) {
+  if(!_have_hyperlink_system)
+    return;
+    
+  AcquireSRWLockExclusive(_srw_global_links);
+  
+  activate_visible_links(_global_links, FALSE);
+  
+  ReleaseSRWLockExclusive(_srw_global_links);
 }
 
 void hyperlink_system_end_input(void) {
   if(!_have_hyperlink_system)
     return;
     
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockExclusive(_srw_global_links);
   
   hs_end_input(_global_links);
   
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockExclusive(_srw_global_links);
 }
 
 /*
@@ -1334,19 +2329,79 @@ void hyperlink_system_print_debug_info(void) {
   if(!_have_hyperlink_system)
     return;
 
-  EnterCriticalSection(_cs_global_links);
+  AcquireSRWLockExclusive(_srw_global_links);
 
   hs_print_debug_info(_global_links);
 
-  LeaveCriticalSection(_cs_global_links);
+  ReleaseSRWLockExclusive(_srw_global_links);
 }
 */
 
+HYPER_CONSOLE_API
+void hyper_console_get_link_statistics(struct hyper_console_link_statistics_t *stats) {
+  size_t size;
+  
+  assert(stats != NULL);
+  assert(stats->size >= sizeof(size_t));
+  
+  size = MIN(stats->size, sizeof(struct hyper_console_link_statistics_t));
+  
+  if(_have_hyperlink_system)
+    AcquireSRWLockShared(_srw_global_links);
+    
+  memcpy((char*)stats + sizeof(size_t), (char*)&_link_arena.stats + sizeof(size_t), size - sizeof(size_t));
+  
+  if(_have_hyperlink_system)
+    ReleaseSRWLockShared(_srw_global_links);
+}
+
+HYPER_CONSOLE_API
+void hyper_console_set_scrollback_archive_size(size_t max_bytes) {
+  assert(_have_hyperlink_system);
+  
+  AcquireSRWLockExclusive(_srw_global_links);
+  
+  console_scrollback_set_archive_size(_global_links->scrollback, max_bytes);
+  
+  ReleaseSRWLockExclusive(_srw_global_links);
+}
+
+HYPER_CONSOLE_API
+void hyper_console_get_scrollback_statistics(struct hyper_console_scrollback_statistics_t *stats) {
+  struct hyper_console_scrollback_statistics_t result;
+  struct console_archive_t *archive;
+  size_t size;
+  
+  assert(stats != NULL);
+  assert(stats->size >= sizeof(size_t));
+  
+  memset(&result, 0, sizeof(result));
+  
+  if(_have_hyperlink_system) {
+    AcquireSRWLockShared(_srw_global_links);
+    
+    archive = console_scrollback_get_archive(_global_links->scrollback);
+    if(archive) {
+      int first_line;
+      int end_line;
+      
+      console_archive_get_lines(archive, &first_line, &end_line);
+      console_archive_get_size(archive, &result.text_bytes, &result.archive_bytes);
+      result.archived_lines = end_line - first_line;
+    }
+    
+    ReleaseSRWLockShared(_srw_global_links);
+  }
+  
+  size = MIN(stats->size, sizeof(struct hyper_console_scrollback_statistics_t));
+  memcpy((char*)stats + sizeof(size_t), (char*)&result + sizeof(size_t), size - sizeof(size_t));
+}
+
 HYPER_CONSOLE_API
 void hyper_console_init_hyperlink_system(void) {
   assert(!_have_hyperlink_system);
   
-  InitializeCriticalSection(_cs_global_links);
+  InitializeSRWLock(_srw_global_links);
   init_hyperlink_collection(_global_links);
   
   _have_hyperlink_system = TRUE;
@@ -1359,5 +2414,4 @@ void hyper_console_done_hyperlink_system(void) {
   _have_hyperlink_system = FALSE;
   
   free_hyperlink_collection(_global_links);
-  DeleteCriticalSection(_cs_global_links);
 }
@@ -12,6 +12,13 @@ void hyperlink_system_paste_and_activate_links(struct dangling_hyperlinks_t *lin
 
 BOOL hyperlink_system_local_to_global(COORD local, int *line, int *column);
 
+/* The lines that left the screen buffer, see hyper_console_set_scrollback_archive_size() and 
+   scrollback-archive.h. Line numbers are global.
+ */
+BOOL hyperlink_system_get_archived_lines(int *first_line, int *end_line);
+int hyperlink_system_find_archived_text(int *line, int max_lines, const wchar_t *folded, int length);
+wchar_t *hyperlink_system_get_archived_text(int first_line, int end_line, int *total_length);
+
 BOOL hyperlink_system_click(COORD local, COORD local_end);
 BOOL hyperlink_system_get_hover_title(COORD local, COORD local_end, wchar_t *buf, size_t buf_len);
 BOOL hyperlink_system_find_next_link(COORD *pos, COORD *endpos, BOOL forward);
@@ -22,6 +29,12 @@ void hyperlink_system_update_scollback(int pre_input_lines);
 void hyperlink_system_start_input(int console_width, int pre_input_lines);
 void hyperlink_system_end_input(void);
 
+/* During input, only links in the console window are colored. Call these after scrolling. The 
+   link colors overwrite any inverted selection.
+ */
+BOOL hyperlink_system_have_inactive_visible_links(void);
+void hyperlink_system_activate_visible_links(void);
+
 //void hyperlink_system_print_debug_info(void);
 
 #endif // __CONSOLE__HYPERLINK_OUTPUT_H_I_
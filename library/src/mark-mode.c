@@ -2,6 +2,7 @@
 
 #include "mark-mode.h"
 
+#include "console-backend.h"
 #include "console-buffer-io.h"
 #include "debug.h"
 #include "memory-util.h"
@@ -46,12 +47,16 @@ struct console_mark_t {
   unsigned mouse_down: 1;
   unsigned follow_cursor: 1;
   unsigned continue_with_search: 1;
+  unsigned include_archive: 1; // the whole buffer is selected and the scrollback archive prepended
 };
 
 static BOOL have_selected_output(struct console_mark_t *cm);
+static BOOL is_whole_buffer_selected(struct console_mark_t *cm);
+static void select_all(struct console_mark_t *cm);
 static void make_inclusive_rect(SMALL_RECT *rect, COORD p1, COORD p2);
 static void set_selection_link_title(struct console_mark_t *cm);
 static void reselect_output(struct console_mark_t *cm, COORD pos, COORD anchor);
+static void activate_visible_links(struct console_mark_t *cm);
 
 static void move_selection_left( struct console_mark_t *cm, BOOL fix_anchor, BOOL jump_word);
 static void move_selection_right(struct console_mark_t *cm, BOOL fix_anchor, BOOL jump_word);
@@ -60,7 +65,7 @@ static void move_selection_down (struct console_mark_t *cm, BOOL fix_anchor);
 
 static void goto_next_link(struct console_mark_t *cm, BOOL forward);
 
-static wchar_t *cat_console_line(struct console_mark_t *cm, wchar_t *buffer, wchar_t *buffer_end, COORD start, int length);
+static wchar_t *cat_console_line(struct console_mark_t *cm, const struct console_snapshot_t *snapshot, wchar_t *buffer, wchar_t *buffer_end, COORD start, int length);
 static void copy_output_to_clipboard(struct console_mark_t *cm);
 
 static void set_mark_mode_title(struct console_mark_t *cm, const wchar_t *str);
@@ -79,6 +84,45 @@ static BOOL have_selected_output(struct console_mark_t *cm) {
   return cm->block_mode || cm->anchor.X != cm->pos.X || cm->anchor.Y != cm->pos.Y;
 }
 
+static BOOL is_whole_buffer_selected(struct console_mark_t *cm) {
+  assert(cm != NULL);
+  
+  return !cm->block_mode &&
+         cm->anchor.X == 0 && cm->anchor.Y == 0 &&
+         cm->pos.X    == 0 && cm->pos.Y    == cm->console_size.Y;
+}
+
+/* Select the whole screen buffer. Doing so again adds the scrollback archive to the selection.
+ */
+static void select_all(struct console_mark_t *cm) {
+  COORD anchor;
+  COORD pos;
+  int first_line;
+  int end_line;
+  
+  assert(cm != NULL);
+  
+  if( is_whole_buffer_selected(cm) && 
+      !cm->include_archive && 
+      hyperlink_system_get_archived_lines(&first_line, &end_line)) 
+  {
+    wchar_t buf[64];
+    
+    cm->include_archive = TRUE;
+    
+    StringCbPrintfW(buf, sizeof(buf), L"(all text and %d archived lines)", end_line - first_line);
+    set_mark_mode_title(cm, buf);
+    return;
+  }
+  
+  anchor.X = 0;
+  anchor.Y = 0;
+  pos.X = 0;
+  pos.Y = cm->console_size.Y;
+  
+  reselect_output(cm, pos, anchor);
+}
+
 static void make_inclusive_rect(SMALL_RECT *rect, COORD p1, COORD p2) {
   assert(rect != NULL);
   
@@ -109,6 +153,8 @@ static void reselect_output(struct console_mark_t *cm, COORD pos, COORD anchor)
   
   assert(cm != NULL);
   
+  cm->include_archive = FALSE;
+  
   if(cm->block_mode) {
     SMALL_RECT old_rect;
     SMALL_RECT new_rect;
@@ -150,17 +196,45 @@ static void reselect_output(struct console_mark_t *cm, COORD pos, COORD anchor)
 //    pos.X = cm->console_size.X - 1;
 //  }
 
-  if(GetConsoleScreenBufferInfo(cm->output_handle, &csbi)) {
+  if(console_backend->get_screen_buffer_info(cm->output_handle, &csbi)) {
     if(csbi.dwCursorPosition.X != pos.X || csbi.dwCursorPosition.Y != pos.Y) {
-      SetConsoleCursorPosition(cm->output_handle, pos);
+      console_backend->set_cursor_position(cm->output_handle, pos);
       
       if(!cm->follow_cursor)
-        SetConsoleWindowInfo(cm->output_handle, TRUE, &csbi.srWindow);
+        console_backend->set_window_info(cm->output_handle, TRUE, &csbi.srWindow);
     }
   }
   
   cm->follow_cursor = FALSE;
   set_selection_link_title(cm);
+  activate_visible_links(cm);
+}
+
+/* Color the links that were scrolled into view. Activating a link overwrites its colors, so the
+   selection must be removed meanwhile.
+ */
+static void activate_visible_links(struct console_mark_t *cm) {
+  SMALL_RECT empty = {0};
+  SMALL_RECT rect;
+  
+  assert(cm != NULL);
+  
+  if(!hyperlink_system_have_inactive_visible_links())
+    return;
+    
+  make_inclusive_rect(&rect, cm->anchor, cm->pos);
+  
+  if(cm->was_block_mode)
+    console_reinvert_colors_rect(cm->output_handle, &rect, &empty);
+  else
+    console_reinvert_colors(cm->output_handle, cm->anchor, cm->pos, cm->anchor, cm->anchor);
+    
+  hyperlink_system_activate_visible_links();
+  
+  if(cm->was_block_mode)
+    console_reinvert_colors_rect(cm->output_handle, &empty, &rect);
+  else
+    console_reinvert_colors(cm->output_handle, cm->anchor, cm->anchor, cm->anchor, cm->pos);
 }
 
 
@@ -260,6 +334,7 @@ static void goto_next_link(struct console_mark_t *cm, BOOL forward) {
 
 static wchar_t *cat_console_line(
   struct console_mark_t *cm,
+  const struct console_snapshot_t *snapshot,
   wchar_t *buffer,
   wchar_t *buffer_end,
   COORD start,
@@ -269,6 +344,7 @@ static wchar_t *cat_console_line(
   wchar_t *s;
   
   assert(cm != NULL);
+  assert(snapshot != NULL);
   
   assert(buffer != NULL);
   assert(buffer_end != NULL);
@@ -281,18 +357,11 @@ static wchar_t *cat_console_line(
     return buffer;
   }
   
-  console_read_output_character(
-    cm->output_handle,
-    buffer,
-    length,
-    start,
-    &read_count);
+  read_count = console_read_snapshot_characters(snapshot, buffer, length, start);
     
   s = buffer + read_count;
-  if(s[-1] == L' ') {
-    while(s > buffer && s[-1] == L' ')
-      --s;
-  }
+  while(s > buffer && s[-1] == L' ')
+    --s;
   
   if(s == buffer || s - buffer + start.X + 1 < cm->console_size.X) {
     *s++ = L'\r';
@@ -306,9 +375,11 @@ static wchar_t *cat_console_line(
 /** Get the non-block-mode selected text.
   
   \param total_length Receives the string length of the selection.
-  \return The unwrapped text lines. Should be freed with hyper_console_free_memory(). NULL on error.
+  \return The unwrapped text lines, preceded by the archived lines if cm->include_archive is set. 
+  Should be freed with hyper_console_free_memory(). NULL on error.
  */
 static wchar_t *get_selection_lines(struct console_mark_t *cm, int *total_length) {
+  const struct console_snapshot_t *snapshot;
   COORD start;
   COORD end;
   int length;
@@ -342,19 +413,27 @@ static wchar_t *get_selection_lines(struct console_mark_t *cm, int *total_length
   max_length = length + 2 * (end.Y - start.Y + 1) + 1;
   str = hyper_console_allocate_memory(sizeof(wchar_t) * max_length);
   if(!str) {
-    total_length = 0;
+    *total_length = 0;
+    return NULL;
+  }
+  
+  snapshot = console_borrow_snapshot(cm->output_handle);
+  if(!snapshot) {
+    hyper_console_free_memory(str);
+    *total_length = 0;
     return NULL;
   }
   
   s = str;
   while(start.Y < end.Y) {
-    s = cat_console_line(cm, s, str + max_length, start, cm->console_size.X - start.X);
+    s = cat_console_line(cm, snapshot, s, str + max_length, start, cm->console_size.X - start.X);
     
     start.X = 0;
     start.Y++;
   }
   
-  s = cat_console_line(cm, s, str + max_length, start, end.X - start.X);
+  s = cat_console_line(cm, snapshot, s, str + max_length, start, end.X - start.X);
+  console_return_snapshot(snapshot);
   
   while(str + 2 <= s && s[-2] == L'\r' && s[-1] == L'\n')
     s -= 2;
@@ -362,6 +441,33 @@ static wchar_t *get_selection_lines(struct console_mark_t *cm, int *total_length
   *s = L'\0';
   
   *total_length = (int)(s - str);
+  
+  if(cm->include_archive) {
+    int first_line;
+    int end_line;
+    
+    if(hyperlink_system_get_archived_lines(&first_line, &end_line)) {
+      int archive_length;
+      wchar_t *archive = hyperlink_system_get_archived_text(first_line, end_line, &archive_length);
+      wchar_t *all;
+      
+      if(!archive)
+        return str;
+      
+      all = hyper_console_allocate_memory(sizeof(wchar_t) * (archive_length + *total_length + 1));
+      if(all) {
+        memcpy(all,                  archive, sizeof(wchar_t) * archive_length);
+        memcpy(all + archive_length, str,     sizeof(wchar_t) * (*total_length + 1));
+        
+        hyper_console_free_memory(str);
+        str = all;
+        *total_length+= archive_length;
+      }
+      
+      hyper_console_free_memory(archive);
+    }
+  }
+  
   return str;
 }
 
@@ -372,6 +478,7 @@ static wchar_t *get_selection_lines(struct console_mark_t *cm, int *total_length
   Should be freed with hyper_console_free_memory(). NULL on error.
  */
 static wchar_t *get_selection_block_lines(struct console_mark_t *cm, int *total_length) {
+  const struct console_snapshot_t *snapshot;
   COORD start;
   COORD end;
   wchar_t *str;
@@ -397,18 +504,20 @@ static wchar_t *get_selection_block_lines(struct console_mark_t *cm, int *total_
     return NULL;
   }
   
+  snapshot = console_borrow_snapshot(cm->output_handle);
+  if(!snapshot) {
+    hyper_console_free_memory(str);
+    *total_length = 0;
+    return NULL;
+  }
+  
   s = str;
   pos.X = start.X;
   for(pos.Y = start.Y; pos.Y <= end.Y; pos.Y++) {
     DWORD read_count;
     wchar_t *next;
     
-    console_read_output_character(
-      cm->output_handle,
-      s,
-      line_length,
-      pos,
-      &read_count);
+    read_count = console_read_snapshot_characters(snapshot, s, line_length, pos);
       
     next = s + read_count;
     if(pos.Y < end.Y) {
@@ -422,6 +531,8 @@ static wchar_t *get_selection_block_lines(struct console_mark_t *cm, int *total_
     s = next;
   }
   
+  console_return_snapshot(snapshot);
+  
   if(start.Y < end.Y) {
     while(s != str && s[-1] == L' ')
       --s;
@@ -532,10 +643,10 @@ static void set_mark_mode_title(struct console_mark_t *cm, const wchar_t *str) {
     wchar_t buffer[256 + 20];
     
     StringCbPrintfW(buffer, sizeof(buffer), L"%s %s", mark_mode_translation, str);
-    SetConsoleTitleW(buffer);
+    console_backend->set_title(buffer);
   }
   else
-    SetConsoleTitleW(mark_mode_translation);
+    console_backend->set_title(mark_mode_translation);
 }
 
 static void start_mark_mode(struct console_mark_t *cm) {
@@ -544,7 +655,7 @@ static void start_mark_mode(struct console_mark_t *cm) {
   
   assert(cm != NULL);
   
-  if(GetConsoleScreenBufferInfo(cm->output_handle, &csbi)) {
+  if(console_backend->get_screen_buffer_info(cm->output_handle, &csbi)) {
     reselect_output(cm, csbi.dwCursorPosition, csbi.dwCursorPosition);
     cm->active = TRUE;
   }
@@ -552,14 +663,14 @@ static void start_mark_mode(struct console_mark_t *cm) {
   if(cm->oritinal_title == NULL) {
     cm->oritinal_title = hyper_console_allocate_memory(sizeof(wchar_t) * 256);
     if(cm->oritinal_title)
-      GetConsoleTitleW(cm->oritinal_title, 256);
+      console_backend->get_title(cm->oritinal_title, 256);
       
     set_mark_mode_title(cm, cm->oritinal_title);
   }
   
   cci.bVisible = TRUE;
   cci.dwSize = 50;
-  SetConsoleCursorInfo(cm->output_handle, &cci);
+  console_backend->set_cursor_info(cm->output_handle, &cci);
 }
 
 
@@ -607,7 +718,9 @@ static BOOL mark_mode_handle_key_event(struct console_mark_t *cm, KEY_EVENT_RECO
         return TRUE;
         
       case VK_UP:
-        if(!console_scroll_key(cm->output_handle, er)) {
+        if(console_scroll_key(cm->output_handle, er))
+          activate_visible_links(cm);
+        else {
           cm->follow_cursor = TRUE;
           cm->block_mode = 0 != (er->dwControlKeyState & (LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED));
           move_selection_up(
@@ -617,7 +730,9 @@ static BOOL mark_mode_handle_key_event(struct console_mark_t *cm, KEY_EVENT_RECO
         return TRUE;
         
       case VK_DOWN:
-        if(!console_scroll_key(cm->output_handle, er)) {
+        if(console_scroll_key(cm->output_handle, er))
+          activate_visible_links(cm);
+        else {
           cm->follow_cursor = TRUE;
           cm->block_mode = 0 != (er->dwControlKeyState & (LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED));
           move_selection_down(
@@ -628,19 +743,15 @@ static BOOL mark_mode_handle_key_event(struct console_mark_t *cm, KEY_EVENT_RECO
         
       case VK_PRIOR:
       case VK_NEXT:
-        return console_scroll_key(cm->output_handle, er);
+        if(console_scroll_key(cm->output_handle, er)) {
+          activate_visible_links(cm);
+          return TRUE;
+        }
+        return FALSE;
         
       case 'A': // Ctrl+A
         if(er->dwControlKeyState & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)) {
-          COORD anchor;
-          COORD pos;
-          
-          anchor.X = 0;
-          anchor.Y = 0;
-          pos.X = 0;
-          pos.Y = cm->console_size.Y;
-          
-          reselect_output(cm, pos, anchor);
+          select_all(cm);
           return TRUE;
         }
         break;
@@ -781,7 +892,8 @@ static BOOL mark_mode_handle_mouse_event(struct console_mark_t *cm, MOUSE_EVENT_
     case MOUSE_HWHEELED:
     case MOUSE_WHEELED:
       if(cm->active) {
-        console_scroll_wheel(cm->output_handle, er);
+        if(console_scroll_wheel(cm->output_handle, er))
+          activate_visible_links(cm);
         return TRUE;
       }
       return FALSE;
@@ -818,7 +930,7 @@ static BOOL run_mark_mode(struct console_mark_t *cm, INPUT_RECORD *event) {
     if(!cm->active || cm->stop)
       return TRUE;
       
-    if(!ReadConsoleInputW(cm->input_handle, event, 1, &num_read) || num_read < 1)
+    if(!console_backend->read_input(cm->input_handle, event, 1, &num_read) || num_read < 1)
       return TRUE;
       
     if(cm->continue_with_search) {
@@ -845,16 +957,16 @@ static void finish_mark_mode(struct console_mark_t *cm) {
   reselect_output(cm, cm->original_pos, cm->original_pos);
   
   if(cm->oritinal_title) {
-    SetConsoleTitleW(cm->oritinal_title);
+    console_backend->set_title(cm->oritinal_title);
     
     hyper_console_free_memory(cm->oritinal_title);
     cm->oritinal_title = NULL;
   }
   
   cci = cm->original_cursor;
-  GetConsoleCursorInfo(cm->output_handle, &cci);
+  console_backend->get_cursor_info(cm->output_handle, &cci);
   if(0 != memcmp(&cci, &cm->original_cursor, sizeof(cci))) {
-    SetConsoleCursorInfo(cm->output_handle, &cm->original_cursor);
+    console_backend->set_cursor_info(cm->output_handle, &cm->original_cursor);
   }
 }
 
@@ -873,10 +985,10 @@ BOOL console_handle_mark_mode(struct mark_mode_settings_t *settings, INPUT_RECOR
   cm.callback_context = settings->callback_context;
   cm.key_event_filter = settings->key_event_filter;
   
-  if(!GetConsoleScreenBufferInfo(cm.output_handle, &csbi))
+  if(!console_backend->get_screen_buffer_info(cm.output_handle, &csbi))
     return FALSE;
     
-  if(!GetConsoleCursorInfo(cm.output_handle, &cm.original_cursor))
+  if(!console_backend->get_cursor_info(cm.output_handle, &cm.original_cursor))
     return FALSE;
     
   if(settings->mm_handle_ptr)
@@ -0,0 +1,137 @@
+#define _WIN32_WINNT 0x0600
+
+#include <hyper-console.h>
+
+#include "output-queue.h"
+#include "console-backend.h"
+#include "memory-util.h"
+#include "debug.h"
+
+#include <assert.h>
+
+
+/* Protects all of the following. hyper_console_post_output() may be called from any thread. */
+static SRWLOCK _srw_output_queue = SRWLOCK_INIT;
+
+static HANDLE _attached_input_handle = NULL;
+static wchar_t *_queued_text = NULL;
+static int _queued_length = 0;
+static int _queued_capacity = 0;
+
+static BOOL wake_input_loop(HANDLE input_handle);
+
+
+static BOOL wake_input_loop(HANDLE input_handle) {
+  INPUT_RECORD event;
+  DWORD num_written;
+  
+  // Menu events are ignored by all input loops, but WaitForSingleObject() returns.
+  memset(&event, 0, sizeof(event));
+  event.EventType = MENU_EVENT;
+  
+  if(!console_backend->write_input(input_handle, &event, 1, &num_written) || num_written < 1) {
+    debug_printf(L"wake_input_loop: WriteConsoleInputW failed\n");
+    return FALSE;
+  }
+  
+  return TRUE;
+}
+
+HANDLE output_queue_attach(HANDLE input_handle) {
+  HANDLE previous;
+  
+  assert(input_handle != NULL);
+  
+  AcquireSRWLockExclusive(&_srw_output_queue);
+  previous = _attached_input_handle;
+  _attached_input_handle = input_handle;
+  ReleaseSRWLockExclusive(&_srw_output_queue);
+  
+  return previous;
+}
+
+void output_queue_detach(HANDLE previous_input_handle, HANDLE output_handle) {
+  AcquireSRWLockExclusive(&_srw_output_queue);
+  
+  _attached_input_handle = previous_input_handle;
+  if(previous_input_handle) {
+    // The outer input loop has not seen the wake-up event, which we might have consumed.
+    if(_queued_length > 0)
+      wake_input_loop(previous_input_handle);
+  }
+  else {
+    // Still under the lock, so that text posted meanwhile cannot overtake this text.
+    if(_queued_length > 0 && !console_backend->write_text(output_handle, _queued_text, (DWORD)_queued_length, NULL)) {
+      debug_printf(L"output_queue_detach: WriteConsoleW failed\n");
+    }
+    
+    hyper_console_free_memory(_queued_text);
+    _queued_text = NULL;
+    _queued_length = 0;
+    _queued_capacity = 0;
+  }
+  
+  ReleaseSRWLockExclusive(&_srw_output_queue);
+}
+
+wchar_t *output_queue_take(int *length) {
+  wchar_t *text;
+  
+  assert(length != NULL);
+  
+  AcquireSRWLockExclusive(&_srw_output_queue);
+  text = _queued_text;
+  *length = _queued_length;
+  _queued_text = NULL;
+  _queued_length = 0;
+  _queued_capacity = 0;
+  ReleaseSRWLockExclusive(&_srw_output_queue);
+  
+  if(text && *length == 0) {
+    hyper_console_free_memory(text);
+    return NULL;
+  }
+  
+  return text;
+}
+
+HYPER_CONSOLE_API
+BOOL hyper_console_post_output(const wchar_t *text, int length) {
+  BOOL success = TRUE;
+  
+  assert(text != NULL);
+  
+  if(length < 0)
+    length = (int)wcslen(text);
+    
+  if(length == 0)
+    return TRUE;
+    
+  AcquireSRWLockExclusive(&_srw_output_queue);
+  
+  if(_attached_input_handle) {
+    BOOL was_empty = _queued_length == 0;
+    
+    if( length > 0x7FFFFFFF - _queued_length ||
+        !resize_array((void**)&_queued_text, &_queued_capacity, sizeof(wchar_t), _queued_length + length))
+    {
+      success = FALSE;
+    }
+    else {
+      memcpy(_queued_text + _queued_length, text, length * sizeof(wchar_t));
+      _queued_length += length;
+      
+      // One wake-up per batch. The input loop takes the whole queue.
+      if(was_empty)
+        wake_input_loop(_attached_input_handle);
+    }
+  }
+  else {
+    HANDLE output_handle = console_backend->get_std_handle(STD_OUTPUT_HANDLE);
+    
+    success = console_backend->write_text(output_handle, text, (DWORD)length, NULL);
+  }
+  
+  ReleaseSRWLockExclusive(&_srw_output_queue);
+  return success;
+}
@@ -0,0 +1,43 @@
+#ifndef __CONSOLE__OUTPUT_QUEUE_H__
+#define __CONSOLE__OUTPUT_QUEUE_H__
+
+#include <windows.h>
+
+
+/** The queue of text posted with hyper_console_post_output().
+
+  While an input loop is attached, posted text is collected and the loop is woken up with a
+  MENU_EVENT in its console input. Otherwise, posted text is written immediately.
+ */
+
+
+/** Let the input loop of the current thread collect posted text.
+
+  \param input_handle The console input handle of the input loop.
+  
+  \return The previously attached input handle (of an outer input loop) or NULL. Pass it to
+          output_queue_detach().
+ */
+HANDLE output_queue_attach(HANDLE input_handle);
+
+
+/** Stop collecting posted text in the current input loop.
+
+  \param previous_input_handle The return value of the matching output_queue_attach().
+  \param output_handle The console output handle for any remaining text. This is only used if
+                       \a previous_input_handle is NULL.
+ */
+void output_queue_detach(HANDLE previous_input_handle, HANDLE output_handle);
+
+
+/** Remove all collected text from the queue.
+
+  \param length Output parameter for the text length.
+  
+  \return The text (not 0-terminated) or NULL if the queue is empty. 
+          It must be freed with hyper_console_free_memory().
+ */
+wchar_t *output_queue_take(int *length);
+
+
+#endif // __CONSOLE__OUTPUT_QUEUE_H__
@@ -6,11 +6,13 @@
 #include "console-history.h"
 #include "memory-util.h"
 #include "hyperlink-output.h"
+#include "console-backend.h"
 #include "console-buffer-io.h"
 #include "debug.h"
 #include "mark-mode.h"
 #include "search-mode.h"
 #include "text-util.h"
+#include "output-queue.h"
 
 #include <assert.h>
 #include <stdio.h>
@@ -27,6 +29,10 @@
 #define MAX(A, B)  ((A) > (B) ? (A) : (B))
 
 
+/* Maximum number of input events that input_loop() reads at once */
+#define MAX_INPUT_BATCH  256
+
+
 #ifndef offsetof
 #  define offsetof(type, member) __builtin_offsetof(type, member)
 #endif
@@ -47,9 +53,14 @@ struct console_input_t {
   WORD attr_completion;
   int input_line_coord_y;
   
-  wchar_t *input_text; // [input_length + 1]
+  /* Gap buffer: input_text[input_gap_start ... input_gap_start + input_gap_size - 1] is unused.
+     Use get_input_char() or get_input_text() to access the text.
+   */
+  wchar_t *input_text; // [input_capacity]
   int input_capacity;
   int input_length;
+  int input_gap_start;
+  int input_gap_size;
   int input_pos;
   int input_anchor;
   
@@ -76,6 +87,12 @@ struct console_input_t {
   int *output_to_input_positions; // [output_size]
   int output_to_input_capacity;
   
+  /* Scratch buffers for expand_glyphs(), swapped with output_buffer and output_to_input_positions */
+  CHAR_INFO *layout_buffer;
+  int layout_capacity;
+  int *layout_to_input_positions;
+  int layout_to_input_capacity;
+  
   void *callback_context;
   BOOL (*need_more_input_predicate)(void *context, const wchar_t *buffer, int len, int cursor_pos);
   wchar_t **(*auto_completion)(void *context, const wchar_t *buffer, int len, int cursor_pos, int *completion_start, int *completion_end);
@@ -90,6 +107,27 @@ struct console_input_t {
   
   const char *error;
   int dirty_lines;
+  
+  /* The lines last written by write_output_buffer_lines(), used to skip unchanged cells */
+  CHAR_INFO *shadow_buffer; // [shadow_lines * shadow_width]
+  int shadow_capacity;
+  int shadow_lines;
+  int shadow_width;
+  int shadow_line_coord_y;
+  int cells_written; // by the last redraw, see hyper_console_get_redraw_info()
+  
+  /* Input events read at once by read_input_batch() */
+  INPUT_RECORD *input_batch;
+  int input_batch_capacity;
+  int batch_events;
+  int batch_redraws;
+  
+  /* Reverse incremental history search (Ctrl+R). The original input is the history future entry. */
+  wchar_t *history_search_text; // [history_search_capacity]
+  int history_search_capacity;
+  int history_search_length;
+  int history_search_index; // the matching entry or console_history_count() before the first match
+  wchar_t *history_search_old_title;
 
   DWORD old_input_mode;
   DWORD old_output_mode;
@@ -109,6 +147,10 @@ struct console_input_t {
   unsigned retain_completions: 1;
   unsigned navigating_history: 1;
   unsigned no_echo: 1;
+  unsigned defer_update: 1;
+  unsigned update_pending: 1;
+  unsigned searching_history: 1;
+  unsigned history_search_failed: 1;
 };
 
 static BOOL is_console(HANDLE handle);
@@ -126,21 +168,27 @@ static int get_input_position_from_screen_position(struct console_input_t *con,
 
 static BOOL resize_output_buffer(struct console_input_t *con, int size);
 static BOOL fill_output_buffer(struct console_input_t *con);
-static BOOL insert_glyphs(struct console_input_t *con, int pos, const CHAR_INFO *glyphs, int glyphs_count, int repeat);
+static BOOL reserve_layout_buffer(struct console_input_t *con, int size);
 static BOOL expand_glyphs(struct console_input_t *con);
 static BOOL colorize_matching_fences(struct console_input_t *con);
 static void highlight_completion(struct console_input_t *con);
 static void highlight_selection(struct console_input_t *con);
 static BOOL extend_output_buffer_to_full_lines(struct console_input_t *con);
 static BOOL scroll_screen_if_needed(struct console_input_t *con);
+static BOOL find_changed_span(struct console_input_t *con, const CHAR_INFO *line_buffer, int line, int *left, int *right);
+static BOOL write_changed_lines(struct console_input_t *con, const CHAR_INFO *lines_buffer, int first_line, int num_lines);
 static BOOL write_output_buffer_lines(struct console_input_t *con);
+static void invalidate_shadow_buffer(struct console_input_t *con);
 static BOOL set_output_cursor_position(struct console_input_t *con);
 
 static BOOL selection_equals(struct console_input_t *con, const wchar_t *str);
 static BOOL can_auto_surround(struct console_input_t *con);
 static BOOL has_hard_line_break(struct console_input_t *con);
 
-static BOOL resize_input_text(struct console_input_t *con, int length);
+static void move_input_gap(struct console_input_t *con, int pos);
+static BOOL reserve_input_gap(struct console_input_t *con, int length);
+static wchar_t get_input_char(struct console_input_t *con, int pos);
+static wchar_t *get_input_text(struct console_input_t *con);
 static BOOL insert_input_text(struct console_input_t *con, int pos, const  wchar_t *str, int length);
 static BOOL insert_input_char(struct console_input_t *con, int pos, wchar_t ch);
 static BOOL surround_selection(struct console_input_t *con, const wchar_t *left, const wchar_t *right);
@@ -154,12 +202,23 @@ static void move_end(struct console_input_t *con, BOOL fix_anchor);
 
 static BOOL delete_selection_no_update(struct console_input_t *con);
 static void copy_to_clipboard(struct console_input_t *con);
+static void paste_text(struct console_input_t *con, const wchar_t *text, int length);
+static void paste_from_clipboard(struct console_input_t *con);
+
+static BOOL scroll_window_by_key(struct console_input_t *con, const KEY_EVENT_RECORD *er);
+static void scroll_window_by_wheel(struct console_input_t *con, const MOUSE_EVENT_RECORD *er);
 
 static BOOL begin_navigate_history(struct console_input_t *con);
 static void cancel_navigate_history(struct console_input_t *con);
 static void navigate_history(struct console_input_t *con, int delta);
+static void set_history_search_title(struct console_input_t *con);
+static void find_in_history(struct console_input_t *con, int before_index);
+static BOOL begin_history_search(struct console_input_t *con);
+static void end_history_search(struct console_input_t *con, BOOL accept);
+static BOOL handle_history_search_key_down(struct console_input_t *con, const KEY_EVENT_RECORD *er);
 static BOOL handle_history_key_down(struct console_input_t *con, const KEY_EVENT_RECORD *er);
 
+static BOOL break_line_or_stop(struct console_input_t *con);
 static void handle_key_return(struct console_input_t *con);
 static BOOL try_indent(struct console_input_t *con, BOOL forward);
 static void handle_completion(struct console_input_t *con, BOOL forward);
@@ -179,16 +238,22 @@ static void handle_menu_event(struct console_input_t *con, const MENU_EVENT_RECO
 static void handle_unknown_event(struct console_input_t *con, const INPUT_RECORD *ir);
 
 static BOOL is_mouse_event_inside_edit_region(struct console_input_t *con, INPUT_RECORD *ir);
+static BOOL is_text_input_event(const INPUT_RECORD *ir);
+static int read_input_batch(struct console_input_t *con);
+static void flush_deferred_update(struct console_input_t *con);
 
 static void finish_input(struct console_input_t *con);
 static BOOL set_console_modes(struct console_input_t *con);
 static BOOL input_loop(struct console_input_t *con);
+static void interrupt_input(struct console_input_t *con, void (*callback)(void*), void *callback_arg);
+static void print_posted_output(struct console_input_t *con);
+static void write_posted_output(void *context);
 
 static struct console_input_t *get_current_input(void);
 
 static BOOL is_console(HANDLE handle) {
   DWORD mode;
-  return GetConsoleMode(handle, &mode);
+  return console_backend->get_mode(handle, &mode);
 }
 
 static BOOL default_need_more_input_predicate(void *context, const wchar_t *buffer, int len, int cursor_pos) {
@@ -221,8 +286,8 @@ static BOOL init_console(struct console_input_t *con) {
   
   memset(con, 0, sizeof(struct console_input_t));
   
-  con->input_handle = GetStdHandle(STD_INPUT_HANDLE);
-  con->output_handle = GetStdHandle(STD_OUTPUT_HANDLE);
+  con->input_handle = console_backend->get_std_handle(STD_INPUT_HANDLE);
+  con->output_handle = console_backend->get_std_handle(STD_OUTPUT_HANDLE);
   
   if(con->input_handle == INVALID_HANDLE_VALUE) {
     con->error = "GetStdHandle(STD_INPUT_HANDLE)";
@@ -246,7 +311,17 @@ static BOOL init_console(struct console_input_t *con) {
     return FALSE;
   }
   
-  con->input_text[0] = L'\0';
+  con->input_gap_start = 0;
+  con->input_gap_size = con->input_capacity;
+
+  con->input_to_output_capacity = con->input_capacity;
+  con->input_to_output_positions = hyper_console_allocate_memory(sizeof(int) * con->input_to_output_capacity);
+  if(!con->input_to_output_positions) {
+    con->input_to_output_capacity = 0;
+    con->error = "hyper_console_allocate_memory";
+    return FALSE;
+  }
+
   con->use_position_dependent_coloring = TRUE;
   
   con->preferred_column = -1;
@@ -270,7 +345,7 @@ static BOOL init_buffer(struct console_input_t *con) {
     return FALSE;
     
   memset(&csbi, 0, sizeof(csbi));
-  if(!GetConsoleScreenBufferInfo(con->output_handle, &csbi)) {
+  if(!console_backend->get_screen_buffer_info(con->output_handle, &csbi)) {
     con->error = "GetConsoleScreenBufferInfo";
     return FALSE;
   }
@@ -353,7 +428,7 @@ static BOOL read_prompt(struct console_input_t *con, int length) {
   region.Top = (SHORT)con->input_line_coord_y;
   region.Right = (SHORT)con->prompt_size;
   region.Bottom = region.Top;
-  if(!ReadConsoleOutputW(con->output_handle, con->prompt, bufsize, bufpos, &region)) {
+  if(!console_backend->read_output(con->output_handle, con->prompt, bufsize, bufpos, &region)) {
     hyper_console_free_memory(con->prompt);
     con->prompt = NULL;
     con->prompt_size = 0;
@@ -416,10 +491,18 @@ static void forget_completions(struct console_input_t *con) {
 static void free_console(struct console_input_t *con) {
   assert(con != NULL);
   
+  if(con->searching_history)
+    end_history_search(con, TRUE);
+    
   hyper_console_free_memory(con->input_text);
   hyper_console_free_memory(con->prompt);
   hyper_console_free_memory(con->continuation_prompt);
   hyper_console_free_memory(con->output_buffer);
+  hyper_console_free_memory(con->layout_buffer);
+  hyper_console_free_memory(con->layout_to_input_positions);
+  hyper_console_free_memory(con->shadow_buffer);
+  hyper_console_free_memory(con->input_batch);
+  hyper_console_free_memory(con->history_search_text);
   hyper_console_free_memory(con->input_to_output_positions);
   hyper_console_free_memory(con->output_to_input_positions);
   forget_completions(con);
@@ -524,6 +607,16 @@ static BOOL fill_output_buffer(struct console_input_t *con) {
   if(con->error)
     return FALSE;
     
+  if(!resize_array(
+        (void**)&con->input_to_output_positions,
+        &con->input_to_output_capacity,
+        sizeof(con->input_to_output_positions[0]),
+        con->input_length + 1))
+  {
+    con->error = "resize_array";
+    return FALSE;
+  }
+  
   memcpy(con->output_buffer, con->prompt, con->prompt_size * sizeof(con->prompt[0]));
   
   o2i = con->output_to_input_positions;
@@ -536,6 +629,8 @@ static BOOL fill_output_buffer(struct console_input_t *con) {
   s = con->input_text;
   len = con->input_length;
   for(i = 0; i < len; ++i) {
+    if(i == con->input_gap_start)
+      s += con->input_gap_size;
   
     p->Char.UnicodeChar = *s;
     p->Attributes = con->attr_default;
@@ -554,58 +649,48 @@ static BOOL fill_output_buffer(struct console_input_t *con) {
   return TRUE;
 }
 
-static BOOL insert_glyphs(struct console_input_t *con, int pos, const CHAR_INFO *glyphs, int glyphs_count, int repeat) {
-  int i;
-  int input_pos;
-  
+static BOOL reserve_layout_buffer(struct console_input_t *con, int size) {
   assert(con != NULL);
-  if(con->error)
-    return FALSE;
-    
-  assert(pos >= 0);
-  assert(pos <= con->output_size);
-  
-  assert(repeat >= 0);
-  assert(glyphs_count >= 0);
-  assert(glyphs != NULL || glyphs_count == 0);
   
-  resize_output_buffer(con, con->output_size + glyphs_count * repeat);
   if(con->error)
     return FALSE;
     
-  memmove(
-    con->output_buffer + pos + glyphs_count * repeat,
-    con->output_buffer + pos,
-    (con->output_size - pos - glyphs_count * repeat) * sizeof(CHAR_INFO));
-  memmove(
-    con->output_to_input_positions + pos + glyphs_count * repeat,
-    con->output_to_input_positions + pos,
-    (con->output_size - pos - glyphs_count * repeat) * sizeof(int));
-    
-  for(i = 0; i < repeat; ++i) {
-    int j;
-    for(j = 0; j < glyphs_count; ++j)
-      con->output_buffer[pos + i * glyphs_count + j] = glyphs[j];
-  }
-  
-  if(pos > 0)
-    input_pos = con->output_to_input_positions[pos - 1];
-  else
-    input_pos = 0;
-    
-  for(i = 0; i < repeat * glyphs_count; ++i) {
-    con->output_to_input_positions[pos + i] = input_pos;
+  if(!resize_array(
+        (void**)&con->layout_buffer,
+        &con->layout_capacity,
+        sizeof(con->layout_buffer[0]),
+        size))
+  {
+    con->error = "resize_array";
+    return FALSE;
   }
   
-  for(++input_pos; input_pos <= con->input_length; ++input_pos) {
-    con->input_to_output_positions[input_pos] += repeat * glyphs_count;
+  if(!resize_array(
+        (void**)&con->layout_to_input_positions,
+        &con->layout_to_input_capacity,
+        sizeof(con->layout_to_input_positions[0]),
+        size))
+  {
+    con->error = "resize_array";
+    return FALSE;
   }
   
   return TRUE;
 }
 
+/* Lay out tabs, line breaks and double-width characters in a single pass from output_buffer
+   into layout_buffer and then swap both buffers. Every expanded cell inherits the attributes 
+   and input position of the character it was expanded from.
+ */
 static BOOL expand_glyphs(struct console_input_t *con) {
+  CHAR_INFO *old_buffer;
+  int *old_o2i;
+  int old_capacity;
+  CHAR_INFO *dst;
+  int *dst_o2i;
+  int *i2o;
   int bufpos;
+  int out;
   int console_width;
   int tab_width;
   int tab_start;
@@ -630,26 +715,31 @@ static BOOL expand_glyphs(struct console_input_t *con) {
     tab_start = 0;
   else
     tab_start = tab_start % tab_width;
-    
+  
+  if(!reserve_layout_buffer(con, con->output_size))
+    return FALSE;
+  
+  memcpy(con->layout_buffer, con->output_buffer, con->prompt_size * sizeof(CHAR_INFO));
+  memcpy(con->layout_to_input_positions, con->output_to_input_positions, con->prompt_size * sizeof(int));
+  
+  i2o = con->input_to_output_positions;
+  out = con->prompt_size;
   for(bufpos = con->prompt_size; bufpos < con->output_size; ++bufpos) {
-    if(con->multiline_mode && con->output_buffer[bufpos].Char.UnicodeChar == L'\n') {
-      int column = bufpos % console_width;
-      
-      con->output_buffer[bufpos].Char.UnicodeChar = L' ';
-      if(!insert_glyphs(con, bufpos + 1, &con->output_buffer[bufpos], 1, console_width - column - 1))
-        return FALSE;
-        
-      bufpos += console_width - column;
-      if(!insert_glyphs(con, bufpos, con->continuation_prompt, con->continuation_prompt_size, 1))
-        return FALSE;
-        
-      bufpos += con->continuation_prompt_size;
-      bufpos -= 1; // will be incremented immediately
-      continue;
-    }
+    CHAR_INFO cell = con->output_buffer[bufpos];
+    int input_pos = con->output_to_input_positions[bufpos];
+    int column = out % console_width;
+    int repeat = 0;
+    int prompt_size = 0;
+    CHAR_INFO second_cell = cell;
+    int i;
     
-    if(con->output_buffer[bufpos].Char.UnicodeChar == L'\t') {
-      int column = bufpos % console_width;
+    if(con->multiline_mode && cell.Char.UnicodeChar == L'\n') {
+      cell.Char.UnicodeChar = L' ';
+      repeat = console_width - column - 1;
+      prompt_size = con->continuation_prompt_size;
+      second_cell.Char.UnicodeChar = L' ';
+    }
+    else if(cell.Char.UnicodeChar == L'\t') {
       int tabstop;
       
       if(column < tab_start)
@@ -659,33 +749,61 @@ static BOOL expand_glyphs(struct console_input_t *con) {
       
       if(tabstop > console_width)
         tabstop = console_width;
-        
-      con->output_buffer[bufpos].Char.UnicodeChar = L' ';
-      if(!insert_glyphs(con, bufpos + 1, &con->output_buffer[bufpos], 1, tabstop - column - 1))
-        return FALSE;
-        
-      bufpos += tabstop - column - 1;
-      continue;
+      
+      cell.Char.UnicodeChar = L' ';
+      repeat = tabstop - column - 1;
+      second_cell.Char.UnicodeChar = L' ';
+    }
+    else if(!(cell.Attributes & (COMMON_LVB_LEADING_BYTE |  COMMON_LVB_TRAILING_BYTE)) &&
+        2 == console_get_cell_count_for_character(cell.Char.UnicodeChar)) 
+    {
+      second_cell.Attributes |= COMMON_LVB_TRAILING_BYTE;
+      cell.Attributes |= COMMON_LVB_LEADING_BYTE;
+      repeat = 1;
     }
     
-    if(con->output_buffer[bufpos].Attributes & (COMMON_LVB_LEADING_BYTE |  COMMON_LVB_TRAILING_BYTE)) 
-      continue;
+    // Also keep room for the remaining unexpanded cells.
+    if(!reserve_layout_buffer(con, out + 1 + repeat + prompt_size + con->output_size - bufpos - 1))
+      return FALSE;
     
-    if(2 == console_get_cell_count_for_character(con->output_buffer[bufpos].Char.UnicodeChar)) {
-      CHAR_INFO cell;
-      cell.Char.UnicodeChar = con->output_buffer[bufpos].Char.UnicodeChar;
-      cell.Attributes = con->output_buffer[bufpos].Attributes | COMMON_LVB_TRAILING_BYTE;
-      
-      if(!insert_glyphs(con, bufpos + 1, &cell, 1, 1))
-        return FALSE;
-        
-      con->output_buffer[bufpos].Attributes |= COMMON_LVB_LEADING_BYTE;
-      ++bufpos;
-      continue;
+    dst = con->layout_buffer + out;
+    dst_o2i = con->layout_to_input_positions + out;
+    
+    i2o[input_pos] = out;
+    *dst++ = cell;
+    *dst_o2i++ = input_pos;
+    for(i = 0; i < repeat; ++i) {
+      *dst++ = second_cell;
+      *dst_o2i++ = input_pos;
+    }
+    
+    if(prompt_size > 0) {
+      memcpy(dst, con->continuation_prompt, prompt_size * sizeof(CHAR_INFO));
+      for(i = 0; i < prompt_size; ++i)
+        *dst_o2i++ = input_pos;
     }
+    
+    out += 1 + repeat + prompt_size;
   }
   
-  return 1;
+  i2o[con->input_length] = out;
+  
+  old_buffer = con->output_buffer;
+  con->output_buffer = con->layout_buffer;
+  con->layout_buffer = old_buffer;
+  old_capacity = con->output_capacity;
+  con->output_capacity = con->layout_capacity;
+  con->layout_capacity = old_capacity;
+  
+  old_o2i = con->output_to_input_positions;
+  con->output_to_input_positions = con->layout_to_input_positions;
+  con->layout_to_input_positions = old_o2i;
+  old_capacity = con->output_to_input_capacity;
+  con->output_to_input_capacity = con->layout_to_input_capacity;
+  con->layout_to_input_capacity = old_capacity;
+  
+  con->output_size = out;
+  return TRUE;
 }
 
 static BOOL colorize_matching_fences(struct console_input_t *con) {
@@ -709,7 +827,10 @@ static BOOL colorize_matching_fences(struct console_input_t *con) {
   for(pos = con->input_pos; pos >= 0 && pos >= con->input_pos - 1; --pos) {
     buf_pos = get_output_position_from_input_position(con, pos);
     
-    other_pos = console_find_opposite_fence(con->input_text, con->input_length, pos);
+    if(pos == con->input_length || !console_get_opposite_fence(get_input_char(con, pos)))
+      continue;
+    
+    other_pos = console_find_opposite_fence(get_input_text(con), con->input_length, pos);
     if(other_pos >= 0) {
       other_buf_pos = get_output_position_from_input_position(con, other_pos);
       
@@ -720,12 +841,10 @@ static BOOL colorize_matching_fences(struct console_input_t *con) {
       return TRUE;
     }
     
-    if(console_get_opposite_fence(con->input_text[pos])) {
-      con->output_buffer[buf_pos].Attributes = con->attr_missing_fence;
-      
-      con->have_colored_fences = TRUE;
-      return TRUE;
-    }
+    con->output_buffer[buf_pos].Attributes = con->attr_missing_fence;
+    
+    con->have_colored_fences = TRUE;
+    return TRUE;
   }
   
   return FALSE;
@@ -846,13 +965,14 @@ static BOOL scroll_screen_if_needed(struct console_input_t *con) {
     
     hyperlink_system_end_input();
     
-    if(!ScrollConsoleScreenBufferW(con->output_handle, &scroll_rect, NULL, dst, &space)) {
+    if(!console_scroll_buffer(con->output_handle, &scroll_rect, NULL, dst, &space)) {
       con->error = "ScrollConsoleScreenBufferW";
       return did_scroll;
     }
     
     con->input_line_coord_y -= scroll_lines;
     did_scroll = TRUE;
+    invalidate_shadow_buffer(con);
     
     hyperlink_system_start_input(con->console_size.X, con->input_line_coord_y);
   }
@@ -877,13 +997,113 @@ static BOOL scroll_screen_if_needed(struct console_input_t *con) {
   return did_scroll;
 }
 
-// Only writes full lines. Does not scroll buffer. Does not update cursor.
-static BOOL write_output_buffer_lines(struct console_input_t *con) {
+static void invalidate_shadow_buffer(struct console_input_t *con) {
+  assert(con != NULL);
+  
+  con->shadow_lines = 0;
+}
+
+// Get the range of cells in a line that differ from what the shadow buffer says is on screen.
+static BOOL find_changed_span(struct console_input_t *con, const CHAR_INFO *line_buffer, int line, int *left, int *right) {
+  const CHAR_INFO *shadow;
+  int l;
+  int r;
+  
+  assert(con != NULL);
+  assert(line_buffer != NULL);
+  assert(left != NULL);
+  assert(right != NULL);
+  
+  l = 0;
+  r = con->console_size.X - 1;
+  
+  if(line < con->shadow_lines) {
+    shadow = con->shadow_buffer + line * con->console_size.X;
+    
+    while(l <= r && memcmp(&line_buffer[l], &shadow[l], sizeof(CHAR_INFO)) == 0)
+      ++l;
+    
+    while(l <= r && memcmp(&line_buffer[r], &shadow[r], sizeof(CHAR_INFO)) == 0)
+      --r;
+      
+    if(l > r)
+      return FALSE;
+  }
+  
+  *left = l;
+  *right = r;
+  return TRUE;
+}
+
+// Consecutive changed lines are written with a single WriteConsoleOutputW() call.
+static BOOL write_changed_lines(struct console_input_t *con, const CHAR_INFO *lines_buffer, int first_line, int num_lines) {
   COORD bufsize;
   COORD bufpos;
   SMALL_RECT region;
+  SHORT console_width;
+  int i;
+  
+  assert(con != NULL);
+  if(con->error)
+    return FALSE;
+    
+  console_width = con->console_size.X;
+  assert(console_width > 0);
+  assert(first_line + num_lines <= con->shadow_capacity / console_width);
+  
+  i = 0;
+  while(i < num_lines) {
+    int left;
+    int right;
+    int end;
+    
+    if(!find_changed_span(con, lines_buffer + i * console_width, first_line + i, &left, &right)) {
+      ++i;
+      continue;
+    }
+    
+    for(end = i + 1; end < num_lines; ++end) {
+      int next_left;
+      int next_right;
+      
+      if(!find_changed_span(con, lines_buffer + end * console_width, first_line + end, &next_left, &next_right))
+        break;
+      
+      left  = MIN(left,  next_left);
+      right = MAX(right, next_right);
+    }
+    
+    bufsize.X = console_width;
+    bufsize.Y = end - i;
+    bufpos.X = left;
+    bufpos.Y = 0;
+    region.Left = left;
+    region.Top = con->input_line_coord_y + first_line + i;
+    region.Right = right;
+    region.Bottom = region.Top + end - i - 1;
+    if(!console_write_output(con->output_handle, lines_buffer + i * console_width, bufsize, bufpos, &region)) {
+      con->error = "WriteConsoleOutputW";
+      invalidate_shadow_buffer(con);
+      return FALSE;
+    }
+    
+    con->cells_written += (right - left + 1) * (end - i);
+    memcpy(
+      con->shadow_buffer + (first_line + i) * console_width, 
+      lines_buffer + i * console_width, 
+      (end - i) * console_width * sizeof(CHAR_INFO));
+    
+    i = end;
+  }
+  
+  return TRUE;
+}
+
+// Only writes full lines. Does not scroll buffer. Does not update cursor.
+static BOOL write_output_buffer_lines(struct console_input_t *con) {
   SHORT console_width;
   int lines;
+  int total_lines;
   
   assert(con != NULL);
   if(con->error)
@@ -893,6 +1113,29 @@ static BOOL write_output_buffer_lines(struct console_input_t *con) {
   assert(console_width > 0);
   
   lines = con->output_size / console_width;
+  total_lines = MAX(lines, con->dirty_lines);
+  
+  if(con->shadow_width != console_width || con->shadow_line_coord_y != con->input_line_coord_y) {
+    con->shadow_width = console_width;
+    con->shadow_line_coord_y = con->input_line_coord_y;
+    invalidate_shadow_buffer(con);
+  }
+  
+  if(!resize_array(
+        (void**)&con->shadow_buffer, 
+        &con->shadow_capacity, 
+        sizeof(con->shadow_buffer[0]), 
+        total_lines * console_width))
+  {
+    con->error = "resize_array";
+    invalidate_shadow_buffer(con);
+    return FALSE;
+  }
+  
+  con->cells_written = 0;
+  if(!write_changed_lines(con, con->output_buffer, 0, lines))
+    return FALSE;
+  
   if(lines < con->dirty_lines) {
     CHAR_INFO *empty = hyper_console_allocate_memory((con->dirty_lines - lines) * console_width * sizeof(CHAR_INFO));
     if(empty) {
@@ -905,15 +1148,7 @@ static BOOL write_output_buffer_lines(struct console_input_t *con) {
         empty[i] = space;
       }
       
-      bufsize.X = console_width;
-      bufsize.Y = con->dirty_lines - lines;
-      bufpos.X = 0;
-      bufpos.Y = 0;
-      region.Left = 0;
-      region.Top = con->input_line_coord_y + lines;
-      region.Right = console_width - 1;
-      region.Bottom = region.Top + con->dirty_lines - 1;
-      if(!WriteConsoleOutputW(con->output_handle, empty, bufsize, bufpos, &region)) {
+      if(!write_changed_lines(con, empty, lines, con->dirty_lines - lines)) {
         con->error = "WriteConsoleOutputW empty";
         hyper_console_free_memory(empty);
         return FALSE;
@@ -921,25 +1156,12 @@ static BOOL write_output_buffer_lines(struct console_input_t *con) {
       
       hyper_console_free_memory(empty);
     }
-  }
-  con->dirty_lines = lines;
-  
-  bufsize.X = console_width;
-  bufsize.Y = lines;
-  bufpos.X = 0;
-  bufpos.Y = 0;
-  region.Left = 0;
-  region.Top = (SHORT)con->input_line_coord_y;
-  region.Right = console_width - 1;
-  region.Bottom = region.Top + lines - 1;
-  
-  if(bufsize.Y > 0) {
-    if(!WriteConsoleOutputW(con->output_handle, con->output_buffer, bufsize, bufpos, &region)) {
-      con->error = "WriteConsoleOutputW";
-      return FALSE;
+    else {
+      total_lines = lines;
     }
   }
-  
+  con->dirty_lines = lines;
+  con->shadow_lines = total_lines;
   return TRUE;
 }
 
@@ -964,7 +1186,7 @@ static BOOL set_output_cursor_position(struct console_input_t *con) {
   pos.Y = output_pos / console_width + con->input_line_coord_y;
   
   con->last_cursor_pos = pos;
-  if(!SetConsoleCursorPosition(con->output_handle, pos)) {
+  if(!console_backend->set_cursor_position(con->output_handle, pos)) {
     //  con->error = "SetConsoleCursorPosition";
     //  return 0;
   }
@@ -973,9 +1195,16 @@ static BOOL set_output_cursor_position(struct console_input_t *con) {
 }
 
 static BOOL update_output(struct console_input_t *con) {
+  if(con->defer_update) {
+    con->update_pending = TRUE;
+    return !(con->error);
+  }
+  
+  con->update_pending = FALSE;
   if(con->no_echo)
     return !(con->error);
   
+  con->batch_redraws++;
   fill_output_buffer(con);
   colorize_matching_fences(con);
   highlight_completion(con);
@@ -1003,7 +1232,12 @@ static BOOL selection_equals(struct console_input_t *con, const wchar_t *str) {
   end   = (size_t)MAX(con->input_anchor, con->input_pos);
   
   if(end - start == length) {
-    return 0 == memcmp(con->input_text + start, str, length * sizeof(wchar_t));
+    size_t i;
+    for(i = 0; i < length; ++i) {
+      if(get_input_char(con, (int)(start + i)) != str[i])
+        return FALSE;
+    }
+    return TRUE;
   }
   
   return FALSE;
@@ -1051,44 +1285,92 @@ static BOOL has_hard_line_break(struct console_input_t *con) {
     return FALSE;
     
   for(i = 0; i < con->input_length; ++i)
-    if(con->input_text[i] == L'\n')
+    if(get_input_char(con, i) == L'\n')
       return TRUE;
       
   return FALSE;
 }
 
-static BOOL resize_input_text(struct console_input_t *con, int length) {
+static void move_input_gap(struct console_input_t *con, int pos) {
+  assert(con != NULL);
+  assert(pos >= 0);
+  assert(pos <= con->input_length);
+  
+  if(pos < con->input_gap_start) {
+    memmove(
+      con->input_text + pos + con->input_gap_size,
+      con->input_text + pos,
+      (con->input_gap_start - pos) * sizeof(wchar_t));
+  }
+  else if(pos > con->input_gap_start) {
+    memmove(
+      con->input_text + con->input_gap_start,
+      con->input_text + con->input_gap_start + con->input_gap_size,
+      (pos - con->input_gap_start) * sizeof(wchar_t));
+  }
+  
+  con->input_gap_start = pos;
+}
+
+// Ensure that the gap can take length more characters and still leave room for a terminating NUL.
+static BOOL reserve_input_gap(struct console_input_t *con, int length) {
+  int old_capacity;
+  int tail_length;
+  
   assert(con != NULL);
+  assert(length >= 0);
   if(con->error)
     return FALSE;
     
-  if(!resize_array(
-        (void**)&con->input_text,
-        &con->input_capacity,
-        sizeof(con->input_text[0]),
-        length + 1))
-  {
-    con->error = "resize_array";
-    con->input_length = 0;
+  if(length < con->input_gap_size)
+    return TRUE;
+    
+  if(length > INT_MAX - 1 - con->input_length) {
+    con->error = "reserve_input_gap";
     return FALSE;
   }
   
+  old_capacity = con->input_capacity;
   if(!resize_array(
-        (void**)&con->input_to_output_positions,
-        &con->input_to_output_capacity,
-        sizeof(con->input_to_output_positions[0]),
-        length + 1))
+        (void**)&con->input_text,
+        &con->input_capacity,
+        sizeof(con->input_text[0]),
+        con->input_length + length + 1))
   {
     con->error = "resize_array";
-    con->input_length = 0;
     return FALSE;
   }
   
-  con->input_text[length] = L'\0';
-  con->input_length = length;
+  tail_length = old_capacity - con->input_gap_start - con->input_gap_size;
+  memmove(
+    con->input_text + con->input_capacity - tail_length,
+    con->input_text + old_capacity - tail_length,
+    tail_length * sizeof(wchar_t));
+  con->input_gap_size += con->input_capacity - old_capacity;
   return TRUE;
 }
 
+static wchar_t get_input_char(struct console_input_t *con, int pos) {
+  assert(con != NULL);
+  assert(pos >= 0);
+  assert(pos < con->input_length);
+  
+  if(pos < con->input_gap_start)
+    return con->input_text[pos];
+  
+  return con->input_text[pos + con->input_gap_size];
+}
+
+// Moves the gap to the end. The result is valid until the next edit.
+static wchar_t *get_input_text(struct console_input_t *con) {
+  assert(con != NULL);
+  assert(con->input_gap_size > 0);
+  
+  move_input_gap(con, con->input_length);
+  con->input_text[con->input_length] = L'\0';
+  return con->input_text;
+}
+
 static BOOL insert_input_text(struct console_input_t *con, int pos, const wchar_t *str, int length) {
   assert(con != NULL);
   if(con->error)
@@ -1111,19 +1393,17 @@ static BOOL insert_input_text(struct console_input_t *con, int pos, const wchar_
       return FALSE;
   }
   
-  resize_input_text(con, con->input_length + length);
-  if(con->error)
+  if(!reserve_input_gap(con, length))
     return FALSE;
     
-  memmove(
-    con->input_text + pos + length,
-    con->input_text + pos,
-    (con->input_length - pos - length) * sizeof(wchar_t));
-    
+  move_input_gap(con, pos);
   memmove(
     con->input_text + pos,
     str,
     length * sizeof(wchar_t));
+  con->input_gap_start += length;
+  con->input_gap_size -= length;
+  con->input_length += length;
     
   if(pos <= con->input_pos)
     con->input_pos += length;
@@ -1186,14 +1466,9 @@ static BOOL delete_input_text(struct console_input_t *con, int pos, int length)
     forget_completions(con);
   }
   
-  memmove(
-    con->input_text + pos,
-    con->input_text + pos + length,
-    (con->input_length - pos - length) * sizeof(wchar_t));
-    
-  resize_input_text(con, con->input_length - length);
-  if(con->error)
-    return FALSE;
+  move_input_gap(con, pos);
+  con->input_gap_size += length;
+  con->input_length -= length;
     
   if(pos + length <= con->input_pos)
     con->input_pos -= length;
@@ -1258,7 +1533,7 @@ static void move_left(struct console_input_t *con, BOOL fix_anchor, BOOL jump_wo
     new_pos--;
     
   if(jump_word)
-    new_pos = console_get_word_start(con->input_text, con->input_length, new_pos);
+    new_pos = console_get_word_start(get_input_text(con), con->input_length, new_pos);
     
   if(fix_anchor) {
     reselect_input(con, new_pos, con->input_anchor);
@@ -1282,7 +1557,7 @@ static void move_right(struct console_input_t *con, BOOL fix_anchor, BOOL jump_w
     
   new_pos = con->input_pos;
   if(jump_word)
-    new_pos = console_get_word_end(con->input_text, con->input_length, new_pos);
+    new_pos = console_get_word_end(get_input_text(con), con->input_length, new_pos);
   else if(new_pos < con->input_length)
     new_pos++;
     
@@ -1396,7 +1671,7 @@ static void copy_to_clipboard(struct console_input_t *con) {
   }
   
   copy_data = GlobalLock(copy_handle);
-  memcpy(copy_data, con->input_text + start, (end - start) * sizeof(wchar_t));
+  memcpy(copy_data, get_input_text(con) + start, (end - start) * sizeof(wchar_t));
   copy_data[end - start] = L'\0';
   GlobalUnlock(copy_handle);
   
@@ -1405,35 +1680,107 @@ static void copy_to_clipboard(struct console_input_t *con) {
   CloseClipboard();
 }
 
-static BOOL begin_navigate_history(struct console_input_t *con) {
-  assert(con != NULL);
+/* Insert text as if it was typed, but with a single redraw. Like console_send_text() keys, \r 
+   behaves like the Return key and \t inserts a literal tab. Other control characters are dropped.
+   When a \r completes the input, the rest of the text is left in the console input for the next 
+   hyper_console_readline() call.
+ */
+static void paste_text(struct console_input_t *con, const wchar_t *text, int length) {
+  int run_start;
+  int i;
   
-  if(con->navigating_history)
-    return TRUE;
-    
-  if(has_hard_line_break(con))
-    return FALSE;
+  assert(con != NULL);
+  assert(text != NULL || length == 0);
+  if(con->error)
+    return;
     
-  console_history_set_future(con->history, con->input_text, con->input_length);
-  con->navigating_history = TRUE;
-  //if(con->input_anchor == con->input_length && con->input_pos == con->input_length)
-    return TRUE;
+  if(con->navigating_history)
+    cancel_navigate_history(con);
     
-  //reselect_input(con, con->input_length, con->input_length);
-  //return FALSE;
+  delete_selection_no_update(con);
+  
+  run_start = 0;
+  for(i = 0; i <= length; ++i) {
+    if(i < length && (text[i] >= L' ' || text[i] == L'\t'))
+      continue;
+      
+    if(!insert_input_text(con, con->input_pos, text + run_start, i - run_start))
+      return;
+      
+    run_start = i + 1;
+    if(i < length && text[i] == L'\r' && !break_line_or_stop(con)) {
+      if(run_start < length)
+        console_send_text(con->input_handle, text + run_start, length - run_start);
+      break;
+    }
+  }
+  
+  update_output(con);
 }
 
-static void cancel_navigate_history(struct console_input_t *con) {
+static void paste_from_clipboard(struct console_input_t *con) {
+  wchar_t *text;
+  int length;
+  
   assert(con != NULL);
   
-  console_history_set_future(con->history, NULL, 0);
-  console_history_set_index(con->history, console_history_count(con->history));
-  con->navigating_history = FALSE;
+  text = console_get_clipboard_text(&length);
+  if(text) {
+    paste_text(con, text, length);
+    hyper_console_free_memory(text);
+  }
 }
 
-static void navigate_history(struct console_input_t *con, int delta) {
-  const wchar_t *hist_text;
-  int hist_text_length;
+/* Links are only colored while they are visible, so new ones might have scrolled into view.
+ */
+static BOOL scroll_window_by_key(struct console_input_t *con, const KEY_EVENT_RECORD *er) {
+  assert(con != NULL);
+  assert(er != NULL);
+  
+  if(!console_scroll_key(con->output_handle, er))
+    return FALSE;
+    
+  hyperlink_system_activate_visible_links();
+  return TRUE;
+}
+
+static void scroll_window_by_wheel(struct console_input_t *con, const MOUSE_EVENT_RECORD *er) {
+  assert(con != NULL);
+  assert(er != NULL);
+  
+  if(console_scroll_wheel(con->output_handle, er))
+    hyperlink_system_activate_visible_links();
+}
+
+static BOOL begin_navigate_history(struct console_input_t *con) {
+  assert(con != NULL);
+  
+  if(con->navigating_history)
+    return TRUE;
+    
+  if(has_hard_line_break(con))
+    return FALSE;
+    
+  console_history_set_future(con->history, get_input_text(con), con->input_length);
+  con->navigating_history = TRUE;
+  //if(con->input_anchor == con->input_length && con->input_pos == con->input_length)
+    return TRUE;
+    
+  //reselect_input(con, con->input_length, con->input_length);
+  //return FALSE;
+}
+
+static void cancel_navigate_history(struct console_input_t *con) {
+  assert(con != NULL);
+  
+  console_history_set_future(con->history, NULL, 0);
+  console_history_set_index(con->history, console_history_count(con->history));
+  con->navigating_history = FALSE;
+}
+
+static void navigate_history(struct console_input_t *con, int delta) {
+  const wchar_t *hist_text;
+  int hist_text_length;
   int index;
   
   assert(con != NULL);
@@ -1476,13 +1823,13 @@ static BOOL handle_history_key_down(struct console_input_t *con, const KEY_EVENT
       return TRUE;
       
     case VK_UP:
-      if(console_scroll_key(con->output_handle, er))
+      if(scroll_window_by_key(con, er))
         return TRUE;
       navigate_history(con, -1);
       return TRUE;
       
     case VK_DOWN:
-      if(console_scroll_key(con->output_handle, er))
+      if(scroll_window_by_key(con, er))
         return TRUE;
       navigate_history(con, +1);
       return TRUE;
@@ -1498,25 +1845,242 @@ static BOOL handle_history_key_down(struct console_input_t *con, const KEY_EVENT
   return FALSE;
 }
 
-static void handle_key_return(struct console_input_t *con) {
+static void set_history_search_title(struct console_input_t *con) {
+  wchar_t text[MAX_PATH];
+  wchar_t *s = text;
+  wchar_t *end = text + ARRAYSIZE(text) - 1;
+  
+  assert(con != NULL);
+  
+  if(!con->history_search_old_title)
+    return;
+    
+  if(con->history_search_failed)
+    s = append_text(s, end, L"Failing history search ", NULL);
+  else
+    s = append_text(s, end, L"History search ", NULL);
+  
+  if(con->history_search_text)
+    s = append_text(s, end, con->history_search_text, con->history_search_text + con->history_search_length);
+  
+  s = append_text(s, end, L"|", NULL);
+  *s = L'\0';
+  
+  console_backend->set_title(text);
+}
+
+/* Show the newest entry before \a before_index that contains the search text and select the match.
+ */
+static void find_in_history(struct console_input_t *con, int before_index) {
+  const wchar_t *hist_text;
+  int hist_text_length;
+  int index;
+  int pos;
+  
+  assert(con != NULL);
+  
+  index = console_history_find(
+            con->history,
+            con->history_search_text,
+            con->history_search_length,
+            before_index,
+            &pos);
+  hist_text = console_history_get(con->history, index, &hist_text_length);
+  if(!hist_text) {
+    con->history_search_failed = TRUE;
+    set_history_search_title(con);
+    console_alert(con->output_handle);
+    return;
+  }
+  
+  con->history_search_failed = FALSE;
+  con->history_search_index = index;
+  console_history_set_index(con->history, index);
+  set_history_search_title(con);
+  
+  con->input_anchor = 0;
+  con->input_pos = con->input_length;
+  delete_selection_no_update(con);
+  insert_input_text(con, 0, hist_text, hist_text_length);
+  con->input_pos = pos;
+  con->input_anchor = pos + con->history_search_length;
+  update_output(con);
+}
+
+static BOOL begin_history_search(struct console_input_t *con) {
+  assert(con != NULL);
+  
+  if(!con->history || con->no_echo)
+    return FALSE;
+    
+  if(!con->navigating_history) {
+    console_history_set_future(con->history, get_input_text(con), con->input_length);
+    con->navigating_history = TRUE;
+  }
+  
+  con->searching_history = TRUE;
+  con->history_search_failed = FALSE;
+  con->history_search_length = 0;
+  con->history_search_index = console_history_count(con->history);
+  
+  if(con->history_search_old_title == NULL) {
+    con->history_search_old_title = hyper_console_allocate_memory(sizeof(wchar_t) * 256);
+    if(con->history_search_old_title)
+      console_backend->get_title(con->history_search_old_title, 256);
+  }
+  
+  set_history_search_title(con);
+  return TRUE;
+}
+
+/* Leave history search mode. When accepting, the shown entry remains and Up/Down continue 
+   navigating from there. Otherwise, the original input is restored.
+ */
+static void end_history_search(struct console_input_t *con, BOOL accept) {
+  assert(con != NULL);
+  
+  con->searching_history = FALSE;
+  
+  if(con->history_search_old_title) {
+    console_backend->set_title(con->history_search_old_title);
+    hyper_console_free_memory(con->history_search_old_title);
+    con->history_search_old_title = NULL;
+  }
+  
+  if(!accept) {
+    const wchar_t *text;
+    int text_length;
+    
+    text = console_history_get_future(con->history, &text_length);
+    con->input_anchor = 0;
+    con->input_pos = con->input_length;
+    delete_selection_no_update(con);
+    insert_input_text(con, 0, text, text_length);
+    cancel_navigate_history(con);
+    update_output(con);
+  }
+}
+
+static BOOL handle_history_search_key_down(struct console_input_t *con, const KEY_EVENT_RECORD *er) {
+  BOOL ctrl;
+  BOOL alt;
+  
+  assert(con != NULL);
+  assert(er != NULL);
+  
+  ctrl = (er->dwControlKeyState & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)) != 0;
+  alt  = (er->dwControlKeyState & (LEFT_ALT_PRESSED  | RIGHT_ALT_PRESSED))  != 0;
+  
+  if(!con->searching_history) {
+    if(er->wVirtualKeyCode == 'R' && ctrl && !alt) // Ctrl+R
+      return begin_history_search(con);
+      
+    return FALSE;
+  }
+  
+  if(ctrl && !alt) {
+    switch(er->wVirtualKeyCode) {
+      case 'R': // Ctrl+R = next older match
+        find_in_history(con, con->history_search_index);
+        return TRUE;
+        
+      case 'G': // Ctrl+G = cancel
+        end_history_search(con, FALSE);
+        return TRUE;
+    }
+  }
+  
+  switch(er->wVirtualKeyCode) {
+    case VK_SHIFT:
+    case VK_CONTROL:
+    case VK_MENU:
+      return TRUE;
+      
+    case VK_ESCAPE:
+      end_history_search(con, FALSE);
+      return TRUE;
+      
+    case VK_BACK:
+      if(con->history_search_length > 0) 
+        con->history_search_length--;
+        
+      if(con->history_search_length > 0) {
+        find_in_history(con, console_history_count(con->history));
+      }
+      else {
+        const wchar_t *text;
+        int text_length;
+        
+        text = console_history_get_future(con->history, &text_length);
+        con->history_search_failed = FALSE;
+        con->history_search_index = console_history_count(con->history);
+        console_history_set_index(con->history, con->history_search_index);
+        set_history_search_title(con);
+        
+        con->input_anchor = 0;
+        con->input_pos = con->input_length;
+        delete_selection_no_update(con);
+        insert_input_text(con, 0, text, text_length);
+        update_output(con);
+      }
+      return TRUE;
+      
+    case VK_TAB:
+    case VK_RETURN:
+      break;
+      
+    default:
+      if((unsigned)er->uChar.UnicodeChar >= (unsigned)L' ' && (!ctrl || alt)) { // AltGr = Ctrl+Alt
+        if(!resize_array(
+              (void**)&con->history_search_text,
+              &con->history_search_capacity,
+              sizeof(con->history_search_text[0]),
+              con->history_search_length + 1))
+        {
+          console_alert(con->output_handle);
+          return TRUE;
+        }
+        
+        con->history_search_text[con->history_search_length++] = er->uChar.UnicodeChar;
+        
+        // the current match may still match the longer text
+        find_in_history(con, con->history_search_index + 1);
+        return TRUE;
+      }
+      break;
+  }
+  
+  end_history_search(con, TRUE);
+  return FALSE;
+}
+
+// Returns FALSE if the input is complete (con->stop is set) and TRUE if a line break was inserted.
+static BOOL break_line_or_stop(struct console_input_t *con) {
   int pos, next_nl;
   assert(con != NULL);
   
   next_nl = pos = MAX(con->input_pos, con->input_anchor);
-  while(next_nl < con->input_length && con->input_text[next_nl] != L'\n') {
+  while(next_nl < con->input_length && get_input_char(con, next_nl) != L'\n') {
     ++next_nl;
   }
   
   if(next_nl == con->input_length) { /* cursor is at last line */
-    if(!con->need_more_input_predicate(con->callback_context, con->input_text, con->input_length, pos)) {
+    if(!con->need_more_input_predicate(con->callback_context, get_input_text(con), con->input_length, pos)) {
       con->stop = 1;
-      return;
+      return FALSE;
     }
   }
   
   delete_selection_no_update(con);
   insert_input_char(con, con->input_pos, L'\n');
-  update_output(con);
+  return TRUE;
+}
+
+static void handle_key_return(struct console_input_t *con) {
+  assert(con != NULL);
+  
+  if(break_line_or_stop(con))
+    update_output(con);
   
 //  if(con->multiline_mode) {
 //    if(con->input_pos == con->input_length && con->input_pos > 0 && con->input_text[con->input_pos - 1] == L'\n') {
@@ -1544,7 +2108,7 @@ static BOOL try_indent(struct console_input_t *con, BOOL forward) {
   if(con->input_anchor == con->input_pos) {
     int line_start = con->input_pos;
     while(line_start > 0) {
-      switch(con->input_text[line_start - 1]) {
+      switch(get_input_char(con, line_start - 1)) {
         case L' ':
         case L'\t':
           --line_start;
@@ -1553,7 +2117,7 @@ static BOOL try_indent(struct console_input_t *con, BOOL forward) {
       break;
     }
     
-    if(line_start > 0 && con->input_text[line_start - 1] != L'\n')
+    if(line_start > 0 && get_input_char(con, line_start - 1) != L'\n')
       return FALSE;
       
     if(forward) {
@@ -1573,7 +2137,7 @@ static BOOL try_indent(struct console_input_t *con, BOOL forward) {
     int i;
     
     for(i = start; i < end; ++i) {
-      if(con->input_text[i] == '\n') {
+      if(get_input_char(con, i) == '\n') {
         have_embedded_line_breaks = TRUE;
         break;
       }
@@ -1582,12 +2146,12 @@ static BOOL try_indent(struct console_input_t *con, BOOL forward) {
     if(!have_embedded_line_breaks)
       return FALSE;
       
-    while(start > 0 && con->input_text[start - 1] != L'\n')
+    while(start > 0 && get_input_char(con, start - 1) != L'\n')
       --start;
       
     if(forward) {
       for(i = end; i > start; --i) {
-        if(con->input_text[i - 1] == L'\n')
+        if(get_input_char(con, i - 1) == L'\n')
           insert_input_char(con, i, L'\t');
       }
       
@@ -1595,8 +2159,8 @@ static BOOL try_indent(struct console_input_t *con, BOOL forward) {
     }
     else {
       for(i = end; i >= start; --i) {
-        if(i == start || con->input_text[i - 1] == L'\n') {
-          if(i < end && con->input_text[i] == L'\t') {
+        if(i == start || get_input_char(con, i - 1) == L'\n') {
+          if(i < end && get_input_char(con, i) == L'\t') {
             delete_input_text(con, i, 1);
           }
           // TODO: unindent spaces
@@ -1622,7 +2186,7 @@ static void handle_completion(struct console_input_t *con, BOOL forward) {
     
     results = con->auto_completion(
                 con->callback_context,
-                con->input_text,
+                get_input_text(con),
                 con->input_length,
                 MIN(con->input_pos, con->input_anchor),
                 &start,
@@ -1652,7 +2216,7 @@ static void handle_completion(struct console_input_t *con, BOOL forward) {
         return;
       }
       
-      memcpy(orig, con->input_text + start, (end - start) * sizeof(wchar_t));
+      memcpy(orig, get_input_text(con) + start, (end - start) * sizeof(wchar_t));
       orig[end - start] = L'\0';
       *results = orig;
       con->completions_count++;
@@ -1689,6 +2253,9 @@ static void handle_key_down(struct console_input_t *con, const KEY_EVENT_RECORD
   assert(con != NULL);
   assert(er != NULL);
   
+  if(handle_history_search_key_down(con, er))
+    return;
+    
   if(handle_history_key_down(con, er))
     return;
     
@@ -1742,7 +2309,7 @@ static void handle_key_down(struct console_input_t *con, const KEY_EVENT_RECORD
       return;
       
     case VK_UP:
-      if(console_scroll_key(con->output_handle, er))
+      if(scroll_window_by_key(con, er))
         return;
       if(move_up_down(con, -1, er->dwControlKeyState & SHIFT_PRESSED))
         return;
@@ -1751,7 +2318,7 @@ static void handle_key_down(struct console_input_t *con, const KEY_EVENT_RECORD
       return;
       
     case VK_DOWN:
-      if(console_scroll_key(con->output_handle, er))
+      if(scroll_window_by_key(con, er))
         return;
       if(move_up_down(con, +1, er->dwControlKeyState & SHIFT_PRESSED))
         return;
@@ -1761,7 +2328,7 @@ static void handle_key_down(struct console_input_t *con, const KEY_EVENT_RECORD
       
     case VK_PRIOR:
     case VK_NEXT:
-      console_scroll_key(con->output_handle, er);
+      scroll_window_by_key(con, er);
       return;
       
     case VK_ESCAPE:
@@ -1798,7 +2365,7 @@ static void handle_key_down(struct console_input_t *con, const KEY_EVENT_RECORD
         return;
       }
       if(er->dwControlKeyState & SHIFT_PRESSED) {
-        console_paste_from_clipboard(con->input_handle);
+        paste_from_clipboard(con);
         return;
       }
       break;
@@ -1820,7 +2387,7 @@ static void handle_key_down(struct console_input_t *con, const KEY_EVENT_RECORD
       
     case 'V': // Ctrl+V
       if(er->dwControlKeyState & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)) {
-        console_paste_from_clipboard(con->input_handle);
+        paste_from_clipboard(con);
         return;
       }
       break;
@@ -1948,8 +2515,8 @@ static void handle_lbutton_double_click(struct console_input_t *con, const MOUSE
   i = get_input_position_from_screen_position(con, er->dwMousePosition, FALSE);
   
   if(i >= 0) {
-    int s = console_get_word_start(con->input_text, con->input_length, i);
-    int e = console_get_word_end(con->input_text, con->input_length, i);
+    int s = console_get_word_start(get_input_text(con), con->input_length, i);
+    int e = console_get_word_end(get_input_text(con), con->input_length, i);
     
     con->input_anchor = s;
     con->input_pos = e;
@@ -1989,7 +2556,7 @@ static void handle_mouse_event(struct console_input_t *con, const MOUSE_EVENT_RE
       
     case MOUSE_HWHEELED:
     case MOUSE_WHEELED:
-      console_scroll_wheel(con->output_handle, er);
+      scroll_window_by_wheel(con, er);
       break;
   }
 }
@@ -1999,7 +2566,7 @@ static void handle_delayed_window_buffer_size_event(struct console_input_t *con)
   
   con->next_delayed_resize_time = 0;
   
-  if(!GetConsoleScreenBufferInfo(con->output_handle, &csbi)) {
+  if(!console_backend->get_screen_buffer_info(con->output_handle, &csbi)) {
     con->error = "GetConsoleScreenBufferInfo";
     return;
   }
@@ -2052,6 +2619,7 @@ static void handle_delayed_window_buffer_size_event(struct console_input_t *con)
   }
   
   console_clean_lines(con->output_handle, con->input_line_coord_y);
+  invalidate_shadow_buffer(con);
   
   hyperlink_system_update_scollback(con->input_line_coord_y);
   hyperlink_system_end_input();
@@ -2105,6 +2673,100 @@ static BOOL is_mouse_event_inside_edit_region(struct console_input_t *con, INPUT
   return i >= 0;
 }
 
+// Typed characters and key releases only change the input text, they do not depend on the screen.
+static BOOL is_text_input_event(const INPUT_RECORD *ir) {
+  const KEY_EVENT_RECORD *er;
+  
+  assert(ir != NULL);
+  
+  if(ir->EventType != KEY_EVENT)
+    return FALSE;
+    
+  er = &ir->Event.KeyEvent;
+  if(!er->bKeyDown)
+    return TRUE;
+    
+  if(er->dwControlKeyState & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED | LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED))
+    return FALSE;
+    
+  switch(er->wVirtualKeyCode) {
+    case VK_BACK:
+    case VK_TAB:
+    case VK_RETURN:
+    case VK_ESCAPE:
+    case VK_PRIOR:
+    case VK_NEXT:
+    case VK_END:
+    case VK_HOME:
+    case VK_LEFT:
+    case VK_UP:
+    case VK_RIGHT:
+    case VK_DOWN:
+    case VK_INSERT:
+    case VK_DELETE:
+      return FALSE;
+  }
+  
+  return (unsigned)er->uChar.UnicodeChar >= (unsigned)L' ';
+}
+
+/* Read the next input events into con->input_batch and return their count (0 on error).
+   
+   All queued text input events up to the first other event are read at once. Any other event is
+   read on its own, because handling it may finish the input or read further events itself (mark 
+   mode, search mode, hyperlink clicks), and those must still be in the console input queue.
+ */
+static int read_input_batch(struct console_input_t *con) {
+  DWORD count = 0;
+  DWORD num_read = 0;
+  
+  assert(con != NULL);
+  if(con->error)
+    return 0;
+    
+  if(!console_backend->get_number_of_input_events(con->input_handle, &count) || count < 1 || con->continue_with_search)
+    count = 1;
+    
+  if(!resize_array(
+        (void**)&con->input_batch,
+        &con->input_batch_capacity,
+        sizeof(con->input_batch[0]),
+        (int)MIN(count, MAX_INPUT_BATCH)))
+  {
+    con->error = "resize_array";
+    return 0;
+  }
+  
+  if(count > 1) {
+    DWORD num_text_events = 0;
+    
+    count = MIN(count, MAX_INPUT_BATCH);
+    if(!console_backend->peek_input(con->input_handle, con->input_batch, count, &num_read))
+      num_read = 0;
+      
+    while(num_text_events < num_read && is_text_input_event(&con->input_batch[num_text_events]))
+      ++num_text_events;
+      
+    count = MAX(num_text_events, 1);
+  }
+  
+  num_read = 0;
+  if(!console_backend->read_input(con->input_handle, con->input_batch, count, &num_read) || num_read < 1) {
+    con->error = "ReadConsoleInputW";
+    return 0;
+  }
+  
+  return (int)num_read;
+}
+
+static void flush_deferred_update(struct console_input_t *con) {
+  assert(con != NULL);
+  
+  con->defer_update = FALSE;
+  if(con->update_pending)
+    update_output(con);
+}
+
 static void finish_input(struct console_input_t *con) {
   assert(con != NULL);
   
@@ -2113,7 +2775,7 @@ static void finish_input(struct console_input_t *con) {
     
   forget_completions(con);
   
-  con->input_text[con->input_length] = L'\0';
+  get_input_text(con);
   con->input_pos = con->input_anchor = con->input_length;
   con->use_position_dependent_coloring = FALSE;
   update_output(con);
@@ -2122,12 +2784,12 @@ static void finish_input(struct console_input_t *con) {
 static BOOL set_console_modes(struct console_input_t *con) {
   assert(con != NULL);
 
-  if(!SetConsoleMode(con->input_handle, ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT | ENABLE_EXTENDED_FLAGS)) {
+  if(!console_backend->set_mode(con->input_handle, ENABLE_WINDOW_INPUT | ENABLE_MOUSE_INPUT | ENABLE_EXTENDED_FLAGS)) {
     con->error = "SetConsoleMode on input_handle";
     return FALSE;
   }
   
-  if(!SetConsoleMode(con->output_handle, ENABLE_LVB_GRID_WORLDWIDE)) {
+  if(!console_backend->set_mode(con->output_handle, ENABLE_LVB_GRID_WORLDWIDE)) {
     /* Trying to set ENABLE_LVB_GRID_WORLDWIDE will fail on pre-Win10 (v10.0.14393) systems
        with "Invalid Parameter".
        But this setting is not essential for correct functioning, so we ignore any error.
@@ -2140,16 +2802,18 @@ static BOOL set_console_modes(struct console_input_t *con) {
 }
 
 static BOOL input_loop(struct console_input_t *con) {
+  HANDLE previous_queue_input_handle;
+  
   assert(con != NULL);
   if(con->error)
     return FALSE;
     
-  if(!GetConsoleMode(con->input_handle, &con->old_input_mode)) {
+  if(!console_backend->get_mode(con->input_handle, &con->old_input_mode)) {
     con->error = "GetConsoleMode on input_handle";
     return FALSE;
   }
   
-  if(!GetConsoleMode(con->output_handle, &con->old_output_mode)) {
+  if(!console_backend->get_mode(con->output_handle, &con->old_output_mode)) {
     con->error = "GetConsoleMode on input_handle";
     return FALSE;
   }
@@ -2162,16 +2826,19 @@ static BOOL input_loop(struct console_input_t *con) {
   // There might be some links in the prompt, which just changed their color.
   read_prompt(con, con->prompt_size);
   
+  previous_queue_input_handle = output_queue_attach(con->input_handle);
+  
   while(!con->stop && !con->error) {
     INPUT_RECORD event;
     DWORD num_read;
     DWORD timeout = INFINITE;
+    int batch_pos;
     
     if(con->next_delayed_resize_time) {
       timeout = con->next_delayed_resize_time - GetTickCount();
     }
     
-    num_read = WaitForSingleObject(con->input_handle, timeout);
+    num_read = console_backend->wait_for_input(con->input_handle, timeout);
     if(con->next_delayed_resize_time) {
       if(con->next_delayed_resize_time <= GetTickCount()) {
         con->next_delayed_resize_time = 0;
@@ -2190,80 +2857,49 @@ static BOOL input_loop(struct console_input_t *con) {
         break;
     }
     
-    num_read = 0;
-    if(!ReadConsoleInputW(con->input_handle, &event, 1, &num_read) || num_read < 1) {
-      con->error = "ReadConsoleInputW";
+    con->batch_events = read_input_batch(con);
+    con->batch_redraws = 0;
+    if(con->batch_events < 1)
       break;
-    }
-    
-    if(con->continue_with_search) {
-      wchar_t *filter;
-      BOOL event_eaten;
-      int start = MIN(con->input_anchor, con->input_pos);
-      int end   = MAX(con->input_anchor, con->input_pos);
-      int length = end - start;
       
-      con->continue_with_search = FALSE;
+    for(batch_pos = 0; batch_pos < con->batch_events && !con->stop && !con->error; ++batch_pos) {
+      event = con->input_batch[batch_pos];
+      
+      // Redraw at most once for a batch of typed characters.
+      con->defer_update = con->batch_events > 1 && is_text_input_event(&event);
       
-      filter = hyper_console_allocate_memory((length + 1) * sizeof(wchar_t));
-      if(filter) {
-        memcpy(filter, con->input_text + start, length * sizeof(wchar_t));
-        filter[length] = L'\0';
+      if(con->continue_with_search) {
+        wchar_t *filter;
+        BOOL event_eaten;
+        int start = MIN(con->input_anchor, con->input_pos);
+        int end   = MAX(con->input_anchor, con->input_pos);
+        int length = end - start;
         
-        event_eaten = console_handle_search_mode(con->input_handle, con->output_handle, &event, filter);
+        con->continue_with_search = FALSE;
         
-        hyper_console_free_memory(filter);
-        if(event_eaten)
-          continue;
-      }
-    }
-    
-    if(!is_mouse_event_inside_edit_region(con, &event)) {
-      if(hyperlink_system_handle_events(&event))
-        continue;
-        
-//      if(console_handle_search_mode(con->input_handle, con->output_handle, &event, NULL))
-//        continue;
-      
-      struct mark_mode_settings_t mm = { 
-        .input_handle     = con->input_handle, 
-        .output_handle    = con->output_handle,
-        .callback_context = con->callback_context,
-        .key_event_filter = con->mark_mode_key_event_filter,
-        .mm_handle_ptr    = &con->current_mark_mode };
-      if(console_handle_mark_mode(&mm, &event, FALSE))
-        continue;
-    }
-    
-    for(;;) {
-      switch(event.EventType) {
-        case KEY_EVENT:
-          handle_key_event(con, &event.Event.KeyEvent);
-          break;
-          
-        case MOUSE_EVENT:
-          handle_mouse_event(con, &event.Event.MouseEvent);
-          break;
+        filter = hyper_console_allocate_memory((length + 1) * sizeof(wchar_t));
+        if(filter) {
+          memcpy(filter, get_input_text(con) + start, length * sizeof(wchar_t));
+          filter[length] = L'\0';
           
-        case WINDOW_BUFFER_SIZE_EVENT: // scrn buf. resizing
-          handle_window_buffer_size_event(con, &event.Event.WindowBufferSizeEvent);
-          break;
-          
-        case FOCUS_EVENT:
-          handle_focus_event(con, &event.Event.FocusEvent);
-          break;
-          
-        case MENU_EVENT:   // disregard menu events
-          handle_menu_event(con, &event.Event.MenuEvent);
-          break;
+          event_eaten = console_handle_search_mode(con->input_handle, con->output_handle, &event, filter);
           
-        default:
-          handle_unknown_event(con, &event);
-          break;
+          hyper_console_free_memory(filter);
+          if(event_eaten) {
+            invalidate_shadow_buffer(con);
+            continue;
+          }
+        }
       }
       
-      if(con->redo_in_mark_mode) {
-        con->redo_in_mark_mode = FALSE;
+      if(!is_mouse_event_inside_edit_region(con, &event)) {
+        if(hyperlink_system_handle_events(&event)) {
+          invalidate_shadow_buffer(con);
+          continue;
+        }
+          
+//      if(console_handle_search_mode(con->input_handle, con->output_handle, &event, NULL))
+//        continue;
         
         struct mark_mode_settings_t mm = { 
           .input_handle     = con->input_handle, 
@@ -2271,24 +2907,78 @@ static BOOL input_loop(struct console_input_t *con) {
           .callback_context = con->callback_context,
           .key_event_filter = con->mark_mode_key_event_filter,
           .mm_handle_ptr    = &con->current_mark_mode };
-        if(console_handle_mark_mode(&mm, &event, TRUE))
+        if(console_handle_mark_mode(&mm, &event, FALSE)) {
+          invalidate_shadow_buffer(con);
+          continue;
+        }
+      }
+      
+      for(;;) {
+        switch(event.EventType) {
+          case KEY_EVENT:
+            handle_key_event(con, &event.Event.KeyEvent);
+            break;
+            
+          case MOUSE_EVENT:
+            handle_mouse_event(con, &event.Event.MouseEvent);
+            break;
+            
+          case WINDOW_BUFFER_SIZE_EVENT: // scrn buf. resizing
+            handle_window_buffer_size_event(con, &event.Event.WindowBufferSizeEvent);
+            break;
+            
+          case FOCUS_EVENT:
+            handle_focus_event(con, &event.Event.FocusEvent);
+            break;
+            
+          case MENU_EVENT:   // disregard menu events
+            handle_menu_event(con, &event.Event.MenuEvent);
+            break;
+            
+          default:
+            handle_unknown_event(con, &event);
+            break;
+        }
+        
+        if(con->redo_in_mark_mode) {
+          con->redo_in_mark_mode = FALSE;
+          
+          struct mark_mode_settings_t mm = { 
+            .input_handle     = con->input_handle, 
+            .output_handle    = con->output_handle,
+            .callback_context = con->callback_context,
+            .key_event_filter = con->mark_mode_key_event_filter,
+            .mm_handle_ptr    = &con->current_mark_mode };
+          invalidate_shadow_buffer(con);
+          if(console_handle_mark_mode(&mm, &event, TRUE))
+            break;
+        }
+        else
           break;
       }
-      else
-        break;
     }
+    
+    flush_deferred_update(con);
+    
+    /* Other threads wake us up with a menu event after posting output. Mark mode and search mode 
+       may have eaten it, and text posted after the wake-up is not announced again, so always 
+       check the queue. Text that is left at the end is written by output_queue_detach(). */
+    if(!con->stop && !con->error)
+      print_posted_output(con);
   }
   
   finish_input(con);
   
   hyperlink_system_end_input();
   
-  SetConsoleMode(con->input_handle, con->old_input_mode);
-  SetConsoleMode(con->output_handle, con->old_output_mode);
+  console_backend->set_mode(con->input_handle, con->old_input_mode);
+  console_backend->set_mode(con->output_handle, con->old_output_mode);
   
-  if(!WriteConsoleA(con->output_handle, "\n", 1, NULL, NULL))
-    con->error = "WriteConsoleA";
+  if(!console_backend->write_text(con->output_handle, L"\n", 1, NULL))
+    con->error = "WriteConsoleW";
     
+  output_queue_detach(previous_queue_input_handle, con->output_handle);
+  
   return !con->error;
 }
 
@@ -2299,62 +2989,106 @@ void hyper_console_interrupt(void (*callback)(void*), void *callback_arg) {
   assert(callback != NULL);
   
   con = get_current_input();
-  if(con) {
-    COORD pos;
-    CONSOLE_SCREEN_BUFFER_INFO csbi;
-    struct dangling_hyperlinks_t *prompt_links;
-    int global_line_before;
-    int global_line_after;
-    int dummy_column;
+  if(con)
+    interrupt_input(con, callback, callback_arg);
+  else
+    callback(callback_arg);
+}
     
-    con->output_size = 0;
-    write_output_buffer_lines(con);
-    pos.X = 0;
-    pos.Y = con->input_line_coord_y;
-    if(!SetConsoleCursorPosition(con->output_handle, pos)) {
-      debug_printf(L"hyper_console_interrupt: SetConsoleCursorPosition failed.");
-    }
+/* Hide the input, call the callback and show the input again below the then current cursor position.
+ */
+static void interrupt_input(struct console_input_t *con, void (*callback)(void*), void *callback_arg) {
+  COORD pos;
+  CONSOLE_SCREEN_BUFFER_INFO csbi;
+  struct dangling_hyperlinks_t *prompt_links;
+  int global_line_before;
+  int global_line_after;
+  int dummy_column;
     
-    if(!hyperlink_system_local_to_global(pos, &global_line_before, &dummy_column)) {
-      debug_printf(L"hyper_console_interrupt: cannot get global_line_before.");
-    }
+  assert(con != NULL);
+  assert(callback != NULL);
     
-    SetConsoleMode(con->input_handle, con->old_input_mode);
-    SetConsoleMode(con->output_handle, con->old_output_mode);
+  con->defer_update = FALSE;
+  con->output_size = 0;
+  write_output_buffer_lines(con);
+  pos.X = 0;
+  pos.Y = con->input_line_coord_y;
+  if(!console_backend->set_cursor_position(con->output_handle, pos)) {
+    debug_printf(L"interrupt_input: SetConsoleCursorPosition failed.");
+  }
     
-    hyperlink_system_end_input();
-    prompt_links = hyperlink_system_cut_links_after_cursor();
+  if(!hyperlink_system_local_to_global(pos, &global_line_before, &dummy_column)) {
+    debug_printf(L"interrupt_input: cannot get global_line_before.");
+  }
     
-    callback(callback_arg);
+  console_backend->set_mode(con->input_handle, con->old_input_mode);
+  console_backend->set_mode(con->output_handle, con->old_output_mode);
     
-    set_console_modes(con);
-    if(!GetConsoleScreenBufferInfo(con->output_handle, &csbi)) {
-      con->error = "GetConsoleScreenBufferInfo in hyper_console_interrupt";
-      con->stop = TRUE;
-      return;
-    }
+  hyperlink_system_end_input();
+  prompt_links = hyperlink_system_cut_links_after_cursor();
     
-    con->console_size = csbi.dwSize;
-    con->input_line_coord_y = csbi.dwCursorPosition.Y;
-    if(csbi.dwCursorPosition.X > 0) {
-      // might be in last line: scrolling and adjusting input_line_coord_y happens in update_output()
-      con->input_line_coord_y++; 
-    }
+  callback(callback_arg);
+  invalidate_shadow_buffer(con);
     
-    update_output(con);
+  set_console_modes(con);
+  if(!console_backend->get_screen_buffer_info(con->output_handle, &csbi)) {
+    con->error = "GetConsoleScreenBufferInfo in interrupt_input";
+    con->stop = TRUE;
+    return;
+  }
     
-    hyperlink_system_start_input(con->console_size.X, con->input_line_coord_y);
+  con->console_size = csbi.dwSize;
+  con->input_line_coord_y = csbi.dwCursorPosition.Y;
+  if(csbi.dwCursorPosition.X > 0) {
+    // might be in last line: scrolling and adjusting input_line_coord_y happens in update_output()
+    con->input_line_coord_y++; 
+  }
     
-    pos.Y = con->input_line_coord_y;
-    if(!hyperlink_system_local_to_global(pos, &global_line_after, &dummy_column)) {
-      debug_printf(L"hyper_console_interrupt: cannot get global_line_after.");
-    }
+  update_output(con);
     
-    hyperlink_system_move_links(prompt_links, global_line_after - global_line_before);
-    hyperlink_system_paste_and_activate_links(prompt_links);
+  hyperlink_system_start_input(con->console_size.X, con->input_line_coord_y);
+  
+  pos.Y = con->input_line_coord_y;
+  if(!hyperlink_system_local_to_global(pos, &global_line_after, &dummy_column)) {
+    debug_printf(L"interrupt_input: cannot get global_line_after.");
   }
-  else {
-    callback(callback_arg);
+  
+  hyperlink_system_move_links(prompt_links, global_line_after - global_line_before);
+  hyperlink_system_paste_and_activate_links(prompt_links);
+}
+
+struct posted_output_t {
+  HANDLE output_handle;
+  const wchar_t *text;
+  int length;
+};
+
+/* Print all text posted by hyper_console_post_output() since the last call, hiding the input only once.
+ */
+static void print_posted_output(struct console_input_t *con) {
+  struct posted_output_t posted;
+  wchar_t *text;
+  
+  assert(con != NULL);
+  
+  text = output_queue_take(&posted.length);
+  if(!text)
+    return;
+    
+  posted.output_handle = con->output_handle;
+  posted.text = text;
+  interrupt_input(con, write_posted_output, &posted);
+  
+  hyper_console_free_memory(text);
+}
+
+static void write_posted_output(void *context) {
+  struct posted_output_t *posted = context;
+  
+  assert(posted != NULL);
+  
+  if(!console_backend->write_text(posted->output_handle, posted->text, (DWORD)posted->length, NULL)) {
+    debug_printf(L"write_posted_output: WriteConsoleW failed\n");
   }
 }
 
@@ -2544,10 +3278,10 @@ wchar_t *hyper_console_readline(struct hyper_console_settings_t *settings) {
   }
   
   if(!con->ignore_input_when_stopped) {
-    wchar_t *result = con->input_text;
+    wchar_t *result = get_input_text(con);
     int index = console_history_get_index(con->history);
     
-    console_history_add(con->history, con->input_text, con->input_length);
+    console_history_add(con->history, result, con->input_length);
     
     if(con->navigating_history)
       console_history_set_index(con->history, index);
@@ -2581,8 +3315,7 @@ const wchar_t *hyper_console_get_current_input(int *length) {
     return NULL;
   
   *length = con->input_length;
-  con->input_text[con->input_length] = L'\0';
-  return con->input_text;
+  return get_input_text(con);
 }
 
 HYPER_CONSOLE_API
@@ -2602,6 +3335,32 @@ void hyper_console_get_current_selection(int *position, int *anchor) {
   }
 }
 
+HYPER_CONSOLE_API
+BOOL hyper_console_get_input_batch_info(int *events, int *redraws) {
+  struct console_input_t *con = get_current_input();
+  
+  if(events)
+    *events = con ? con->batch_events : 0;
+    
+  if(redraws)
+    *redraws = con ? con->batch_redraws : 0;
+    
+  return con != NULL;
+}
+
+HYPER_CONSOLE_API
+BOOL hyper_console_get_redraw_info(int *input_cells, int *search_cells) {
+  struct console_input_t *con = get_current_input();
+  
+  if(input_cells)
+    *input_cells = con ? con->cells_written : 0;
+    
+  if(search_cells)
+    *search_cells = console_get_search_cells_written();
+    
+  return con != NULL;
+}
+
 HYPER_CONSOLE_API
 void hyper_console_set_current_selection(int position, int anchor) {
   struct console_input_t *con = get_current_input();
@@ -2661,7 +3420,7 @@ BOOL stop_current_input(BOOL do_abort, const wchar_t *opt_replace_input) {
     
   if(opt_replace_input) {
     if(!do_abort) 
-      console_history_set_future(con->history, con->input_text, con->input_length);
+      console_history_set_future(con->history, get_input_text(con), con->input_length);
     
     delete_input_text(con, 0, con->input_length);
     insert_input_text(con, 0, opt_replace_input, -1);
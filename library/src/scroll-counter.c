@@ -2,8 +2,10 @@
 
 #include "scroll-counter.h"
 
+#include "console-backend.h"
 #include "console-buffer-io.h"
 #include "memory-util.h"
+#include "scrollback-archive.h"
 
 #include <assert.h>
 #include <limits.h>
@@ -11,6 +13,14 @@
 
 #define MIN(A, B)  ((A) < (B) ? (A) : (B))
 
+/* Odd base of the polynomial rolling hash over line hashes (computed modulo 2^64) */
+#define ROLLING_HASH_BASE  0x100000001B3ULL
+
+/* Number of previously known lines that an incremental update reads to detect scrolling, at first 
+   and at most */
+#define INITIAL_OVERLAP_LINES  16
+#define MAX_OVERLAP_LINES      256
+
 /* Due to line (un-)wrapping, global lines can map to screen lines in the
    following ways.
 
@@ -24,6 +34,7 @@
 
 
 struct text_line_t {
+  ULONGLONG hash; // see hash_line()
   int length;
   wchar_t content[1];
 };
@@ -52,6 +63,18 @@ struct console_scrollback_t {
   struct line_numbers_array_t visible_line_numbers;
   
   int past_lines_count;
+  
+  /* Reading buffers, kept between updates */
+  CHAR_INFO *cells;
+  int        cells_capacity;
+  ULONGLONG *row_hashes;
+  int        row_hashes_capacity;
+  
+  /* Buffer width at the last update if every old line covered exactly one visible line, 0 otherwise */
+  int single_row_width;
+  
+  /* Optional store for the old lines that are removed */
+  struct console_archive_t *archive;
 };
 
 static struct text_line_t *create_text_line(int length);
@@ -65,11 +88,20 @@ static BOOL resize_line_numbers_array(struct line_numbers_array_t *array, int co
 static void clear_line_numbers_array(struct line_numbers_array_t *array);
 
 static BOOL is_space_only(const wchar_t *str, int length);
+static ULONGLONG hash_line(const wchar_t *str, int length);
+static ULONGLONG inverse_of_rolling_hash_base(void);
 static int is_match(const struct text_line_t *original, const wchar_t *visible, COORD visible_size);
 static int apply_match_at(const struct text_array_t *original, int orig_start, int past_lines_count, struct global_coord_t *visible_coords, const wchar_t *visible, COORD visible_size);
-static void match_lines(struct console_scrollback_t *cs, const wchar_t *visible, COORD visible_size);
-static void clean_old_lines(struct console_scrollback_t *cs);
-static void append_new_known_lines(struct console_scrollback_t *cs, const wchar_t *visible, COORD visible_size);
+static BOOL is_complete_match(struct console_scrollback_t *cs, int vis_match);
+static int find_tail_match(struct console_scrollback_t *cs, int first, const wchar_t *visible, const ULONGLONG *row_hashes, COORD visible_size);
+static void match_lines(struct console_scrollback_t *cs, const wchar_t *visible, const ULONGLONG *row_hashes, COORD visible_size);
+static void archive_old_lines(struct console_scrollback_t *cs, int count, int width);
+static void clean_old_lines(struct console_scrollback_t *cs, int width);
+static void append_new_known_lines(struct console_scrollback_t *cs, const wchar_t *new_lines, const ULONGLONG *row_hashes, COORD new_size);
+static const wchar_t *read_rows(struct console_scrollback_t *cs, int top, COORD size);
+static BOOL has_full_width_row(const wchar_t *rows, COORD size);
+static BOOL update_changed_rows(struct console_scrollback_t *cs, COORD visible_size);
+static void update_all_rows(struct console_scrollback_t *cs, COORD visible_size);
 
 /** Create a new uninitialized text-line.
  */
@@ -188,6 +220,35 @@ static BOOL is_space_only(const wchar_t *str, int length) {
   return TRUE;
 }
 
+/** Hash a line (FNV-1a). Trailing spaces must be removed beforehand.
+ */
+static ULONGLONG hash_line(const wchar_t *str, int length) {
+  ULONGLONG hash = 14695981039346656037ULL;
+  int i;
+  
+  assert(length >= 0);
+  
+  for(i = 0; i < length; ++i) {
+    hash ^= (unsigned short)str[i];
+    hash *= 1099511628211ULL;
+  }
+  
+  return hash;
+}
+
+/** Get x with ROLLING_HASH_BASE * x == 1 (modulo 2^64) by Newton iteration.
+ */
+static ULONGLONG inverse_of_rolling_hash_base(void) {
+  ULONGLONG inverse = ROLLING_HASH_BASE; // correct in the lowest 3 bits
+  int i;
+  
+  for(i = 0; i < 5; ++i)
+    inverse *= 2 - ROLLING_HASH_BASE * inverse;
+    
+  assert(inverse * ROLLING_HASH_BASE == 1);
+  return inverse;
+}
+
 /** Return the number of visible lines that match the original line (Could be > 1 in case of line-wrapping).
    @param original     The long line to be matched.
    @param visible      The visible lines which should start @a original.
@@ -275,62 +336,227 @@ static int apply_match_at(
   return visible_matched_lines;
 }
 
+/** Check whether the visible line numbers stored by apply_match_at() reach the last old line.
+  @param cs        The scrollback.
+  @param vis_match The result of apply_match_at().
+ */
+static BOOL is_complete_match(struct console_scrollback_t *cs, int vis_match) {
+  const struct global_coord_t *vis_coords;
+  int last_matched_global_line_index;
+  
+  assert(cs != NULL);
+  
+  vis_coords = cs->visible_line_numbers.line_starts;
+  if(vis_match == 0)
+    return FALSE;
+    
+  last_matched_global_line_index = vis_coords[vis_match - 1].line - cs->past_lines_count;
+  
+  assert(last_matched_global_line_index <= cs->old_lines.count);
+  
+  return last_matched_global_line_index + 1 == cs->old_lines.count;
+}
+
+/** Find the next tail of old lines that equals the first visible lines.
+  @param cs           The scrollback.
+  @param first        The first candidate old line. All old lines from here on must be shorter than 
+                      visible_size.X and there must be at most visible_size.Y of them.
+  @param visible      The visible lines.
+  @param row_hashes   The hash_line() of every visible line.
+  @param visible_size The line length (X) and number of visible lines (Y).
+  
+  @return The smallest index i >= @a first such that the old lines i, i+1, ... equal the first 
+  visible lines, or cs->old_lines.count if there is none.
+  
+  Candidates are compared by a rolling hash over the line hashes and only an alignment with equal 
+  hashes is verified character by character.
+ */
+static int find_tail_match(struct console_scrollback_t *cs, int first, const wchar_t *visible, const ULONGLONG *row_hashes, COORD visible_size) {
+  struct text_line_t **old;
+  ULONGLONG old_tail_hash;
+  ULONGLONG visible_head_hash;
+  ULONGLONG power;
+  ULONGLONG inverse_base;
+  COORD row_size;
+  int count;
+  int k;
+  
+  assert(cs != NULL);
+  assert(visible != NULL);
+  assert(row_hashes != NULL);
+  assert(visible_size.X > 0);
+  assert(first >= 0);
+  assert(cs->old_lines.count - first <= visible_size.Y);
+  
+  old = cs->old_lines.lines;
+  count = cs->old_lines.count;
+  if(first >= count)
+    return count;
+    
+  /* old_tail_hash is the rolling hash of old[first .. count-1],
+     visible_head_hash that of row_hashes[0 .. count-first-1], 
+     power = ROLLING_HASH_BASE^(count-first-1).
+   */
+  old_tail_hash = 0;
+  visible_head_hash = 0;
+  power = 1;
+  for(k = 0; k < count - first; ++k) {
+    assert(old[first + k]->length < visible_size.X);
+    
+    old_tail_hash     = old_tail_hash     * ROLLING_HASH_BASE + old[first + k]->hash;
+    visible_head_hash = visible_head_hash * ROLLING_HASH_BASE + row_hashes[k];
+    if(k > 0)
+      power *= ROLLING_HASH_BASE;
+  }
+  
+  row_size.X = visible_size.X;
+  row_size.Y = 1;
+  inverse_base = inverse_of_rolling_hash_base();
+  for(; first < count; ++first) {
+    int num_lines = count - first;
+    
+    if(old_tail_hash == visible_head_hash) {
+      for(k = 0; k < num_lines; ++k) {
+        if(is_match(old[first + k], visible + k * visible_size.X, row_size) != 1)
+          break;
+      }
+      
+      if(k == num_lines)
+        return first;
+    }
+    
+    // drop old[first] and the last visible line of the comparison
+    old_tail_hash -= old[first]->hash * power;
+    visible_head_hash = (visible_head_hash - row_hashes[num_lines - 1]) * inverse_base;
+    power *= inverse_base;
+  }
+  
+  return count;
+}
+
 /** Estimate the global line numbers of the top-most visible lines.
+  @param cs           The scrollback.
+  @param visible      The visible lines.
+  @param row_hashes   The hash_line() of every visible line.
+  @param visible_size The line length (X) and number of visible lines (Y).
+  
+  The old lines are matched against the top of the visible lines, trying the longest tail of old 
+  lines first. Every old line covers at least one visible line, so only the last visible_size.Y 
+  old lines are candidates for the first visible line.
+  Old lines shorter than visible_size.X cover exactly one visible line. Where only such lines 
+  follow, the candidates are searched with find_tail_match().
  */
-static void match_lines(struct console_scrollback_t *cs, const wchar_t *visible, COORD visible_size) {
+static void match_lines(struct console_scrollback_t *cs, const wchar_t *visible, const ULONGLONG *row_hashes, COORD visible_size) {
+  struct text_line_t **old;
+  struct global_coord_t *vis_coords;
+  int first_single;
+  int count;
   int first;
+  int k;
   
   assert(visible_size.X > 0);
   assert(visible_size.Y > 0);
   assert(cs != NULL);
   assert(visible != NULL);
+  assert(row_hashes != NULL);
   
   if(!resize_line_numbers_array(&cs->visible_line_numbers, visible_size.Y)) {
     cs->visible_line_numbers.count = 0;
     return;
   }
   
-  for(first = 0; first < cs->old_lines.count; ++first) {
-    struct global_coord_t *vis_coords = cs->visible_line_numbers.line_starts;
-    
-    int vis_match = apply_match_at(
-                      &cs->old_lines,
-                      first,
-                      cs->past_lines_count,
-                      cs->visible_line_numbers.line_starts,
-                      visible,
-                      visible_size);
-                      
-    assert(vis_match <= visible_size.Y);
+  old = cs->old_lines.lines;
+  count = cs->old_lines.count;
+  
+  first = count - visible_size.Y;
+  if(first < 0)
+    first = 0;
     
-    if(vis_match > 0) {
-      int last_matched_global_line_index = vis_coords[vis_match - 1].line - cs->past_lines_count;
-      
-      assert(last_matched_global_line_index <= cs->old_lines.count);
+  first_single = count;
+  while(first_single > first && old[first_single - 1]->length < visible_size.X)
+    --first_single;
+    
+  /* Old lines longer than one visible line (e.g. after the buffer width shrank) may cover 
+     several visible lines. Compare them directly.
+   */
+  for(; first < first_single; ++first) {
+    int vis_match;
+    
+    if(old[first]->length < visible_size.X && old[first]->hash != row_hashes[0])
+      continue;
       
-      if(last_matched_global_line_index + 1 == cs->old_lines.count) {
-        /* Success, found whole rest of cs->old_lines */
-        cs->visible_line_numbers.count = vis_match;
-        
-        return;
-      }
+    vis_match = apply_match_at(
+                  &cs->old_lines,
+                  first,
+                  cs->past_lines_count,
+                  cs->visible_line_numbers.line_starts,
+                  visible,
+                  visible_size);
+                  
+    assert(vis_match <= visible_size.Y);
+    
+    if(is_complete_match(cs, vis_match)) {
+      /* Success, found whole rest of cs->old_lines */
+      cs->visible_line_numbers.count = vis_match;
+      return;
     }
   }
   
-  /* No match found.
-    TODO: the first visible lines might be the rest of some old lines due to line-breaking.
-   */
-  cs->visible_line_numbers.count = 0;
+  first = find_tail_match(cs, first, visible, row_hashes, visible_size);
+  if(first == count) {
+    /* No match found.
+      TODO: the first visible lines might be the rest of some old lines due to line-breaking.
+     */
+    cs->visible_line_numbers.count = 0;
+    return;
+  }
+  
+  vis_coords = cs->visible_line_numbers.line_starts;
+  for(k = 0; k < count - first; ++k) {
+    vis_coords[k].line = cs->past_lines_count + first + k;
+    vis_coords[k].column = 0;
+  }
+  
+  cs->visible_line_numbers.count = count - first;
+}
+
+/** Pass the first old lines to the archive, if any.
+  @param cs    The scrollback.
+  @param count The number of old lines that are about to be removed.
+  @param width The buffer width. Lines that fill it are assumed to continue on the next line.
+ */
+static void archive_old_lines(struct console_scrollback_t *cs, int count, int width) {
+  int i;
+  
+  assert(cs != NULL);
+  assert(count <= cs->old_lines.count);
+  
+  if(!cs->archive)
+    return;
+    
+  for(i = 0; i < count; ++i) {
+    const struct text_line_t *line = cs->old_lines.lines[i];
+    
+    console_archive_append(
+      cs->archive,
+      cs->past_lines_count + i,
+      line->content,
+      line->length,
+      line->length >= width);
+  }
 }
 
 /** Remove the (initial) lines from the old_lines cache, which do not match the currently visible lines according to visible_line_numbers.
+  @param cs    The scrollback.
+  @param width The buffer width.
  */
-static void clean_old_lines(struct console_scrollback_t *cs) {
+static void clean_old_lines(struct console_scrollback_t *cs, int width) {
   int remove_count;
   
   assert(cs != NULL);
   
   if(cs->visible_line_numbers.count == 0) {
+    archive_old_lines(cs, cs->old_lines.count, width);
     cs->past_lines_count += cs->old_lines.count;
     
     clear_lines(&cs->old_lines);
@@ -340,27 +566,32 @@ static void clean_old_lines(struct console_scrollback_t *cs) {
   remove_count = cs->visible_line_numbers.line_starts[0].line - cs->past_lines_count;
   assert(remove_count >= 0);
   
+  archive_old_lines(cs, remove_count, width);
   cs->past_lines_count += remove_count;
   remove_lines_front(&cs->old_lines, remove_count);
 }
 
-/** Append those @a visible lines to the old_lines cache, which are not listed there yet (according to visible_line_numbers).
+/** Append the visible lines following those in visible_line_numbers to the old_lines cache.
+  @param cs          The scrollback.
+  @param new_lines   The visible lines after the last one listed in visible_line_numbers.
+  @param row_hashes  The hash_line() of every new line.
+  @param new_size    The line length (X) and number of new lines (Y).
  */
-static void append_new_known_lines(struct console_scrollback_t *cs, const wchar_t *visible, COORD visible_size) {
+static void append_new_known_lines(struct console_scrollback_t *cs, const wchar_t *new_lines, const ULONGLONG *row_hashes, COORD new_size) {
   int new_count;
   int old_lines_offset;
   int visible_lines_offset;
   
   assert(cs != NULL);
-  assert(visible != NULL);
-  assert(visible_size.X > 0);
-  assert(visible_size.Y >= cs->visible_line_numbers.count);
+  assert(new_lines != NULL);
+  assert(row_hashes != NULL);
+  assert(new_size.X > 0);
+  assert(new_size.Y >= 0);
   
   old_lines_offset     = cs->old_lines.count;
   visible_lines_offset = cs->visible_line_numbers.count;
   
-  new_count = visible_size.Y - visible_lines_offset;
-  visible += visible_lines_offset * visible_size.X;
+  new_count = new_size.Y;
   
   if(append_null_lines(&cs->old_lines, new_count)) {
     int i;
@@ -370,18 +601,19 @@ static void append_new_known_lines(struct console_scrollback_t *cs, const wchar_
       return;
     }
     
-    for(i = 0; i < new_count; ++i, visible += visible_size.X) {
-      struct text_line_t *line = create_text_line(visible_size.X);
+    for(i = 0; i < new_count; ++i, new_lines += new_size.X) {
+      struct text_line_t *line = create_text_line(new_size.X);
       
       if(line == NULL) {
         cs->old_lines.count = i;
         break;
       }
       
-      memcpy(line->content, visible, visible_size.X * sizeof(wchar_t));
+      memcpy(line->content, new_lines, new_size.X * sizeof(wchar_t));
       while(line->length > 0 && line->content[line->length - 1] == ' ')
         line->length--;
       line->content[line->length] = '\0';
+      line->hash = row_hashes[i];
       
       cs->old_lines.lines[old_lines_offset + i] = line;
       cs->visible_line_numbers.line_starts[visible_lines_offset + i].column = 0;
@@ -390,13 +622,234 @@ static void append_new_known_lines(struct console_scrollback_t *cs, const wchar_
   }
 }
 
+/** Read whole screen lines into cs->cells as text and compute their hash_line() in cs->row_hashes.
+  @param cs   The scrollback.
+  @param top  The first screen line to read.
+  @param size The line length (X) and number of lines to read (Y).
+  
+  @return The lines, stored in cs->cells, or NULL on failure.
+ */
+static const wchar_t *read_rows(struct console_scrollback_t *cs, int top, COORD size) {
+  SMALL_RECT read_region;
+  COORD write_pos;
+  wchar_t *lines;
+  int y;
+  
+  assert(cs != NULL);
+  assert(top >= 0);
+  assert(size.X > 0);
+  assert(size.Y > 0);
+  
+  if(size.X > INT_MAX / size.Y)
+    return NULL;
+    
+  if(!resize_array((void**)&cs->cells, &cs->cells_capacity, sizeof(CHAR_INFO), size.X * size.Y))
+    return NULL;
+    
+  if(!resize_array((void**)&cs->row_hashes, &cs->row_hashes_capacity, sizeof(ULONGLONG), size.Y))
+    return NULL;
+    
+  read_region.Left = 0;
+  read_region.Top = (SHORT)top;
+  read_region.Right = read_region.Left + size.X - 1;
+  read_region.Bottom = read_region.Top + size.Y - 1;
+  write_pos.X = 0;
+  write_pos.Y = 0;
+  if(!console_read_output(cs->output_handle, cs->cells, size, write_pos, &read_region))
+    return NULL;
+    
+  if( read_region.Right + 1 - read_region.Left != size.X ||
+      read_region.Bottom + 1 - read_region.Top != size.Y)
+  {
+    return NULL;
+  }
+  
+  lines = (wchar_t*)cs->cells;
+  for(y = 0; y < size.Y; ++y) {
+    const CHAR_INFO *cells = cs->cells + y * size.X;
+    wchar_t *line = lines + y * size.X;
+    int length = 0;
+    int x;
+    
+    for(x = 0; x < size.X; ++x) {
+      line[x] = cells[x].Char.UnicodeChar;
+      if(line[x] != L' ')
+        length = x + 1;
+    }
+    
+    cs->row_hashes[y] = hash_line(line, length);
+  }
+  
+  return lines;
+}
+
+/** Check whether any of the lines is filled up to the last column.
+ */
+static BOOL has_full_width_row(const wchar_t *rows, COORD size) {
+  int y;
+  
+  assert(rows != NULL);
+  assert(size.X > 0);
+  
+  for(y = 0; y < size.Y; ++y) {
+    if(rows[y * size.X + size.X - 1] != L' ')
+      return TRUE;
+  }
+  
+  return FALSE;
+}
+
+/** Update the line numbers by reading only the bottom of the visible lines.
+  @param cs           The scrollback.
+  @param visible_size The line length (X) and number of known visible lines (Y).
+  
+  @return TRUE on success, FALSE if all visible lines must be read.
+  
+  The lines above those read are assumed to be unchanged since the last update, except for 
+  scrolling. This is not tried if the cursor moved above the previously known lines.
+  The first read covers the lines below the previously known ones and INITIAL_OVERLAP_LINES more.
+  The scroll distance follows from the unique tail of old lines that equals the top of the read 
+  lines. While there is no such overlap, it is ambiguous (e.g. for repetitive output) or it 
+  consists of empty lines only, the number of previously known lines to read is doubled, up to 
+  MAX_OVERLAP_LINES or half of the visible lines. As a cheap check of the assumption, the first 
+  visible line must hash like the old line that scrolled there.
+ */
+static BOOL update_changed_rows(struct console_scrollback_t *cs, COORD visible_size) {
+  ULONGLONG first_row_hash;
+  ULONGLONG empty_hash;
+  COORD first_row_size;
+  int overlap_rows;
+  int old_rows;
+  int new_rows;
+  
+  assert(cs != NULL);
+  assert(visible_size.X > 0);
+  assert(visible_size.Y > 0);
+  
+  // When the cursor moved up, the program probably rewrites the screen.
+  old_rows = cs->visible_line_numbers.count;
+  if(cs->single_row_width != visible_size.X || old_rows == 0 || visible_size.Y < old_rows)
+    return FALSE;
+    
+  assert(old_rows == cs->old_lines.count);
+  
+  new_rows = visible_size.Y - old_rows;
+  if(2 * (new_rows + INITIAL_OVERLAP_LINES) >= visible_size.Y)
+    return FALSE;
+    
+  first_row_size.X = visible_size.X;
+  first_row_size.Y = 1;
+  if(!read_rows(cs, 0, first_row_size))
+    return FALSE;
+    
+  first_row_hash = cs->row_hashes[0];
+  empty_hash = hash_line(L"", 0);
+  
+  for(overlap_rows = INITIAL_OVERLAP_LINES; overlap_rows <= MAX_OVERLAP_LINES; overlap_rows *= 2) {
+    struct global_coord_t *vis_coords;
+    const wchar_t *rows;
+    COORD window_size;
+    int overlap;
+    int scroll;
+    int window;
+    int match;
+    int top;
+    int y;
+    
+    window = new_rows + overlap_rows;
+    if(2 * window >= visible_size.Y)
+      break;
+      
+    top = visible_size.Y - window;
+    
+    window_size.X = visible_size.X;
+    window_size.Y = (SHORT)window;
+    rows = read_rows(cs, top, window_size);
+    if(!rows)
+      return FALSE;
+      
+    // The screen does not scroll backwards, so at most overlap_rows old lines are in the window.
+    match = find_tail_match(cs, old_rows - overlap_rows, rows, cs->row_hashes, window_size);
+    if(match == old_rows)
+      continue;
+      
+    if(find_tail_match(cs, match + 1, rows, cs->row_hashes, window_size) < old_rows)
+      continue;
+      
+    overlap = old_rows - match;
+    for(y = 0; y < overlap && cs->row_hashes[y] == empty_hash; ++y) {
+    }
+    
+    if(y == overlap)
+      continue;
+      
+    scroll = match - top;
+    if(cs->old_lines.lines[scroll]->hash != first_row_hash)
+      return FALSE;
+      
+    if(!resize_line_numbers_array(&cs->visible_line_numbers, top + overlap))
+      return FALSE;
+      
+    vis_coords = cs->visible_line_numbers.line_starts;
+    for(y = 0; y < top + overlap; ++y) {
+      vis_coords[y].line = cs->past_lines_count + scroll + y;
+      vis_coords[y].column = 0;
+    }
+    
+    clean_old_lines(cs, visible_size.X);
+    
+    rows += overlap * visible_size.X;
+    window_size.Y = (SHORT)(window - overlap);
+    append_new_known_lines(cs, rows, cs->row_hashes + overlap, window_size);
+    
+    if(cs->visible_line_numbers.count != cs->old_lines.count || has_full_width_row(rows, window_size))
+      cs->single_row_width = 0;
+      
+    return TRUE;
+  }
+  
+  return FALSE;
+}
+
+/** Update the line numbers by reading all known visible lines.
+  @param cs           The scrollback.
+  @param visible_size The line length (X) and number of known visible lines (Y).
+  
+  Afterwards, cs->single_row_width enables update_changed_rows() if every old line is on one 
+  visible line.
+ */
+static void update_all_rows(struct console_scrollback_t *cs, COORD visible_size) {
+  const wchar_t *rows;
+  COORD new_size;
+  int matched;
+  
+  assert(cs != NULL);
+  
+  cs->single_row_width = 0;
+  
+  rows = read_rows(cs, 0, visible_size);
+  if(!rows)
+    return;
+    
+  match_lines(cs, rows, cs->row_hashes, visible_size);
+  clean_old_lines(cs, visible_size.X);
+  
+  matched = cs->visible_line_numbers.count;
+  new_size.X = visible_size.X;
+  new_size.Y = (SHORT)(visible_size.Y - matched);
+  append_new_known_lines(cs, rows + matched * visible_size.X, cs->row_hashes + matched, new_size);
+  
+  if(cs->visible_line_numbers.count == cs->old_lines.count && !has_full_width_row(rows, visible_size))
+    cs->single_row_width = visible_size.X;
+}
+
 struct console_scrollback_t *console_scrollback_new(void) {
   struct console_scrollback_t *cs;
   
   cs = hyper_console_allocate_memory(sizeof(struct console_scrollback_t));
   if(cs) {
     memset(cs, 0, sizeof(*cs));
-    cs->output_handle = GetStdHandle(STD_OUTPUT_HANDLE);
+    cs->output_handle = console_backend->get_std_handle(STD_OUTPUT_HANDLE);
   }
   
   return cs;
@@ -408,18 +861,43 @@ void console_scrollback_free(struct console_scrollback_t *cs) {
     
   clear_lines(&cs->old_lines);
   clear_line_numbers_array(&cs->visible_line_numbers);
+  hyper_console_free_memory(cs->cells);
+  hyper_console_free_memory(cs->row_hashes);
+  console_archive_free(cs->archive);
   hyper_console_free_memory(cs);
 }
 
+void console_scrollback_set_archive_size(struct console_scrollback_t *cs, size_t max_bytes) {
+  if(cs == NULL)
+    return;
+    
+  if(max_bytes == 0) {
+    console_archive_free(cs->archive);
+    cs->archive = NULL;
+    return;
+  }
+  
+  if(cs->archive)
+    console_archive_set_max_bytes(cs->archive, max_bytes);
+  else
+    cs->archive = console_archive_new(max_bytes);
+}
+
+struct console_archive_t *console_scrollback_get_archive(struct console_scrollback_t *cs) {
+  if(cs == NULL)
+    return NULL;
+    
+  return cs->archive;
+}
+
 void console_scrollback_update(struct console_scrollback_t *cs, int known_visible_lines) {
   CONSOLE_SCREEN_BUFFER_INFO csbi;
-  CHAR_INFO *visible_cells;
   COORD visible_size;
   
   if(cs == NULL)
     return;
     
-  if(!GetConsoleScreenBufferInfo(cs->output_handle, &csbi)) {
+  if(!console_backend->get_screen_buffer_info(cs->output_handle, &csbi)) {
     return;
   }
   
@@ -434,39 +912,12 @@ void console_scrollback_update(struct console_scrollback_t *cs, int known_visibl
   
   if(visible_size.X <= 0 || visible_size.Y <= 0) {
     clear_line_numbers_array(&cs->visible_line_numbers);
+    cs->single_row_width = 0;
     return;
   }
   
-  visible_cells = hyper_console_allocate_memory(visible_size.X * visible_size.Y * sizeof(CHAR_INFO));
-  if(visible_cells != NULL) {
-    SMALL_RECT read_region;
-    read_region.Left = 0;
-    read_region.Top = 0;
-    read_region.Right = read_region.Left + visible_size.X - 1;
-    read_region.Bottom = read_region.Top + visible_size.Y - 1;
-    COORD write_pos;
-    write_pos.X = 0;
-    write_pos.Y = 0;
-    if( console_read_output(
-          cs->output_handle,
-          visible_cells,
-          visible_size,
-          write_pos,
-          &read_region) &&
-       read_region.Right + 1 - read_region.Left == visible_size.X &&
-       read_region.Bottom + 1 - read_region.Top == visible_size.Y) 
-    {
-      wchar_t *visible_lines = (wchar_t*)visible_cells;
-      for(int i = 0;i < visible_size.X * visible_size.Y;++i)
-        visible_lines[i] = visible_cells[i].Char.UnicodeChar;
-      
-      match_lines(cs, visible_lines, visible_size);
-      clean_old_lines(cs);
-      append_new_known_lines(cs, visible_lines, visible_size);
-    }
-    
-    hyper_console_free_memory(visible_cells);
-  }
+  if(!update_changed_rows(cs, visible_size))
+    update_all_rows(cs, visible_size);
 }
 
 BOOL console_scollback_local_to_global(struct console_scrollback_t *cs, COORD local, int *line, int *column) {
@@ -10,6 +10,15 @@ void console_scrollback_free(struct console_scrollback_t *cs);
  */
 void console_scrollback_update(struct console_scrollback_t *cs, int known_visible_lines);
 
+/** Keep the lines that leave the screen buffer in a compressed archive of at most max_bytes, or 
+    drop the archive if max_bytes is 0.
+ */
+void console_scrollback_set_archive_size(struct console_scrollback_t *cs, size_t max_bytes);
+
+/** Get the archive of lines that left the screen buffer or NULL if there is none.
+ */
+struct console_archive_t *console_scrollback_get_archive(struct console_scrollback_t *cs);
+
 BOOL console_scollback_local_to_global(struct console_scrollback_t *cs, COORD local, int *line, int *column);
 BOOL console_scollback_global_to_local(struct console_scrollback_t *cs, int line, int column, COORD *local);
 
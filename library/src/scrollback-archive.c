@@ -0,0 +1,873 @@
+#include <hyper-console.h>
+
+#include "scrollback-archive.h"
+#include "text-search.h"
+#include "debug.h"
+#include "memory-util.h"
+
+#include <assert.h>
+#include <limits.h>
+#include <string.h>
+
+
+#define MIN(A, B)  ((A) < (B) ? (A) : (B))
+#define MAX(A, B)  ((A) > (B) ? (A) : (B))
+
+/* UTF-8 bytes that are collected before a block is compressed. A block is only closed at a line
+   that does not continue on the next one, unless it grew to MAX_BLOCK_SIZE.
+ */
+#define BLOCK_SIZE      (32 * 1024)
+#define MAX_BLOCK_SIZE  (60 * 1024)
+
+/* Bits of the Bloom filter of each block (a power of two). A block of log output has a few
+   thousand distinct character pairs, so that a search for some words rarely hits a block that
+   does not contain them.
+ */
+#define BLOOM_BITS  (8 * 1024)
+
+/* The compressed data is a sequence of LZ4-style commands: a token with the number of literals
+   in the high nibble and the match length minus MIN_MATCH in the low nibble (each continued by
+   bytes of 255 if the nibble is 15), then the literals, a 16-bit little-endian match offset and the
+   continuation of the match length. The last command has no match.
+ */
+#define MIN_MATCH         4
+#define MAX_OFFSET        0xFFFF
+#define HASH_BITS         13
+#define MAX_CHAIN_LENGTH  32
+
+#define LINE_END        '\n'
+#define LINE_CONTINUED  '\r'
+
+struct archive_block_t {
+  int first_line;
+  int line_count;
+  int raw_length;        // bytes of UTF-8 text with line terminators
+  int compressed_length;
+  size_t text_bytes;     // the lines as UTF-16
+  unsigned char bloom[BLOOM_BITS / 8];
+  unsigned char data[1];
+};
+
+struct console_archive_t {
+  size_t max_bytes;
+  size_t used_bytes; // the blocks and the open block
+
+  struct archive_block_t **blocks;
+  int block_count;
+  int block_capacity;
+
+  int first_line;
+  int end_line;
+
+  /* The open block collects the lines after the last block uncompressed. */
+  unsigned char *open_data;
+  int open_length;
+  int open_capacity;
+  int open_first_line;
+  size_t open_text_bytes;
+  unsigned char open_bloom[BLOOM_BITS / 8];
+  wchar_t open_last_char; // the folded last character if the last line continues, else 0
+
+  /* The text of one block, decoded by decode_block() and folded by fold_decoded_text() */
+  const void *decoded_block; // a block or open_data
+  int decoded_line_count;
+  wchar_t *text;
+  int text_length;
+  int text_capacity;
+  wchar_t *folded_text;
+  int folded_text_capacity;
+  BOOL have_folded_text;
+  int *line_starts;
+  int line_starts_capacity;
+
+  /* Scratch space */
+  unsigned char *raw;
+  int raw_capacity;
+  int *chain;
+  int chain_capacity;
+  int hash_heads[1 << HASH_BITS];
+  wchar_t *folded_line;
+  int folded_line_capacity;
+};
+
+static unsigned hash_pair(wchar_t a, wchar_t b);
+static void add_pair(unsigned char *bloom, wchar_t a, wchar_t b);
+static BOOL may_contain(const unsigned char *bloom, const wchar_t *folded, int length);
+
+static unsigned hash_bytes(const unsigned char *s);
+static unsigned char *write_length(unsigned char *dst, int length);
+static unsigned char *write_command(unsigned char *dst, const unsigned char *literals, int literal_count, int offset, int match_length);
+static int find_longest_match(struct console_archive_t *ar, const unsigned char *src, int pos, int length, int *offset);
+static int compress_block(struct console_archive_t *ar, const unsigned char *src, int length, unsigned char *dst);
+static BOOL decompress_block(const unsigned char *src, int length, unsigned char *dst, int raw_length);
+
+static unsigned char *encode_utf8(unsigned char *dst, wchar_t ch);
+static BOOL decode_block(struct console_archive_t *ar, int block);
+static BOOL fold_decoded_text(struct console_archive_t *ar);
+
+static int find_block(struct console_archive_t *ar, int line);
+static void get_block_lines(struct console_archive_t *ar, int block, int *first_line, int *end_line);
+
+static BOOL close_open_block(struct console_archive_t *ar);
+static void drop_oldest_block(struct console_archive_t *ar);
+static void drop_all_lines(struct console_archive_t *ar, int next_line);
+static void trim_to_max_bytes(struct console_archive_t *ar);
+static BOOL append_line(struct console_archive_t *ar, const wchar_t *text, int length, BOOL continued);
+
+
+static unsigned hash_pair(wchar_t a, wchar_t b) {
+  unsigned h = (unsigned)a * 0x9E3779B1u ^ (unsigned)b * 0x85EBCA77u;
+
+  h ^= h >> 15;
+  h *= 0x2C1B3C6Du;
+  h ^= h >> 13;
+  return h;
+}
+
+/* Add a pair of folded characters to a Bloom filter with two hash functions.
+ */
+static void add_pair(unsigned char *bloom, wchar_t a, wchar_t b) {
+  unsigned h = hash_pair(a, b);
+  unsigned bit1 = h & (BLOOM_BITS - 1);
+  unsigned bit2 = (h >> 16) & (BLOOM_BITS - 1);
+
+  bloom[bit1 / 8] |= (unsigned char)(1u << (bit1 % 8));
+  bloom[bit2 / 8] |= (unsigned char)(1u << (bit2 % 8));
+}
+
+/* Check whether all character pairs of a folded text may be in a Bloom filter. Single characters
+   are not recorded, so they may be anywhere.
+ */
+static BOOL may_contain(const unsigned char *bloom, const wchar_t *folded, int length) {
+  int i;
+
+  assert(bloom != NULL);
+  assert(folded != NULL);
+
+  for(i = 1; i < length; ++i) {
+    unsigned h = hash_pair(folded[i - 1], folded[i]);
+    unsigned bit1 = h & (BLOOM_BITS - 1);
+    unsigned bit2 = (h >> 16) & (BLOOM_BITS - 1);
+
+    if(!(bloom[bit1 / 8] & (1u << (bit1 % 8))) || !(bloom[bit2 / 8] & (1u << (bit2 % 8))))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static unsigned hash_bytes(const unsigned char *s) {
+  unsigned value = (unsigned)s[0] | ((unsigned)s[1] << 8) | ((unsigned)s[2] << 16) | ((unsigned)s[3] << 24);
+
+  return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static unsigned char *write_length(unsigned char *dst, int length) {
+  assert(length >= 0);
+
+  for(; length >= 255; length -= 255)
+    *dst++ = 255;
+
+  *dst++ = (unsigned char)length;
+  return dst;
+}
+
+/* Write one command. A match_length of 0 means no match (only for the last command).
+ */
+static unsigned char *write_command(unsigned char *dst, const unsigned char *literals, int literal_count, int offset, int match_length) {
+  unsigned char *token = dst++;
+  int match_code = match_length > 0 ? match_length - MIN_MATCH : 0;
+
+  assert(literal_count >= 0);
+  assert(match_length == 0 || match_length >= MIN_MATCH);
+
+  *token = (unsigned char)(MIN(literal_count, 15) << 4);
+  if(literal_count >= 15)
+    dst = write_length(dst, literal_count - 15);
+
+  memcpy(dst, literals, literal_count);
+  dst += literal_count;
+
+  if(match_length == 0)
+    return dst;
+
+  assert(0 < offset && offset <= MAX_OFFSET);
+  *dst++ = (unsigned char)(offset & 0xFF);
+  *dst++ = (unsigned char)(offset >> 8);
+
+  *token |= (unsigned char)MIN(match_code, 15);
+  if(match_code >= 15)
+    dst = write_length(dst, match_code - 15);
+
+  return dst;
+}
+
+/* Find the longest earlier occurrence of the bytes at pos along the hash chain.
+ */
+static int find_longest_match(struct console_archive_t *ar, const unsigned char *src, int pos, int length, int *offset) {
+  int best = 0;
+  int candidate;
+  int steps;
+
+  assert(ar != NULL);
+  assert(offset != NULL);
+
+  if(pos + MIN_MATCH > length)
+    return 0;
+
+  candidate = ar->chain[pos];
+  for(steps = 0; candidate >= 0 && steps < MAX_CHAIN_LENGTH; ++steps, candidate = ar->chain[candidate]) {
+    int n = 0;
+
+    if(pos - candidate > MAX_OFFSET)
+      break;
+
+    if(pos + best == length)
+      break;
+
+    if(src[candidate + best] != src[pos + best])
+      continue;
+
+    while(pos + n < length && src[candidate + n] == src[pos + n])
+      ++n;
+
+    if(n > best) {
+      best = n;
+      *offset = pos - candidate;
+    }
+  }
+
+  return best >= MIN_MATCH ? best : 0;
+}
+
+/* Compress a block with greedy parsing and a one-step lazy match check.
+
+   @param dst Output buffer of at least length + length / 255 + 16 bytes.
+   @return The compressed length or -1 on out-of-memory.
+ */
+static int compress_block(struct console_archive_t *ar, const unsigned char *src, int length, unsigned char *dst) {
+  unsigned char *out = dst;
+  int literal_start = 0;
+  int pos;
+
+  assert(ar != NULL);
+  assert(src != NULL);
+  assert(dst != NULL);
+  assert(length >= 0);
+
+  if(!resize_array((void**)&ar->chain, &ar->chain_capacity, sizeof(int), length + 1))
+    return -1;
+
+  // ar->chain[i] is the previous position with the same hash as position i.
+  memset(ar->hash_heads, 0xFF, sizeof(ar->hash_heads));
+  for(pos = 0; pos + MIN_MATCH <= length; ++pos) {
+    unsigned h = hash_bytes(src + pos);
+
+    ar->chain[pos] = ar->hash_heads[h];
+    ar->hash_heads[h] = pos;
+  }
+
+  pos = 0;
+  while(pos < length) {
+    int offset = 0;
+    int match_length = find_longest_match(ar, src, pos, length, &offset);
+
+    if(match_length > 0) {
+      int next_offset = 0;
+
+      if(find_longest_match(ar, src, pos + 1, length, &next_offset) > match_length) {
+        ++pos;
+        continue;
+      }
+
+      out = write_command(out, src + literal_start, pos - literal_start, offset, match_length);
+      pos+= match_length;
+      literal_start = pos;
+    }
+    else
+      ++pos;
+  }
+
+  out = write_command(out, src + literal_start, length - literal_start, 0, 0);
+  return (int)(out - dst);
+}
+
+static BOOL decompress_block(const unsigned char *src, int length, unsigned char *dst, int raw_length) {
+  const unsigned char *src_end = src + length;
+  unsigned char *out = dst;
+  unsigned char *out_end = dst + raw_length;
+
+  assert(src != NULL);
+  assert(dst != NULL);
+
+  while(src < src_end) {
+    unsigned token = *src++;
+    int literal_count = token >> 4;
+    int match_length;
+    int offset;
+
+    if(literal_count == 15) {
+      unsigned char b;
+      do {
+        if(src == src_end)
+          return FALSE;
+        b = *src++;
+        literal_count+= b;
+      } while(b == 255);
+    }
+
+    if(literal_count > src_end - src || literal_count > out_end - out)
+      return FALSE;
+
+    memcpy(out, src, literal_count);
+    out+= literal_count;
+    src+= literal_count;
+
+    if(src == src_end)
+      break;
+
+    if(src_end - src < 2)
+      return FALSE;
+
+    offset = src[0] | (src[1] << 8);
+    src+= 2;
+
+    match_length = (token & 0x0F) + MIN_MATCH;
+    if((token & 0x0F) == 15) {
+      unsigned char b;
+      do {
+        if(src == src_end)
+          return FALSE;
+        b = *src++;
+        match_length+= b;
+      } while(b == 255);
+    }
+
+    if(offset == 0 || offset > out - dst || match_length > out_end - out)
+      return FALSE;
+
+    // Overlapping matches repeat the last offset bytes, so copy byte by byte.
+    for(; match_length > 0; --match_length, ++out)
+      *out = out[-offset];
+  }
+
+  return out == out_end;
+}
+
+/* Encode a UTF-16 unit as UTF-8. Surrogates are encoded individually.
+ */
+static unsigned char *encode_utf8(unsigned char *dst, wchar_t ch) {
+  unsigned u = (unsigned short)ch;
+
+  if(u < 0x80) {
+    *dst++ = (unsigned char)u;
+  }
+  else if(u < 0x800) {
+    *dst++ = (unsigned char)(0xC0 | (u >> 6));
+    *dst++ = (unsigned char)(0x80 | (u & 0x3F));
+  }
+  else {
+    *dst++ = (unsigned char)(0xE0 | (u >> 12));
+    *dst++ = (unsigned char)(0x80 | ((u >> 6) & 0x3F));
+    *dst++ = (unsigned char)(0x80 | (u & 0x3F));
+  }
+
+  return dst;
+}
+
+/* Decode a block (or the open block if block == ar->block_count) into ar->text and
+   ar->line_starts. Line ends become \n, continued lines are joined.
+ */
+static BOOL decode_block(struct console_archive_t *ar, int block) {
+  const unsigned char *raw;
+  const unsigned char *raw_end;
+  const void *key;
+  int line_count;
+  int line;
+  wchar_t *t;
+
+  assert(ar != NULL);
+  assert(0 <= block && block <= ar->block_count);
+
+  if(block < ar->block_count) {
+    struct archive_block_t *b = ar->blocks[block];
+
+    key = b;
+    line_count = b->line_count;
+    if(ar->decoded_block == key && ar->decoded_line_count == line_count)
+      return TRUE;
+
+    if(!resize_array((void**)&ar->raw, &ar->raw_capacity, 1, b->raw_length))
+      return FALSE;
+
+    if(!decompress_block(b->data, b->compressed_length, ar->raw, b->raw_length)) {
+      debug_printf(L"scrollback archive: corrupt block %d\n", block);
+      return FALSE;
+    }
+
+    raw = ar->raw;
+    raw_end = ar->raw + b->raw_length;
+  }
+  else {
+    key = ar->open_data;
+    line_count = ar->end_line - ar->open_first_line;
+    if(ar->decoded_block == key && ar->decoded_line_count == line_count)
+      return TRUE;
+
+    raw = ar->open_data;
+    raw_end = ar->open_data + ar->open_length;
+  }
+
+  ar->decoded_block = NULL;
+
+  if(!resize_array((void**)&ar->text, &ar->text_capacity, sizeof(wchar_t), (int)(raw_end - raw)))
+    return FALSE;
+
+  if(!resize_array((void**)&ar->line_starts, &ar->line_starts_capacity, sizeof(int), line_count + 1))
+    return FALSE;
+
+  t = ar->text;
+  line = 0;
+  ar->line_starts[0] = 0;
+  while(raw < raw_end) {
+    unsigned u = *raw++;
+
+    if(u == LINE_END || u == LINE_CONTINUED) {
+      if(u == LINE_END)
+        *t++ = L'\n';
+
+      if(line < line_count)
+        ar->line_starts[++line] = (int)(t - ar->text);
+
+      continue;
+    }
+
+    if(u >= 0xE0 && raw_end - raw >= 2) {
+      u = ((u & 0x0F) << 12) | ((raw[0] & 0x3F) << 6) | (raw[1] & 0x3F);
+      raw+= 2;
+    }
+    else if(u >= 0xC0 && raw_end - raw >= 1) {
+      u = ((u & 0x1F) << 6) | (raw[0] & 0x3F);
+      raw+= 1;
+    }
+
+    *t++ = (wchar_t)u;
+  }
+
+  assert(line == line_count);
+
+  ar->text_length = (int)(t - ar->text);
+  ar->have_folded_text = FALSE;
+  ar->decoded_block = key;
+  ar->decoded_line_count = line_count;
+  return TRUE;
+}
+
+static BOOL fold_decoded_text(struct console_archive_t *ar) {
+  assert(ar != NULL);
+  assert(ar->decoded_block != NULL);
+
+  if(ar->have_folded_text)
+    return TRUE;
+
+  if(!resize_array((void**)&ar->folded_text, &ar->folded_text_capacity, sizeof(wchar_t), ar->text_length))
+    return FALSE;
+
+  ar->have_folded_text = console_fold_case(ar->text, ar->text_length, ar->folded_text);
+  return ar->have_folded_text;
+}
+
+/* Get the block that contains a line, or ar->block_count for the open block.
+ */
+static int find_block(struct console_archive_t *ar, int line) {
+  int lo = 0;
+  int hi = ar->block_count;
+
+  assert(ar != NULL);
+  assert(ar->first_line <= line && line < ar->end_line);
+
+  if(line >= ar->open_first_line)
+    return ar->block_count;
+
+  while(hi - lo > 1) {
+    int mid = lo + (hi - lo) / 2;
+
+    if(ar->blocks[mid]->first_line <= line)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+static void get_block_lines(struct console_archive_t *ar, int block, int *first_line, int *end_line) {
+  assert(ar != NULL);
+  assert(0 <= block && block <= ar->block_count);
+
+  if(block < ar->block_count) {
+    *first_line = ar->blocks[block]->first_line;
+    *end_line   = ar->blocks[block]->first_line + ar->blocks[block]->line_count;
+  }
+  else {
+    *first_line = ar->open_first_line;
+    *end_line   = ar->end_line;
+  }
+}
+
+/* Compress the open block and start a new one.
+ */
+static BOOL close_open_block(struct console_archive_t *ar) {
+  struct archive_block_t *block;
+  int compressed_length;
+
+  assert(ar != NULL);
+
+  if(ar->open_first_line == ar->end_line)
+    return TRUE;
+
+  if(!resize_array((void**)&ar->raw, &ar->raw_capacity, 1, ar->open_length + ar->open_length / 255 + 16))
+    return FALSE;
+
+  compressed_length = compress_block(ar, ar->open_data, ar->open_length, ar->raw);
+  if(compressed_length < 0)
+    return FALSE;
+
+  if(!resize_array((void**)&ar->blocks, &ar->block_capacity, sizeof(ar->blocks[0]), ar->block_count + 1))
+    return FALSE;
+
+  block = hyper_console_allocate_memory(sizeof(struct archive_block_t) + compressed_length);
+  if(!block)
+    return FALSE;
+
+  block->first_line        = ar->open_first_line;
+  block->line_count        = ar->end_line - ar->open_first_line;
+  block->raw_length        = ar->open_length;
+  block->compressed_length = compressed_length;
+  block->text_bytes        = ar->open_text_bytes;
+  memcpy(block->bloom, ar->open_bloom, sizeof(block->bloom));
+  memcpy(block->data, ar->raw, compressed_length);
+
+  ar->blocks[ar->block_count++] = block;
+  ar->used_bytes+= sizeof(struct archive_block_t) + compressed_length;
+
+  if(ar->decoded_block == ar->open_data)
+    ar->decoded_block = NULL;
+
+  ar->open_length = 0;
+  ar->open_first_line = ar->end_line;
+  ar->open_text_bytes = 0;
+  ar->open_last_char = 0;
+  memset(ar->open_bloom, 0, sizeof(ar->open_bloom));
+  return TRUE;
+}
+
+static void drop_oldest_block(struct console_archive_t *ar) {
+  struct archive_block_t *block;
+
+  assert(ar != NULL);
+  assert(ar->block_count > 0);
+
+  block = ar->blocks[0];
+  if(ar->decoded_block == block)
+    ar->decoded_block = NULL;
+
+  ar->used_bytes-= sizeof(struct archive_block_t) + block->compressed_length;
+  hyper_console_free_memory(block);
+
+  --ar->block_count;
+  memmove(ar->blocks, ar->blocks + 1, ar->block_count * sizeof(ar->blocks[0]));
+
+  ar->first_line = ar->block_count > 0 ? ar->blocks[0]->first_line : ar->open_first_line;
+}
+
+static void drop_all_lines(struct console_archive_t *ar, int next_line) {
+  assert(ar != NULL);
+
+  while(ar->block_count > 0)
+    drop_oldest_block(ar);
+
+  ar->decoded_block = NULL;
+  ar->open_length = 0;
+  ar->open_text_bytes = 0;
+  ar->open_last_char = 0;
+  memset(ar->open_bloom, 0, sizeof(ar->open_bloom));
+
+  ar->first_line = ar->end_line = ar->open_first_line = next_line;
+}
+
+static void trim_to_max_bytes(struct console_archive_t *ar) {
+  assert(ar != NULL);
+
+  while(ar->used_bytes > ar->max_bytes && ar->block_count > 0)
+    drop_oldest_block(ar);
+}
+
+static BOOL append_line(struct console_archive_t *ar, const wchar_t *text, int length, BOOL continued) {
+  unsigned char *s;
+  wchar_t prev;
+  int i;
+
+  assert(ar != NULL);
+  assert(text != NULL || length == 0);
+  assert(length >= 0);
+
+  if(length > (INT_MAX - 1) / 3 - ar->open_length)
+    return FALSE;
+
+  if( ar->open_length > 0 &&
+      ar->open_length + 3 * length + 1 > BLOCK_SIZE &&
+      (ar->open_last_char == 0 || ar->open_length >= MAX_BLOCK_SIZE))
+  {
+    if(!close_open_block(ar))
+      return FALSE;
+  }
+
+  if(ar->open_length + 3 * length + 1 > ar->open_capacity) {
+    int old_capacity = ar->open_capacity;
+
+    if(!resize_array((void**)&ar->open_data, &ar->open_capacity, 1, MAX(BLOCK_SIZE, ar->open_length + 3 * length + 1)))
+      return FALSE;
+
+    ar->used_bytes+= ar->open_capacity - old_capacity;
+    ar->decoded_block = NULL;
+  }
+
+  if(!resize_array((void**)&ar->folded_line, &ar->folded_line_capacity, sizeof(wchar_t), length))
+    return FALSE;
+
+  if(!console_fold_case(text, length, ar->folded_line))
+    return FALSE;
+
+  s = ar->open_data + ar->open_length;
+  prev = ar->open_last_char;
+  for(i = 0; i < length; ++i) {
+    wchar_t ch = text[i];
+
+    if(ch == L'\n' || ch == L'\r')
+      ch = L' ';
+
+    s = encode_utf8(s, ch);
+
+    if(prev != 0)
+      add_pair(ar->open_bloom, prev, ar->folded_line[i]);
+    prev = ar->folded_line[i];
+  }
+
+  *s++ = continued ? LINE_CONTINUED : LINE_END;
+
+  ar->open_length = (int)(s - ar->open_data);
+  ar->open_text_bytes+= length * sizeof(wchar_t);
+  ar->open_last_char = continued && length > 0 ? ar->folded_line[length - 1] : 0;
+  ar->end_line++;
+  return TRUE;
+}
+
+struct console_archive_t *console_archive_new(size_t max_bytes) {
+  struct console_archive_t *ar;
+
+  assert(max_bytes > 0);
+
+  ar = hyper_console_allocate_memory(sizeof(struct console_archive_t));
+  if(ar) {
+    memset(ar, 0, sizeof(*ar));
+    ar->max_bytes = max_bytes;
+  }
+
+  return ar;
+}
+
+void console_archive_free(struct console_archive_t *ar) {
+  if(!ar)
+    return;
+
+  while(ar->block_count > 0)
+    drop_oldest_block(ar);
+
+  hyper_console_free_memory(ar->blocks);
+  hyper_console_free_memory(ar->open_data);
+  hyper_console_free_memory(ar->text);
+  hyper_console_free_memory(ar->folded_text);
+  hyper_console_free_memory(ar->line_starts);
+  hyper_console_free_memory(ar->raw);
+  hyper_console_free_memory(ar->chain);
+  hyper_console_free_memory(ar->folded_line);
+  hyper_console_free_memory(ar);
+}
+
+void console_archive_set_max_bytes(struct console_archive_t *ar, size_t max_bytes) {
+  assert(ar != NULL);
+  assert(max_bytes > 0);
+
+  ar->max_bytes = max_bytes;
+  trim_to_max_bytes(ar);
+}
+
+BOOL console_archive_append(struct console_archive_t *ar, int line, const wchar_t *text, int length, BOOL continued) {
+  assert(ar != NULL);
+
+  if(line < ar->end_line) {
+    debug_printf(L"scrollback archive: line %d appended after %d\n", line, ar->end_line - 1);
+    return FALSE;
+  }
+
+  // Unless the gap is small, start over rather than storing many empty lines.
+  if(ar->first_line == ar->end_line || line - ar->end_line > BLOCK_SIZE)
+    drop_all_lines(ar, line);
+
+  while(ar->end_line < line) {
+    if(!append_line(ar, NULL, 0, FALSE))
+      return FALSE;
+  }
+
+  if(!append_line(ar, text, length, continued)) {
+    // Keep the line numbers with an empty line or start over.
+    if(!append_line(ar, NULL, 0, FALSE))
+      drop_all_lines(ar, line + 1);
+    return FALSE;
+  }
+
+  trim_to_max_bytes(ar);
+  return TRUE;
+}
+
+void console_archive_get_lines(struct console_archive_t *ar, int *first_line, int *end_line) {
+  assert(ar != NULL);
+  assert(first_line != NULL);
+  assert(end_line != NULL);
+
+  *first_line = ar->first_line;
+  *end_line = ar->end_line;
+}
+
+int console_archive_find_text(struct console_archive_t *ar, int *line, int max_lines, const wchar_t *folded, int length) {
+  int checked = 0;
+
+  assert(ar != NULL);
+  assert(line != NULL);
+  assert(folded != NULL);
+  assert(length > 0);
+
+  if(*line < ar->first_line)
+    *line = ar->first_line;
+
+  while(*line < ar->end_line && checked < max_lines) {
+    const unsigned char *bloom;
+    int block_first;
+    int block_end;
+    int block;
+
+    block = find_block(ar, *line);
+    get_block_lines(ar, block, &block_first, &block_end);
+
+    bloom = block < ar->block_count ? ar->blocks[block]->bloom : ar->open_bloom;
+    if(may_contain(bloom, folded, length)) {
+      int pos;
+
+      if(!decode_block(ar, block) || !fold_decoded_text(ar))
+        pos = -1;
+      else
+        pos = console_find_text(
+                ar->folded_text,
+                ar->text_length,
+                ar->line_starts[*line - block_first],
+                ar->text_length,
+                folded,
+                length);
+        
+      if(pos >= 0) {
+        int lo = *line - block_first;
+        int hi = block_end - block_first;
+
+        // The last line that starts at or before pos
+        while(hi - lo > 1) {
+          int mid = lo + (hi - lo) / 2;
+
+          if(ar->line_starts[mid] <= pos)
+            lo = mid;
+          else
+            hi = mid;
+        }
+
+        *line = block_first + lo + 1;
+        return block_first + lo;
+      }
+    }
+
+    checked+= block_end - *line;
+    *line = block_end;
+  }
+
+  return -1;
+}
+
+wchar_t *console_archive_get_text(struct console_archive_t *ar, int first_line, int end_line, int *total_length) {
+  wchar_t *str = NULL;
+  int capacity = 0;
+  int length = 0;
+  int line;
+
+  assert(ar != NULL);
+  assert(total_length != NULL);
+
+  *total_length = 0;
+
+  first_line = MAX(first_line, ar->first_line);
+  end_line   = MIN(end_line,   ar->end_line);
+
+  if(!resize_array((void**)&str, &capacity, sizeof(wchar_t), 1))
+    return NULL;
+
+  for(line = first_line; line < end_line;) {
+    const wchar_t *s;
+    const wchar_t *e;
+    int block_first;
+    int block_end;
+    int block;
+    int stop;
+
+    block = find_block(ar, line);
+    get_block_lines(ar, block, &block_first, &block_end);
+
+    if(!decode_block(ar, block)) {
+      hyper_console_free_memory(str);
+      return NULL;
+    }
+
+    stop = MIN(end_line, block_end);
+    s = ar->text + ar->line_starts[line - block_first];
+    e = ar->text + ar->line_starts[stop - block_first];
+
+    // Every \n becomes \r\n.
+    if(!resize_array((void**)&str, &capacity, sizeof(wchar_t), length + 2 * (int)(e - s) + 1)) {
+      hyper_console_free_memory(str);
+      return NULL;
+    }
+
+    for(; s != e; ++s) {
+      if(*s == L'\n')
+        str[length++] = L'\r';
+      str[length++] = *s;
+    }
+
+    line = stop;
+  }
+
+  str[length] = L'\0';
+  *total_length = length;
+  return str;
+}
+
+void console_archive_get_size(struct console_archive_t *ar, size_t *text_bytes, size_t *used_bytes) {
+  int i;
+
+  assert(ar != NULL);
+  assert(text_bytes != NULL);
+  assert(used_bytes != NULL);
+
+  *text_bytes = ar->open_text_bytes;
+  for(i = 0; i < ar->block_count; ++i)
+    *text_bytes+= ar->blocks[i]->text_bytes;
+
+  *used_bytes = sizeof(struct console_archive_t) + ar->used_bytes + ar->block_capacity * sizeof(ar->blocks[0]);
+}
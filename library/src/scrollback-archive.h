@@ -0,0 +1,103 @@
+#ifndef __CONSOLE__SCROLLBACK_ARCHIVE_H__
+#define __CONSOLE__SCROLLBACK_ARCHIVE_H__
+
+#include <windows.h>
+
+
+/** A compressed store of the lines that left the screen buffer.
+
+  Lines are numbered like the global lines of the scroll counter. They are collected as UTF-8
+  in an open block, which is compressed LZ4-style once it is full. Every block has a Bloom filter
+  over the case-folded character pairs of its text, so that a search decompresses only the
+  blocks which may contain the searched text. When the archive exceeds its memory limit, the
+  oldest blocks are dropped.
+ */
+struct console_archive_t;
+
+
+/** Create an empty archive.
+
+  \param max_bytes The memory limit. Must be positive.
+
+  \return The archive or NULL on out-of-memory. Free it with console_archive_free().
+ */
+struct console_archive_t *console_archive_new(size_t max_bytes);
+
+
+/** Free an archive.
+
+  \param ar An archive or NULL.
+ */
+void console_archive_free(struct console_archive_t *ar);
+
+
+/** Change the memory limit, dropping the oldest blocks as necessary.
+ */
+void console_archive_set_max_bytes(struct console_archive_t *ar, size_t max_bytes);
+
+
+/** Append a line.
+
+  \param ar        The archive.
+  \param line      The global line number. Lines must be appended in increasing order. Skipped
+                   numbers become empty lines.
+  \param text      The line text without trailing line break.
+  \param length    The number of characters in \a text.
+  \param continued Whether the next line continues this one, because the text filled a whole row.
+
+  \return TRUE on success, FALSE on out-of-memory. Then, the line is lost.
+ */
+BOOL console_archive_append(struct console_archive_t *ar, int line, const wchar_t *text, int length, BOOL continued);
+
+
+/** Get the range of archived lines.
+
+  \param ar         The archive.
+  \param first_line Receives the first line that is still archived.
+  \param end_line   Receives the line after the last archived one.
+ */
+void console_archive_get_lines(struct console_archive_t *ar, int *first_line, int *end_line);
+
+
+/** Find the next line that contains a text.
+
+  \param ar        The archive.
+  \param line      The first line to check. Receives the line after the one that was found or
+                   where the search stopped.
+  \param max_lines The number of lines to check at most, rounded up to whole blocks.
+  \param folded    The text to find, folded with console_fold_case().
+  \param length    The number of characters in \a folded. Must be positive.
+
+  \return The line that contains \a folded, or -1 if none was found before the search stopped.
+  Then \a *line is the end of the archive if all lines were checked.
+
+  Lines that continue each other are searched as one text, unless a very long sequence of them
+  had to be split between blocks. A match is reported at the line where it starts.
+ */
+int console_archive_find_text(struct console_archive_t *ar, int *line, int max_lines, const wchar_t *folded, int length);
+
+
+/** Get the text of archived lines.
+
+  \param ar           The archive.
+  \param first_line   The first line to get.
+  \param end_line     The line after the last one to get.
+  \param total_length Receives the string length of the result.
+
+  \return The lines, each followed by \\r\\n unless it continues on the next one. Must be freed
+  with hyper_console_free_memory(). NULL on error.
+ */
+wchar_t *console_archive_get_text(struct console_archive_t *ar, int first_line, int end_line, int *total_length);
+
+
+/** Get memory usage information.
+
+  \param ar         The archive.
+  \param text_bytes Receives the size of all archived lines as UTF-16 without line breaks.
+  \param used_bytes Receives the memory used by the archived lines, without the scratch buffers
+                    for compressing and searching.
+ */
+void console_archive_get_size(struct console_archive_t *ar, size_t *text_bytes, size_t *used_bytes);
+
+
+#endif // __CONSOLE__SCROLLBACK_ARCHIVE_H__
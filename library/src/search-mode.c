@@ -1,12 +1,17 @@
 #include <hyper-console.h>
 
 #include "search-mode.h"
+#include "console-backend.h"
 #include "console-buffer-io.h"
+#include "hyperlink-output.h"
 #include "memory-util.h"
 #include "text-util.h"
+#include "text-pattern.h"
+#include "text-search.h"
 
 #include <assert.h>
 #include <strsafe.h>
+#include <wctype.h>
 
 
 #ifndef MOUSE_HWHEELED
@@ -18,11 +23,22 @@
 #define MAX(A, B)  ((A) > (B) ? (A) : (B))
 
 
+/* Number of screen cells to search outside the window before checking for input again.
+ */
+#define SEARCH_SLICE_LENGTH  (64 * 1024)
+
+/* Number of archived lines to search before checking for input again.
+ */
+#define ARCHIVE_SLICE_LINES  4096
+
+/* Changed cells that are at most this far apart are written with one call. Rewriting a few
+   unchanged rows is cheaper than another round trip to the console.
+ */
+#define FLUSH_MERGE_GAP  1024
+
 struct match_t {
-  struct match_t *prev;
-  struct match_t *next;
-  
-  COORD position;
+  int index;
+  int length;
 };
 
 struct console_search_t {
@@ -31,27 +47,68 @@ struct console_search_t {
   
   COORD console_size;
   wchar_t *screen;
+  wchar_t *folded_screen;
   WORD *attributes;
   
+  /* Non-zero for rows whose attributes may have been changed by other programs since the snapshot 
+     was taken. They are re-read before anything is written there, see refresh_stale_rows().
+   */
+  char *stale_rows;
+  
+  /* Highlights are drawn into composed_attributes and written by flush_attributes(). 
+     shadow_attributes is what the screen shows. The two may only differ within the columns
+     dirty_left[y] to dirty_right[y] of the rows y in [dirty_top, dirty_bottom).
+   */
+  WORD *composed_attributes;
+  WORD *shadow_attributes;
+  int *dirty_left;
+  int *dirty_right;
+  int dirty_top;
+  int dirty_bottom;
+  int cells_written; // for the current keystroke or other input event
+  
   COORD                last_result_pos;
   COORD                original_pos;
   wchar_t             *oritinal_title;
   CONSOLE_CURSOR_INFO  original_cursor;
   
-  WORD *highlight_attributes;
-  int highlight_attributes_capacity;
-  
-  WORD *result_attributes;
-  int result_attributes_capacity;
+  WORD *match_attributes;
+  int match_attributes_capacity;
   
   wchar_t *filter_text;
   int filter_length;
   int filter_capacity;
   
+  wchar_t *folded_filter;
+  int folded_filter_capacity;
+  
+  struct console_pattern_t *pattern; // the compiled filter in regex mode, NULL if invalid
+  
   int filter_anchor;
   int filter_pos;
   
-  struct match_t *current_result;
+  struct match_t *matches; // sorted by index
+  int match_count;
+  int match_capacity;
+  int current_match;
+  
+  /* A new search covers the window rows first. It then continues from there to scan_end
+     and finally from the top to scan_above_end, the window top. The first above_count 
+     matches were found in the latter part.
+   */
+  int scan_next;
+  int scan_end;
+  int scan_above_next;
+  int scan_above_end;
+  int above_count;
+  int search_origin;
+  
+  /* Lines in the scrollback archive are only counted, once the whole screen is searched.
+     Counting happens in [archive_next_line, archive_end_line).
+   */
+  int archive_next_line;
+  int archive_end_line;
+  int archive_match_count;
   
   WORD highlight_attr;
   WORD current_attr;
@@ -59,15 +116,42 @@ struct console_search_t {
   unsigned active: 1;
   unsigned stop: 1;
   unsigned dont_follow_cursor: 1;
+  unsigned compare_folded: 1;
+  unsigned regex_mode: 1;
+  unsigned whole_word: 1;
+  unsigned provisional_match: 1; // current_match follows search_origin until the user navigates
 };
 
 static BOOL should_ignore_filter(struct console_search_t *cs);
+static void compile_filter(struct console_search_t *cs);
 static BOOL is_match_at_index(struct console_search_t *cs, int index);
-static struct match_t *find_all_within(struct console_search_t *cs, int start, int end);
+static BOOL is_word_char(wchar_t ch);
+static BOOL is_whole_word(struct console_search_t *cs, int index, int length);
+static int get_line_end(struct console_search_t *cs, int index);
+static int find_pattern_match(struct console_search_t *cs, int start, int end, int *match_end);
+static int find_next_match(struct console_search_t *cs, int start, int end, int *length);
+static COORD index_to_position(struct console_search_t *cs, int index);
+static void refresh_stale_rows(struct console_search_t *cs, int start, int end);
+static void write_attributes_at(struct console_search_t *cs, int index, const WORD *attributes, int length);
+static void draw_match(struct console_search_t *cs, const struct match_t *match, BOOL current);
+static void restore_match(struct console_search_t *cs, const struct match_t *match);
+static void mark_dirty(struct console_search_t *cs, int start, int end);
+static BOOL find_changed_span(struct console_search_t *cs, int row, int *left, int *right);
+static void write_composed_attributes(struct console_search_t *cs, int start, int end);
+static void flush_attributes(struct console_search_t *cs);
+static BOOL allocate_composed_attributes(struct console_search_t *cs);
+static void free_composed_attributes(struct console_search_t *cs);
+static void reverse_matches(struct console_search_t *cs, int start, int end);
+static int find_matches(struct console_search_t *cs, int *next, int end);
+static void start_archive_search(struct console_search_t *cs);
+static BOOL continue_archive_search(struct console_search_t *cs);
+static BOOL is_search_complete(struct console_search_t *cs);
+static void choose_current_match(struct console_search_t *cs);
 static void find_all_at(struct console_search_t *cs, COORD pos);
-static void extended_filter(struct console_search_t *cs, int old_length);
-static void truncated_filter(struct console_search_t *cs, int old_length);
-static void reset_filter(struct console_search_t *cs, int old_length);
+static void continue_search(struct console_search_t *cs);
+static void continue_search_until_input(struct console_search_t *cs);
+static void extended_filter(struct console_search_t *cs);
+static void reset_filter(struct console_search_t *cs);
 
 static BOOL resize_filter_text(struct console_search_t *cs, int length);
 static BOOL raw_edit_filter_selection(struct console_search_t *cs, const wchar_t *ins, int ins_length);
@@ -82,6 +166,9 @@ static void set_filter_title(struct console_search_t *cs);
 static void goto_result(struct console_search_t *cs);
 static void goto_next_result(struct console_search_t *cs, BOOL forward);
 
+static void toggle_regex_mode(struct console_search_t *cs);
+static void toggle_whole_word(struct console_search_t *cs);
+
 static void copy_filter_selection_to_clipboard(struct console_search_t *cs);
 
 static BOOL start_search_mode(struct console_search_t *cs);
@@ -92,6 +179,15 @@ static BOOL search_mode_handle_mouse_event(struct console_search_t *cs, MOUSE_EV
 static BOOL run_search_mode(struct console_search_t *cs, INPUT_RECORD *event);
 static void finish_search_mode(struct console_search_t *cs);
 
+/* The cells_written of the last keystroke or other input event in this thread that did not end 
+   search mode */
+#ifdef __GNUC__
+static __thread
+#else
+static __declspec( thread )
+#endif
+int last_search_cells_written = 0;
+
 
 static BOOL should_ignore_filter(struct console_search_t *cs) {
   const wchar_t *s;
@@ -109,6 +205,40 @@ static BOOL should_ignore_filter(struct console_search_t *cs) {
   return TRUE;
 }
 
+/* In regex mode, compile the filter. Otherwise decide whether the filter can be searched in the 
+   folded screen and fold it. If not, every index is compared with CompareStringW().
+ */
+static void compile_filter(struct console_search_t *cs) {
+  assert(cs != NULL);
+  
+  console_pattern_free(cs->pattern);
+  cs->pattern = NULL;
+  cs->compare_folded = FALSE;
+  
+  if(cs->regex_mode) {
+    cs->pattern = console_pattern_compile(cs->filter_text, cs->filter_length);
+    return;
+  }
+  
+  if( !cs->folded_screen || 
+      cs->filter_length == 0 ||
+      !console_can_compare_folded(cs->filter_text, cs->filter_length))
+  {
+    return;
+  }
+  
+  if(!resize_array(
+        (void**)&cs->folded_filter,
+        &cs->folded_filter_capacity,
+        sizeof(cs->folded_filter[0]),
+        cs->filter_length))
+  {
+    return;
+  }
+  
+  cs->compare_folded = console_fold_case(cs->filter_text, cs->filter_length, cs->folded_filter);
+}
+
 static BOOL is_match_at_index(struct console_search_t *cs, int index) {
   int cmp;
   
@@ -126,6 +256,9 @@ static BOOL is_match_at_index(struct console_search_t *cs, int index) {
   if(index > cs->console_size.X * cs->console_size.Y - cs->filter_length)
     return FALSE;
   
+  if(cs->compare_folded)
+    return 0 == memcmp(cs->folded_screen + index, cs->folded_filter, cs->filter_length * sizeof(wchar_t));
+  
   cmp = CompareStringW(
     LOCALE_USER_DEFAULT, 
     LINGUISTIC_IGNORECASE, 
@@ -137,276 +270,840 @@ static BOOL is_match_at_index(struct console_search_t *cs, int index) {
   return (cmp == CSTR_EQUAL);
 }
 
-static struct match_t *find_all_within(struct console_search_t *cs, int start, int end) {
-  struct match_t *result = NULL;
+static BOOL is_word_char(wchar_t ch) {
+  return iswalnum(ch) || ch == L'_';
+}
+
+/* Whether the text at [index, index+length) neither starts nor ends inside a word.
+ */
+static BOOL is_whole_word(struct console_search_t *cs, int index, int length) {
+  int size;
   
   assert(cs != NULL);
-  assert(0 <= start);
-  assert(start <= end);
-  assert(end <= cs->console_size.X * cs->console_size.Y);
+  assert(cs->screen != NULL);
+  assert(0 <= index);
+  assert(length > 0);
+  
+  size = cs->console_size.X * cs->console_size.Y;
+  assert(index + length <= size);
+  
+  if(index > 0 && is_word_char(cs->screen[index - 1]) && is_word_char(cs->screen[index]))
+    return FALSE;
   
-  if(cs->filter_length == 0)
-    return NULL;
+  if(index + length < size && is_word_char(cs->screen[index + length - 1]) && is_word_char(cs->screen[index + length]))
+    return FALSE;
   
+  return TRUE;
+}
+
+/* Get the end of the line that contains the cell at index. A row whose last cell is used 
+   continues on the next row, like wrapped output. Other rows end in blank padding.
+ */
+static int get_line_end(struct console_search_t *cs, int index) {
+  int width;
+  int size;
+  int line_end;
+  
+  assert(cs != NULL);
+  assert(cs->screen != NULL);
+  
+  width = cs->console_size.X;
+  size = width * cs->console_size.Y;
+  line_end = (index / width + 1) * width;
+  while(line_end < size && cs->screen[line_end - 1] != L' ' && cs->screen[line_end - 1] != L'\0')
+    line_end += width;
+  
+  return line_end;
+}
+
+/* Find the first regex match starting in [start, end). Matches neither extend across line ends 
+   nor into the blank padding before them, otherwise patterns like "error.*" would run through 
+   all following rows.
+   
+   @param match_end Output parameter for the end of the match.
+   @return The index of the match or -1 if there is none.
+ */
+static int find_pattern_match(struct console_search_t *cs, int start, int end, int *match_end) {
+  const wchar_t *text;
+  
+  assert(cs != NULL);
+  assert(cs->pattern != NULL);
+  assert(match_end != NULL);
+  
+  text = cs->folded_screen ? cs->folded_screen : cs->screen;
   while(start < end) {
-    if(is_match_at_index(cs, start)) {
-      struct match_t *new_match = (struct match_t*)hyper_console_allocate_memory(sizeof(struct match_t));
+    int line_end = get_line_end(cs, start);
+    int text_end = line_end;
+    
+    while(text_end > start && (cs->screen[text_end - 1] == L' ' || cs->screen[text_end - 1] == L'\0'))
+      --text_end;
+    
+    if(start < text_end) {
+      int found = console_pattern_find(cs->pattern, text, text_end, start, MIN(end, text_end), match_end);
       
-      if(new_match) {
-        if(result) {
-          new_match->next = result;
-          new_match->prev = result->prev;
-          new_match->prev->next = new_match;
-          result->prev = new_match;
-        }
-        else{
-          result = new_match->prev = new_match->next = new_match;
-        }
+      if(found >= 0)
+        return found;
+    }
+    
+    start = line_end;
+  }
+  
+  return -1;
+}
+
+/* Find the first match starting in [start, end). It may extend beyond end.
+   
+   @param length Output parameter for the length of the match.
+   @return The index of the match or -1 if there is none.
+ */
+static int find_next_match(struct console_search_t *cs, int start, int end, int *length) {
+  int size;
+  
+  assert(cs != NULL);
+  assert(length != NULL);
+  
+  if(!cs->screen || cs->filter_length == 0)
+    return -1;
+  
+  size = cs->console_size.X * cs->console_size.Y;
+  
+  for(;start < end;++start) {
+    if(cs->regex_mode) {
+      int match_end;
+      
+      if(!cs->pattern)
+        return -1;
+      
+      start = find_pattern_match(cs, start, end, &match_end);
+      if(start < 0)
+        return -1;
+      
+      *length = match_end - start;
+    }
+    else {
+      if(cs->compare_folded) {
+        start = console_find_text(
+          cs->folded_screen, 
+          size, 
+          start, 
+          end, 
+          cs->folded_filter, 
+          cs->filter_length);
         
-        new_match->position.Y = (SHORT)(start / cs->console_size.X);
-        new_match->position.X = start % cs->console_size.X;
+        if(start < 0)
+          return -1;
+      }
+      else {
+        while(start < end && !is_match_at_index(cs, start))
+          ++start;
+        
+        if(start == end)
+          return -1;
       }
       
-      start+= cs->filter_length;
+      *length = cs->filter_length;
     }
-    else
-      ++start;
+    
+    if(!cs->whole_word || is_whole_word(cs, start, *length))
+      return start;
   }
   
-  return result;
+  return -1;
 }
 
-static void find_all_at(struct console_search_t *cs, COORD pos) {
-  int index;
-  struct match_t *above;
-  struct match_t *below;
+static COORD index_to_position(struct console_search_t *cs, int index) {
+  COORD pos;
+  
+  assert(cs != NULL);
+  assert(cs->console_size.X > 0);
+  
+  pos.Y = (SHORT)(index / cs->console_size.X);
+  pos.X = index % cs->console_size.X;
+  return pos;
+}
+
+/* Re-read the attributes of the stale rows that contain any of the cells [start, end), so 
+   that restoring a match does not bring back outdated colors. Highlights that are not 
+   written yet are kept.
+ */
+static void refresh_stale_rows(struct console_search_t *cs, int start, int end) {
+  int width = cs->console_size.X;
+  int row;
+  int last_row;
+  
+  assert(cs != NULL);
+  assert(0 <= start);
+  assert(start < end);
+  
+  row = start / width;
+  last_row = (end - 1) / width;
+  while(row <= last_row) {
+    WORD *live;
+    COORD pos;
+    DWORD read;
+    int run_end;
+    int i;
+    
+    if(!cs->stale_rows[row]) {
+      ++row;
+      continue;
+    }
+    
+    run_end = row + 1;
+    while(run_end <= last_row && cs->stale_rows[run_end])
+      ++run_end;
+    
+    // The screen still shows the snapshot's attributes there, so shadow_attributes is free.
+    live = cs->shadow_attributes ? cs->shadow_attributes : cs->attributes;
+    pos.X = 0;
+    pos.Y = (SHORT)row;
+    if(!console_read_output_attribute(cs->output_handle, live + row * width, (run_end - row) * width, pos, &read))
+      read = 0;
+    
+    for(i = row * width;i < row * width + (int)read;++i) {
+      if(cs->composed_attributes && cs->composed_attributes[i] == cs->attributes[i])
+        cs->composed_attributes[i] = live[i];
+      
+      cs->attributes[i] = live[i];
+    }
+    
+    memset(cs->stale_rows + row, 0, run_end - row);
+    row = run_end;
+  }
+}
+
+static void write_attributes_at(struct console_search_t *cs, int index, const WORD *attributes, int length) {
   DWORD written;
   
   assert(cs != NULL);
-  assert(pos.X >= 0);
-  assert(pos.Y >= 0);
+  assert(attributes != NULL);
+  assert(0 <= index);
+  assert(index + length <= cs->console_size.X * cs->console_size.Y);
+  
+  if(cs->composed_attributes) {
+    if(length > 0) {
+      memcpy(cs->composed_attributes + index, attributes, length * sizeof(WORD));
+      mark_dirty(cs, index, index + length);
+    }
+    return;
+  }
   
-  if(!cs->active)
+  if(length <= 0)
     return;
   
-  assert(cs->current_result == NULL);
+  refresh_stale_rows(cs, index, index + length);
+  console_write_output_attribute(
+    cs->output_handle, 
+    attributes, 
+    length,
+    index_to_position(cs, index),
+    &written);
   
-  if(cs->filter_length == 0 || should_ignore_filter(cs))
-    return;
-     
-  index = pos.Y * cs->console_size.X + pos.X;
-  above = find_all_within(cs, 0, index);
-  below = find_all_within(cs, index, cs->console_size.X * cs->console_size.Y);
+  cs->cells_written += length;
+}
+
+static void draw_match(struct console_search_t *cs, const struct match_t *match, BOOL current) {
+  WORD attr;
+  WORD *dst;
+  int i;
   
-  if(above && below) {
-    struct match_t *last_above = above->prev;
-    
-    below->prev->next = above;
-    above->prev = below->prev;
+  assert(cs != NULL);
+  assert(match != NULL);
+  assert(match->length > 0);
+  assert(match->index + match->length <= cs->console_size.X * cs->console_size.Y);
+  
+  // Draw into the composed plane directly, a temporary row is only needed for direct writes.
+  if(cs->composed_attributes) {
+    dst = cs->composed_attributes + match->index;
+  }
+  else {
+    if(!resize_array(
+        (void**)&cs->match_attributes,
+        &cs->match_attributes_capacity,
+        sizeof(cs->match_attributes[0]),
+        match->length))
+    {
+      return;
+    }
     
-    below->prev = last_above;
-    last_above->next = below;
+    dst = cs->match_attributes;
   }
-  else if(above)
-    below = above;
-  
-  if(below) {
-    if(below->position.X == pos.X && below->position.Y == pos.Y)
-      cs->current_result = below;
-    else 
-      cs->current_result = below->prev;
+  
+  attr = current ? cs->current_attr : cs->highlight_attr;
+  for(i = 0;i < match->length;++i)
+    dst[i] = attr;
+  
+  dst[0]                 |= COMMON_LVB_GRID_LVERTICAL;
+  dst[match->length - 1] |= COMMON_LVB_GRID_RVERTICAL;
+  
+  if(cs->composed_attributes)
+    mark_dirty(cs, match->index, match->index + match->length);
+  else
+    write_attributes_at(cs, match->index, dst, match->length);
+}
+
+static void restore_match(struct console_search_t *cs, const struct match_t *match) {
+  assert(cs != NULL);
+  assert(match != NULL);
+  
+  if(cs->attributes)
+    write_attributes_at(cs, match->index, cs->attributes + match->index, match->length);
+}
+
+static void mark_dirty(struct console_search_t *cs, int start, int end) {
+  int width;
+  int row;
+  int last_row;
+  
+  assert(cs != NULL);
+  assert(cs->dirty_left != NULL);
+  assert(cs->dirty_right != NULL);
+  assert(0 <= start);
+  assert(start < end);
+  
+  width = cs->console_size.X;
+  row = start / width;
+  last_row = (end - 1) / width;
+  
+  if(cs->dirty_top < cs->dirty_bottom) {
+    cs->dirty_top    = MIN(cs->dirty_top,    row);
+    cs->dirty_bottom = MAX(cs->dirty_bottom, last_row + 1);
+  }
+  else {
+    cs->dirty_top    = row;
+    cs->dirty_bottom = last_row + 1;
+  }
+  
+  for(;row <= last_row;++row) {
+    int left  = row == start / width ? start % width : 0;
+    int right = row == last_row ? (end - 1) % width : width - 1;
+    
+    cs->dirty_left[row]  = MIN(cs->dirty_left[row],  left);
+    cs->dirty_right[row] = MAX(cs->dirty_right[row], right);
   }
+}
+
+/* Get the range of dirty cells in a row that differ from what the shadow attributes say is on 
+   screen. The row is clean afterwards.
+ */
+static BOOL find_changed_span(struct console_search_t *cs, int row, int *left, int *right) {
+  const WORD *composed;
+  const WORD *shadow;
+  int l;
+  int r;
+  
+  assert(cs != NULL);
+  assert(left != NULL);
+  assert(right != NULL);
+  
+  composed = cs->composed_attributes + row * cs->console_size.X;
+  shadow   = cs->shadow_attributes   + row * cs->console_size.X;
+  
+  l = cs->dirty_left[row];
+  r = cs->dirty_right[row];
+  cs->dirty_left[row]  = cs->console_size.X;
+  cs->dirty_right[row] = -1;
+  
+  while(l <= r && composed[l] == shadow[l])
+    ++l;
+  
+  while(l <= r && composed[r] == shadow[r])
+    --r;
+  
+  if(l > r)
+    return FALSE;
+  
+  *left = l;
+  *right = r;
+  return TRUE;
+}
+
+static void write_composed_attributes(struct console_search_t *cs, int start, int end) {
+  DWORD written;
   
-  if(cs->current_result) {
-    struct match_t *tmp = cs->current_result->next;
+  assert(cs != NULL);
+  assert(0 <= start);
+  assert(start < end);
+  
+  refresh_stale_rows(cs, start, end);
+  console_write_output_attribute(
+    cs->output_handle,
+    cs->composed_attributes + start,
+    end - start,
+    index_to_position(cs, start),
+    &written);
+  
+  memcpy(
+    cs->shadow_attributes + start,
+    cs->composed_attributes + start,
+    (end - start) * sizeof(WORD));
+  
+  cs->cells_written += end - start;
+}
+
+// Changed cells close to each other are written with a single console_write_output_attribute() call.
+static void flush_attributes(struct console_search_t *cs) {
+  int run_start = -1;
+  int run_end = -1;
+  int row;
+  
+  assert(cs != NULL);
+  
+  if(!cs->composed_attributes || cs->dirty_top >= cs->dirty_bottom)
+    return;
+  
+  for(row = cs->dirty_top;row < cs->dirty_bottom;++row) {
+    int left;
+    int right;
+    int start;
+    
+    if(!find_changed_span(cs, row, &left, &right))
+      continue;
     
-    for(;tmp != cs->current_result;tmp = tmp->next) {
-      console_write_output_attribute(
-        cs->output_handle, 
-        cs->highlight_attributes, 
-        cs->filter_length,
-        tmp->position,
-        &written);
+    start = row * cs->console_size.X + left;
+    if(run_start >= 0 && start - run_end > FLUSH_MERGE_GAP) {
+      write_composed_attributes(cs, run_start, run_end);
+      run_start = -1;
     }
     
-    cs->last_result_pos = tmp->position;
+    if(run_start < 0)
+      run_start = start;
     
-    console_write_output_attribute(
-      cs->output_handle, 
-      cs->result_attributes, 
-      cs->filter_length,
-      tmp->position,
-      &written);
+    run_end = row * cs->console_size.X + right + 1;
   }
+  
+  if(run_start >= 0)
+    write_composed_attributes(cs, run_start, run_end);
+  
+  cs->dirty_top = cs->dirty_bottom = 0;
 }
 
-static void extended_filter(struct console_search_t *cs, int old_length) {
-  struct match_t *tmp;
-  struct match_t *prev;
-  DWORD written;
-  int index;
+/* Set up the composed and shadow attributes from the screen attributes.
+ */
+static BOOL allocate_composed_attributes(struct console_search_t *cs) {
+  int length;
+  int row;
   
   assert(cs != NULL);
+  assert(cs->attributes != NULL);
   
-  if(!cs->current_result)
-    return;
+  free_composed_attributes(cs);
   
-  tmp = cs->current_result->prev;
-  while(tmp != cs->current_result) {
-    index = tmp->position.Y * cs->console_size.X + tmp->position.X;
-    prev = tmp->prev;
-    
-    if(is_match_at_index(cs, index)) {
-      console_write_output_attribute(
-        cs->output_handle, 
-        cs->highlight_attributes, 
-        cs->filter_length,
-        tmp->position,
-        &written);
-      
-      tmp = prev;
+  length = cs->console_size.X * cs->console_size.Y;
+  cs->composed_attributes = hyper_console_allocate_memory(length * sizeof(WORD));
+  cs->shadow_attributes   = hyper_console_allocate_memory(length * sizeof(WORD));
+  cs->dirty_left          = hyper_console_allocate_memory(cs->console_size.Y * sizeof(int));
+  cs->dirty_right         = hyper_console_allocate_memory(cs->console_size.Y * sizeof(int));
+  if(!cs->composed_attributes || !cs->shadow_attributes || !cs->dirty_left || !cs->dirty_right) {
+    free_composed_attributes(cs);
+    return FALSE;
+  }
+  
+  memcpy(cs->composed_attributes, cs->attributes, length * sizeof(WORD));
+  memcpy(cs->shadow_attributes,   cs->attributes, length * sizeof(WORD));
+  for(row = 0;row < cs->console_size.Y;++row) {
+    cs->dirty_left[row]  = cs->console_size.X;
+    cs->dirty_right[row] = -1;
+  }
+  
+  return TRUE;
+}
+
+static void free_composed_attributes(struct console_search_t *cs) {
+  assert(cs != NULL);
+  
+  hyper_console_free_memory(cs->composed_attributes);
+  hyper_console_free_memory(cs->shadow_attributes);
+  hyper_console_free_memory(cs->dirty_left);
+  hyper_console_free_memory(cs->dirty_right);
+  cs->composed_attributes = NULL;
+  cs->shadow_attributes = NULL;
+  cs->dirty_left = NULL;
+  cs->dirty_right = NULL;
+  cs->dirty_top = cs->dirty_bottom = 0;
+}
+
+static void reverse_matches(struct console_search_t *cs, int start, int end) {
+  assert(cs != NULL);
+  assert(0 <= start);
+  assert(end <= cs->match_count);
+  
+  while(start + 1 < end) {
+    struct match_t tmp = cs->matches[start];
+    cs->matches[start] = cs->matches[end - 1];
+    cs->matches[end - 1] = tmp;
+    ++start;
+    --end;
+  }
+}
+
+/* Find non-overlapping matches in [*next, end) and append them to cs->matches.
+   Afterwards, *next is where the scan continues. This may lie behind end, if 
+   the last match crosses it.
+   
+   @return The number of new matches.
+ */
+static int find_matches(struct console_search_t *cs, int *next, int end) {
+  int start;
+  int old_count;
+  
+  assert(cs != NULL);
+  assert(next != NULL);
+  assert(0 <= *next);
+  assert(end <= cs->console_size.X * cs->console_size.Y);
+  
+  old_count = cs->match_count;
+  start = *next;
+  
+  if(cs->filter_length == 0) {
+    *next = MAX(start, end);
+    return 0;
+  }
+  
+  while(start < end) {
+    int length;
+    
+    start = find_next_match(cs, start, end, &length);
+    if(start < 0) {
+      start = end;
+      break;
     }
-    else {
-      console_write_output_attribute(
-        cs->output_handle, 
-        cs->attributes + index, 
-        old_length,
-        tmp->position,
-        &written);
-      
-      tmp->next->prev = prev;
-      prev->next = tmp->next;
-      
-      hyper_console_free_memory(tmp);
+    
+    if(resize_array(
+        (void**)&cs->matches,
+        &cs->match_capacity,
+        sizeof(cs->matches[0]),
+        cs->match_count + 1))
+    {
+      struct match_t *match = &cs->matches[cs->match_count++];
       
-      tmp = prev;
+      match->index = start;
+      match->length = length;
+      draw_match(cs, match, FALSE);
     }
+    
+    start+= length;
   }
   
-  index = tmp->position.Y * cs->console_size.X + tmp->position.X;
-  if(!is_match_at_index(cs, index)) {
-    console_write_output_attribute(
-      cs->output_handle, 
-      cs->attributes + index, 
-      old_length,
-      tmp->position,
-      &written);
-    
-    prev = tmp->prev;
+  *next = start;
+  return cs->match_count - old_count;
+}
+
+/* The archive stores folded lines without attributes, so only plain substring searches can 
+   use it.
+ */
+static void start_archive_search(struct console_search_t *cs) {
+  assert(cs != NULL);
+  
+  cs->archive_next_line   = cs->archive_end_line = 0;
+  cs->archive_match_count = 0;
+  
+  if(cs->regex_mode || cs->whole_word || !cs->compare_folded || cs->filter_length == 0)
+    return;
+  
+  hyperlink_system_get_archived_lines(&cs->archive_next_line, &cs->archive_end_line);
+}
+
+/* Count the matching lines in the next slice of the archive.
+   
+   @return Whether any were found.
+ */
+static BOOL continue_archive_search(struct console_search_t *cs) {
+  int stop;
+  int old_count;
+  
+  assert(cs != NULL);
+  
+  old_count = cs->archive_match_count;
+  stop = cs->archive_next_line + ARCHIVE_SLICE_LINES;
+  if(stop < cs->archive_next_line) // overflow
+    stop = cs->archive_end_line;
+  
+  while(cs->archive_next_line < MIN(stop, cs->archive_end_line)) {
+    int line = cs->archive_next_line;
     
-    if(prev != tmp) {
-      tmp->next->prev = prev;
-      prev->next = tmp->next;
+    if(hyperlink_system_find_archived_text(
+        &cs->archive_next_line, 
+        stop - line, 
+        cs->folded_filter, 
+        cs->filter_length) < 0)
+    {
+      if(cs->archive_next_line <= line)
+        cs->archive_next_line = cs->archive_end_line;
+      break;
     }
-    else 
-      prev = NULL;
     
-    hyper_console_free_memory(tmp);
-      
-    cs->current_result = prev;
+    ++cs->archive_match_count;
   }
   
-  if(cs->current_result) {
-    cs->last_result_pos = cs->current_result->position;
-    console_write_output_attribute(
-      cs->output_handle, 
-      cs->result_attributes, 
-      cs->filter_length,
-      cs->last_result_pos,
-      &written);
+  return cs->archive_match_count > old_count;
+}
+
+static BOOL is_search_complete(struct console_search_t *cs) {
+  assert(cs != NULL);
+  
+  return cs->scan_next >= cs->scan_end && 
+         cs->scan_above_next >= cs->scan_above_end && 
+         cs->archive_next_line >= cs->archive_end_line;
+}
+
+/* Pick the match at the search origin or else the last one before it (wrapping around).
+ */
+static void choose_current_match(struct console_search_t *cs) {
+  int lo = 0;
+  int hi = cs->match_count;
+  
+  assert(cs != NULL);
+  assert(cs->match_count > 0);
+  
+  while(lo < hi) {
+    int mid = lo + (hi - lo) / 2;
+    
+    if(cs->matches[mid].index < cs->search_origin)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
+  
+  if(lo < cs->match_count && cs->matches[lo].index == cs->search_origin)
+    cs->current_match = lo;
+  else if(lo > 0)
+    cs->current_match = lo - 1;
+  else
+    cs->current_match = cs->match_count - 1;
 }
 
-static void truncated_filter(struct console_search_t *cs, int old_length) {
-  COORD pos;
-  int new_length;
+/* Start a new search. Only the window rows are searched immediately. The remaining rows
+   are left to continue_search(): first below the window, then above it.
+ */
+static void find_all_at(struct console_search_t *cs, COORD pos) {
+  CONSOLE_SCREEN_BUFFER_INFO csbi;
+  int top;
+  int bottom;
   
   assert(cs != NULL);
+  assert(pos.X >= 0);
+  assert(pos.Y >= 0);
   
   if(!cs->active)
     return;
-    
-  new_length = cs->filter_length;
-  assert(new_length < old_length);
   
-  if(cs->current_result) {
-    struct match_t *current;
-    DWORD written;
-    COORD console_size = cs->console_size;
+  assert(cs->match_count == 0);
+  
+  cs->current_match     = 0;
+  cs->above_count       = 0;
+  cs->scan_next         = cs->scan_end = 0;
+  cs->scan_above_next   = cs->scan_above_end = 0;
+  cs->archive_next_line = cs->archive_end_line = 0;
+  cs->archive_match_count = 0;
+  cs->search_origin     = pos.Y * cs->console_size.X + pos.X;
+  cs->provisional_match = TRUE;
+  
+  if(cs->filter_length == 0 || should_ignore_filter(cs))
+    return;
+     
+  compile_filter(cs);
+  if(cs->regex_mode && !cs->pattern)
+    return;
+  
+  start_archive_search(cs);
+  
+  top = 0;
+  bottom = cs->console_size.Y;
+  if(console_backend->get_screen_buffer_info(cs->output_handle, &csbi)) {
+    top    = MAX(0,   MIN(csbi.srWindow.Top,        cs->console_size.Y));
+    bottom = MAX(top, MIN(csbi.srWindow.Bottom + 1, cs->console_size.Y));
+  }
+  
+  cs->scan_next      = top * cs->console_size.X;
+  cs->scan_end       = cs->console_size.X * cs->console_size.Y;
+  cs->scan_above_end = top * cs->console_size.X;
+  
+  find_matches(cs, &cs->scan_next, bottom * cs->console_size.X);
+  
+  if(cs->match_count > 0) {
+    choose_current_match(cs);
     
-    pos = cs->current_result->position;
+    cs->last_result_pos = index_to_position(cs, cs->matches[cs->current_match].index);
+    draw_match(cs, &cs->matches[cs->current_match], TRUE);
+  }
+}
+
+/* Search the next slice of the rows outside the window, or else of the scrollback archive.
+ */
+static void continue_search(struct console_search_t *cs) {
+  struct match_t old_current;
+  int found;
+  
+  assert(cs != NULL);
+  
+  old_current.index = -1;
+  old_current.length = 0;
+  if(cs->match_count > 0)
+    old_current = cs->matches[cs->current_match];
+  
+  if(cs->scan_next < cs->scan_end) {
+    found = find_matches(cs, &cs->scan_next, MIN(cs->scan_end, cs->scan_next + SEARCH_SLICE_LENGTH));
+  }
+  else if(cs->scan_above_next < cs->scan_above_end) {
+    int old_count = cs->match_count;
     
-    assert(cs->current_result->prev != NULL);
-    assert(cs->current_result->prev->next == cs->current_result);
-    assert(cs->current_result->next != NULL);
-    assert(cs->current_result->next->prev == cs->current_result);
+    found = find_matches(cs, &cs->scan_above_next, MIN(cs->scan_above_end, cs->scan_above_next + SEARCH_SLICE_LENGTH));
     
-    current = cs->current_result;
-    current->prev->next = NULL;
-    while(current) {
-      struct match_t *tmp = current;
-      COORD tmp_pos;
-      int index = new_length + current->position.Y * console_size.X + current->position.X;
-      
-      tmp_pos.Y = (SHORT)(index / console_size.X);
-      tmp_pos.X = index % console_size.X;
+    // Rotate the new matches in front of those from the window top onwards.
+    if(found > 0 && cs->above_count < old_count) {
+      reverse_matches(cs, cs->above_count, old_count);
+      reverse_matches(cs, old_count, cs->match_count);
+      reverse_matches(cs, cs->above_count, cs->match_count);
       
-      console_write_output_attribute(
-        cs->output_handle, 
-        cs->attributes + index, 
-        old_length - new_length,
-        tmp_pos,
-        &written);
-      
-      current = current->next;
-      
-      hyper_console_free_memory(tmp);
+      if(cs->current_match >= cs->above_count)
+        cs->current_match+= found;
     }
     
-    cs->current_result = NULL;
+    cs->above_count+= found;
+  }
+  else if(cs->archive_next_line < cs->archive_end_line) {
+    if(continue_archive_search(cs) || is_search_complete(cs))
+      set_filter_title(cs);
+    return;
   }
   else
-    pos = cs->last_result_pos;
+    return;
   
-  find_all_at(cs, pos);
+  if(found > 0) {
+    if(cs->provisional_match || old_current.index < 0)
+      choose_current_match(cs);
+    
+    if(cs->matches[cs->current_match].index != old_current.index) {
+      if(old_current.index >= 0)
+        draw_match(cs, &old_current, FALSE);
+      
+      cs->last_result_pos = index_to_position(cs, cs->matches[cs->current_match].index);
+      goto_result(cs);
+    }
+    
+    // A long match from above the window may overlap the current one.
+    draw_match(cs, &cs->matches[cs->current_match], TRUE);
+  }
+  
+  flush_attributes(cs);
+  
+  if(found > 0 || is_search_complete(cs))
+    set_filter_title(cs);
 }
 
-static void reset_filter(struct console_search_t *cs, int old_length) {
-  COORD pos;
+/* Continue searching in the background as long as no input is waiting.
+ */
+static void continue_search_until_input(struct console_search_t *cs) {
+  assert(cs != NULL);
+  
+  while(!is_search_complete(cs)) {
+    DWORD count;
+    
+    if(!console_backend->get_number_of_input_events(cs->input_handle, &count) || count > 0)
+      return;
+    
+    continue_search(cs);
+  }
+}
+
+/* Drop the matches that end with the new filter in place. The rest of the screen is 
+   searched with the new filter as usual. This only works for plain substring search.
+ */
+static void extended_filter(struct console_search_t *cs) {
+  int new_current = -1;
+  int kept = 0;
+  int kept_above = 0;
+  int kept_end = 0;
+  int i;
   
   assert(cs != NULL);
+  assert(!cs->regex_mode);
+  assert(!cs->whole_word);
+  
+  if(cs->match_count == 0)
+    return;
+  
+  compile_filter(cs);
+  start_archive_search(cs);
   
-  if(cs->current_result) {
-    struct match_t *current;
-    DWORD written;
-    COORD console_size = cs->console_size;
+  // Mark the dropped matches, including those that now overlap their predecessor.
+  for(i = 0;i < cs->match_count;++i) {
+    int index = cs->matches[i].index;
     
-    pos = cs->current_result->position;
+    if(i == cs->above_count)
+      kept_end = 0;
     
-    assert(cs->current_result->prev != NULL);
-    assert(cs->current_result->prev->next == cs->current_result);
-    assert(cs->current_result->next != NULL);
-    assert(cs->current_result->next->prev == cs->current_result);
+    if(index >= kept_end && is_match_at_index(cs, index))
+      kept_end = index + cs->filter_length;
+    else
+      cs->matches[i].index = ~index;
+  }
+  
+  // Backwards, so that restoring a dropped match cannot overwrite the highlight of its predecessor.
+  for(i = cs->match_count - 1;i >= 0;--i) {
+    struct match_t *match = &cs->matches[i];
     
-    current = cs->current_result;
-    current->prev->next = NULL;
-    while(current) {
-      struct match_t *tmp = current;
-      int index = current->position.Y * console_size.X + current->position.X;
-      
-      console_write_output_attribute(
-        cs->output_handle, 
-        cs->attributes + index, 
-        old_length,
-        current->position,
-        &written);
+    if(match->index < 0) {
+      match->index = ~match->index;
+      restore_match(cs, match);
+      match->length = 0;
+    }
+    else {
+      match->length = cs->filter_length;
+      if(i != cs->current_match)
+        draw_match(cs, match, FALSE);
+    }
+  }
+  
+  for(i = 0;i < cs->match_count;++i) {
+    if(cs->matches[i].length > 0) {
+      if(i == cs->current_match)
+        new_current = kept;
       
-      current = current->next;
+      if(i < cs->above_count)
+        ++kept_above;
       
-      hyper_console_free_memory(tmp);
+      cs->matches[kept++] = cs->matches[i];
     }
+    else if(i == cs->current_match)
+      new_current = kept - 1;
+  }
+  
+  cs->match_count = kept;
+  cs->above_count = kept_above;
+  cs->current_match = 0;
+  
+  if(kept == 0)
+    return;
+  
+  // The longer matches must not overlap those found next.
+  if(kept_above > 0)
+    cs->scan_above_next = MAX(cs->scan_above_next, cs->matches[kept_above - 1].index + cs->filter_length);
+  
+  if(kept > kept_above)
+    cs->scan_next = MAX(cs->scan_next, cs->matches[kept - 1].index + cs->filter_length);
+  
+  cs->current_match = new_current >= 0 ? new_current : kept - 1;
+  cs->last_result_pos = index_to_position(cs, cs->matches[cs->current_match].index);
+  draw_match(cs, &cs->matches[cs->current_match], TRUE);
+}
+
+/* Restore all highlighted matches and start over. This also cancels the background search.
+ */
+static void reset_filter(struct console_search_t *cs) {
+  COORD pos;
+  int i;
+  
+  assert(cs != NULL);
+  
+  if(cs->match_count > 0) {
+    pos = index_to_position(cs, cs->matches[cs->current_match].index);
+    
+    for(i = 0;i < cs->match_count;++i) 
+      restore_match(cs, &cs->matches[i]);
     
-    cs->current_result = NULL;
+    cs->match_count = 0;
   }
   else
     pos = cs->last_result_pos;
@@ -415,8 +1112,6 @@ static void reset_filter(struct console_search_t *cs, int old_length) {
 }
 
 static BOOL resize_filter_text(struct console_search_t *cs, int length) {
-  int i;
-  
   assert(cs != NULL);
     
   if(!resize_array(
@@ -429,44 +1124,9 @@ static BOOL resize_filter_text(struct console_search_t *cs, int length) {
     return FALSE;
   }
   
-  if(!resize_array(
-        (void**)&cs->highlight_attributes,
-        &cs->highlight_attributes_capacity,
-        sizeof(cs->highlight_attributes[0]),
-        length))
-  {
-    cs->filter_length = 0;
-    return FALSE;
-  }
-  
-  if(!resize_array(
-        (void**)&cs->result_attributes,
-        &cs->result_attributes_capacity,
-        sizeof(cs->result_attributes[0]),
-        length))
-  {
-    cs->filter_length = 0;
-    return FALSE;
-  }
-  
   cs->filter_text[length] = L'\0';
   cs->filter_length = length;
   
-  if(length > 0){
-    for(i = 0;i < length;++i)
-      cs->highlight_attributes[i] = cs->highlight_attr;
-    
-    cs->highlight_attributes[0]        |= COMMON_LVB_GRID_LVERTICAL;
-    cs->highlight_attributes[length-1] |= COMMON_LVB_GRID_RVERTICAL;
-    
-    
-    for(i = 0;i < length;++i)
-      cs->result_attributes[i] = cs->current_attr;
-    
-    cs->result_attributes[0]        |= COMMON_LVB_GRID_LVERTICAL;
-    cs->result_attributes[length-1] |= COMMON_LVB_GRID_RVERTICAL;
-  }
-  
   return TRUE;
 }
 
@@ -530,11 +1190,11 @@ static BOOL add_filter_char(struct console_search_t *cs, wchar_t ch) {
   
   cs->filter_anchor = cs->filter_pos;
   
-  if(cs->current_result && append_only) {
-    extended_filter(cs, old_length);
+  if(cs->match_count > 0 && append_only && !cs->regex_mode && !cs->whole_word) {
+    extended_filter(cs);
   }
   else {
-    reset_filter(cs, old_length);
+    reset_filter(cs);
   }
   
   update_filter_selection(cs);
@@ -559,12 +1219,7 @@ static BOOL remove_filter_selection(struct console_search_t *cs) {
   if(!raw_edit_filter_selection(cs, NULL, 0))
     return FALSE;
   
-  if(cs->filter_pos == cs->filter_length) {
-    truncated_filter(cs, old_length);
-  }
-  else {
-    reset_filter(cs, old_length);
-  }
+  reset_filter(cs);
   
   update_filter_selection(cs);
   
@@ -648,7 +1303,15 @@ static void set_filter_title(struct console_search_t *cs) {
   if(!cs->oritinal_title)
     return;
   
-  s = append_text(s, end, L"Find ", NULL);
+  if(cs->regex_mode && cs->whole_word)
+    s = append_text(s, end, L"Find (regex, word) ", NULL);
+  else if(cs->regex_mode)
+    s = append_text(s, end, L"Find (regex) ", NULL);
+  else if(cs->whole_word)
+    s = append_text(s, end, L"Find (word) ", NULL);
+  else
+    s = append_text(s, end, L"Find ", NULL);
+  
   if(cs->filter_text) {
     int sel_start = MIN(cs->filter_pos, cs->filter_anchor);
     int sel_end   = MAX(cs->filter_pos, cs->filter_anchor);
@@ -666,10 +1329,37 @@ static void set_filter_title(struct console_search_t *cs) {
     }
     
     s = append_text(s, end, cs->filter_text + sel_end, cs->filter_text + cs->filter_length);
+
+    if(cs->active && cs->filter_length > 0 && !should_ignore_filter(cs)) {
+      if(cs->regex_mode && !cs->pattern)
+        s = append_text(s, end, L"   (invalid pattern)", NULL);
+      else if(cs->match_count > 0) {
+        wchar_t count[64];
+        
+        StringCbPrintfW(
+          count,
+          sizeof(count),
+          is_search_complete(cs) ? L"   (%d of %d)" : L"   (%d of %d, searching...)",
+          cs->current_match + 1,
+          cs->match_count);
+        s = append_text(s, end, count, NULL);
+      }
+      else if(is_search_complete(cs))
+        s = append_text(s, end, L"   (no matches)", NULL);
+      else
+        s = append_text(s, end, L"   (searching...)", NULL);
+      
+      if(cs->archive_match_count > 0) {
+        wchar_t count[64];
+        
+        StringCbPrintfW(count, sizeof(count), L"   (+%d archived lines)", cs->archive_match_count);
+        s = append_text(s, end, count, NULL);
+      }
+    }
   }
   *s = L'\0';
   
-  SetConsoleTitleW(text);
+  console_backend->set_title(text);
 }
 
 static void goto_result(struct console_search_t *cs) {
@@ -678,8 +1368,8 @@ static void goto_result(struct console_search_t *cs) {
   assert(cs != NULL);
   
   pos = cs->last_result_pos;
-  if(cs->current_result) {
-    int index = MIN(cs->filter_pos, cs->filter_anchor);
+  if(cs->match_count > 0 && !cs->regex_mode) {
+    int index = MIN(MIN(cs->filter_pos, cs->filter_anchor), cs->matches[cs->current_match].length);
     if(index > 0) {
       index += pos.Y * cs->console_size.X + pos.X;
       pos.Y = (SHORT)(index / cs->console_size.X);
@@ -687,34 +1377,25 @@ static void goto_result(struct console_search_t *cs) {
     }
   }
   
-  SetConsoleCursorPosition(cs->output_handle, pos);
+  console_backend->set_cursor_position(cs->output_handle, pos);
 }
 
 static void goto_next_result(struct console_search_t *cs, BOOL forward) {
-  struct match_t *result;
-  DWORD written;
-  
   assert(cs != NULL);
   
-  result = cs->current_result;
-  if(result && result->prev != result) {
-    console_write_output_attribute(
-      cs->output_handle,
-      cs->highlight_attributes,
-      cs->filter_length,
-      result->position,
-      &written);
-    
-    result = forward ? result->next : result->prev;
-    console_write_output_attribute(
-      cs->output_handle,
-      cs->result_attributes,
-      cs->filter_length,
-      result->position,
-      &written);
-    
-    cs->current_result = result;
-    cs->last_result_pos = result->position;
+  if(cs->match_count > 1) {
+    draw_match(cs, &cs->matches[cs->current_match], FALSE);
+    
+    if(forward)
+      cs->current_match = cs->current_match + 1 < cs->match_count ? cs->current_match + 1 : 0;
+    else
+      cs->current_match = cs->current_match > 0 ? cs->current_match - 1 : cs->match_count - 1;
+    
+    draw_match(cs, &cs->matches[cs->current_match], TRUE);
+    
+    cs->provisional_match = FALSE;
+    cs->last_result_pos = index_to_position(cs, cs->matches[cs->current_match].index);
+    set_filter_title(cs);
     goto_result(cs);
   }
   else {
@@ -722,6 +1403,21 @@ static void goto_next_result(struct console_search_t *cs, BOOL forward) {
   }
 }
 
+static void toggle_regex_mode(struct console_search_t *cs) {
+  assert(cs != NULL);
+  
+  cs->regex_mode = !cs->regex_mode;
+  reset_filter(cs);
+  update_filter_selection(cs);
+}
+
+static void toggle_whole_word(struct console_search_t *cs) {
+  assert(cs != NULL);
+  
+  cs->whole_word = !cs->whole_word;
+  reset_filter(cs);
+  update_filter_selection(cs);
+}
 
 static void copy_filter_selection_to_clipboard(struct console_search_t *cs) {
   int start;
@@ -758,56 +1454,63 @@ static void copy_filter_selection_to_clipboard(struct console_search_t *cs) {
 
 
 static BOOL start_search_mode(struct console_search_t *cs) {
-  CONSOLE_SCREEN_BUFFER_INFO csbi;
+  const struct console_snapshot_t *snapshot;
   CONSOLE_CURSOR_INFO cci;
   
   assert(cs != NULL);
   
-  if(GetConsoleScreenBufferInfo(cs->output_handle, &csbi)) {
-    COORD pos;
-    DWORD read;
+  // Re-entering search mode only re-reads the rows that changed in between.
+  snapshot = console_borrow_snapshot(cs->output_handle);
+  if(snapshot) {
     DWORD length;
     
-    pos.X = pos.Y = 0;
-    
-    cs->console_size = csbi.dwSize;
+    cs->console_size = snapshot->size;
     
-    read = 0;
-    length = csbi.dwSize.X * csbi.dwSize.Y;
+    length = snapshot->size.X * snapshot->size.Y;
     
     hyper_console_free_memory(cs->screen);
-    cs->screen = hyper_console_allocate_memory(length * sizeof(wchar_t));
-    if( !cs->screen || 
-        !console_read_output_character(cs->output_handle, cs->screen, length, pos, &read) ||
-        read != length) 
-    {
-      hyper_console_free_memory(cs->screen);
-      cs->screen = NULL;
-      return FALSE;
-    }
-    
-    read = 0;
     hyper_console_free_memory(cs->attributes);
+    hyper_console_free_memory(cs->stale_rows);
+    cs->screen     = hyper_console_allocate_memory(length * sizeof(wchar_t));
     cs->attributes = hyper_console_allocate_memory(length * sizeof(WORD));
-    if( !cs->attributes || 
-        !console_read_output_attribute(cs->output_handle, cs->attributes, length, pos, &read) ||
-        read != length) 
-    {
+    cs->stale_rows = hyper_console_allocate_memory(snapshot->size.Y);
+    if(!cs->screen || !cs->attributes || !cs->stale_rows) {
+      console_return_snapshot(snapshot);
+    
       hyper_console_free_memory(cs->screen);
       cs->screen = NULL;
       
       hyper_console_free_memory(cs->attributes);
       cs->attributes = NULL;
+      
+      hyper_console_free_memory(cs->stale_rows);
+      cs->stale_rows = NULL;
       return FALSE;
     }
     
+    memcpy(cs->screen,     snapshot->text,       length * sizeof(wchar_t));
+    memcpy(cs->attributes, snapshot->attributes, length * sizeof(WORD));
+    memcpy(cs->stale_rows, snapshot->stale_rows, snapshot->size.Y);
+    console_return_snapshot(snapshot);
+    
+    // Without these copies, every highlight is written on its own.
+    allocate_composed_attributes(cs);
+    
+    // Searching without the folded copy is slower, but still works.
+    hyper_console_free_memory(cs->folded_screen);
+    cs->folded_screen = hyper_console_allocate_memory(length * sizeof(wchar_t));
+    if(cs->folded_screen && !console_fold_case(cs->screen, (int)length, cs->folded_screen)) {
+      hyper_console_free_memory(cs->folded_screen);
+      cs->folded_screen = NULL;
+    }
+    
     cs->active = TRUE;
   }
   
   if(cs->oritinal_title == NULL) {
     cs->oritinal_title = hyper_console_allocate_memory(sizeof(wchar_t) * 256);
     if(cs->oritinal_title) {
-      GetConsoleTitleW(cs->oritinal_title, 256);
+      console_backend->get_title(cs->oritinal_title, 256);
     }
   }
   
@@ -815,7 +1518,7 @@ static BOOL start_search_mode(struct console_search_t *cs) {
   
   cci.bVisible = TRUE;
   cci.dwSize = 100;
-  SetConsoleCursorInfo(cs->output_handle, &cci);
+  console_backend->set_cursor_info(cs->output_handle, &cci);
     
   return TRUE;
 }
@@ -962,6 +1665,24 @@ static BOOL search_mode_handle_key_event(struct console_search_t *cs, KEY_EVENT_
         }
         break;
         
+      case 'R': // Alt+R
+        if( (er->dwControlKeyState & (LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED)) &&
+           !(er->dwControlKeyState & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)))
+        {
+          toggle_regex_mode(cs);
+          return TRUE;
+        }
+        break;
+        
+      case 'W': // Alt+W
+        if( (er->dwControlKeyState & (LEFT_ALT_PRESSED | RIGHT_ALT_PRESSED)) &&
+           !(er->dwControlKeyState & (LEFT_CTRL_PRESSED | RIGHT_CTRL_PRESSED)))
+        {
+          toggle_whole_word(cs);
+          return TRUE;
+        }
+        break;
+        
       case VK_RETURN:
       case VK_F3:
         goto_next_result(cs, er->dwControlKeyState & SHIFT_PRESSED);
@@ -1044,11 +1765,24 @@ static BOOL run_search_mode(struct console_search_t *cs, INPUT_RECORD *event) {
         break;
     }
     
+    flush_attributes(cs);
+    
     if(!cs->active || cs->stop)
       return TRUE;
-      
-    if(!ReadConsoleInputW(cs->input_handle, event, 1, &num_read) || num_read < 1)
+    
+    // The background search and restoring the screen at the end do not count.
+    last_search_cells_written = cs->cells_written;
+    
+    continue_search_until_input(cs);
+    
+    if(!console_backend->read_input(cs->input_handle, event, 1, &num_read) || num_read < 1)
       return TRUE;
+    
+    // A key release belongs to the keystroke before it.
+    if(event->EventType == KEY_EVENT && !event->Event.KeyEvent.bKeyDown)
+      cs->cells_written = last_search_cells_written;
+    else
+      cs->cells_written = 0;
   };
 }
 
@@ -1059,62 +1793,78 @@ static void finish_search_mode(struct console_search_t *cs) {
   assert(cs != NULL);
   
   if(cs->oritinal_title) {
-    SetConsoleTitleW(cs->oritinal_title);
+    console_backend->set_title(cs->oritinal_title);
     
     hyper_console_free_memory(cs->oritinal_title);
     cs->oritinal_title = NULL;
   }
   
-  if(cs->attributes) {
-    COORD pos;
-    DWORD length = cs->console_size.X * cs->console_size.Y;
-    DWORD written;
-    pos.X = 0;
-    pos.Y = 0;
-    console_write_output_attribute(cs->output_handle, cs->attributes, length, pos, &written);
+  if(cs->composed_attributes) {
+    int length = cs->console_size.X * cs->console_size.Y;
+    
+    memcpy(cs->composed_attributes, cs->attributes, length * sizeof(WORD));
+    mark_dirty(cs, 0, length);
+    flush_attributes(cs);
+  }
+  else if(cs->attributes) {
+    int width = cs->console_size.X;
+    int row = 0;
+    
+    // Stale rows were never written.
+    while(row < cs->console_size.Y) {
+      int run_end;
+      
+      if(cs->stale_rows[row]) {
+        ++row;
+        continue;
+      }
+      
+      run_end = row + 1;
+      while(run_end < cs->console_size.Y && !cs->stale_rows[run_end])
+        ++run_end;
+      
+      write_attributes_at(cs, row * width, cs->attributes + row * width, (run_end - row) * width);
+      row = run_end;
+    }
   }
   
   hyper_console_free_memory(cs->screen);
+  hyper_console_free_memory(cs->folded_screen);
   hyper_console_free_memory(cs->attributes);
+  hyper_console_free_memory(cs->stale_rows);
+  free_composed_attributes(cs);
   
-  hyper_console_free_memory(cs->highlight_attributes);
-  hyper_console_free_memory(cs->result_attributes);
+  hyper_console_free_memory(cs->match_attributes);
+  console_pattern_free(cs->pattern);
   hyper_console_free_memory(cs->filter_text);
+  hyper_console_free_memory(cs->folded_filter);
   
-  if(cs->current_result) {
-    assert(cs->current_result->prev != NULL);
-    assert(cs->current_result->prev->next == cs->current_result);
-    assert(cs->current_result->next != NULL);
-    assert(cs->current_result->next->prev == cs->current_result);
-    
-    cs->current_result->prev->next = NULL;
-    while(cs->current_result) {
-      struct match_t *tmp = cs->current_result;
-      
-      cs->current_result = tmp->next;
-      
-      hyper_console_free_memory(tmp);
-    }
-  }
+  hyper_console_free_memory(cs->matches);
+  cs->matches = NULL;
+  cs->match_count = 0;
   
-  if(GetConsoleScreenBufferInfo(cs->output_handle, &csbi)) {
+  if(console_backend->get_screen_buffer_info(cs->output_handle, &csbi)) {
     COORD pos = cs->original_pos;
     
     if(csbi.dwCursorPosition.X != pos.X || csbi.dwCursorPosition.Y != pos.Y) {
-      SetConsoleCursorPosition(cs->output_handle, pos);
+      console_backend->set_cursor_position(cs->output_handle, pos);
       
       if(cs->dont_follow_cursor)
-        SetConsoleWindowInfo(cs->output_handle, TRUE, &csbi.srWindow);
+        console_backend->set_window_info(cs->output_handle, TRUE, &csbi.srWindow);
     }
   }
   
   cci = cs->original_cursor;
-  GetConsoleCursorInfo(cs->output_handle, &cci);
+  console_backend->get_cursor_info(cs->output_handle, &cci);
   if(0 != memcmp(&cci, &cs->original_cursor, sizeof(cci))) {
-    SetConsoleCursorInfo(cs->output_handle, &cs->original_cursor);
+    console_backend->set_cursor_info(cs->output_handle, &cs->original_cursor);
   }
 }
 
+int console_get_search_cells_written(void) {
+  return last_search_cells_written;
+}
+
 BOOL console_handle_search_mode(HANDLE hConsoleInput, HANDLE hConsoleOutput, INPUT_RECORD *event, const wchar_t *filter) {
   CONSOLE_SCREEN_BUFFER_INFO csbi;
   struct console_search_t cs[1];
@@ -1128,10 +1878,10 @@ BOOL console_handle_search_mode(HANDLE hConsoleInput, HANDLE hConsoleOutput, INP
   cs->highlight_attr = BACKGROUND_INTENSITY | BACKGROUND_RED | BACKGROUND_GREEN | COMMON_LVB_UNDERSCORE | COMMON_LVB_GRID_HORIZONTAL;
   cs->current_attr   = BACKGROUND_INTENSITY | BACKGROUND_RED | FOREGROUND_INTENSITY | FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | COMMON_LVB_UNDERSCORE | COMMON_LVB_GRID_HORIZONTAL;
   
-  if(!GetConsoleScreenBufferInfo(hConsoleOutput, &csbi))
+  if(!console_backend->get_screen_buffer_info(hConsoleOutput, &csbi))
     return FALSE;
     
-  if(!GetConsoleCursorInfo(hConsoleOutput, &cs->original_cursor))
+  if(!console_backend->get_cursor_info(hConsoleOutput, &cs->original_cursor))
     return FALSE;
     
   cs->console_size    = csbi.dwSize;
@@ -1148,8 +1898,9 @@ BOOL console_handle_search_mode(HANDLE hConsoleInput, HANDLE hConsoleOutput, INP
       cs->filter_pos = length;
     }
     
-    reset_filter(cs, 0);
+    reset_filter(cs);
     update_filter_selection(cs);
+    flush_attributes(cs);
   }
   
   result = run_search_mode(cs, event);
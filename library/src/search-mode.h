@@ -5,4 +5,9 @@
 
 BOOL console_handle_search_mode(HANDLE hConsoleInput, HANDLE hConsoleOutput, INPUT_RECORD *event, const wchar_t *filter);
 
+/* Get the number of cells that search mode wrote for its last keystroke in this thread, not 
+   counting the background search and the input event that ended it.
+ */
+int console_get_search_cells_written(void);
+
 #endif // __CONSOLE__SEARCH_MODE_H__
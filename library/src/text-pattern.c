@@ -0,0 +1,597 @@
+#include <hyper-console.h>
+
+#include "text-pattern.h"
+#include "text-search.h"
+#include "memory-util.h"
+
+#include <assert.h>
+#include <string.h>
+#include <wctype.h>
+
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+static int count_trailing_zeros(ULONGLONG mask) {
+  unsigned long index;
+  if(_BitScanForward(&index, (unsigned long)mask))
+    return (int)index;
+
+  _BitScanForward(&index, (unsigned long)(mask >> 32));
+  return 32 + (int)index;
+}
+#else
+#  define count_trailing_zeros(MASK)  __builtin_ctzll(MASK)
+#endif
+
+#define BIT(INDEX)  (((ULONGLONG)1) << (INDEX))
+
+#define MAX_POSITIONS    64
+#define MAX_DEPTH        64
+#define MASK_TABLE_SIZE  256
+
+#define CLASS_ANY        0x01
+#define CLASS_DIGIT      0x02
+#define CLASS_NOT_DIGIT  0x04
+#define CLASS_WORD       0x08
+#define CLASS_NOT_WORD   0x10
+#define CLASS_SPACE      0x20
+#define CLASS_NOT_SPACE  0x40
+#define CLASS_NEGATED    0x80
+
+struct char_range_t {
+  wchar_t first;
+  wchar_t last;
+};
+
+/* The characters that a position of the pattern accepts: all characters with one of the flags
+   or in one of the ranges, or in none of them if CLASS_NEGATED is set.
+ */
+struct char_class_t {
+  int first_range;
+  int range_count;
+  unsigned flags;
+};
+
+struct console_pattern_t {
+  int position_count;
+  struct char_class_t classes[MAX_POSITIONS];
+  ULONGLONG follow[MAX_POSITIONS]; // the positions that may come after each position
+  ULONGLONG first;                 // the positions that may start a match
+  ULONGLONG last;                  // the positions that may end a match
+
+  ULONGLONG masks[MASK_TABLE_SIZE]; // the positions that accept each of the first characters
+
+  struct char_range_t *ranges;
+  int range_count;
+  int range_capacity;
+};
+
+/* The Glushkov sets of a subexpression. */
+struct fragment_t {
+  ULONGLONG first;
+  ULONGLONG last;
+  BOOL nullable;
+};
+
+struct parser_t {
+  struct console_pattern_t *pattern;
+  const wchar_t *s;
+  const wchar_t *end;
+  int depth;
+  BOOL error;
+};
+
+static BOOL is_word_char(wchar_t ch);
+static BOOL class_contains(const struct console_pattern_t *pattern, const struct char_class_t *cls, wchar_t ch);
+static ULONGLONG get_char_mask(const struct console_pattern_t *pattern, wchar_t ch);
+static void add_follow(struct console_pattern_t *pattern, ULONGLONG from, ULONGLONG to);
+
+static BOOL add_range(struct parser_t *p, wchar_t first, wchar_t last);
+static BOOL add_literal(struct parser_t *p, wchar_t ch);
+static struct fragment_t new_position(struct parser_t *p, const struct char_class_t *cls);
+
+static BOOL parse_escape(struct parser_t *p, struct char_class_t *cls);
+static BOOL parse_class(struct parser_t *p, struct char_class_t *cls);
+static struct fragment_t parse_atom(struct parser_t *p);
+static struct fragment_t parse_repetition(struct parser_t *p);
+static struct fragment_t parse_concatenation(struct parser_t *p);
+static struct fragment_t parse_alternation(struct parser_t *p);
+
+
+static BOOL is_word_char(wchar_t ch) {
+  return iswalnum(ch) || ch == L'_';
+}
+
+static BOOL class_contains(const struct console_pattern_t *pattern, const struct char_class_t *cls, wchar_t ch) {
+  BOOL result = FALSE;
+  int i;
+
+  assert(pattern != NULL);
+  assert(cls != NULL);
+
+  if(cls->flags & CLASS_ANY)
+    result = TRUE;
+  else if((cls->flags & CLASS_DIGIT) && iswdigit(ch))
+    result = TRUE;
+  else if((cls->flags & CLASS_NOT_DIGIT) && !iswdigit(ch))
+    result = TRUE;
+  else if((cls->flags & CLASS_WORD) && is_word_char(ch))
+    result = TRUE;
+  else if((cls->flags & CLASS_NOT_WORD) && !is_word_char(ch))
+    result = TRUE;
+  else if((cls->flags & CLASS_SPACE) && iswspace(ch))
+    result = TRUE;
+  else if((cls->flags & CLASS_NOT_SPACE) && !iswspace(ch))
+    result = TRUE;
+
+  for(i = 0;!result && i < cls->range_count;++i) {
+    const struct char_range_t *range = &pattern->ranges[cls->first_range + i];
+
+    if(range->first <= ch && ch <= range->last)
+      result = TRUE;
+  }
+
+  return (cls->flags & CLASS_NEGATED) ? !result : result;
+}
+
+static ULONGLONG get_char_mask(const struct console_pattern_t *pattern, wchar_t ch) {
+  ULONGLONG mask = 0;
+  int i;
+
+  assert(pattern != NULL);
+
+  if((unsigned)ch < MASK_TABLE_SIZE)
+    return pattern->masks[(unsigned)ch];
+
+  for(i = 0;i < pattern->position_count;++i) {
+    if(class_contains(pattern, &pattern->classes[i], ch))
+      mask|= BIT(i);
+  }
+
+  return mask;
+}
+
+static void add_follow(struct console_pattern_t *pattern, ULONGLONG from, ULONGLONG to) {
+  assert(pattern != NULL);
+
+  for(;from;from &= from - 1)
+    pattern->follow[count_trailing_zeros(from)]|= to;
+}
+
+// Add a range to the class that is being parsed. Capital ASCII letters also get their lower case.
+static BOOL add_range(struct parser_t *p, wchar_t first, wchar_t last) {
+  struct console_pattern_t *pattern;
+
+  assert(p != NULL);
+
+  pattern = p->pattern;
+  if(first > last) {
+    p->error = TRUE;
+    return FALSE;
+  }
+
+  if(!resize_array(
+        (void**)&pattern->ranges,
+        &pattern->range_capacity,
+        sizeof(pattern->ranges[0]),
+        pattern->range_count + 2))
+  {
+    p->error = TRUE;
+    return FALSE;
+  }
+
+  pattern->ranges[pattern->range_count].first = first;
+  pattern->ranges[pattern->range_count].last  = last;
+  pattern->range_count++;
+
+  if(first <= L'Z' && last >= L'A') {
+    pattern->ranges[pattern->range_count].first = (first < L'A' ? L'A' : first) - L'A' + L'a';
+    pattern->ranges[pattern->range_count].last  = (last  > L'Z' ? L'Z' : last)  - L'A' + L'a';
+    pattern->range_count++;
+  }
+
+  return TRUE;
+}
+
+static BOOL add_literal(struct parser_t *p, wchar_t ch) {
+  wchar_t folded;
+
+  assert(p != NULL);
+
+  if(!console_fold_case(&ch, 1, &folded))
+    folded = ch;
+
+  return add_range(p, folded, folded);
+}
+
+static struct fragment_t new_position(struct parser_t *p, const struct char_class_t *cls) {
+  struct fragment_t result;
+  struct console_pattern_t *pattern;
+
+  assert(p != NULL);
+  assert(cls != NULL);
+
+  pattern = p->pattern;
+  memset(&result, 0, sizeof(result));
+
+  if(pattern->position_count == MAX_POSITIONS) {
+    p->error = TRUE;
+    return result;
+  }
+
+  pattern->classes[pattern->position_count] = *cls;
+  result.first = result.last = BIT(pattern->position_count);
+  pattern->position_count++;
+  return result;
+}
+
+/* Parse the escape after a backslash.
+ */
+static BOOL parse_escape(struct parser_t *p, struct char_class_t *cls) {
+  wchar_t ch;
+
+  assert(p != NULL);
+  assert(cls != NULL);
+
+  if(p->s == p->end) {
+    p->error = TRUE;
+    return FALSE;
+  }
+
+  ch = *p->s++;
+  switch(ch) {
+    case L'd': cls->flags|= CLASS_DIGIT;     return TRUE;
+    case L'D': cls->flags|= CLASS_NOT_DIGIT; return TRUE;
+    case L'w': cls->flags|= CLASS_WORD;      return TRUE;
+    case L'W': cls->flags|= CLASS_NOT_WORD;  return TRUE;
+    case L's': cls->flags|= CLASS_SPACE;     return TRUE;
+    case L'S': cls->flags|= CLASS_NOT_SPACE; return TRUE;
+    case L't': return add_range(p, L'\t', L'\t');
+  }
+
+  if(iswalnum(ch)) {
+    p->error = TRUE;
+    return FALSE;
+  }
+
+  return add_literal(p, ch);
+}
+
+/* Parse a class after the opening [.
+ */
+static BOOL parse_class(struct parser_t *p, struct char_class_t *cls) {
+  BOOL first = TRUE;
+
+  assert(p != NULL);
+  assert(cls != NULL);
+
+  if(p->s != p->end && *p->s == L'^') {
+    cls->flags|= CLASS_NEGATED;
+    ++p->s;
+  }
+
+  for(;;) {
+    wchar_t lo;
+    wchar_t hi;
+
+    if(p->s == p->end) {
+      p->error = TRUE;
+      return FALSE;
+    }
+
+    lo = *p->s++;
+    if(lo == L']' && !first)
+      return TRUE;
+
+    first = FALSE;
+    if(lo == L'\\') {
+      if(p->s != p->end && !iswalnum(*p->s)) {
+        lo = *p->s++;
+      }
+      else {
+        if(!parse_escape(p, cls))
+          return FALSE;
+        continue;
+      }
+    }
+
+    hi = lo;
+    if(p->s + 1 < p->end && p->s[0] == L'-' && p->s[1] != L']') {
+      hi = p->s[1];
+      p->s+= 2;
+      if(hi == L'\\') {
+        if(p->s == p->end || iswalnum(*p->s)) {
+          p->error = TRUE;
+          return FALSE;
+        }
+        hi = *p->s++;
+      }
+    }
+
+    if(lo == hi) {
+      if(!add_literal(p, lo))
+        return FALSE;
+    }
+    else if(!add_range(p, lo, hi))
+      return FALSE;
+  }
+}
+
+static struct fragment_t parse_atom(struct parser_t *p) {
+  struct fragment_t result;
+  struct char_class_t cls;
+  wchar_t ch;
+
+  assert(p != NULL);
+
+  memset(&result, 0, sizeof(result));
+  memset(&cls, 0, sizeof(cls));
+  cls.first_range = p->pattern->range_count;
+
+  ch = *p->s++;
+  switch(ch) {
+    case L'(':
+      if(++p->depth > MAX_DEPTH) {
+        p->error = TRUE;
+        return result;
+      }
+
+      result = parse_alternation(p);
+      --p->depth;
+      if(p->s == p->end || *p->s != L')') {
+        p->error = TRUE;
+        return result;
+      }
+
+      ++p->s;
+      return result;
+
+    case L'.':
+      cls.flags = CLASS_ANY;
+      break;
+
+    case L'[':
+      parse_class(p, &cls);
+      break;
+
+    case L'\\':
+      parse_escape(p, &cls);
+      break;
+
+    case L')':
+    case L'*':
+    case L'+':
+    case L'?':
+    case L'^':
+    case L'$':
+      p->error = TRUE;
+      return result;
+
+    default:
+      add_literal(p, ch);
+      break;
+  }
+
+  if(p->error)
+    return result;
+
+  cls.range_count = p->pattern->range_count - cls.first_range;
+  return new_position(p, &cls);
+}
+
+static struct fragment_t parse_repetition(struct parser_t *p) {
+  struct fragment_t result;
+
+  assert(p != NULL);
+
+  result = parse_atom(p);
+  while(!p->error && p->s != p->end) {
+    switch(*p->s) {
+      case L'*':
+        add_follow(p->pattern, result.last, result.first);
+        result.nullable = TRUE;
+        break;
+
+      case L'+':
+        add_follow(p->pattern, result.last, result.first);
+        break;
+
+      case L'?':
+        result.nullable = TRUE;
+        break;
+
+      default:
+        return result;
+    }
+
+    ++p->s;
+  }
+
+  return result;
+}
+
+static struct fragment_t parse_concatenation(struct parser_t *p) {
+  struct fragment_t result;
+
+  assert(p != NULL);
+
+  result.first = 0;
+  result.last = 0;
+  result.nullable = TRUE;
+
+  while(!p->error && p->s != p->end && *p->s != L'|' && *p->s != L')') {
+    struct fragment_t next = parse_repetition(p);
+
+    add_follow(p->pattern, result.last, next.first);
+
+    if(result.nullable)
+      result.first|= next.first;
+
+    if(next.nullable)
+      result.last|= next.last;
+    else
+      result.last = next.last;
+
+    result.nullable = result.nullable && next.nullable;
+  }
+
+  return result;
+}
+
+static struct fragment_t parse_alternation(struct parser_t *p) {
+  struct fragment_t result;
+
+  assert(p != NULL);
+
+  result = parse_concatenation(p);
+  while(!p->error && p->s != p->end && *p->s == L'|') {
+    struct fragment_t next;
+
+    ++p->s;
+    next = parse_concatenation(p);
+
+    result.first|= next.first;
+    result.last|=  next.last;
+    result.nullable = result.nullable || next.nullable;
+  }
+
+  return result;
+}
+
+struct console_pattern_t *console_pattern_compile(const wchar_t *text, int length) {
+  struct console_pattern_t *pattern;
+  struct fragment_t all;
+  struct parser_t p[1];
+  int ch;
+
+  assert(text != NULL || length == 0);
+  assert(length >= 0);
+
+  pattern = hyper_console_allocate_memory(sizeof(struct console_pattern_t));
+  if(!pattern)
+    return NULL;
+
+  memset(pattern, 0, sizeof(struct console_pattern_t));
+
+  memset(p, 0, sizeof(p));
+  p->pattern = pattern;
+  p->s = text;
+  p->end = text + length;
+
+  all = parse_alternation(p);
+  if(p->error || p->s != p->end) {
+    console_pattern_free(pattern);
+    return NULL;
+  }
+
+  pattern->first = all.first;
+  pattern->last = all.last;
+
+  for(ch = 0;ch < MASK_TABLE_SIZE;++ch) {
+    int i;
+
+    for(i = 0;i < pattern->position_count;++i) {
+      if(class_contains(pattern, &pattern->classes[i], (wchar_t)ch))
+        pattern->masks[ch]|= BIT(i);
+    }
+  }
+
+  return pattern;
+}
+
+void console_pattern_free(struct console_pattern_t *pattern) {
+  if(!pattern)
+    return;
+
+  hyper_console_free_memory(pattern->ranges);
+  hyper_console_free_memory(pattern);
+}
+
+int console_pattern_find(
+  const struct console_pattern_t *pattern,
+  const wchar_t *text,
+  int text_length,
+  int start,
+  int end,
+  int *match_end
+) {
+  ULONGLONG active = 0;
+  int starts[MAX_POSITIONS];
+  int next_starts[MAX_POSITIONS];
+  int best_start = -1;
+  int best_end = -1;
+  int i;
+
+  assert(pattern != NULL);
+  assert(text != NULL || text_length == 0);
+  assert(0 <= start);
+  assert(end <= text_length);
+  assert(match_end != NULL);
+
+  for(i = start;i < text_length;++i) {
+    ULONGLONG mask;
+    ULONGLONG next = 0;
+    ULONGLONG bits;
+
+    if(active == 0) {
+      if(best_start >= 0)
+        break;
+
+      // Skip the characters that cannot start a match.
+      while(i < end && 0 == (pattern->first & get_char_mask(pattern, text[i])))
+        ++i;
+
+      if(i >= end)
+        break;
+    }
+
+    mask = get_char_mask(pattern, text[i]);
+
+    for(bits = active;bits;bits &= bits - 1) {
+      int from = count_trailing_zeros(bits);
+      ULONGLONG targets;
+
+      for(targets = pattern->follow[from] & mask;targets;targets &= targets - 1) {
+        int to = count_trailing_zeros(targets);
+
+        if(!(next & BIT(to)) || starts[from] < next_starts[to]) {
+          next|= BIT(to);
+          next_starts[to] = starts[from];
+        }
+      }
+    }
+
+    // Matches further right are not needed once one was found.
+    if(best_start < 0 && i < end) {
+      for(bits = pattern->first & mask & ~next;bits;bits &= bits - 1)
+        next_starts[count_trailing_zeros(bits)] = i;
+
+      next|= pattern->first & mask;
+    }
+
+    active = 0;
+    for(bits = next;bits;bits &= bits - 1) {
+      int to = count_trailing_zeros(bits);
+
+      if(best_start < 0 || next_starts[to] <= best_start) {
+        active|= BIT(to);
+        starts[to] = next_starts[to];
+      }
+    }
+
+    for(bits = active & pattern->last;bits;bits &= bits - 1) {
+      int to = count_trailing_zeros(bits);
+
+      if(best_start < 0 || starts[to] <= best_start) {
+        best_start = starts[to];
+        best_end = i + 1;
+      }
+    }
+  }
+
+  if(best_start < 0)
+    return -1;
+
+  *match_end = best_end;
+  return best_start;
+}
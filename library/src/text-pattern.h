@@ -0,0 +1,64 @@
+#ifndef __CONSOLE__TEXT_PATTERN_H__
+#define __CONSOLE__TEXT_PATTERN_H__
+
+#include <windows.h>
+
+
+/** A compiled regular expression for case-insensitive searching.
+
+  Supported are literal characters, . (any character), classes like [a-z_] or [^0-9], the escapes
+  \\d \\w \\s \\D \\W \\S and \\ before any other punctuation, grouping with (), alternatives with |
+  and the repetitions *, + and ?. Anchors and counted repetitions are not supported.
+
+  The pattern is compiled into a position (Glushkov) automaton with at most 64 states. The active 
+  states are kept as a bit set and one table lookup per character gives the states that accept it, 
+  but following the transitions costs O(active states * their targets) per character.
+ */
+struct console_pattern_t;
+
+
+/** Compile a regular expression.
+
+  \param text   The pattern.
+  \param length The number of characters in \a text.
+
+  \return The compiled pattern or NULL if it is invalid, too long or out of memory.
+          Free it with console_pattern_free().
+
+  Letters are folded with console_fold_case() and ranges of ASCII capital letters also contain
+  their lower case counterparts, so the pattern should be matched against folded text.
+ */
+struct console_pattern_t *console_pattern_compile(const wchar_t *text, int length);
+
+
+/** Free a compiled pattern.
+
+  \param pattern A pattern or NULL.
+ */
+void console_pattern_free(struct console_pattern_t *pattern);
+
+
+/** Find the leftmost-longest non-empty match of a pattern.
+
+  \param pattern     A compiled pattern.
+  \param text        The text to search in, usually case-folded.
+  \param text_length The number of characters in \a text.
+  \param start       The first index in \a text where a match may start.
+  \param end         The index where matches may no longer start. A match may extend beyond it.
+  \param match_end   Output parameter for the end of the match.
+
+  \return The index of the first match in [start, end) or -1 if there is none.
+
+  The text is scanned once from \a start. Every automaton state remembers the leftmost start
+  that reaches it, so no backtracking is needed.
+ */
+int console_pattern_find(
+  const struct console_pattern_t *pattern,
+  const wchar_t *text,
+  int text_length,
+  int start,
+  int end,
+  int *match_end);
+
+
+#endif // __CONSOLE__TEXT_PATTERN_H__
@@ -0,0 +1,145 @@
+#include <hyper-console.h>
+
+#include "text-search.h"
+#include "debug.h"
+
+#include <assert.h>
+#include <string.h>
+#include <wchar.h>
+
+// The vector code compares 16-bit units, i.e. needs the Windows wchar_t.
+#if WCHAR_MAX <= 0xFFFF
+#  if defined(__AVX2__)
+#    include <immintrin.h>
+#    define TEXT_SEARCH_AVX2
+#  elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    include <emmintrin.h>
+#    define TEXT_SEARCH_SSE2
+#  endif
+#endif
+
+
+#define MIN(A, B)  ((A) < (B) ? (A) : (B))
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+static int count_trailing_zeros(unsigned mask) {
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (int)index;
+}
+#else
+#  define count_trailing_zeros(MASK)  __builtin_ctz(MASK)
+#endif
+
+
+static BOOL is_match_at(const wchar_t *text, const wchar_t *pattern, int pattern_length);
+static int find_candidates(const wchar_t *text, int *start, int limit, const wchar_t *pattern, int pattern_length);
+
+
+BOOL console_fold_case(const wchar_t *text, int length, wchar_t *folded) {
+  assert(length >= 0);
+  assert(text != NULL || length == 0);
+  assert(folded != NULL || length == 0);
+  
+  if(length == 0)
+    return TRUE;
+    
+  // Lower-casing maps every UTF-16 unit to exactly one unit, so indices stay the same.
+  if(LCMapStringW(LOCALE_USER_DEFAULT, LCMAP_LOWERCASE | LCMAP_LINGUISTIC_CASING, text, length, folded, length) != length) {
+    debug_printf(L"console_fold_case: LCMapStringW failed\n");
+    return FALSE;
+  }
+  
+  return TRUE;
+}
+
+BOOL console_can_compare_folded(const wchar_t *pattern, int length) {
+  int i;
+  
+  assert(pattern != NULL || length == 0);
+  
+  for(i = 0; i < length; ++i) {
+    wchar_t ch = pattern[i];
+    
+    // Basic Latin, Latin-1 Supplement and Latin Extended-A/B, except for controls and the 
+    // soft hyphen, which CompareStringW() ignores.
+    if(ch < L' ' || (ch >= 0x7F && ch < 0xA0) || ch == 0xAD || ch >= 0x250)
+      return FALSE;
+  }
+  
+  return TRUE;
+}
+
+static BOOL is_match_at(const wchar_t *text, const wchar_t *pattern, int pattern_length) {
+  return 0 == memcmp(text + 1, pattern + 1, (pattern_length - 1) * sizeof(wchar_t));
+}
+
+/* Vectorized part of console_find_text(). Returns the first match among whole blocks of 8 (or 16) 
+   start positions before limit, or -1. Then *start is where the scalar search must continue.
+ */
+static int find_candidates(const wchar_t *text, int *start, int limit, const wchar_t *pattern, int pattern_length) {
+#if defined(TEXT_SEARCH_AVX2)
+  __m256i first = _mm256_set1_epi16((short)pattern[0]);
+  
+  for(; *start + 16 <= limit; *start += 16) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i*)(text + *start));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi16(chunk, first));
+    
+    while(mask) {
+      int bit = count_trailing_zeros(mask);
+      
+      if(is_match_at(text + *start + bit / 2, pattern, pattern_length))
+        return *start + bit / 2;
+        
+      mask &= ~(3u << bit);
+    }
+  }
+#elif defined(TEXT_SEARCH_SSE2)
+  __m128i first = _mm_set1_epi16((short)pattern[0]);
+  
+  for(; *start + 8 <= limit; *start += 8) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)(text + *start));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi16(chunk, first));
+    
+    while(mask) {
+      int bit = count_trailing_zeros(mask);
+      
+      if(is_match_at(text + *start + bit / 2, pattern, pattern_length))
+        return *start + bit / 2;
+        
+      mask &= ~(3u << bit);
+    }
+  }
+#endif
+  
+  return -1;
+}
+
+int console_find_text(const wchar_t *text, int text_length, int start, int end, const wchar_t *pattern, int pattern_length) {
+  wchar_t first;
+  int limit;
+  int pos;
+  
+  assert(text != NULL);
+  assert(pattern != NULL);
+  assert(pattern_length > 0);
+  assert(0 <= start);
+  assert(end <= text_length);
+  
+  limit = MIN(end, text_length - pattern_length + 1);
+  if(start >= limit)
+    return -1;
+    
+  pos = find_candidates(text, &start, limit, pattern, pattern_length);
+  if(pos >= 0)
+    return pos;
+    
+  first = pattern[0];
+  for(pos = start; pos < limit; ++pos) {
+    if(text[pos] == first && is_match_at(text + pos, pattern, pattern_length))
+      return pos;
+  }
+  
+  return -1;
+}
@@ -0,0 +1,45 @@
+#ifndef __CONSOLE__TEXT_SEARCH_H__
+#define __CONSOLE__TEXT_SEARCH_H__
+
+#include <windows.h>
+
+
+/** Case-fold a text for case-insensitive searching.
+
+  \param text   The text.
+  \param length The number of characters in \a text.
+  \param folded Output buffer for \a length characters.
+  
+  \return TRUE on success.
+  
+  Comparing folded texts with memcmp() gives the same result as CompareStringW() with 
+  LINGUISTIC_IGNORECASE for equal-length texts, if console_can_compare_folded() holds for one of 
+  them.
+ */
+BOOL console_fold_case(const wchar_t *text, int length, wchar_t *folded);
+
+
+/** Check whether a pattern consists of common Latin characters only, such that matches of its 
+  folded form are exactly the linguistic matches.
+ */
+BOOL console_can_compare_folded(const wchar_t *pattern, int length);
+
+
+/** Find the first occurrence of a pattern.
+
+  \param text           The text to search in, usually case-folded.
+  \param text_length    The number of characters in \a text.
+  \param start          The first index in \a text where a match may start.
+  \param end            The index where matches may no longer start. A match may extend beyond it.
+  \param pattern        The text to find, folded like \a text.
+  \param pattern_length The length of \a pattern. Must be positive.
+  
+  \return The index of the first match in [start, end) or -1 if there is none.
+  
+  Candidates are found by comparing the first pattern character against 8 or 16 text characters
+  at once (SSE2 or AVX2, depending on the target architecture) and then verified with memcmp().
+ */
+int console_find_text(const wchar_t *text, int text_length, int start, int end, const wchar_t *pattern, int pattern_length);
+
+
+#endif // __CONSOLE__TEXT_SEARCH_H__
@@ -134,7 +134,7 @@ wchar_t *append_text(wchar_t *dst, const wchar_t *dst_end, const wchar_t *src, c
   assert(dst_end != NULL);
   assert(src != NULL);
   
-  while(dst != dst_end && *src && src != optional_src_end)
+  while(dst != dst_end && src != optional_src_end && *src)
     *dst++ = *src++;
   
   return dst;